@@ -2,8 +2,35 @@
 
 #import <UIKit/UIKit.h>
 
+#import "AloomaFirehose.h"
+#import "AloomaMiddleware.h"
+#import "AloomaTracer.h"
+
 @protocol AloomaDelegate;
 
+/*!
+ @enum
+ How much the library logs.
+
+ @constant AloomaLogLevelNone     nothing
+ @constant AloomaLogLevelError    failures only
+ @constant AloomaLogLevelDebug    failures and every queued event, flush and archive
+ @constant AloomaLogLevelVerbose  everything
+ */
+typedef NS_ENUM(NSInteger, AloomaLogLevel) {
+    AloomaLogLevelNone,
+    AloomaLogLevelError,
+    AloomaLogLevelDebug,
+    AloomaLogLevelVerbose
+};
+
+/*!
+ @constant AloomaRateUnlimited
+ Rate for <code>setRateLimit:burst:forEvent:</code> that lets every event
+ through. A rate of 0 lets none through.
+ */
+extern const double AloomaRateUnlimited;
+
 /*!
  @class
  Mixpanel API.
@@ -47,6 +74,10 @@
  Typically, this is the user ID from your database. By default, we'll use a
  hash of the MAC address of the device. To change the current distinct ID,
  use the <code>identify:</code> method.
+
+ Reading the property returns the ID as last set, without waiting for the
+ SDK queue; read before the queue has restored the ID from disk, it reads
+ the archive itself.
  */
 @property (atomic, readonly, copy) NSString *distinctId;
 /*!
@@ -80,8 +111,12 @@
  @discussion
  Useful if you need to proxy Mixpanel requests. Defaults to
  https://api.mixpanel.com.
+
+ Set at init: instances with the same URL share a queue and send their
+ events in the same requests. To report to another server, create another
+ instance.
  */
-@property (atomic, copy) NSString *serverURL;
+@property (atomic, readonly, copy) NSString *serverURL;
 
 /*!
  @property
@@ -94,6 +129,116 @@
  */
 @property (atomic) NSUInteger flushInterval;
 
+/*!
+ @property
+
+ @abstract
+ Maximum age, in seconds, of an event that is still worth sending.
+
+ @discussion
+ Events older than their TTL, measured from their <code>time</code>
+ property, are dropped when a batch is built and when the queue is archived
+ or restored, so they are never encoded or sent after a long offline stretch.
+ Dropped events are counted under <code>expired</code> in
+ <code>suppressedEventCounts</code>. Per-event TTLs set with
+ <code>setTTL:forEvent:</code> take precedence. Defaults to 0, meaning events
+ do not expire.
+ */
+@property (atomic) NSTimeInterval eventTTL;
+
+/*!
+ @property
+
+ @abstract
+ Window, in seconds, within which identical events are dropped.
+
+ @discussion
+ When greater than 0, <code>track:</code> hashes the event name, properties
+ and custom event and drops the call if an identical one was made less than
+ <code>dedupeWindow</code> seconds earlier, e.g. on double taps. The window
+ is measured from the first occurrence. Dropped events are counted under
+ <code>duplicate</code> in <code>suppressedEventCounts</code>. Defaults to 0,
+ which turns duplicate suppression off.
+ */
+@property (atomic) NSTimeInterval dedupeWindow;
+
+/*!
+ @property
+
+ @abstract
+ Public key used to verify remote configuration documents.
+
+ @discussion
+ The base64 encoded P-256 public key of the collector, as the 65 byte
+ uncompressed point or its DER SubjectPublicKeyInfo. Only the collector holds
+ the private key, so the key can ship in the app. When set, the library fetches
+ <code>&lt;serverURL&gt;/config/&lt;token&gt;</code>
+ right away and then at most once per refresh interval (an hour unless the
+ document says otherwise) when flushing. Documents whose ECDSA signature does
+ not verify, that have expired, or whose version is older than the one the
+ library already has are ignored. A verified document is cached
+ on disk, applied again on the next launch as soon as the key is set, and can
+ change the flush interval, batch size and bytes, queue cap, compression,
+ sampling and rate limits, or disable the library altogether. See
+ <code>AloomaRemoteConfig</code> for the format. Defaults to nil, which turns
+ remote configuration off. Builds with <code>ALOOMA_MINIMAL_TRANSPORT</code>
+ leave remote configuration out and ignore the key.
+ */
+@property (atomic, copy) NSString *remoteConfigKey;
+
+/*!
+ @property
+
+ @abstract
+ Length of a metric aggregation interval, in seconds.
+
+ @discussion
+ Metrics recorded with <code>increment:</code>,
+ <code>setGauge:forMetric:</code> and <code>recordValue:forMetric:</code> are
+ rolled up in memory and sent as one <code>$aggregate</code> event per metric
+ and dimension set on the first flush after the interval ends, and whenever
+ the app enters the background. Defaults to 60.
+ */
+@property (atomic) NSTimeInterval aggregationInterval;
+
+/*!
+ @property
+
+ @abstract
+ Interval, in seconds, at which the library reports on itself.
+
+ @discussion
+ When greater than 0, the first flush after each interval queues a
+ <code>$sdk_metrics</code> event whose properties are the current
+ <code>metricsSnapshot</code>. Defaults to 0, which keeps the metrics local.
+ */
+@property (atomic) NSTimeInterval metricsInterval;
+
+/*!
+ @property
+
+ @abstract
+ Whether tracked events are staged in per-thread buffers.
+
+ @discussion
+ For apps that track from many threads at once. When YES, each thread
+ appends its events to a buffer of its own instead of handing every event
+ to the library's queue, so threads do not contend with each other. A
+ buffer is handed over when it holds 256 events, and all of them are merged
+ on every flush and when the app enters the background or terminates.
+ Until then an event is not in the queue, so it does not count towards the
+ queue cap and is not archived. Each merge puts the events in the order
+ they were tracked, and keeps each thread's events in its own order;
+ <code>message_index</code> is assigned as they are merged, so it follows
+ that order. <code>identify:</code>, <code>reset</code>,
+ <code>timeEvent:</code> and changes to super properties or timed events
+ are staged the same way, so every event gets the identity and super
+ properties in effect when it was tracked. <code>distinctId</code> and
+ <code>currentSuperProperties</code> return the values as last set
+ without waiting for the merge. Defaults to NO.
+ */
+@property (atomic) BOOL stagedIngest;
+
 /*!
  @property
 
@@ -132,6 +277,19 @@
  */
 @property (atomic, weak) id<AloomaDelegate> delegate; // allows fine grain control over uploading (optional)
 
+/*!
+ @property
+
+ @abstract
+ Object notified when each pipeline stage begins and ends.
+
+ @discussion
+ See <code>AloomaTracer</code> for the stages and what the callbacks carry.
+ The tracer is retained. When it is nil, which is the default, each stage
+ costs one extra branch.
+ */
+@property (atomic, strong) id<AloomaTracer> tracer;
+
 #pragma mark Tracking
 
 /*!
@@ -192,6 +350,47 @@
  */
 + (Alooma *)sharedInstance;
 
+/*!
+ @method
+
+ @abstract
+ Sets how much the library logs, for all instances.
+
+ @discussion
+ Log calls below the level cost one comparison. Calls at or above it only
+ capture their arguments into an in-memory ring; the messages are formatted
+ and written out on a background queue, so logging does not slow down
+ <code>track:</code>. Defaults to <code>AloomaLogLevelNone</code>, or to the
+ level named by the <code>ALOOMA_ERROR</code>, <code>ALOOMA_DEBUG</code> or
+ <code>ALOOMA_MESSAGING_DEBUG</code> preprocessor macro.
+ <code>ALOOMA_NO_LOGGING</code> compiles logging out altogether.
+
+ @param level           the lowest level that is logged
+ */
++ (void)setLogLevel:(AloomaLogLevel)level;
+
+/*!
+ @method
+
+ @abstract
+ Sends log messages to a block instead of <code>NSLog</code>.
+
+ @discussion
+ The handler is called on a background queue, in order. Pass nil to go back
+ to <code>NSLog</code>.
+
+ @param handler         receives the level, time and text of each message
+ */
++ (void)setLogHandler:(void (^)(AloomaLogLevel level, NSDate *time, NSString *message))handler;
+
+/*!
+ @method
+
+ @abstract
+ Formats and writes out every message logged so far before returning.
+ */
++ (void)flushLogs;
+
 /*!
  @method
 
@@ -204,6 +403,17 @@
  one Mixpanel project from a single app. If you only need to send data to one
  project, consider using <code>sharedInstanceWithToken:</code>.
 
+ Instances created with the same server URL share one
+ <code>AloomaEngine</code>: a single serial queue, network monitor, set of
+ automatic properties, event archive and uploader. A flush on any of them
+ uploads the pending events of all of them, multiplexed into the same
+ requests, using the batch settings of the instance that flushed.
+
+ Returns without collecting device properties or reading the event archive:
+ that is done on the SDK queue right after, ahead of anything called on the
+ new instance, so events tracked meanwhile are merged once it is done and
+ keep the time they were tracked at.
+
  @param apiToken        your project token
  @param launchOptions   optional app delegate launchOptions
  @param flushInterval   interval to run background flushing
@@ -247,8 +457,9 @@
  for Advertising (IFA) to identify users. If you have this framework in your
  app, Mixpanel will use the IFA as the default distinct ID. If you have
  AdSupport installed but still don't want to use the IFA, you can define the
- <code>MIXPANEL_NO_IFA</code> preprocessor flag in your build settings, and
- Mixpanel will use the IFV as the default distinct ID.
+ <code>ALOOMA_NO_IFA</code> (or <code>MIXPANEL_NO_IFA</code>) preprocessor flag
+ in your build settings, and Mixpanel will use the IFV as the default distinct
+ ID. See <code>AloomaFeatures.h</code> for the other build switches.
 
  If we are unable to get an IFA or IFV, we will fall back to generating a
  random persistent UUID.
@@ -347,6 +558,316 @@
  */
 - (void)trackPushNotification:(NSDictionary *)userInfo;
 
+/*!
+ @method
+
+ @abstract
+ Returns a high-frequency record channel with a fixed layout.
+
+ @discussion
+ Use a firehose for sensor-style telemetry sampled hundreds of times per
+ second, where building an event dictionary per sample is too expensive.
+ Records are buffered in a preallocated ring of <code>capacity</code> records
+ and uploaded as <code>$firehose</code> events holding columnar blocks on every
+ flush. Calling this again with the same name returns the existing firehose;
+ it is an error to reuse a name with different fields.
+
+ @param name            firehose name
+ @param fields          array of field name strings, one per record value
+ @param capacity        number of records to buffer between flushes
+ */
+- (AloomaFirehose *)firehoseWithName:(NSString *)name fields:(NSArray *)fields capacity:(NSUInteger)capacity;
+
+#pragma mark Sampling
+
+/*!
+ @method
+
+ @abstract
+ Sets the maximum age of events with the given name, overriding
+ <code>eventTTL</code>.
+
+ @param ttl             maximum age in seconds, 0 for events that never expire
+ @param event           event name
+ */
+- (void)setTTL:(NSTimeInterval)ttl forEvent:(NSString *)event;
+
+/*!
+ @method
+
+ @abstract
+ Keeps only a fraction of the events with the given name.
+
+ @discussion
+ The decision is made at the very start of <code>track:</code>, before any
+ property work. Kept events carry a <code>sample_weight</code> property equal
+ to <code>1 / rate</code>, so weighted counts stay unbiased. Pass a nil event
+ to set the default for every event without a rule of its own.
+
+ @param rate            fraction of events to keep, in (0, 1]
+ @param event           event name, or nil for all events
+ */
+- (void)setSampleRate:(double)rate forEvent:(NSString *)event;
+
+/*!
+ @method
+
+ @abstract
+ Caps the rate of events with the given name with a token bucket.
+
+ @discussion
+ Up to <code>burst</code> events are let through at once, refilling at
+ <code>eventsPerSecond</code>. Events over the limit are dropped and counted in
+ <code>suppressedEventCounts</code>. Their <code>sample_weight</code> is
+ carried over to the next event let through, so weighted counts still add
+ up. 0 events per second drops every event with the name;
+ <code>AloomaRateUnlimited</code> removes the limit. Pass a nil event to set
+ the default for every event without a rule of its own.
+
+ @param eventsPerSecond sustained rate, 0 to drop all or AloomaRateUnlimited
+ @param burst           bucket size
+ @param event           event name, or nil for all events
+ */
+- (void)setRateLimit:(double)eventsPerSecond burst:(NSUInteger)burst forEvent:(NSString *)event;
+
+/*!
+ @method
+
+ @abstract
+ Removes the sample rate and rate limit set for an event name.
+
+ @param event           event name, or nil for the default rule
+ */
+- (void)removeSamplingRulesForEvent:(NSString *)event;
+
+/*!
+ @method
+
+ @abstract
+ Returns the number of events dropped by sampling and rate limiting.
+
+ @discussion
+ The dictionary maps <code>sampled_out</code>, <code>rate_limited</code>,
+ <code>duplicate</code>, <code>expired</code> and <code>middleware</code>
+ to dictionaries of event name to count.
+ */
+- (NSDictionary *)suppressedEventCounts;
+
+#pragma mark Property filtering
+
+/*!
+ @method
+
+ @abstract
+ Installs rules that drop, hash or truncate event properties before the
+ event is queued.
+
+ @discussion
+ Rules apply to the merged properties of every event, including super
+ properties and values nested in dictionaries and arrays, and to the fields
+ of custom events. They are compiled once here rather than interpreted per
+ event.
+ Each rule is a dictionary naming a property <code>key</code> or a value
+ <code>pattern</code> (POSIX extended regular expression) and an
+ <code>action</code> of <code>drop</code>, <code>hash</code> or
+ <code>truncate</code> (with a <code>length</code>). A rule of the form
+ <code>@{@"allow": @[...]}</code> drops every property not listed, except
+ the ones the library sets itself. Hashed values are the hex SHA-256 of the
+ salt followed by the value. See <code>AloomaPropertyFilter.h</code> for
+ examples.
+
+ Returns NO, keeping the previous rules, if a rule is malformed. Pass nil or
+ an empty array to remove all rules.
+
+ @param rules           array of rule dictionaries
+ @param salt            salt prepended to values before hashing
+ */
+- (BOOL)setPropertyFilterRules:(NSArray *)rules salt:(NSString *)salt;
+
+#pragma mark Middleware
+
+/*!
+ @method
+
+ @abstract
+ Adds a stage to the end of the middleware chain.
+
+ @discussion
+ Every tracked event passes through the stages in the order they were added,
+ after its properties are merged and before property filter rules are
+ applied. Stages run on the library's serial queue, not on the thread that
+ called <code>track:</code>, and all of them share one mutable
+ <code>AloomaEventView</code> over the merged properties, so enriching an
+ event does not copy it. A stage returning NO drops the event; such events
+ are counted under <code>middleware</code> in
+ <code>suppressedEventCounts</code>. Names are unique: adding a stage under
+ a name already in the chain logs an error and does nothing.
+
+ <pre>
+ [alooma addMiddlewareNamed:@"screen" block:^BOOL(AloomaEventView *event) {
+     event[@"screen"] = currentScreenName;
+     return YES;
+ }];
+ </pre>
+
+ @param name            name used in <code>middlewareTimings</code> and for removal
+ @param block           the stage
+ */
+- (void)addMiddlewareNamed:(NSString *)name block:(AloomaMiddlewareBlock)block;
+
+/*!
+ @method
+
+ @abstract
+ Removes the stage added under the given name.
+ */
+- (void)removeMiddlewareNamed:(NSString *)name;
+
+/*!
+ @method
+
+ @abstract
+ Returns how long each middleware stage has taken.
+
+ @discussion
+ Maps stage names to dictionaries with <code>calls</code>,
+ <code>dropped</code>, <code>total_ms</code>, <code>mean_us</code> and
+ <code>max_us</code>.
+ */
+- (NSDictionary *)middlewareTimings;
+
+#pragma mark Aggregation
+
+/*!
+ @method
+
+ @abstract
+ Adds one to a counter metric.
+
+ @discussion
+ Use counters instead of <code>track:</code> for events that are only ever
+ counted. Counters, gauges and histograms are rolled up on the device and sent
+ as <code>$aggregate</code> events once per
+ <code>aggregationInterval</code>.
+
+ @param metric          metric name
+ */
+- (void)increment:(NSString *)metric;
+
+/*!
+ @method
+
+ @abstract
+ Adds an amount to a counter metric.
+
+ @param metric          metric name
+ @param amount          amount to add
+ */
+- (void)increment:(NSString *)metric by:(double)amount;
+
+/*!
+ @method
+
+ @abstract
+ Adds an amount to a counter metric for a dimension set.
+
+ @discussion
+ Each distinct dimension set is rolled up and reported separately. Dimension
+ keys must be <code>NSString</code> objects and values should be strings or
+ numbers with a small number of distinct values.
+
+ @param metric          metric name
+ @param amount          amount to add
+ @param dimensions      dimensions dictionary, may be nil
+ */
+- (void)increment:(NSString *)metric by:(double)amount dimensions:(NSDictionary *)dimensions;
+
+/*!
+ @method
+
+ @abstract
+ Sets the current value of a gauge metric.
+
+ @discussion
+ Gauges report the last value set in the interval along with its min, max,
+ sum and count.
+
+ @param value           current value
+ @param metric          metric name
+ */
+- (void)setGauge:(double)value forMetric:(NSString *)metric;
+
+/*!
+ @method
+
+ @abstract
+ Sets the current value of a gauge metric for a dimension set.
+
+ @param value           current value
+ @param metric          metric name
+ @param dimensions      dimensions dictionary, may be nil
+ */
+- (void)setGauge:(double)value forMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions;
+
+/*!
+ @method
+
+ @abstract
+ Records a value in a histogram metric.
+
+ @discussion
+ Histograms are kept as DDSketch quantile sketches with 1% relative accuracy.
+ They report count, sum, min, max, p50, p90 and p99, plus the sketch bins so
+ that intervals and devices can be merged server side.
+
+ @param value           value to record, e.g. a frame time
+ @param metric          metric name
+ */
+- (void)recordValue:(double)value forMetric:(NSString *)metric;
+
+/*!
+ @method
+
+ @abstract
+ Records a value in a histogram metric for a dimension set.
+
+ @param value           value to record
+ @param metric          metric name
+ @param dimensions      dimensions dictionary, may be nil
+ */
+- (void)recordValue:(double)value forMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions;
+
+#pragma mark SDK metrics
+
+/*!
+ @method
+
+ @abstract
+ Returns the library's own counters and latencies.
+
+ @discussion
+ The snapshot has four dictionaries. <code>counters</code> holds totals since
+ launch: <code>events_tracked</code>, <code>events_dropped_queue_full</code>,
+ <code>events_sent</code>, <code>bytes_sent</code>, <code>requests</code>,
+ <code>request_failures</code>, <code>requests_rejected</code> and
+ <code>flushes</code>. <code>gauges</code> holds the current
+ <code>queue_depth</code> and <code>queue_bytes</code>, an estimate of the
+ memory held by queued events. It counts keys and values shared between
+ events, such as automatic properties, once per event, so it errs high.
+ <code>latencies</code> maps
+ <code>enqueue_to_ack_us</code>, <code>encode_us</code>,
+ <code>request_us</code> and <code>flush_us</code> to their
+ <code>count</code>, <code>min</code>, <code>mean</code>, <code>p50</code>,
+ <code>p90</code>, <code>p99</code> and <code>max</code> in microseconds,
+ read from HDR histograms accurate to 1%. <code>suppressed</code> is
+ <code>suppressedEventCounts</code>.
+
+ Instances reporting to the same server share uploads; sent events, bytes,
+ requests and ack latencies are counted by the instance whose flush sent
+ them.
+ */
+- (NSDictionary *)metricsSnapshot;
+
 
 /*!
  @method
@@ -434,6 +955,10 @@
 
  @abstract
  Returns the currently set super properties.
+
+ @discussion
+ The returned dictionary is an immutable snapshot; taking it does not copy
+ the properties and later registrations do not change it.
  */
 - (NSDictionary *)currentSuperProperties;
 
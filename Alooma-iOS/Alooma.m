@@ -5,49 +5,127 @@
 #include <arpa/inet.h>
 #include <net/if.h>
 #include <net/if_dl.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
 #include <sys/sysctl.h>
 
 #import <CommonCrypto/CommonDigest.h>
-#import <CoreTelephony/CTCarrier.h>
-#import <CoreTelephony/CTTelephonyNetworkInfo.h>
-#import <SystemConfiguration/SystemConfiguration.h>
 #import <UIKit/UIDevice.h>
+#import <objc/runtime.h>
 
 #import "Alooma.h"
+#import "AloomaAggregator.h"
+#import "AloomaClock.h"
+#import "AloomaDedupe.h"
+#import "AloomaEngine.h"
+#import "AloomaFeatures.h"
 #import "AloomaLogger.h"
+#import "AloomaMetrics.h"
+#import "AloomaPersistentMap.h"
+#import "AloomaPropertyFilter.h"
+#import "AloomaRemoteConfig.h"
+#import "AloomaSampler.h"
+#import "AloomaScheduler.h"
+#import "AloomaStaging.h"
 #import "NSData+AloomaBase64.h"
 
+#if !defined(ALOOMA_NO_TELEPHONY)
+#import <CoreTelephony/CTCarrier.h>
+#import <CoreTelephony/CTTelephonyNetworkInfo.h>
+#endif
+#if !defined(ALOOMA_MINIMAL_TRANSPORT)
+#include <zlib.h>
+#endif
+
 #define VERSION @"0.1.4"
 
 static NSString * const kSendingTimePlaceHolder = @"<SendingTimePlaceHolder>";
 static NSString * const kSendingTimeKey = @"sending_time";
+static NSString * const kSampleWeightKey = @"sample_weight";
+static NSString * const kFirehoseEvent = @"$firehose";
+static const NSUInteger kFirehoseMaxBlockRecords = 1000;
+static NSString * const kAggregateEvent = @"$aggregate";
+static const NSUInteger kDefaultBatchSize = 50;
+static const NSUInteger kDefaultMaxQueueSize = 500;
+static const NSTimeInterval kDefaultRemoteConfigRefreshInterval = 3600;
+// uploads block the engine's queue, so give up well before the default minute
+static const NSTimeInterval kRequestTimeout = 20;
+static const size_t kDedupeCapacity = 1024;
+static NSString * const kDuplicateReason = @"duplicate";
+static NSString * const kExpiredReason = @"expired";
+static NSString * const kMiddlewareReason = @"middleware";
+static NSString * const kMetricsEvent = @"$sdk_metrics";
+static const NSTimeInterval kAutomaticPropertiesRevalidationDelay = 10;
+static const size_t kStagingBufferCapacity = 256;
+
+typedef AloomaPersistentMap *(^AloomaSuperPropertiesChange)(AloomaPersistentMap *superProperties);
 
 @interface Alooma () <UIAlertViewDelegate>
 
 {
     NSUInteger _flushInterval;
+    // identity and super properties as last set by the app, for the getters;
+    // @synchronized(self). The serial queue keeps its own, applied in order
+    // with the events.
+    NSString *_distinctId;
+    AloomaPersistentMap *_currentSuperProperties;
+    NSMutableArray *_unrestoredChanges;     // published before the archive was read
+    NSDictionary *_restoredProperties;      // read for the serial queue, until it takes them
+    NSString *_remoteConfigKey;
+    AloomaDedupeWindow *_recentEvents;
+    AloomaMetrics *_metrics;
+    AloomaMetrics *_disabledMetrics;    // kept until dealloc, a snapshot may still read it
+    NSMapTable *_enqueueTimes;          // serial queue only; queued event to wall time
+    NSTimeInterval _metricsEmittedAt;
+    int64_t _queueBytes;        // serial queue only
+    id<AloomaTracer> _tracer;
+    BOOL _tracing;
+    atomic_uint_fast64_t _eventSpans;
+    uint64_t _batchSpans;
+    uint64_t _archiveSpans;
+    _Atomic(AloomaStaging *) _staging;  // created on first use, never replaced
+    atomic_bool _stagedIngest;
+    atomic_bool _stagedMergeScheduled;
+    BOOL _mergingStaged;                // serial queue only
 }
 
 // re-declare internally as readwrite
-@property (atomic, copy) NSString *distinctId;
+@property (atomic, copy) NSString *serverURL;
 @property (atomic, copy) NSString *sessionId;
 @property (atomic, copy) NSNumber* messageIndex;
 
 @property (nonatomic, copy) NSString *apiToken;
-@property (atomic, strong) NSDictionary *superProperties;
-@property (atomic, strong) NSDictionary *automaticProperties;
-@property (nonatomic, strong) NSTimer *timer;
+// the identity and super properties events get, serial queue only
+@property (nonatomic, copy) NSString *eventDistinctId;
+@property (nonatomic, strong) AloomaPersistentMap *superProperties;
+@property (nonatomic, readonly) NSDictionary *automaticProperties;
+@property (nonatomic, strong) AloomaEngine *engine;
+@property (nonatomic, assign) uint64_t flushTimer;
 @property (nonatomic, strong) NSMutableArray *eventsQueue;
 @property (nonatomic, assign) UIBackgroundTaskIdentifier taskId;
 @property (nonatomic, strong) dispatch_queue_t serialQueue;
-@property (nonatomic, assign) SCNetworkReachabilityRef reachability;
-@property (nonatomic, strong) CTTelephonyNetworkInfo *telephonyInfo;
 @property (nonatomic, strong) NSDateFormatter *dateFormatter;
-@property (nonatomic, strong) NSMutableDictionary *timedEvents;
+@property (nonatomic, strong) AloomaPersistentMap *timedEvents;
+@property (nonatomic, strong) NSMutableDictionary *firehoses;
+@property (nonatomic, strong) AloomaAggregator *aggregator;
+@property (nonatomic, strong) AloomaSampler *sampler;
+@property (atomic, strong) AloomaPropertyFilter *propertyFilter;
+@property (atomic, copy) NSArray *middleware;
+@property (atomic) NSUInteger batchSize;
+@property (atomic) NSUInteger maxBatchBytes;
+@property (atomic) NSUInteger maxQueueSize;
+@property (atomic, copy) NSString *compression;
+@property (atomic) BOOL disabled;
+@property (nonatomic, strong) AloomaRemoteConfig *remoteConfig;
+@property (nonatomic) long long remoteConfigVersion;
+@property (nonatomic, strong) NSDate *remoteConfigFetchedAt;
+@property (nonatomic, copy) NSSet *remoteSamplingEvents;
+@property (nonatomic, strong) NSMutableDictionary *eventTTLs;
 @property (nonatomic, readonly, nullable) UIApplication *application;
 @property (nonatomic) BOOL inBG;
 
+- (void)scheduleStagedMerge;
+
 @end
 
 @implementation Alooma
@@ -77,6 +155,21 @@ static Alooma *sharedInstance = nil;
     return sharedInstance;
 }
 
++ (void)setLogLevel:(AloomaLogLevel)level
+{
+    AloomaLogSetLevel(level);
+}
+
++ (void)setLogHandler:(void (^)(AloomaLogLevel level, NSDate *time, NSString *message))handler
+{
+    AloomaLogSetHandler(handler);
+}
+
++ (void)flushLogs
+{
+    AloomaLogFlush();
+}
+
 - (instancetype)initWithToken:(NSString *)apiToken serverURL:(NSString *)url launchOptions:(NSDictionary *)launchOptions andFlushInterval:(NSUInteger)flushInterval
 {
     if (apiToken == nil) {
@@ -94,22 +187,38 @@ static Alooma *sharedInstance = nil;
 
         self.serverURL = url;
 
-        self.distinctId = [self defaultDistinctId];
         self.sessionId = [[NSUUID UUID] UUIDString];
-        self.superProperties = [NSMutableDictionary dictionary];
-        self.telephonyInfo = [[CTTelephonyNetworkInfo alloc] init];
-        self.automaticProperties = [self collectAutomaticProperties];
+        self.superProperties = [AloomaPersistentMap map];
+        _currentSuperProperties = [AloomaPersistentMap map];
+        _unrestoredChanges = [NSMutableArray array];
+        // queue, network monitoring, automatic properties, storage and uploads
+        // are shared with every other instance reporting to this server
+        self.engine = [AloomaEngine engineForServerURL:url];
+        self.serialQueue = self.engine.serialQueue;
         self.eventsQueue = [NSMutableArray array];
         self.taskId = UIBackgroundTaskInvalid;
-        NSString *label = [NSString stringWithFormat:@"com.alooma.%@.%p", apiToken, self];
-        self.serialQueue = dispatch_queue_create([label UTF8String], DISPATCH_QUEUE_SERIAL);
         self.dateFormatter = [[NSDateFormatter alloc] init];
         [_dateFormatter setDateFormat:@"yyyy-MM-dd'T'HH:mm:ss.SSS'Z'"];
         [_dateFormatter setTimeZone:[NSTimeZone timeZoneWithAbbreviation:@"UTC"]];
         [_dateFormatter setLocale:[[NSLocale alloc] initWithLocaleIdentifier:@"en_US_POSIX"]];
-        self.timedEvents = [NSMutableDictionary dictionary];
-
-
+        self.timedEvents = [AloomaPersistentMap map];
+        self.firehoses = [NSMutableDictionary dictionary];
+        self.aggregator = [[AloomaAggregator alloc] init];
+        self.aggregationInterval = 60;
+        self.sampler = [[AloomaSampler alloc] init];
+        self.batchSize = kDefaultBatchSize;
+        self.maxQueueSize = kDefaultMaxQueueSize;
+        self.compression = @"none";
+        _recentEvents = AloomaDedupeWindowCreate(kDedupeCapacity);
+        self.eventTTLs = [NSMutableDictionary dictionary];
+        _metrics = AloomaMetricsCreate();
+        // weak keys, so events dropped or restored from the archive need no cleanup
+        _enqueueTimes = [[NSMapTable alloc] initWithKeyOptions:NSPointerFunctionsWeakMemory | NSPointerFunctionsObjectPointerPersonality
+                                                  valueOptions:NSPointerFunctionsStrongMemory
+                                                      capacity:0];
+        _metricsEmittedAt = AloomaClockNow();
+
+        BOOL monitorNetwork = NO;
         if (![Alooma isAppExtension]) {
             if ([[UIApplication class] respondsToSelector:@selector(sharedApplication)]) {
                 _application = [[UIApplication class] performSelector:@selector(sharedApplication)];
@@ -117,11 +226,19 @@ static Alooma *sharedInstance = nil;
 #if !defined(ALOOMA_APP_EXTENSION)
             if(_application) {
                 [self setUpListeners];
+                monitorNetwork = YES;
             }
 #endif
         }
 
-        [self unarchive];
+        // UIKit, so read here on the caller's thread rather than on the queue
+        CGSize screenSize = self.engine.automaticProperties ? CGSizeZero : [UIScreen mainScreen].bounds.size;
+        // the rest is slow enough to show in app launch times. Anything
+        // called on this instance from now on is queued behind it, so events
+        // tracked meanwhile keep their time and are merged once it is done.
+        dispatch_async(self.serialQueue, ^{
+            [self setUpWithScreenSize:screenSize monitorNetwork:monitorNetwork];
+        });
 
         if (launchOptions && launchOptions[UIApplicationLaunchOptionsRemoteNotificationKey]) {
             [self trackPushNotification:launchOptions[UIApplicationLaunchOptionsRemoteNotificationKey] event:@"$app_open"];
@@ -135,22 +252,107 @@ static Alooma *sharedInstance = nil;
     return [self initWithToken:apiToken serverURL:url launchOptions:nil andFlushInterval:flushInterval];
 }
 
-- (void)dealloc
+// runs on the serial queue, before anything else of this instance
+- (void)setUpWithScreenSize:(CGSize)screenSize monitorNetwork:(BOOL)monitorNetwork
+{
+    double start = AloomaClockMonotonicNow();
+    if (self.engine.automaticProperties == nil) {
+        NSDictionary *cached = [self cachedAutomaticProperties];
+        if (cached) {
+            self.engine.automaticProperties = cached;
+            // the carrier or the advertising identifier may have changed
+            // since, check once the app is done launching
+            dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kAutomaticPropertiesRevalidationDelay * NSEC_PER_SEC)),
+                           dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+                [self revalidateAutomaticProperties:cached screenSize:screenSize];
+            });
+        } else {
+            NSDictionary *properties = [self collectAutomaticPropertiesWithScreenSize:screenSize];
+            self.engine.automaticProperties = properties;
+            dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0), ^{
+                [self cacheAutomaticProperties:properties];
+            });
+        }
+    }
+    if (monitorNetwork) {
+        // wifi reachability and cellular radio, shared by the engine
+        [self.engine startMonitoringNetwork];
+    }
+    [self unarchive];
+    // only now can other instances' flushes see our queue
+    [self.engine attachInstance:self];
+    AloomaDebug(@"%@ set up in %.1f ms", self, (AloomaClockMonotonicNow() - start) * 1000);
+}
+
+// reads the archived identity and super properties once, for whichever
+// needs them first: setup on the serial queue, or a getter called before it.
+// Changes published before then are replayed on top.
+- (void)restorePublishedState
 {
-    [[NSNotificationCenter defaultCenter] removeObserver:self];
-    if (_reachability != NULL) {
-        if (!SCNetworkReachabilitySetCallback(_reachability, NULL, NULL)) {
-            AloomaError(@"%@ error unsetting reachability callback", self);
+    @synchronized(self) {
+        if (_unrestoredChanges == nil) {
+            return;
         }
-        if (!SCNetworkReachabilitySetDispatchQueue(_reachability, NULL)) {
-            AloomaError(@"%@ error unsetting reachability dispatch queue", self);
+        NSDictionary *properties = (NSDictionary *)[self unarchiveFromFile:[self propertiesFilePath]];
+        NSMutableDictionary *restored = [NSMutableDictionary dictionary];
+        if ([properties isKindOfClass:[NSDictionary class]]) {
+            [restored addEntriesFromDictionary:properties];
         }
-        CFRelease(_reachability);
-        _reachability = NULL;
-        AloomaDebug(@"realeased reachability");
+        if (restored[@"distinctId"] == nil) {
+            restored[@"distinctId"] = [self defaultDistinctId];
+        }
+        _restoredProperties = restored;
+        _distinctId = restored[@"distinctId"];
+        _currentSuperProperties = [AloomaPersistentMap mapWithDictionary:restored[@"superProperties"]];
+        for (dispatch_block_t publish in _unrestoredChanges) {
+            publish();
+        }
+        _unrestoredChanges = nil;
+    }
+}
+
+- (NSString *)distinctId
+{
+    @synchronized(self) {
+        [self restorePublishedState];
+        return _distinctId;
+    }
+}
+
+// publishes a change to the getters and hands it to the serial queue under
+// one lock, so that both see concurrent calls in the same order
+- (void)dispatchStateChange:(dispatch_block_t)change publishing:(dispatch_block_t)publish
+{
+    @synchronized(self) {
+        publish();
+        [_unrestoredChanges addObject:publish];
+        [self dispatchStateChange:change];
     }
 }
 
+- (void)changeSuperProperties:(AloomaSuperPropertiesChange)change
+{
+    [self dispatchStateChange:^{
+        self.superProperties = change(self.superProperties);
+        if ([self inBackground]) {
+            [self archiveProperties];
+        }
+    } publishing:^{
+        self->_currentSuperProperties = change(self->_currentSuperProperties);
+    }];
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+    AloomaDedupeWindowDestroy(_recentEvents);
+    AloomaMetricsDestroy(_metrics);
+    AloomaMetricsDestroy(_disabledMetrics);
+    // _staging is left allocated: staged events retain the instance, so it
+    // holds none by now, but a thread exiting right now may still reach it
+    // through its key
+}
+
 #pragma mark - Encoding/decoding utilities
 
 static __unused NSString *MPURLEncode(NSString *s)
@@ -158,6 +360,118 @@ static __unused NSString *MPURLEncode(NSString *s)
     return (NSString *)CFBridgingRelease(CFURLCreateStringByAddingPercentEscapes(kCFAllocatorDefault, (CFStringRef)s, NULL, CFSTR("!*'();:@&=+$,/?%#[]"), kCFStringEncodingUTF8));
 }
 
+#if !defined(ALOOMA_MINIMAL_TRANSPORT)
+static NSData *AloomaGzip(NSData *data)
+{
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    // 15 window bits + 16 selects the gzip wrapper
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return nil;
+    }
+    NSMutableData *compressed = [NSMutableData dataWithLength:deflateBound(&stream, (uLong)[data length])];
+    stream.next_in = (Bytef *)[data bytes];
+    stream.avail_in = (uInt)[data length];
+    stream.next_out = [compressed mutableBytes];
+    stream.avail_out = (uInt)[compressed length];
+    int status = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+    if (status != Z_STREAM_END) {
+        return nil;
+    }
+    [compressed setLength:stream.total_out];
+    return compressed;
+}
+#endif
+
+// content hash for duplicate suppression; dictionaries hash the same
+// regardless of key order, and @1 and @YES are considered equal
+static uint64_t AloomaHashObject(id obj)
+{
+    if (obj == nil || [obj isKindOfClass:[NSNull class]]) {
+        return 0;
+    }
+    if ([obj isKindOfClass:[NSString class]]) {
+        // UTF-16 code units, which every string has, unlike a UTF-8 form
+        // (a lone surrogate has none)
+        CFStringRef string = (__bridge CFStringRef)obj;
+        CFIndex length = CFStringGetLength(string);
+        const UniChar *characters = CFStringGetCharactersPtr(string);
+        if (characters != NULL) {
+            return AloomaHash64(characters, (size_t)length * sizeof(UniChar), 1);
+        }
+        UniChar stackBuffer[256];
+        UniChar *buffer = length <= 256 ? stackBuffer : malloc((size_t)length * sizeof(UniChar));
+        if (buffer == NULL) {
+            return 1;
+        }
+        CFStringGetCharacters(string, CFRangeMake(0, length), buffer);
+        uint64_t hash = AloomaHash64(buffer, (size_t)length * sizeof(UniChar), 1);
+        if (buffer != stackBuffer) {
+            free(buffer);
+        }
+        return hash;
+    }
+    if ([obj isKindOfClass:[NSNumber class]]) {
+        double value = [obj doubleValue];
+        return AloomaHash64(&value, sizeof(value), 2);
+    }
+    if ([obj isKindOfClass:[NSDictionary class]]) {
+        uint64_t hash = 0;
+        for (id key in obj) {
+            hash += AloomaHashMix(AloomaHashObject(key), AloomaHashObject(obj[key]));
+        }
+        return AloomaHashMix(hash, 3);
+    }
+    if ([obj isKindOfClass:[NSArray class]]) {
+        uint64_t hash = 4;
+        for (id item in obj) {
+            hash = AloomaHashMix(hash, AloomaHashObject(item));
+        }
+        return hash;
+    }
+    if ([obj isKindOfClass:[NSDate class]]) {
+        double value = [obj timeIntervalSince1970];
+        return AloomaHash64(&value, sizeof(value), 5);
+    }
+    return AloomaHashObject([obj description]);
+}
+
+static inline NSUInteger AloomaMallocRound(NSUInteger size)
+{
+    return (size + 15) & ~(NSUInteger)15;
+}
+
+// heap bytes held by a queued event, from the layout of the Foundation
+// classes rather than by asking malloc, so it is cheap enough to run on every
+// enqueue. Shared keys and values are counted each time they are reached and
+// strings are assumed to be stored one byte per character.
+static NSUInteger AloomaEstimatedSize(id obj)
+{
+    if (obj == nil) {
+        return 0;
+    }
+    if ([obj isKindOfClass:[NSString class]]) {
+        return AloomaMallocRound(16 + [obj length] + 1);
+    }
+    if ([obj isKindOfClass:[NSDictionary class]]) {
+        // object header plus a hash table of key and value pointers
+        NSUInteger size = AloomaMallocRound(32 + [obj count] * 24);
+        for (id key in obj) {
+            size += AloomaEstimatedSize(key) + AloomaEstimatedSize(obj[key]);
+        }
+        return size;
+    }
+    if ([obj isKindOfClass:[NSArray class]]) {
+        NSUInteger size = AloomaMallocRound(32 + [obj count] * 8);
+        for (id item in obj) {
+            size += AloomaEstimatedSize(item);
+        }
+        return size;
+    }
+    return AloomaMallocRound(class_getInstanceSize(object_getClass(obj)));
+}
+
 - (NSData *)JSONSerializeObject:(id)obj
 {
     id coercedObj = [self JSONSerializableObjectForObject:obj];
@@ -223,12 +537,16 @@ static __unused NSString *MPURLEncode(NSString *s)
     NSString *b64String = @"";
     NSData *data = [self JSONSerializeObject:array];
     if (data) {
-        b64String = [data mp_base64EncodedString];
-        b64String = (id)CFBridgingRelease(CFURLCreateStringByAddingPercentEscapes(kCFAllocatorDefault,
-                                                                (CFStringRef)b64String,
-                                                                NULL,
-                                                                CFSTR("!*'();:@&=+$,/?%#[]"),
-                                                                kCFStringEncodingUTF8));
+        // base64 only leaves '+', '/' and '=' to escape, both steps stay in C
+        size_t encodedLength = 0;
+        char *encoded = Alooma_NewBase64Encode([data bytes], [data length], false, &encodedLength);
+        size_t escapedLength = 0;
+        char *escaped = encoded ? AloomaPercentEncode(encoded, encodedLength, &escapedLength) : NULL;
+        if (escaped) {
+            b64String = [[NSString alloc] initWithBytes:escaped length:escapedLength encoding:NSASCIIStringEncoding];
+        }
+        free(escaped);
+        free(encoded);
     }
     return b64String;
 }
@@ -275,12 +593,15 @@ static __unused NSString *MPURLEncode(NSString *s)
         AloomaDebug(@"%@ cannot identify blank distinct id: %@", self, distinctId);
         return;
     }
-    dispatch_async(self.serialQueue, ^{
-        self.distinctId = distinctId;
+    distinctId = [distinctId copy];
+    [self dispatchStateChange:^{
+        self.eventDistinctId = distinctId;
         if ([self inBackground]) {
             [self archiveProperties];
         }
-    });
+    } publishing:^{
+        self->_distinctId = distinctId;
+    }];
 }
 
 - (void)createAlias:(NSString *)alias forDistinctID:(NSString *)distinctID
@@ -315,102 +636,575 @@ static __unused NSString *MPURLEncode(NSString *s)
 
 - (void)track:(NSString *)event properties:(NSDictionary *)properties customEvent:(NSDictionary*)customEvent
 {
+    if (!_tracing) {
+        [self admitEvent:event properties:properties customEvent:customEvent span:0];
+        return;
+    }
+    uint64_t span = [self nextEventSpan];
+    [self traceBeganStage:AloomaTraceStageTrack identifier:span count:1 bytes:0];
+    [self admitEvent:event properties:properties customEvent:customEvent span:span];
+    [self traceEndedStage:AloomaTraceStageTrack identifier:span count:1 bytes:0];
+}
+
+- (void)admitEvent:(NSString *)event properties:(NSDictionary *)properties customEvent:(NSDictionary *)customEvent span:(uint64_t)span
+{
+    if (self.disabled) {
+        return;
+    }
+    NSTimeInterval dedupeWindow = self.dedupeWindow;
+    if (dedupeWindow > 0 && [self isDuplicateEvent:event properties:properties customEvent:customEvent window:dedupeWindow]) {
+        [self.sampler recordSuppressedEvent:event reason:kDuplicateReason];
+        return;
+    }
+    double sampleWeight = [self.sampler admitEvent:event];
+    if (sampleWeight == 0) {
+        return;
+    }
+    [self enqueueEvent:event properties:properties customEvent:customEvent sampleWeight:sampleWeight span:span];
+}
+
+- (BOOL)isDuplicateEvent:(NSString *)event properties:(NSDictionary *)properties customEvent:(NSDictionary *)customEvent window:(NSTimeInterval)window
+{
+    if (_recentEvents == NULL) {
+        return NO;
+    }
+    uint64_t hash = AloomaHashMix(AloomaHashObject(event), AloomaHashMix(AloomaHashObject(properties), AloomaHashObject(customEvent)));
+    return AloomaDedupeWindowCheck(_recentEvents, hash, AloomaClockNow(), window) != 0;
+}
+
+// events generated by the library itself (firehose blocks, aggregates) come in
+// here directly, so sampling rules never drop them
+- (void)enqueueEvent:(NSString *)event properties:(NSDictionary *)properties customEvent:(NSDictionary *)customEvent sampleWeight:(double)sampleWeight
+{
+    [self enqueueEvent:event properties:properties customEvent:customEvent sampleWeight:sampleWeight span:0];
+}
+
+// span is the event's trace identifier, 0 to take a new one
+- (void)enqueueEvent:(NSString *)event properties:(NSDictionary *)properties customEvent:(NSDictionary *)customEvent sampleWeight:(double)sampleWeight span:(uint64_t)span
+{
+    if (self.disabled) {
+        return;
+    }
     if (event == nil || [event length] == 0) {
         AloomaError(@"%@ Alooma track called with empty event parameter. not using an event", self);
     }
     properties = [properties copy];
     [Alooma assertPropertyTypes:properties];
 
-    double epochInterval = [[NSDate date] timeIntervalSince1970];
+    double epochInterval = AloomaClockNow();
     NSNumber *epochSeconds = @(round(epochInterval));
-    dispatch_async(self.serialQueue, ^{
+    double enqueuedAt = AloomaClockWallNow();
+    // set directly rather than through the queue, so read it as of this call
+    NSString *nameTag = self.nameTag;
+    if (_tracing && span == 0) {
+        span = [self nextEventSpan];
+    }
+    dispatch_block_t merge = ^{
+        if (self->_tracing) {
+            [self traceBeganStage:AloomaTraceStageMerge identifier:span count:1 bytes:0];
+        }
         NSNumber *eventStartTime = self.timedEvents[event];
         NSMutableDictionary *p = [NSMutableDictionary dictionary];
         [p addEntriesFromDictionary:self.automaticProperties];
         p[@"token"] = self.apiToken;
         p[@"time"] = epochSeconds;
         if (eventStartTime) {
-            [self.timedEvents removeObjectForKey:event];
             p[@"$duration"] = @([[NSString stringWithFormat:@"%.3f", epochInterval - [eventStartTime doubleValue]] floatValue]);
         }
-        if (self.nameTag) {
-            p[@"mp_name_tag"] = self.nameTag;
+        if (nameTag) {
+            p[@"mp_name_tag"] = nameTag;
         }
-        if (self.distinctId) {
-            p[@"distinct_id"] = self.distinctId;
+        if (self.eventDistinctId) {
+            p[@"distinct_id"] = self.eventDistinctId;
         }
         if (self.sessionId) {
             p[@"session_id"] = self.sessionId;
         }
-        // TODO: add integer overflow check, and generate a new session id on overflow
-        self.messageIndex = [NSNumber numberWithInt:[self.messageIndex intValue] + 1];
-        p[@"message_index"] = self.messageIndex;
         p[kSendingTimeKey] = kSendingTimePlaceHolder;
+        if (sampleWeight != 1) {
+            p[kSampleWeightKey] = @(sampleWeight);
+        }
         [p addEntriesFromDictionary:self.superProperties];
         if (properties) {
             [p addEntriesFromDictionary:properties];
         }
+        NSString *eventName = event;
+        NSArray *middleware = self.middleware;
+        if ([middleware count] > 0) {
+            AloomaEventView *view = [[AloomaEventView alloc] initWithEvent:event properties:p];
+            for (AloomaMiddlewareStage *stage in middleware) {
+                if (![stage runWithView:view]) {
+                    AloomaDebug(@"%@ event %@ dropped by middleware %@", self, event, stage.name);
+                    [self.sampler recordSuppressedEvent:event reason:kMiddlewareReason];
+                    if (self->_tracing) {
+                        [self traceEndedStage:AloomaTraceStageMerge identifier:span count:0 bytes:0];
+                    }
+                    return;
+                }
+            }
+            eventName = view.event;
+        }
+        // a dropped event leaves its timer running for the next one
+        if (eventStartTime) {
+            self.timedEvents = [self.timedEvents mapByRemovingObjectForKey:event];
+        }
+        [self.propertyFilter filterProperties:p];
+        // numbered only once no stage dropped it, so gaps still mean lost events
+        // TODO: add integer overflow check, and generate a new session id on overflow
+        self.messageIndex = [NSNumber numberWithInt:[self.messageIndex intValue] + 1];
+        p[@"message_index"] = self.messageIndex;
 //        NSDictionary *e = @{@"event": event, @"properties": [NSDictionary dictionaryWithDictionary:p]};
         NSMutableDictionary *e = [NSMutableDictionary new];
         [e setObject:[NSDictionary dictionaryWithDictionary:p] forKeyedSubscript:@"properties"];
-        if (event) {
-            [e setObject:event forKeyedSubscript:@"event"];
+        if (eventName) {
+            [e setObject:eventName forKeyedSubscript:@"event"];
         }
         if (customEvent) {
             NSMutableDictionary *args = [customEvent mutableCopy];
+            // the custom fields go out next to the properties, so the same rules apply
+            [self.propertyFilter filterProperties:args];
             [args addEntriesFromDictionary:e];
             e = args;
         }
+        if (self->_metrics != NULL) {
+            [self->_enqueueTimes setObject:@(enqueuedAt) forKey:e];
+        }
         AloomaDebug(@"%@ queueing event: %@", self, e);
         [self.eventsQueue addObject:e];
-        if ([self.eventsQueue count] > 500) {
-            [self.eventsQueue removeObjectAtIndex:0];
+        self->_queueBytes += AloomaEstimatedSize(e);
+        AloomaMetricsAdd(self->_metrics, AloomaCounterEventsTracked, 1);
+        NSUInteger maxQueueSize = self.maxQueueSize;
+        if ([self.eventsQueue count] > maxQueueSize) {
+            // more than one when a remote config just lowered the cap
+            NSRange dropped = NSMakeRange(0, [self.eventsQueue count] - maxQueueSize);
+            AloomaMetricsAdd(self->_metrics, AloomaCounterEventsDroppedQueueFull, dropped.length);
+            for (NSDictionary *old in [self.eventsQueue subarrayWithRange:dropped]) {
+                self->_queueBytes -= AloomaEstimatedSize(old);
+            }
+            [self.eventsQueue removeObjectsInRange:dropped];
         }
-        if ([self inBackground]) {
+        AloomaMetricsSetGauge(self->_metrics, AloomaGaugeQueueDepth, (int64_t)[self.eventsQueue count]);
+        AloomaMetricsSetGauge(self->_metrics, AloomaGaugeQueueBytes, self->_queueBytes);
+        if (self->_tracing) {
+            [self traceEndedStage:AloomaTraceStageMerge identifier:span count:1 bytes:0];
+        }
+        // a staged merge archives once at the end instead
+        if ([self inBackground] && !self->_mergingStaged) {
             [self archiveEvents];
         }
-    });
+    };
+    if (![self stageEvent:merge timestamp:epochInterval]) {
+        dispatch_async(self.serialQueue, merge);
+    }
 
     if ([Alooma isAppExtension]) {
         [self flush];
     }
 }
 
-
-- (void)trackPushNotification:(NSDictionary *)userInfo event:(NSString *)event
+
+- (void)trackPushNotification:(NSDictionary *)userInfo event:(NSString *)event
+{
+    AloomaDebug(@"%@ tracking push payload %@", self, userInfo);
+
+    if (userInfo && userInfo[@"mp"]) {
+        NSDictionary *mpPayload = userInfo[@"mp"];
+
+        if ([mpPayload isKindOfClass:[NSDictionary class]] && mpPayload[@"m"] && mpPayload[@"c"]) {
+            [self track:event properties:@{@"campaign_id": mpPayload[@"c"],
+                                           @"message_id": mpPayload[@"m"],
+                                           @"message_type": @"push"}];
+        } else {
+            AloomaError(@"%@ malformed Alooma push payload %@", self, mpPayload);
+        }
+    }
+}
+
+- (void)trackPushNotification:(NSDictionary *)userInfo
+{
+    [self trackPushNotification:userInfo event:@"$campaign_received"];
+}
+
+#pragma mark - Firehose
+
+- (AloomaFirehose *)firehoseWithName:(NSString *)name fields:(NSArray *)fields capacity:(NSUInteger)capacity
+{
+    if (name == nil || [name length] == 0 || [fields count] == 0 || capacity == 0) {
+        AloomaError(@"%@ firehose needs a name, at least one field and a capacity", self);
+        return nil;
+    }
+    @synchronized(self.firehoses) {
+        AloomaFirehose *firehose = self.firehoses[name];
+        if (firehose) {
+            if (![firehose.fields isEqualToArray:fields]) {
+                AloomaError(@"%@ firehose %@ already registered with fields %@", self, name, firehose.fields);
+                return nil;
+            }
+            return firehose;
+        }
+        firehose = [[AloomaFirehose alloc] initWithName:name fields:fields capacity:capacity];
+        if (firehose) {
+            self.firehoses[name] = firehose;
+        }
+        return firehose;
+    }
+}
+
+- (void)drainFirehoses
+{
+    NSArray *firehoses;
+    @synchronized(self.firehoses) {
+        firehoses = [self.firehoses allValues];
+    }
+    for (AloomaFirehose *firehose in firehoses) {
+        for (NSDictionary *block in [firehose drainBlocksWithMaxRecords:kFirehoseMaxBlockRecords]) {
+            [self enqueueEvent:kFirehoseEvent properties:block customEvent:nil sampleWeight:1];
+        }
+    }
+}
+
+#pragma mark - Sampling
+
+- (void)setSampleRate:(double)rate forEvent:(NSString *)event
+{
+    [self.sampler setSampleRate:rate forEvent:event];
+}
+
+- (void)setRateLimit:(double)eventsPerSecond burst:(NSUInteger)burst forEvent:(NSString *)event
+{
+    [self.sampler setRateLimit:eventsPerSecond burst:burst forEvent:event];
+}
+
+- (void)removeSamplingRulesForEvent:(NSString *)event
+{
+    [self.sampler removeRulesForEvent:event];
+}
+
+- (NSDictionary *)suppressedEventCounts
+{
+    return [self.sampler suppressedCounts];
+}
+
+#pragma mark - Property filtering
+
+- (BOOL)setPropertyFilterRules:(NSArray *)rules salt:(NSString *)salt
+{
+    if ([rules count] == 0) {
+        self.propertyFilter = nil;
+        return YES;
+    }
+    AloomaPropertyFilter *filter = [[AloomaPropertyFilter alloc] initWithRules:rules salt:salt];
+    if (filter == nil) {
+        return NO;
+    }
+    self.propertyFilter = filter;
+    return YES;
+}
+
+#pragma mark - Middleware
+
+- (void)addMiddlewareNamed:(NSString *)name block:(AloomaMiddlewareBlock)block
+{
+    if (name == nil || block == nil) {
+        AloomaError(@"%@ middleware needs a name and a block", self);
+        return;
+    }
+    AloomaMiddlewareStage *stage = [[AloomaMiddlewareStage alloc] initWithName:name block:block];
+    @synchronized(self) {
+        // names key the timings and removal, so they must stay unique
+        for (AloomaMiddlewareStage *existing in self.middleware) {
+            if ([existing.name isEqualToString:name]) {
+                AloomaError(@"%@ middleware named %@ already added, ignoring", self, name);
+                return;
+            }
+        }
+        NSMutableArray *middleware = [NSMutableArray arrayWithArray:self.middleware];
+        [middleware addObject:stage];
+        self.middleware = middleware;
+    }
+}
+
+- (void)removeMiddlewareNamed:(NSString *)name
+{
+    @synchronized(self) {
+        NSMutableArray *middleware = [NSMutableArray arrayWithArray:self.middleware];
+        [middleware filterUsingPredicate:[NSPredicate predicateWithFormat:@"name != %@", name]];
+        // names are unique, so this removes at most one stage
+        self.middleware = middleware;
+    }
+}
+
+- (NSDictionary *)middlewareTimings
+{
+    NSMutableDictionary *timings = [NSMutableDictionary dictionary];
+    for (AloomaMiddlewareStage *stage in self.middleware) {
+        timings[stage.name] = [stage timings];
+    }
+    return timings;
+}
+
+#pragma mark - Aggregation
+
+- (void)increment:(NSString *)metric
+{
+    [self.aggregator increment:metric by:1 dimensions:nil];
+}
+
+- (void)increment:(NSString *)metric by:(double)amount
+{
+    [self.aggregator increment:metric by:amount dimensions:nil];
+}
+
+- (void)increment:(NSString *)metric by:(double)amount dimensions:(NSDictionary *)dimensions
+{
+    [self.aggregator increment:metric by:amount dimensions:[dimensions copy]];
+}
+
+- (void)setGauge:(double)value forMetric:(NSString *)metric
+{
+    [self.aggregator setGauge:value forMetric:metric dimensions:nil];
+}
+
+- (void)setGauge:(double)value forMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions
+{
+    [self.aggregator setGauge:value forMetric:metric dimensions:[dimensions copy]];
+}
+
+- (void)recordValue:(double)value forMetric:(NSString *)metric
+{
+    [self.aggregator recordValue:value forMetric:metric dimensions:nil];
+}
+
+- (void)recordValue:(double)value forMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions
+{
+    [self.aggregator recordValue:value forMetric:metric dimensions:[dimensions copy]];
+}
+
+- (void)drainAggregatesForce:(BOOL)force
+{
+    NSTimeInterval elapsed = AloomaClockNow() - self.aggregator.intervalStart;
+    if (!force && elapsed < self.aggregationInterval) {
+        return;
+    }
+    for (NSDictionary *summary in [self.aggregator drainSummaries]) {
+        [self enqueueEvent:kAggregateEvent properties:summary customEvent:nil sampleWeight:1];
+    }
+}
+
+#pragma mark - Staged ingest
+
+static void AloomaStagingBufferSealed(AloomaStaging *staging, void *info)
+{
+    [(__bridge Alooma *)info scheduleStagedMerge];
+}
+
+static void AloomaMergeStagedEvent(void *item, double timestamp, void *info)
+{
+    dispatch_block_t merge = (__bridge_transfer dispatch_block_t)item;
+    merge();
+}
+
+- (BOOL)stagedIngest
+{
+    return atomic_load_explicit(&_stagedIngest, memory_order_relaxed);
+}
+
+- (void)setStagedIngest:(BOOL)stagedIngest
+{
+    @synchronized(self) {
+        AloomaStaging *staging = atomic_load(&_staging);
+        if (stagedIngest && staging == NULL) {
+            staging = AloomaStagingCreate(kStagingBufferCapacity, AloomaStagingBufferSealed, (__bridge void *)self);
+            atomic_store(&_staging, staging);
+        }
+        atomic_store(&_stagedIngest, stagedIngest && staging != NULL);
+    }
+    if (!stagedIngest) {
+        // queued ahead of anything tracked from now on
+        dispatch_async(self.serialQueue, ^{
+            [self mergeStagedEvents:YES];
+        });
+    }
+}
+
+// hands an event's merge block to the calling thread's staging buffer
+- (BOOL)stageEvent:(dispatch_block_t)merge timestamp:(double)timestamp
+{
+    if (!atomic_load_explicit(&_stagedIngest, memory_order_relaxed)) {
+        return NO;
+    }
+    AloomaStaging *staging = atomic_load_explicit(&_staging, memory_order_acquire);
+    void *item = (__bridge_retained void *)merge;
+    if (AloomaStagingAppend(staging, timestamp, item)) {
+        return YES;
+    }
+    CFBridgingRelease(item);
+    return NO;
+}
+
+// identity, super property and timed event changes go through the calling
+// thread's staging buffer as well, so that they are merged in order with the
+// events that thread tracks before and after them
+- (void)dispatchStateChange:(dispatch_block_t)change
+{
+    if (![self stageEvent:change timestamp:AloomaClockNow()]) {
+        dispatch_async(self.serialQueue, change);
+    }
+}
+
+- (void)scheduleStagedMerge
+{
+    if (atomic_exchange(&_stagedMergeScheduled, true)) {
+        return;
+    }
+    dispatch_async(self.serialQueue, ^{
+        atomic_store(&self->_stagedMergeScheduled, false);
+        [self mergeStagedEvents:NO];
+    });
+}
+
+// serial queue only; unsealed also takes the buffers threads are still filling.
+// The merge blocks number the events, so message_index follows merge order.
+- (void)mergeStagedEvents:(BOOL)unsealed
+{
+    AloomaStaging *staging = atomic_load_explicit(&_staging, memory_order_acquire);
+    // a staged block that merges, like reset, already runs in order
+    if (staging == NULL || _mergingStaged) {
+        return;
+    }
+    _mergingStaged = YES;
+    size_t merged = AloomaStagingMerge(staging, unsealed, AloomaMergeStagedEvent, NULL);
+    _mergingStaged = NO;
+    if (merged > 0 && [self inBackground]) {
+        [self archiveEvents];
+    }
+}
+
+#pragma mark - SDK metrics
+
+static NSDictionary *AloomaLatencySummary(const AloomaHdrHistogram *histogram)
+{
+    return @{@"count": @(AloomaHdrHistogramCount(histogram)),
+             @"min": @(AloomaHdrHistogramMin(histogram)),
+             @"mean": @(round(AloomaHdrHistogramMean(histogram))),
+             @"p50": @(AloomaHdrHistogramValueAtPercentile(histogram, 50)),
+             @"p90": @(AloomaHdrHistogramValueAtPercentile(histogram, 90)),
+             @"p99": @(AloomaHdrHistogramValueAtPercentile(histogram, 99)),
+             @"max": @(AloomaHdrHistogramMax(histogram))};
+}
+
+// start and now must come from the same clock
+static uint64_t AloomaMicrosecondsSince(NSTimeInterval start, NSTimeInterval now)
+{
+    NSTimeInterval elapsed = now - start;
+    return elapsed > 0 ? (uint64_t)(elapsed * 1e6) : 0;
+}
+
+// lets sdk_bench.m measure track: without metrics; call before tracking anything
+- (void)disableMetrics
+{
+    dispatch_sync(self.serialQueue, ^{
+        self->_disabledMetrics = self->_metrics;
+        self->_metrics = NULL;
+    });
+}
+
+- (NSDictionary *)metricsSnapshot
+{
+    AloomaMetrics *metrics = _metrics;
+    if (metrics == NULL) {
+        return @{};
+    }
+    NSMutableDictionary *counters = [NSMutableDictionary dictionary];
+    for (int i = 0; i < AloomaCounterCount; i++) {
+        counters[@(AloomaCounterNames[i])] = @(AloomaMetricsCounterValue(metrics, (AloomaCounter)i));
+    }
+    NSMutableDictionary *gauges = [NSMutableDictionary dictionary];
+    for (int i = 0; i < AloomaGaugeCount; i++) {
+        gauges[@(AloomaGaugeNames[i])] = @(AloomaMetricsGaugeValue(metrics, (AloomaGauge)i));
+    }
+    NSMutableDictionary *latencies = [NSMutableDictionary dictionary];
+    for (int i = 0; i < AloomaLatencyCount; i++) {
+        latencies[@(AloomaLatencyNames[i])] = AloomaLatencySummary(AloomaMetricsLatency(metrics, (AloomaLatency)i));
+    }
+    return @{@"counters": counters,
+             @"gauges": gauges,
+             @"latencies": latencies,
+             @"suppressed": [self suppressedEventCounts]};
+}
+
+// must be called on the serial queue; walks the whole queue, so it is only
+// used where the queue was replaced or mostly drained
+- (void)updateQueueGauges
+{
+    int64_t bytes = 0;
+    for (NSDictionary *e in self.eventsQueue) {
+        bytes += (int64_t)AloomaEstimatedSize(e);
+    }
+    _queueBytes = bytes;
+    AloomaMetricsSetGauge(_metrics, AloomaGaugeQueueDepth, (int64_t)[self.eventsQueue count]);
+    AloomaMetricsSetGauge(_metrics, AloomaGaugeQueueBytes, bytes);
+}
+
+- (void)drainMetrics
+{
+    NSTimeInterval interval = self.metricsInterval;
+    double now = AloomaClockNow();
+    @synchronized(self) {
+        if (interval <= 0 || now - _metricsEmittedAt < interval) {
+            return;
+        }
+        _metricsEmittedAt = now;
+    }
+    [self enqueueEvent:kMetricsEvent properties:[self metricsSnapshot] customEvent:nil sampleWeight:1];
+}
+
+#pragma mark - Tracing
+
+- (id<AloomaTracer>)tracer
+{
+    @synchronized(self) {
+        return _tracer;
+    }
+}
+
+- (void)setTracer:(id<AloomaTracer>)tracer
 {
-    AloomaDebug(@"%@ tracking push payload %@", self, userInfo);
+    @synchronized(self) {
+        _tracer = tracer;
+        // call sites test this flag alone, so tracing off costs one branch
+        _tracing = tracer != nil;
+    }
+}
 
-    if (userInfo && userInfo[@"mp"]) {
-        NSDictionary *mpPayload = userInfo[@"mp"];
+- (uint64_t)nextEventSpan
+{
+    return atomic_fetch_add_explicit(&_eventSpans, 1, memory_order_relaxed) + 1;
+}
 
-        if ([mpPayload isKindOfClass:[NSDictionary class]] && mpPayload[@"m"] && mpPayload[@"c"]) {
-            [self track:event properties:@{@"campaign_id": mpPayload[@"c"],
-                                           @"message_id": mpPayload[@"m"],
-                                           @"message_type": @"push"}];
-        } else {
-            AloomaError(@"%@ malformed Alooma push payload %@", self, mpPayload);
-        }
+- (void)traceBeganStage:(AloomaTraceStage)stage identifier:(uint64_t)identifier count:(NSUInteger)count bytes:(NSUInteger)bytes
+{
+    id<AloomaTracer> tracer = self.tracer;
+    if ([tracer respondsToSelector:@selector(alooma:beganStage:identifier:count:bytes:)]) {
+        [tracer alooma:self beganStage:stage identifier:identifier count:count bytes:bytes];
     }
 }
 
-- (void)trackPushNotification:(NSDictionary *)userInfo
+- (void)traceEndedStage:(AloomaTraceStage)stage identifier:(uint64_t)identifier count:(NSUInteger)count bytes:(NSUInteger)bytes
 {
-    [self trackPushNotification:userInfo event:@"$campaign_received"];
+    id<AloomaTracer> tracer = self.tracer;
+    if ([tracer respondsToSelector:@selector(alooma:endedStage:identifier:count:bytes:)]) {
+        [tracer alooma:self endedStage:stage identifier:identifier count:count bytes:bytes];
+    }
 }
 
 - (void)registerSuperProperties:(NSDictionary *)properties
 {
     properties = [properties copy];
     [Alooma assertPropertyTypes:properties];
-    dispatch_async(self.serialQueue, ^{
-        NSMutableDictionary *tmp = [NSMutableDictionary dictionaryWithDictionary:self.superProperties];
-        [tmp addEntriesFromDictionary:properties];
-        self.superProperties = [NSDictionary dictionaryWithDictionary:tmp];
-        if ([self inBackground]) {
-            [self archiveProperties];
-        }
-    });
+    [self changeSuperProperties:^AloomaPersistentMap *(AloomaPersistentMap *superProperties) {
+        return [superProperties mapByAddingEntriesFromDictionary:properties];
+    }];
 }
 
 - (void)registerSuperPropertiesOnce:(NSDictionary *)properties
@@ -422,48 +1216,38 @@ static __unused NSString *MPURLEncode(NSString *s)
 {
     properties = [properties copy];
     [Alooma assertPropertyTypes:properties];
-    dispatch_async(self.serialQueue, ^{
-        NSMutableDictionary *tmp = [NSMutableDictionary dictionaryWithDictionary:self.superProperties];
+    [self changeSuperProperties:^AloomaPersistentMap *(AloomaPersistentMap *superProperties) {
         for (NSString *key in properties) {
-            id value = tmp[key];
+            id value = superProperties[key];
             if (value == nil || [value isEqual:defaultValue]) {
-                tmp[key] = properties[key];
+                superProperties = [superProperties mapBySettingObject:properties[key] forKey:key];
             }
         }
-        self.superProperties = [NSDictionary dictionaryWithDictionary:tmp];
-        if ([self inBackground]) {
-            [self archiveProperties];
-        }
-    });
+        return superProperties;
+    }];
 }
 
 - (void)unregisterSuperProperty:(NSString *)propertyName
 {
-    dispatch_async(self.serialQueue, ^{
-        NSMutableDictionary *tmp = [NSMutableDictionary dictionaryWithDictionary:self.superProperties];
-        if (tmp[propertyName] != nil) {
-            [tmp removeObjectForKey:propertyName];
-        }
-        self.superProperties = [NSDictionary dictionaryWithDictionary:tmp];
-        if ([self inBackground]) {
-            [self archiveProperties];
-        }
-    });
+    [self changeSuperProperties:^AloomaPersistentMap *(AloomaPersistentMap *superProperties) {
+        return [superProperties mapByRemovingObjectForKey:propertyName];
+    }];
 }
 
 - (void)clearSuperProperties
 {
-    dispatch_async(self.serialQueue, ^{
-        self.superProperties = @{};
-        if ([self inBackground]) {
-            [self archiveProperties];
-        }
-    });
+    [self changeSuperProperties:^AloomaPersistentMap *(AloomaPersistentMap *superProperties) {
+        return [AloomaPersistentMap map];
+    }];
 }
 
 - (NSDictionary *)currentSuperProperties
 {
-    return [self.superProperties copy];
+    @synchronized(self) {
+        [self restorePublishedState];
+        // immutable, so the snapshot itself can be handed out
+        return _currentSuperProperties;
+    }
 }
 
 - (void)timeEvent:(NSString *)event
@@ -472,27 +1256,38 @@ static __unused NSString *MPURLEncode(NSString *s)
         AloomaError(@"Alooma cannot time an empty event");
         return;
     }
-    dispatch_async(self.serialQueue, ^{
-        self.timedEvents[event] = @([[NSDate date] timeIntervalSince1970]);
-    });
+    // the block may run well after this call when it is staged
+    NSNumber *start = @(AloomaClockNow());
+    [self dispatchStateChange:^{
+        self.timedEvents = [self.timedEvents mapBySettingObject:start forKey:event];
+    }];
 }
 
 - (void)clearTimedEvents
-{   dispatch_async(self.serialQueue, ^{
-        self.timedEvents = [NSMutableDictionary dictionary];
-    });
+{
+    [self dispatchStateChange:^{
+        self.timedEvents = [AloomaPersistentMap map];
+    }];
 }
 
 - (void)reset
 {
-    dispatch_async(self.serialQueue, ^{
-        self.distinctId = [self defaultDistinctId];
+    NSString *distinctId = [self defaultDistinctId];
+    [self dispatchStateChange:^{
+        // events tracked before the reset go with the old identity; when
+        // staged, this block already runs in order with them
+        [self mergeStagedEvents:YES];
+        self.eventDistinctId = distinctId;
         self.nameTag = nil;
-        self.superProperties = [NSMutableDictionary dictionary];
+        self.superProperties = [AloomaPersistentMap map];
         self.eventsQueue = [NSMutableArray array];
-        self.timedEvents = [NSMutableDictionary dictionary];
+        self.timedEvents = [AloomaPersistentMap map];
+        [self updateQueueGauges];
         [self archive];
-    });
+    } publishing:^{
+        self->_distinctId = distinctId;
+        self->_currentSuperProperties = [AloomaPersistentMap map];
+    }];
 }
 
 #pragma mark - Network control
@@ -509,40 +1304,56 @@ static __unused NSString *MPURLEncode(NSString *s)
     @synchronized(self) {
         _flushInterval = interval;
     }
-    [self startFlushTimer];
+    // the timer is stopped in the background, applicationDidBecomeActive: restarts it with the new interval
+    if (![self inBackground]) {
+        [self startFlushTimer];
+    }
 }
 
+// flush timers with the same interval fire together, so the first flush
+// picks up every attached instance's events and the others find nothing to send
 - (void)startFlushTimer
 {
-    [self stopFlushTimer];
-    dispatch_async(dispatch_get_main_queue(), ^{
-        if (self.flushInterval > 0) {
-            self.timer = [NSTimer scheduledTimerWithTimeInterval:self.flushInterval
-                                                          target:self
-                                                        selector:@selector(flush)
-                                                        userInfo:nil
-                                                         repeats:YES];
-            AloomaDebug(@"%@ started flush timer: %@", self, self.timer);
+    @synchronized(self) {
+        [self stopFlushTimer];
+        if (_flushInterval > 0) {
+            self.flushTimer = [[AloomaScheduler sharedScheduler] scheduleTimerWithInterval:_flushInterval
+                                                                                   repeats:YES
+                                                                                     queue:self.serialQueue
+                                                                                     block:^{
+                                                                                         [self flush];
+                                                                                     }];
+            AloomaDebug(@"%@ started flush timer %llu", self, self.flushTimer);
         }
-    });
+    }
 }
 
 - (void)stopFlushTimer
 {
-    dispatch_async(dispatch_get_main_queue(), ^{
-        if (self.timer) {
-            [self.timer invalidate];
-            AloomaDebug(@"%@ stopped flush timer: %@", self, self.timer);
+    @synchronized(self) {
+        if (self.flushTimer != 0) {
+            [[AloomaScheduler sharedScheduler] cancelTimer:self.flushTimer];
+            AloomaDebug(@"%@ stopped flush timer %llu", self, self.flushTimer);
         }
-        self.timer = nil;
-    });
+        self.flushTimer = 0;
+    }
 }
 
 - (void)flush
 {
+    // blocks and summaries are queued ahead of the flush below, so they go out with it
+    [self drainFirehoses];
+    [self drainAggregatesForce:NO];
+    [self drainMetrics];
     dispatch_async(self.serialQueue, ^{
         AloomaDebug(@"%@ flush starting", self);
 
+        [self refreshRemoteConfig:NO];
+        if (self.disabled) {
+            AloomaDebug(@"%@ flush skipped, disabled by remote config", self);
+            return;
+        }
+
         __strong id<AloomaDelegate> strongDelegate = self.delegate;
         if (strongDelegate != nil && [strongDelegate respondsToSelector:@selector(aloomaWillFlush:)] && ![strongDelegate aloomaWillFlush:self]) {
             AloomaDebug(@"%@ flush deferred by delegate", self);
@@ -557,62 +1368,380 @@ static __unused NSString *MPURLEncode(NSString *s)
 
 - (void)flushEvents
 {
-    [self flushQueue:_eventsQueue
-            endpoint:@"/track/"];
+    NSTimeInterval flushStart = AloomaClockMonotonicNow();
+    AloomaMetricsAdd(_metrics, AloomaCounterFlushes, 1);
+    // the triggering instance was checked by flush, the others are checked here
+    [self mergeStagedEvents:YES];
+    [self pruneExpiredEvents:self.eventsQueue];
+    NSMutableArray *groups = [NSMutableArray arrayWithObject:[NSMutableArray arrayWithObject:self]];
+    for (Alooma *instance in [self.engine instances]) {
+        if (instance == self) {
+            continue;
+        }
+        [instance mergeStagedEvents:YES];
+        if (![instance readyToFlush]) {
+            continue;
+        }
+        // queues whose owners batch alike share requests
+        NSMutableArray *group = nil;
+        for (NSMutableArray *candidate in groups) {
+            if ([candidate[0] batchesLike:instance]) {
+                group = candidate;
+                break;
+            }
+        }
+        if (group) {
+            [group addObject:instance];
+        } else {
+            [groups addObject:[NSMutableArray arrayWithObject:instance]];
+        }
+    }
+    for (NSArray *owners in groups) {
+        if (![self flushQueuesOf:owners endpoint:@"/track/"]) {
+            break;
+        }
+    }
+    // the batches may have drained other instances' queues too
+    for (Alooma *instance in [self.engine instances]) {
+        [instance updateQueueGauges];
+    }
+    AloomaMetricsRecordLatency(_metrics, AloomaLatencyFlush, AloomaMicrosecondsSince(flushStart, AloomaClockMonotonicNow()));
+}
+
+- (BOOL)batchesLike:(Alooma *)other
+{
+    NSString *compression = self.compression;
+    return self.batchSize == other.batchSize && self.maxBatchBytes == other.maxBatchBytes &&
+        (compression == other.compression || [compression isEqualToString:other.compression]);
+}
+
+// must be called on the serial queue; prunes expired events as a side effect
+- (BOOL)readyToFlush
+{
+    if (self.disabled || [self.eventsQueue count] == 0) {
+        return NO;
+    }
+    __strong id<AloomaDelegate> strongDelegate = self.delegate;
+    if (strongDelegate != nil && [strongDelegate respondsToSelector:@selector(aloomaWillFlush:)] && ![strongDelegate aloomaWillFlush:self]) {
+        return NO;
+    }
+    [self pruneExpiredEvents:self.eventsQueue];
+    return YES;
+}
+
+- (void)setTTL:(NSTimeInterval)ttl forEvent:(NSString *)event
+{
+    if (event == nil || [event length] == 0) {
+        AloomaError(@"%@ cannot set a ttl for an empty event", self);
+        return;
+    }
+    @synchronized(self.eventTTLs) {
+        self.eventTTLs[event] = @(MAX(ttl, 0));
+    }
+}
+
+// drops events older than their ttl so they are never encoded or sent
+- (void)pruneExpiredEvents:(NSMutableArray *)queue
+{
+    NSTimeInterval defaultTTL = self.eventTTL;
+    NSDictionary *ttls;
+    @synchronized(self.eventTTLs) {
+        ttls = [self.eventTTLs copy];
+    }
+    if (defaultTTL <= 0 && [ttls count] == 0) {
+        return;
+    }
+    double now = AloomaClockNow();
+    NSMutableIndexSet *expired = [NSMutableIndexSet indexSet];
+    [queue enumerateObjectsUsingBlock:^(NSDictionary *e, NSUInteger idx, BOOL *stop) {
+        NSString *event = [e[@"event"] isKindOfClass:[NSString class]] ? e[@"event"] : nil;
+        NSNumber *ttl = event ? ttls[event] : nil;
+        NSTimeInterval limit = ttl ? [ttl doubleValue] : defaultTTL;
+        NSNumber *time = e[@"properties"][@"time"];
+        if (limit > 0 && time && now - [time doubleValue] > limit) {
+            [expired addIndex:idx];
+            [self.sampler recordSuppressedEvent:event reason:kExpiredReason];
+        }
+    }];
+    if ([expired count] > 0) {
+        AloomaDebug(@"%@ dropping %lu expired events", self, (unsigned long)[expired count]);
+        [queue removeObjectsAtIndexes:expired];
+        if (queue == self.eventsQueue) {
+            [self updateQueueGauges];
+        }
+    }
 }
 
-- (void)flushQueue:(NSMutableArray *)queue endpoint:(NSString *)endpoint
+// batches take events from the owners' queues in order, so one request can
+// carry the events of several tokens; the owners share batch size, byte cap
+// and compression (see batchesLike:). NO if a request failed.
+- (BOOL)flushQueuesOf:(NSArray *)owners endpoint:(NSString *)endpoint
 {
-    while ([queue count] > 0) {
-        NSUInteger batchSize = ([queue count] > 50) ? 50 : [queue count];
-        NSArray *batch = [queue subarrayWithRange:NSMakeRange(0, batchSize)];
+    Alooma *owner = owners[0];
+    NSMutableArray *queues = [NSMutableArray arrayWithCapacity:[owners count]];
+    for (Alooma *instance in owners) {
+        [queues addObject:instance.eventsQueue];
+    }
+    while (YES) {
+        NSUInteger batchSize = MAX(owner.batchSize, 1);
+        NSMutableArray *batch = [NSMutableArray arrayWithCapacity:batchSize];
+        NSUInteger pending = 0;
+        for (NSMutableArray *queue in queues) {
+            NSUInteger take = MIN([queue count], batchSize - [batch count]);
+            [batch addObjectsFromArray:[queue subarrayWithRange:NSMakeRange(0, take)]];
+            pending += [queue count];
+        }
+        if ([batch count] == 0) {
+            break;
+        }
 
         // adding Sending Timestamp
-        double epochInterval = [[NSDate date] timeIntervalSince1970];
+        double epochInterval = AloomaClockNow();
         for (NSMutableDictionary *event in batch){
             NSMutableDictionary *properties = [[event objectForKeyedSubscript:@"properties"] mutableCopy];
             properties[kSendingTimeKey] = @(round(epochInterval));
             [event setObject:[NSDictionary dictionaryWithDictionary:properties] forKeyedSubscript:@"properties"];
         }
 
+        uint64_t span = ++_batchSpans;
+        if (_tracing) {
+            [self traceBeganStage:AloomaTraceStageEncode identifier:span count:[batch count] bytes:0];
+        }
+        NSTimeInterval encodeStart = AloomaClockMonotonicNow();
         NSString *requestData = [self encodeAPIData:batch];
+        NSUInteger maxBatchBytes = owner.maxBatchBytes;
+        while (maxBatchBytes > 0 && [requestData length] > maxBatchBytes && [batch count] > 1) {
+            [batch removeObjectsInRange:NSMakeRange(([batch count] + 1) / 2, [batch count] / 2)];
+            requestData = [self encodeAPIData:batch];
+        }
+        AloomaMetricsRecordLatency(_metrics, AloomaLatencyEncode, AloomaMicrosecondsSince(encodeStart, AloomaClockMonotonicNow()));
+        if (_tracing) {
+            [self traceEndedStage:AloomaTraceStageEncode identifier:span count:[batch count] bytes:[requestData length]];
+        }
         NSString *postBody = [NSString stringWithFormat:@"ip=1&data=%@", requestData];
-        AloomaDebug(@"%@ flushing %lu of %lu to %@: %@", self, (unsigned long)[batch count], (unsigned long)[queue count], endpoint, queue);
-        NSURLRequest *request = [self apiRequestWithEndpoint:endpoint andBody:postBody];
+        AloomaDebug(@"%@ flushing %lu of %lu to %@", self, (unsigned long)[batch count], (unsigned long)pending, endpoint);
+        NSURLRequest *request = [owner apiRequestWithEndpoint:endpoint andBody:postBody];
         NSError *error = nil;
 
         [self updateNetworkActivityIndicator:YES];
 
         NSURLResponse *urlResponse = nil;
+        if (_tracing) {
+            [self traceBeganStage:AloomaTraceStageRequest identifier:span count:[batch count] bytes:[[request HTTPBody] length]];
+        }
+        NSTimeInterval requestStart = AloomaClockMonotonicNow();
         NSData *responseData = [NSURLConnection sendSynchronousRequest:request returningResponse:&urlResponse error:&error];
+        AloomaMetricsRecordLatency(_metrics, AloomaLatencyRequest, AloomaMicrosecondsSince(requestStart, AloomaClockMonotonicNow()));
+        if (_tracing) {
+            [self traceEndedStage:AloomaTraceStageRequest identifier:span count:[batch count] bytes:[responseData length]];
+        }
+        AloomaMetricsAdd(_metrics, AloomaCounterRequests, 1);
 
         [self updateNetworkActivityIndicator:NO];
 
         if (error) {
             AloomaError(@"%@ network failure: %@", self, error);
-            break;
+            AloomaMetricsAdd(_metrics, AloomaCounterRequestFailures, 1);
+            return NO;
         }
 
+        if (_tracing) {
+            [self traceBeganStage:AloomaTraceStageResponse identifier:span count:[batch count] bytes:[responseData length]];
+        }
         NSString *response = [[NSString alloc] initWithData:responseData encoding:NSUTF8StringEncoding];
         if ([response intValue] == 0) {
             AloomaError(@"%@ %@ api rejected some items", self, endpoint);
+            AloomaMetricsAdd(_metrics, AloomaCounterRequestsRejected, 1);
+        } else {
+            AloomaMetricsAdd(_metrics, AloomaCounterEventsSent, [batch count]);
+        }
+        AloomaMetricsAdd(_metrics, AloomaCounterBytesSent, [[request HTTPBody] length]);
+        double ackedAt = AloomaClockWallNow();
+        for (NSDictionary *event in batch) {
+            for (Alooma *instance in owners) {
+                NSNumber *enqueuedAt = [instance->_enqueueTimes objectForKey:event];
+                if (enqueuedAt) {
+                    AloomaMetricsRecordLatency(_metrics, AloomaLatencyEnqueueToAck, AloomaMicrosecondsSince([enqueuedAt doubleValue], ackedAt));
+                    [instance->_enqueueTimes removeObjectForKey:event];
+                    break;
+                }
+            }
         }
 
-        [queue removeObjectsInArray:batch];
+        for (NSMutableArray *queue in queues) {
+            [queue removeObjectsInArray:batch];
+        }
+        if (_tracing) {
+            [self traceEndedStage:AloomaTraceStageResponse identifier:span count:[batch count] bytes:[responseData length]];
+        }
     }
+    return YES;
 }
 
 - (NSURLRequest *)apiRequestWithEndpoint:(NSString *)endpoint andBody:(NSString *)body
 {
     NSURL *URL = [NSURL URLWithString:[self.serverURL stringByAppendingString:endpoint]];
     NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
+    [request setTimeoutInterval:kRequestTimeout];
     [request setValue:@"gzip" forHTTPHeaderField:@"Accept-Encoding"];
     [request setHTTPMethod:@"POST"];
-    [request setHTTPBody:[body dataUsingEncoding:NSUTF8StringEncoding]];
+    NSData *bodyData = [body dataUsingEncoding:NSUTF8StringEncoding];
+#if !defined(ALOOMA_MINIMAL_TRANSPORT)
+    if ([self.compression isEqualToString:@"gzip"]) {
+        NSData *compressed = AloomaGzip(bodyData);
+        if (compressed) {
+            bodyData = compressed;
+            [request setValue:@"gzip" forHTTPHeaderField:@"Content-Encoding"];
+        } else {
+            AloomaError(@"%@ gzip compression failed, sending uncompressed", self);
+        }
+    }
+#endif
+    [request setHTTPBody:bodyData];
     AloomaDebug(@"%@ http request: %@?%@", self, URL, body);
     return request;
 }
 
+#pragma mark - Remote configuration
+
+- (NSString *)remoteConfigKey
+{
+    @synchronized(self) {
+        return _remoteConfigKey;
+    }
+}
+
+- (void)setRemoteConfigKey:(NSString *)remoteConfigKey
+{
+#if defined(ALOOMA_MINIMAL_TRANSPORT)
+    AloomaError(@"%@ remote configuration is not part of this build, ignoring the key", self);
+#else
+    @synchronized(self) {
+        _remoteConfigKey = [remoteConfigKey copy];
+    }
+    dispatch_async(self.serialQueue, ^{
+        [self loadCachedRemoteConfig];
+        [self refreshRemoteConfig:YES];
+    });
+#endif
+}
+
+- (NSString *)remoteConfigFilePath
+{
+    NSString *filename = [NSString stringWithFormat:@"alooma-%@-config.json", self.apiToken];
+    return [[NSSearchPathForDirectoriesInDomains(NSLibraryDirectory, NSUserDomainMask, YES) lastObject]
+            stringByAppendingPathComponent:filename];
+}
+
+- (void)loadCachedRemoteConfig
+{
+#if !defined(ALOOMA_NO_PERSISTENCE)
+    NSData *document = [NSData dataWithContentsOfFile:[self remoteConfigFilePath]];
+    AloomaRemoteConfig *config = [AloomaRemoteConfig configWithDocument:document publicKey:self.remoteConfigKey];
+    if (!config) {
+        return;
+    }
+    // an expired document is not applied, but fetched ones older than it are still refused
+    self.remoteConfigVersion = MAX(self.remoteConfigVersion, [config.version longLongValue]);
+    if (config.expired) {
+        AloomaDebug(@"%@ cached remote config %@ has expired", self, config);
+        return;
+    }
+    AloomaDebug(@"%@ loaded cached remote config %@", self, config);
+    [self applyRemoteConfig:config];
+#endif
+}
+
+// runs on the serial queue; fetches at most once per refresh interval unless forced
+- (void)refreshRemoteConfig:(BOOL)force
+{
+    NSString *key = self.remoteConfigKey;
+    if ([key length] == 0) {
+        return;
+    }
+    NSTimeInterval refreshInterval = self.remoteConfig.refreshInterval ? [self.remoteConfig.refreshInterval doubleValue] : kDefaultRemoteConfigRefreshInterval;
+    if (!force && self.remoteConfigFetchedAt && -[self.remoteConfigFetchedAt timeIntervalSinceNow] < refreshInterval) {
+        return;
+    }
+    self.remoteConfigFetchedAt = [NSDate date];
+
+    NSString *endpoint = [NSString stringWithFormat:@"/config/%@", MPURLEncode(self.apiToken)];
+    NSURL *URL = [NSURL URLWithString:[self.serverURL stringByAppendingString:endpoint]];
+    NSMutableURLRequest *request = [NSMutableURLRequest requestWithURL:URL];
+    [request setTimeoutInterval:10];
+    NSURLResponse *urlResponse = nil;
+    NSError *error = nil;
+    NSData *document = [NSURLConnection sendSynchronousRequest:request returningResponse:&urlResponse error:&error];
+    if (error || ![urlResponse isKindOfClass:[NSHTTPURLResponse class]] || [(NSHTTPURLResponse *)urlResponse statusCode] != 200) {
+        AloomaDebug(@"%@ no remote config fetched from %@: %@", self, URL, error);
+        return;
+    }
+    AloomaRemoteConfig *config = [AloomaRemoteConfig configWithDocument:document publicKey:key];
+    if (!config) {
+        return;
+    }
+    if ([config.version longLongValue] < self.remoteConfigVersion) {
+        AloomaError(@"%@ ignoring remote config version %@, older than version %lld", self, config.version, self.remoteConfigVersion);
+        return;
+    }
+    if (config.expired) {
+        AloomaError(@"%@ ignoring expired remote config %@", self, config);
+        return;
+    }
+    self.remoteConfigVersion = [config.version longLongValue];
+#if !defined(ALOOMA_NO_PERSISTENCE)
+    if (![document writeToFile:[self remoteConfigFilePath] atomically:YES]) {
+        AloomaError(@"%@ unable to cache remote config", self);
+    }
+#endif
+    [self applyRemoteConfig:config];
+}
+
+// values the document leaves out keep their current setting
+- (void)applyRemoteConfig:(AloomaRemoteConfig *)config
+{
+    self.remoteConfig = config;
+    self.disabled = config.enabled ? ![config.enabled boolValue] : NO;
+    if (config.flushInterval && [config.flushInterval unsignedIntegerValue] != self.flushInterval) {
+        self.flushInterval = [config.flushInterval unsignedIntegerValue];
+    }
+    if (config.batchSize) {
+        self.batchSize = [config.batchSize unsignedIntegerValue];
+    }
+    if (config.batchBytes) {
+        self.maxBatchBytes = [config.batchBytes unsignedIntegerValue];
+    }
+    if (config.maxQueueSize) {
+        self.maxQueueSize = [config.maxQueueSize unsignedIntegerValue];
+    }
+    if (config.compression) {
+        self.compression = config.compression;
+    }
+
+    // remote rules replace the ones from the previous document
+    for (NSString *event in self.remoteSamplingEvents) {
+        [self.sampler removeRulesForEvent:[event isEqualToString:@"*"] ? nil : event];
+    }
+    NSMutableSet *events = [NSMutableSet set];
+    [config.sampling enumerateKeysAndObjectsUsingBlock:^(id event, id rate, BOOL *stop) {
+        if ([event isKindOfClass:[NSString class]] && [rate isKindOfClass:[NSNumber class]]) {
+            [self.sampler setSampleRate:[rate doubleValue] forEvent:[event isEqualToString:@"*"] ? nil : event];
+            [events addObject:event];
+        }
+    }];
+    [config.rateLimits enumerateKeysAndObjectsUsingBlock:^(id event, id limit, BOOL *stop) {
+        if ([event isKindOfClass:[NSString class]] && [limit isKindOfClass:[NSDictionary class]]) {
+            id perSecond = limit[@"per_second"];
+            [self.sampler setRateLimit:[perSecond isKindOfClass:[NSNumber class]] ? [perSecond doubleValue] : AloomaRateUnlimited
+                                 burst:[limit[@"burst"] unsignedIntegerValue]
+                              forEvent:[event isEqualToString:@"*"] ? nil : event];
+            [events addObject:event];
+        }
+    }];
+    self.remoteSamplingEvents = events;
+    AloomaDebug(@"%@ applied remote config %@", self, config);
+}
+
 #pragma mark - Persistence
 
 - (NSString *)filePathForData:(NSString *)data
@@ -638,28 +1767,53 @@ static __unused NSString *MPURLEncode(NSString *s)
     [self archiveProperties];
 }
 
+// the engine keeps one archive for the queues of all its instances
 - (void)archiveEvents
 {
-    NSString *filePath = [self eventsFilePath];
-    NSMutableArray *eventsQueueCopy = [NSMutableArray arrayWithArray:[self.eventsQueue copy]];
-    AloomaDebug(@"%@ archiving events data to %@: %@", self, filePath, eventsQueueCopy);
-    if (![NSKeyedArchiver archiveRootObject:eventsQueueCopy toFile:filePath]) {
-        AloomaError(@"%@ unable to archive events data", self);
+    NSMutableDictionary *queues = [NSMutableDictionary dictionary];
+    for (Alooma *instance in [self.engine instances]) {
+        [instance pruneExpiredEvents:instance.eventsQueue];
+        NSMutableArray *events = [NSMutableArray arrayWithArray:queues[instance.apiToken]];
+        [events addObjectsFromArray:instance.eventsQueue];
+        queues[instance.apiToken] = events;
+    }
+    AloomaDebug(@"%@ archiving events of %lu tokens", self, (unsigned long)[queues count]);
+    if (!_tracing) {
+        [self.engine archiveEventQueues:queues];
+        return;
+    }
+    uint64_t span = ++_archiveSpans;
+    NSUInteger count = 0;
+    for (NSString *token in queues) {
+        count += [queues[token] count];
     }
+    [self traceBeganStage:AloomaTraceStagePersist identifier:span count:count bytes:0];
+    NSUInteger bytes = [self.engine archiveEventQueues:queues];
+    [self traceEndedStage:AloomaTraceStagePersist identifier:span count:count bytes:bytes];
 }
 
 - (void)archiveProperties
 {
+#if !defined(ALOOMA_NO_PERSISTENCE)
     NSString *filePath = [self propertiesFilePath];
     NSMutableDictionary *p = [NSMutableDictionary dictionary];
-    [p setValue:self.distinctId forKey:@"distinctId"];
+    [p setValue:self.eventDistinctId forKey:@"distinctId"];
     [p setValue:self.nameTag forKey:@"nameTag"];
     [p setValue:self.superProperties forKey:@"superProperties"];
     [p setValue:self.timedEvents forKey:@"timedEvents"];
     AloomaDebug(@"%@ archiving properties data to %@: %@", self, filePath, p);
-    if (![NSKeyedArchiver archiveRootObject:p toFile:filePath]) {
+    uint64_t span = _tracing ? ++_archiveSpans : 0;
+    if (_tracing) {
+        [self traceBeganStage:AloomaTraceStagePersist identifier:span count:0 bytes:0];
+    }
+    NSData *data = [NSKeyedArchiver archivedDataWithRootObject:p];
+    if (![data writeToFile:filePath atomically:YES]) {
         AloomaError(@"%@ unable to archive properties data", self);
     }
+    if (_tracing) {
+        [self traceEndedStage:AloomaTraceStagePersist identifier:span count:0 bytes:[data length]];
+    }
+#endif
 }
 
 - (void)unarchive
@@ -670,6 +1824,9 @@ static __unused NSString *MPURLEncode(NSString *s)
 
 - (id)unarchiveFromFile:(NSString *)filePath
 {
+#if defined(ALOOMA_NO_PERSISTENCE)
+    return nil;
+#else
     id unarchivedData = nil;
     @try {
         unarchivedData = [NSKeyedUnarchiver unarchiveObjectWithFile:filePath];
@@ -687,25 +1844,33 @@ static __unused NSString *MPURLEncode(NSString *s)
         }
     }
     return unarchivedData;
+#endif
 }
 
 - (void)unarchiveEvents
 {
-    self.eventsQueue = (NSMutableArray *)[self unarchiveFromFile:[self eventsFilePath]];
-    if (!self.eventsQueue) {
-        self.eventsQueue = [NSMutableArray array];
-    }
+    // events archived by versions without a shared engine come first
+    NSArray *legacy = [self unarchiveFromFile:[self eventsFilePath]];
+    self.eventsQueue = [NSMutableArray arrayWithArray:[legacy isKindOfClass:[NSArray class]] ? legacy : @[]];
+    [self.eventsQueue addObjectsFromArray:[self.engine claimArchivedEventsForToken:self.apiToken]];
+    [self pruneExpiredEvents:self.eventsQueue];
+    [self updateQueueGauges];
 }
 
 - (void)unarchiveProperties
 {
-    NSDictionary *properties = (NSDictionary *)[self unarchiveFromFile:[self propertiesFilePath]];
-    if (properties) {
-        self.distinctId = properties[@"distinctId"] ? properties[@"distinctId"] : [self defaultDistinctId];
+    NSDictionary *properties;
+    @synchronized(self) {
+        [self restorePublishedState];
+        properties = _restoredProperties;
+        _restoredProperties = nil;
+    }
+    self.eventDistinctId = properties[@"distinctId"];
+    if (properties[@"nameTag"]) {
         self.nameTag = properties[@"nameTag"];
-        self.superProperties = properties[@"superProperties"] ? properties[@"superProperties"] : [NSMutableDictionary dictionary];
-        self.timedEvents = properties[@"timedEvents"] ? properties[@"timedEvents"] : [NSMutableDictionary dictionary];
     }
+    self.superProperties = [AloomaPersistentMap mapWithDictionary:properties[@"superProperties"]];
+    self.timedEvents = [AloomaPersistentMap mapWithDictionary:properties[@"timedEvents"]];
 }
 
 #pragma mark - Application Helpers
@@ -754,7 +1919,7 @@ static __unused NSString *MPURLEncode(NSString *s)
 - (NSString *)IFA
 {
     NSString *ifa = nil;
-#if !defined(MIXPANEL_NO_IFA)
+#if !defined(ALOOMA_NO_IFA)
     Class ASIdentifierManagerClass = NSClassFromString(@"ASIdentifierManager");
     if (ASIdentifierManagerClass) {
         SEL sharedManagerSelector = NSSelectorFromString(@"sharedManager");
@@ -767,46 +1932,30 @@ static __unused NSString *MPURLEncode(NSString *s)
     return ifa;
 }
 
-#if __IPHONE_OS_VERSION_MAX_ALLOWED >= 70000
-- (void)setCurrentRadio
-{
-    dispatch_async(self.serialQueue, ^(){
-        NSMutableDictionary *properties = [self.automaticProperties mutableCopy];
-        properties[@"$radio"] = [self currentRadio];
-        self.automaticProperties = [properties copy];
-    });
-}
-
-- (NSString *)currentRadio
+- (NSString *)libVersion
 {
-    NSString *radio = _telephonyInfo.currentRadioAccessTechnology;
-    if (!radio) {
-        radio = @"None";
-    } else if ([radio hasPrefix:@"CTRadioAccessTechnology"]) {
-        radio = [radio substringFromIndex:23];
-    }
-    return radio;
+    return VERSION;
 }
-#endif
 
-- (NSString *)libVersion
+- (NSDictionary *)automaticProperties
 {
-    return VERSION;
+    return self.engine.automaticProperties;
 }
 
-- (NSDictionary *)collectAutomaticProperties
+// the screen size is read by the caller, the rest is safe on any queue
+- (NSDictionary *)collectAutomaticPropertiesWithScreenSize:(CGSize)size
 {
     NSMutableDictionary *p = [NSMutableDictionary dictionary];
     UIDevice *device = [UIDevice currentDevice];
     NSString *deviceModel = [self deviceModel];
-    CGSize size = [UIScreen mainScreen].bounds.size;
-    CTCarrier *carrier = [self.telephonyInfo subscriberCellularProvider];
 
     // Use setValue semantics to avoid adding keys where value can be nil.
     [p setValue:[[NSBundle mainBundle] infoDictionary][@"CFBundleVersion"] forKey:@"$app_version"];
     [p setValue:[[NSBundle mainBundle] infoDictionary][@"CFBundleShortVersionString"] forKey:@"$app_release"];
     [p setValue:[self IFA] forKey:@"$ios_ifa"];
-    [p setValue:carrier.carrierName forKey:@"$carrier"];
+#if !defined(ALOOMA_NO_TELEPHONY)
+    [p setValue:[self.engine.telephonyInfo subscriberCellularProvider].carrierName forKey:@"$carrier"];
+#endif
     [p setValue:[self watchModel] forKey:@"$watch_model"];
 
     [p addEntriesFromDictionary:@{
@@ -842,44 +1991,81 @@ static __unused NSString *MPURLEncode(NSString *s)
     }
 }
 
-#if !defined(ALOOMA_APP_EXTENSION)
+#pragma mark - Automatic properties cache
 
-#pragma mark - UIApplication Events
+// one per app rather than per token, all instances collect the same thing.
+// Caches are not backed up, so a backup restored to another device does not
+// bring along this one's properties
+- (NSString *)automaticPropertiesFilePath
+{
+    return [[NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject]
+            stringByAppendingPathComponent:@"alooma-automatic-properties.json"];
+}
 
-- (void)setUpListeners
+// what the cached properties are valid for: they only change when the app,
+// the OS or the library is upgraded, or the app moves to another device model
+- (NSString *)automaticPropertiesCacheKey
 {
-    // wifi reachability
-    BOOL reachabilityOk = NO;
-    NSURL* url = [NSURL URLWithString:self.serverURL];
-    NSString* host = [url host];
-    if ((_reachability = SCNetworkReachabilityCreateWithName(NULL, host.UTF8String)) != NULL) {
-        SCNetworkReachabilityContext context = {0, (__bridge void*)self, NULL, NULL, NULL};
-        if (SCNetworkReachabilitySetCallback(_reachability, AloomaReachabilityCallback, &context)) {
-            if (SCNetworkReachabilitySetDispatchQueue(_reachability, self.serialQueue)) {
-                reachabilityOk = YES;
-                AloomaDebug(@"%@ successfully set up reachability callback", self);
-            } else {
-                // cleanup callback if setting dispatch queue failed
-                SCNetworkReachabilitySetCallback(_reachability, NULL, NULL);
-            }
-        }
+    NSDictionary *info = [[NSBundle mainBundle] infoDictionary];
+    return [NSString stringWithFormat:@"%@ (%@) %@ %@ %@", info[@"CFBundleShortVersionString"], info[@"CFBundleVersion"],
+            [UIDevice currentDevice].systemVersion, [self libVersion], [self deviceModel]];
+}
+
+- (NSDictionary *)cachedAutomaticProperties
+{
+#if defined(ALOOMA_NO_PERSISTENCE)
+    return nil;
+#else
+    NSData *data = [NSData dataWithContentsOfFile:[self automaticPropertiesFilePath]];
+    if (data == nil) {
+        return nil;
     }
-    if (!reachabilityOk) {
-        AloomaError(@"%@ failed to set up reachability callback: %s", self, SCErrorString(SCError()));
+    NSDictionary *cache = [NSJSONSerialization JSONObjectWithData:data options:0 error:NULL];
+    if (![cache isKindOfClass:[NSDictionary class]] || ![cache[@"key"] isEqual:[self automaticPropertiesCacheKey]] ||
+        ![cache[@"properties"] isKindOfClass:[NSDictionary class]]) {
+        AloomaDebug(@"%@ cached automatic properties are stale", self);
+        return nil;
     }
+    return cache[@"properties"];
+#endif
+}
 
-    NSNotificationCenter *notificationCenter = [NSNotificationCenter defaultCenter];
-
-    // cellular info
-#if __IPHONE_OS_VERSION_MAX_ALLOWED >= 70000
-    if (floor(NSFoundationVersionNumber) > NSFoundationVersionNumber_iOS_6_1) {
-        [self setCurrentRadio];
-        [notificationCenter addObserver:self
-                               selector:@selector(setCurrentRadio)
-                                   name:CTRadioAccessTechnologyDidChangeNotification
-                                 object:nil];
+- (void)cacheAutomaticProperties:(NSDictionary *)properties
+{
+#if !defined(ALOOMA_NO_PERSISTENCE)
+    NSData *data = [NSJSONSerialization dataWithJSONObject:@{@"key": [self automaticPropertiesCacheKey], @"properties": properties}
+                                                   options:0 error:NULL];
+    if (![data writeToFile:[self automaticPropertiesFilePath] atomically:YES]) {
+        AloomaError(@"%@ unable to cache automatic properties", self);
     }
 #endif
+}
+
+// runs on a background queue, well after launch
+- (void)revalidateAutomaticProperties:(NSDictionary *)cached screenSize:(CGSize)screenSize
+{
+    NSDictionary *properties = [self collectAutomaticPropertiesWithScreenSize:screenSize];
+    if ([properties isEqualToDictionary:cached]) {
+        return;
+    }
+    AloomaDebug(@"%@ automatic properties changed since they were cached", self);
+    [self cacheAutomaticProperties:properties];
+    dispatch_async(self.serialQueue, ^{
+        // keep what the engine's network monitor set meanwhile
+        NSMutableDictionary *p = [properties mutableCopy];
+        [p setValue:self.engine.automaticProperties[@"$wifi"] forKey:@"$wifi"];
+        [p setValue:self.engine.automaticProperties[@"$radio"] forKey:@"$radio"];
+        self.engine.automaticProperties = [p copy];
+    });
+}
+
+#if !defined(ALOOMA_APP_EXTENSION)
+
+#pragma mark - UIApplication Events
+
+- (void)setUpListeners
+{
+    NSNotificationCenter *notificationCenter = [NSNotificationCenter defaultCenter];
 
     // Application lifecycle events
     [notificationCenter addObserver:self
@@ -908,30 +2094,6 @@ static __unused NSString *MPURLEncode(NSString *s)
                              object:nil];
 }
 
-static void AloomaReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info)
-{
-    if (info != NULL && [(__bridge NSObject*)info isKindOfClass:[Alooma class]]) {
-        @autoreleasepool {
-            Alooma *alooma = (__bridge Alooma *)info;
-            [alooma reachabilityChanged:flags];
-        }
-    } else {
-        AloomaError(@"reachability callback received unexpected info object");
-    }
-}
-
-- (void)reachabilityChanged:(SCNetworkReachabilityFlags)flags
-{
-    // this should be run in the serial queue. the reason we don't dispatch_async here
-    // is because it's only ever called by the reachability callback, which is already
-    // set to run on the serial queue. see SCNetworkReachabilitySetDispatchQueue in init
-    BOOL wifi = (flags & kSCNetworkReachabilityFlagsReachable) && !(flags & kSCNetworkReachabilityFlagsIsWWAN);
-    NSMutableDictionary *properties = [self.automaticProperties mutableCopy];
-    properties[@"$wifi"] = wifi ? @YES : @NO;
-    self.automaticProperties = [properties copy];
-    AloomaDebug(@"%@ reachability changed, wifi=%d", self, wifi);
-}
-
 - (void)applicationDidBecomeActive:(NSNotification *)notification
 {
     _inBG = false;
@@ -956,11 +2118,14 @@ static void AloomaReachabilityCallback(SCNetworkReachabilityRef target, SCNetwor
     }];
     AloomaDebug(@"%@ starting background cleanup task %lu", self, (unsigned long)self.taskId);
 
+    // rollups only live in memory, close the interval before we may be killed
+    [self drainAggregatesForce:YES];
     if (self.flushOnBackground) {
         [self flush];
     }
 
     dispatch_async(_serialQueue, ^{
+        [self mergeStagedEvents:YES];
         [self archive];
         AloomaDebug(@"%@ ending background cleanup task %lu", self, (unsigned long)self.taskId);
         if (self.taskId != UIBackgroundTaskInvalid) {
@@ -987,7 +2152,8 @@ static void AloomaReachabilityCallback(SCNetworkReachabilityRef target, SCNetwor
 {
     AloomaDebug(@"%@ application will terminate", self);
     dispatch_async(_serialQueue, ^{
-       [self archive];
+        [self mergeStagedEvents:YES];
+        [self archive];
     });
 }
 
@@ -0,0 +1,53 @@
+#import <Foundation/Foundation.h>
+
+/*!
+ @class
+ In-memory metric rollups.
+
+ @abstract
+ Keeps per-interval counters, gauges and histograms keyed by metric name and
+ dimension set.
+
+ @discussion
+ <code>Alooma</code> owns one aggregator and exposes it through
+ <code>increment:</code>, <code>setGauge:forMetric:</code> and
+ <code>recordValue:forMetric:</code>. Recording takes a lock but never hops
+ queues, and allocates only the first time a metric and dimension set is seen
+ in an interval. NaN and infinite values are logged and dropped.
+
+ Histograms are DDSketch quantile sketches with 1% relative accuracy, so
+ summaries from many devices can be merged server side.
+ */
+@interface AloomaAggregator : NSObject
+
+- (void)increment:(NSString *)metric by:(double)amount dimensions:(NSDictionary *)dimensions;
+- (void)setGauge:(double)value forMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions;
+- (void)recordValue:(double)value forMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions;
+
+/*!
+ @property
+
+ @abstract
+ Start of the current interval, in seconds since 1970.
+ */
+@property (atomic, readonly) NSTimeInterval intervalStart;
+
+/*!
+ @method
+
+ @abstract
+ Ends the current interval and returns one summary property dictionary per
+ metric and dimension set recorded in it.
+
+ @discussion
+ Every summary holds <code>metric</code>, <code>metric_type</code>
+ (<code>counter</code>, <code>gauge</code> or <code>histogram</code>),
+ <code>dimensions</code>, <code>interval_start</code>,
+ <code>interval_end</code>, <code>count</code> and <code>sum</code>. Gauges
+ add <code>value</code>, <code>min</code> and <code>max</code>; histograms add
+ <code>min</code>, <code>max</code>, <code>p50</code>, <code>p90</code>,
+ <code>p99</code> and the serialised <code>sketch</code>.
+ */
+- (NSArray *)drainSummaries;
+
+@end
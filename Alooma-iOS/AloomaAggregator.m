@@ -0,0 +1,229 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import "AloomaAggregator.h"
+#import "AloomaClock.h"
+#import "AloomaLogger.h"
+#import "AloomaSketch.h"
+
+static const double kSketchRelativeAccuracy = 0.01;
+static const size_t kSketchMaxBins = 2048;
+
+typedef NS_ENUM(NSInteger, AloomaAggregateType) {
+    AloomaAggregateTypeCounter,
+    AloomaAggregateTypeGauge,
+    AloomaAggregateTypeHistogram
+};
+
+@interface AloomaAggregate : NSObject
+{
+@public
+    AloomaAggregateType _type;
+    uint64_t _count;
+    double _sum;
+    double _min;
+    double _max;
+    double _last;
+    AloomaSketch *_sketch;
+}
+
+@property (nonatomic, copy) NSString *metric;
+@property (nonatomic, copy) NSDictionary *dimensions;
+
+@end
+
+@implementation AloomaAggregate
+
+- (void)dealloc
+{
+    AloomaSketchDestroy(_sketch);
+}
+
+@end
+
+@interface AloomaAggregator ()
+
+@property (atomic, readwrite) NSTimeInterval intervalStart;
+@property (nonatomic, strong) NSMutableDictionary *aggregates;
+
+@end
+
+@implementation AloomaAggregator
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _aggregates = [NSMutableDictionary dictionary];
+        _intervalStart = AloomaClockNow();
+    }
+    return self;
+}
+
+static NSString *AloomaAggregateKey(NSString *metric, NSDictionary *dimensions)
+{
+    if ([dimensions count] == 0) {
+        return metric;
+    }
+    NSMutableString *key = [NSMutableString stringWithString:metric];
+    for (id dimension in [[dimensions allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+        [key appendFormat:@"\x1f%@=%@", dimension, dimensions[dimension]];
+    }
+    return key;
+}
+
+// must be called while holding the lock on self
+- (AloomaAggregate *)aggregateForMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions type:(AloomaAggregateType)type
+{
+    if (metric == nil || [metric length] == 0) {
+        AloomaError(@"%@ cannot aggregate an empty metric", self);
+        return nil;
+    }
+    NSString *key = AloomaAggregateKey(metric, dimensions);
+    AloomaAggregate *aggregate = self.aggregates[key];
+    if (aggregate == nil) {
+        aggregate = [[AloomaAggregate alloc] init];
+        aggregate.metric = metric;
+        aggregate.dimensions = dimensions;
+        aggregate->_type = type;
+        aggregate->_min = INFINITY;
+        aggregate->_max = -INFINITY;
+        if (type == AloomaAggregateTypeHistogram) {
+            aggregate->_sketch = AloomaSketchCreate(kSketchRelativeAccuracy, kSketchMaxBins);
+        }
+        self.aggregates[key] = aggregate;
+    } else if (aggregate->_type != type) {
+        AloomaError(@"%@ metric %@ was already recorded with a different type", self, metric);
+        return nil;
+    }
+    return aggregate;
+}
+
+- (void)increment:(NSString *)metric by:(double)amount dimensions:(NSDictionary *)dimensions
+{
+    if (!isfinite(amount)) {
+        AloomaError(@"%@ ignoring non-finite amount %f for metric %@", self, amount, metric);
+        return;
+    }
+    @synchronized(self) {
+        AloomaAggregate *aggregate = [self aggregateForMetric:metric dimensions:dimensions type:AloomaAggregateTypeCounter];
+        if (aggregate) {
+            aggregate->_count++;
+            aggregate->_sum += amount;
+        }
+    }
+}
+
+- (void)setGauge:(double)value forMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions
+{
+    if (!isfinite(value)) {
+        AloomaError(@"%@ ignoring non-finite value %f for metric %@", self, value, metric);
+        return;
+    }
+    @synchronized(self) {
+        AloomaAggregate *aggregate = [self aggregateForMetric:metric dimensions:dimensions type:AloomaAggregateTypeGauge];
+        if (aggregate) {
+            aggregate->_count++;
+            aggregate->_sum += value;
+            aggregate->_last = value;
+            aggregate->_min = MIN(aggregate->_min, value);
+            aggregate->_max = MAX(aggregate->_max, value);
+        }
+    }
+}
+
+- (void)recordValue:(double)value forMetric:(NSString *)metric dimensions:(NSDictionary *)dimensions
+{
+    if (!isfinite(value)) {
+        AloomaError(@"%@ ignoring non-finite value %f for metric %@", self, value, metric);
+        return;
+    }
+    @synchronized(self) {
+        AloomaAggregate *aggregate = [self aggregateForMetric:metric dimensions:dimensions type:AloomaAggregateTypeHistogram];
+        if (aggregate && aggregate->_sketch) {
+            AloomaSketchAdd(aggregate->_sketch, value);
+        }
+    }
+}
+
+static NSDictionary *AloomaSketchStoreDictionary(const AloomaSketch *sketch, int negative)
+{
+    int32_t offset;
+    const uint64_t *counts;
+    size_t length = AloomaSketchBins(sketch, negative, &offset, &counts);
+    size_t first = 0, last = length;
+    while (first < last && counts[first] == 0) {
+        first++;
+    }
+    while (last > first && counts[last - 1] == 0) {
+        last--;
+    }
+    NSMutableArray *bins = [NSMutableArray arrayWithCapacity:last - first];
+    for (size_t i = first; i < last; i++) {
+        [bins addObject:@(counts[i])];
+    }
+    return @{@"offset": @(offset + (int32_t)first), @"counts": bins};
+}
+
+- (NSDictionary *)summaryForAggregate:(AloomaAggregate *)aggregate intervalEnd:(NSTimeInterval)intervalEnd
+{
+    NSMutableDictionary *summary = [NSMutableDictionary dictionary];
+    summary[@"metric"] = aggregate.metric;
+    summary[@"dimensions"] = aggregate.dimensions ?: @{};
+    summary[@"interval_start"] = @(self.intervalStart);
+    summary[@"interval_end"] = @(intervalEnd);
+    switch (aggregate->_type) {
+        case AloomaAggregateTypeCounter:
+            summary[@"metric_type"] = @"counter";
+            summary[@"count"] = @(aggregate->_count);
+            summary[@"sum"] = @(aggregate->_sum);
+            break;
+        case AloomaAggregateTypeGauge:
+            summary[@"metric_type"] = @"gauge";
+            summary[@"count"] = @(aggregate->_count);
+            summary[@"sum"] = @(aggregate->_sum);
+            summary[@"value"] = @(aggregate->_last);
+            summary[@"min"] = @(aggregate->_min);
+            summary[@"max"] = @(aggregate->_max);
+            break;
+        case AloomaAggregateTypeHistogram: {
+            const AloomaSketch *sketch = aggregate->_sketch;
+            summary[@"metric_type"] = @"histogram";
+            summary[@"count"] = @(AloomaSketchCount(sketch));
+            summary[@"sum"] = @(AloomaSketchSum(sketch));
+            summary[@"min"] = @(AloomaSketchMin(sketch));
+            summary[@"max"] = @(AloomaSketchMax(sketch));
+            summary[@"p50"] = @(AloomaSketchQuantile(sketch, 0.5));
+            summary[@"p90"] = @(AloomaSketchQuantile(sketch, 0.9));
+            summary[@"p99"] = @(AloomaSketchQuantile(sketch, 0.99));
+            summary[@"sketch"] = @{@"gamma": @(AloomaSketchGamma(sketch)),
+                                   @"zero_count": @(AloomaSketchZeroCount(sketch)),
+                                   @"positive": AloomaSketchStoreDictionary(sketch, 0),
+                                   @"negative": AloomaSketchStoreDictionary(sketch, 1)};
+            break;
+        }
+    }
+    return summary;
+}
+
+- (NSArray *)drainSummaries
+{
+    NSDictionary *aggregates;
+    NSTimeInterval now = AloomaClockNow();
+    NSMutableArray *summaries = [NSMutableArray array];
+    @synchronized(self) {
+        aggregates = self.aggregates;
+        self.aggregates = [NSMutableDictionary dictionary];
+        for (AloomaAggregate *aggregate in [aggregates allValues]) {
+            // empty histograms (allocation failure) have nothing to report
+            if (aggregate->_type == AloomaAggregateTypeHistogram && (!aggregate->_sketch || AloomaSketchCount(aggregate->_sketch) == 0)) {
+                continue;
+            }
+            [summaries addObject:[self summaryForAggregate:aggregate intervalEnd:now]];
+        }
+        self.intervalStart = now;
+    }
+    return summaries;
+}
+
+@end
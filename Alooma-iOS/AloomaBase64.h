@@ -0,0 +1,39 @@
+//
+//  AloomaBase64.h
+//  Alooma-iOS
+//
+//  Base64 and percent encoding of request bodies, in plain C so the encoding
+//  cost can be benchmarked off device.
+//
+
+#ifndef AloomaBase64_h
+#define AloomaBase64_h
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void *Alooma_NewBase64Decode(
+	const char *inputBuffer,
+	size_t length,
+	size_t *outputLength);
+
+char *Alooma_NewBase64Encode(
+	const void *inputBuffer,
+	size_t length,
+	bool separateLines,
+	size_t *outputLength);
+
+// Escapes every byte outside the RFC 3986 unreserved set (letters, digits
+// and "-._~") as %XX, into a newly malloced, 0 terminated buffer. The caller
+// frees it.
+char *AloomaPercentEncode(const char *input, size_t length, size_t *outputLength);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,51 @@
+//
+//  AloomaClock.c
+//  Alooma-iOS
+//
+
+#include "AloomaClock.h"
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <sys/time.h>
+#include <time.h>
+
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+
+static _Atomic(AloomaClockFunction) installedClock;
+
+void AloomaClockSet(AloomaClockFunction clock)
+{
+    atomic_store_explicit(&installedClock, clock, memory_order_release);
+}
+
+double AloomaClockWallNow(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec * 1e-6;
+}
+
+double AloomaClockMonotonicNow(void)
+{
+#ifdef __APPLE__
+    // clock_gettime only arrived in iOS 10
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return (double)mach_absolute_time() * timebase.numer / timebase.denom * 1e-9;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+double AloomaClockNow(void)
+{
+    AloomaClockFunction clock = atomic_load_explicit(&installedClock, memory_order_acquire);
+    return clock ? clock() : AloomaClockWallNow();
+}
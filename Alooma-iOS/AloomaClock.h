@@ -0,0 +1,36 @@
+//
+//  AloomaClock.h
+//  Alooma-iOS
+//
+//  The clock behind event timestamps, firehose records, sending times, timed
+//  events, TTLs, dedupe windows, rate limits and aggregation intervals, in
+//  seconds since 1970. It is the wall clock unless a virtual clock is installed, which is
+//  how the replay benchmark feeds recorded traces at any speed and gets the
+//  same timestamps on every run. Durations within the process, such as
+//  encode, request and flush times, use the monotonic clock, which setting
+//  the time of day cannot move; only enqueue-to-ack latency uses the wall
+//  clock, as a queued event waits through device sleep, which
+//  mach_absolute_time does not count.
+//
+
+#ifndef AloomaClock_h
+#define AloomaClock_h
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef double (*AloomaClockFunction)(void);
+
+// NULL restores the wall clock. Install before any instance is created.
+void AloomaClockSet(AloomaClockFunction clock);
+double AloomaClockNow(void);
+double AloomaClockWallNow(void);
+// seconds since an arbitrary point, only meaningful as a difference
+double AloomaClockMonotonicNow(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
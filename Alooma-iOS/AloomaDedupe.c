@@ -0,0 +1,151 @@
+//
+//  AloomaDedupe.c
+//  Alooma-iOS
+//
+
+#include "AloomaDedupe.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kProbeLimit 8
+
+static const uint64_t kSecret0 = 0xa0761d6478bd642full;
+static const uint64_t kSecret1 = 0xe7037ed1a0b428dbull;
+static const uint64_t kSecret2 = 0x8ebc6af09c88c6e3ull;
+
+static inline uint64_t AloomaMum(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    // 32-bit targets (armv7, i386) have no 128-bit integers: the same
+    // product from four 32x32 bit multiplies
+    uint64_t aHigh = a >> 32, aLow = (uint32_t)a, bHigh = b >> 32, bLow = (uint32_t)b;
+    uint64_t lowLow = aLow * bLow, lowHigh = aLow * bHigh, highLow = aHigh * bLow, highHigh = aHigh * bHigh;
+    uint64_t middle = (lowLow >> 32) + (uint32_t)lowHigh + (uint32_t)highLow;
+    uint64_t low = (middle << 32) | (uint32_t)lowLow;
+    uint64_t high = highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+    return low ^ high;
+#endif
+}
+
+static inline uint64_t AloomaRead64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t AloomaRead32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t AloomaHash64(const void *data, size_t length, uint64_t seed)
+{
+    const uint8_t *p = data;
+    seed ^= AloomaMum(seed ^ kSecret0, kSecret1);
+    uint64_t a, b;
+    if (length <= 16) {
+        if (length >= 4) {
+            a = (AloomaRead32(p) << 32) | AloomaRead32(p + ((length >> 3) << 2));
+            b = (AloomaRead32(p + length - 4) << 32) | AloomaRead32(p + length - 4 - ((length >> 3) << 2));
+        } else if (length > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = length;
+        while (i > 16) {
+            seed = AloomaMum(AloomaRead64(p) ^ kSecret1, AloomaRead64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = AloomaRead64(p + i - 16);
+        b = AloomaRead64(p + i - 8);
+    }
+    return AloomaMum(kSecret1 ^ length, AloomaMum(a ^ kSecret1, b ^ seed));
+}
+
+uint64_t AloomaHashMix(uint64_t a, uint64_t b)
+{
+    return AloomaMum(a ^ kSecret2, b ^ kSecret0);
+}
+
+typedef struct {
+    uint64_t hash;      // 0 marks an empty slot
+    double seenAt;
+} AloomaDedupeEntry;
+
+struct AloomaDedupeWindow {
+    pthread_mutex_t lock;
+    size_t mask;
+    AloomaDedupeEntry *entries;
+};
+
+AloomaDedupeWindow *AloomaDedupeWindowCreate(size_t capacity)
+{
+    size_t size = kProbeLimit;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    AloomaDedupeWindow *window = calloc(1, sizeof(AloomaDedupeWindow));
+    if (window == NULL) {
+        return NULL;
+    }
+    window->entries = calloc(size, sizeof(AloomaDedupeEntry));
+    if (window->entries == NULL) {
+        free(window);
+        return NULL;
+    }
+    window->mask = size - 1;
+    pthread_mutex_init(&window->lock, NULL);
+    return window;
+}
+
+void AloomaDedupeWindowDestroy(AloomaDedupeWindow *window)
+{
+    if (window == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&window->lock);
+    free(window->entries);
+    free(window);
+}
+
+int AloomaDedupeWindowCheck(AloomaDedupeWindow *window, uint64_t hash, double now, double windowSeconds)
+{
+    if (hash == 0) {
+        hash = 1;
+    }
+    pthread_mutex_lock(&window->lock);
+    AloomaDedupeEntry *freeSlot = NULL;
+    AloomaDedupeEntry *oldest = NULL;
+    for (size_t i = 0; i < kProbeLimit; i++) {
+        AloomaDedupeEntry *entry = &window->entries[(hash + i) & window->mask];
+        int live = entry->hash != 0 && now - entry->seenAt < windowSeconds;
+        if (!live) {
+            // keep probing, the hash may still be further along
+            if (freeSlot == NULL) {
+                freeSlot = entry;
+            }
+        } else if (entry->hash == hash) {
+            pthread_mutex_unlock(&window->lock);
+            return 1;
+        } else if (oldest == NULL || entry->seenAt < oldest->seenAt) {
+            oldest = entry;
+        }
+    }
+    AloomaDedupeEntry *victim = freeSlot ? freeSlot : oldest;
+    victim->hash = hash;
+    victim->seenAt = now;
+    pthread_mutex_unlock(&window->lock);
+    return 0;
+}
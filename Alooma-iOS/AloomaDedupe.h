@@ -0,0 +1,41 @@
+//
+//  AloomaDedupe.h
+//  Alooma-iOS
+//
+//  64-bit content hash and a bounded, time-windowed set of recently seen
+//  hashes, used to drop identical track: calls made within a short window.
+//
+
+#ifndef AloomaDedupe_h
+#define AloomaDedupe_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// wyhash-style hash of a byte range.
+uint64_t AloomaHash64(const void *data, size_t length, uint64_t seed);
+// Mixes two hashes; not commutative, add the results for an unordered combine.
+uint64_t AloomaHashMix(uint64_t a, uint64_t b);
+
+typedef struct AloomaDedupeWindow AloomaDedupeWindow;
+
+// capacity is rounded up to a power of two. When the table is crowded the
+// oldest entry near a new hash is evicted, so memory stays bounded at the
+// cost of occasionally missing a duplicate.
+AloomaDedupeWindow *AloomaDedupeWindowCreate(size_t capacity);
+void AloomaDedupeWindowDestroy(AloomaDedupeWindow *window);
+
+// Returns 1 if hash was seen less than windowSeconds before now, otherwise
+// records it at now and returns 0. The window is measured from the first
+// occurrence, so a steady stream of repeats is let through once per window.
+int AloomaDedupeWindowCheck(AloomaDedupeWindow *window, uint64_t hash, double now, double windowSeconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
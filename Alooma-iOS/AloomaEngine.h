@@ -0,0 +1,94 @@
+#import <Foundation/Foundation.h>
+
+#import "AloomaFeatures.h"
+
+@class Alooma;
+@class CTTelephonyNetworkInfo;
+
+/*!
+ @class
+ Resources shared by every Alooma instance that reports to one server.
+
+ @abstract
+ Hosts any number of tokens on a single serial queue, network monitor,
+ automatic property set, event store and uploader.
+
+ @discussion
+ <code>Alooma</code> instances created with the same server URL attach to the
+ same engine. Their event queues stay separate, but they are only touched on
+ the engine's queue, persisted together in one file and uploaded together:
+ a flush from any instance sends the pending events of all of them in shared
+ <code>/track/</code> requests, each event carrying its own token. Engines
+ for different servers have queues of their own, so a slow upload to one
+ server does not hold up another; their flush timers share
+ <code>AloomaScheduler</code>.
+ */
+@interface AloomaEngine : NSObject
+
+/*!
+ @method
+
+ @abstract
+ Returns the engine for a server URL, creating it on first use.
+ */
++ (instancetype)engineForServerURL:(NSString *)serverURL;
+
+@property (nonatomic, readonly, copy) NSString *serverURL;
+@property (nonatomic, readonly, strong) dispatch_queue_t serialQueue;
+#if !defined(ALOOMA_NO_TELEPHONY)
+@property (nonatomic, readonly, strong) CTTelephonyNetworkInfo *telephonyInfo;
+#endif
+
+/*!
+ @property
+
+ @abstract
+ Properties added to every event; nil until the first instance collects them.
+ Network changes keep <code>$wifi</code> and <code>$radio</code> current.
+ */
+@property (atomic, strong) NSDictionary *automaticProperties;
+
+/*!
+ @method
+
+ @abstract
+ Starts tracking reachability and radio technology. Only the first call has
+ an effect, and only what the build includes is tracked (see
+ <code>AloomaFeatures.h</code>).
+ */
+- (void)startMonitoringNetwork;
+
+- (void)attachInstance:(Alooma *)alooma;
+
+/*!
+ @method
+
+ @abstract
+ Instances currently attached, in no particular order.
+ */
+- (NSArray *)instances;
+
+/*!
+ @method
+
+ @abstract
+ Returns and forgets the archived events of a token.
+
+ @discussion
+ The archive is read, and deleted, the first time any token is claimed;
+ events of tokens that are not claimed are kept in memory and written back by
+ the next <code>archiveEventQueues:</code>.
+ */
+- (NSArray *)claimArchivedEventsForToken:(NSString *)token;
+
+/*!
+ @method
+
+ @abstract
+ Writes the event queues, keyed by token, to the engine's archive. Must be
+ called on the serial queue. Returns the size of the archive, 0 on failure and
+ in builds without persistence.
+ */
+- (NSUInteger)archiveEventQueues:(NSDictionary *)queues;
+
+@end
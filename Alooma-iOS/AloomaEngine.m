@@ -0,0 +1,285 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import <CommonCrypto/CommonDigest.h>
+
+#import "AloomaEngine.h"
+#import "AloomaFeatures.h"
+
+#if !defined(ALOOMA_NO_TELEPHONY)
+#import <CoreTelephony/CTTelephonyNetworkInfo.h>
+#endif
+#if !defined(ALOOMA_NO_REACHABILITY)
+#import <SystemConfiguration/SystemConfiguration.h>
+#endif
+
+#import "AloomaLogger.h"
+
+@interface AloomaEngine ()
+{
+    BOOL _monitoring;
+    BOOL _archiveLoaded;
+#if !defined(ALOOMA_NO_REACHABILITY)
+    SCNetworkReachabilityRef _reachability;
+#endif
+#if !defined(ALOOMA_NO_TELEPHONY)
+    CTTelephonyNetworkInfo *_telephonyInfo;
+#endif
+}
+
+@property (nonatomic, strong) NSHashTable *attached;
+@property (nonatomic, strong) NSMutableDictionary *unclaimedEvents;
+
+@end
+
+@implementation AloomaEngine
+
++ (instancetype)engineForServerURL:(NSString *)serverURL
+{
+    static NSMutableDictionary *engines;
+    NSString *key = serverURL ?: @"";
+    @synchronized(self) {
+        if (engines == nil) {
+            engines = [NSMutableDictionary dictionary];
+        }
+        AloomaEngine *engine = engines[key];
+        if (engine == nil) {
+            engine = [[self alloc] initWithServerURL:serverURL];
+            engines[key] = engine;
+        }
+        return engine;
+    }
+}
+
+- (instancetype)initWithServerURL:(NSString *)serverURL
+{
+    if (self = [super init]) {
+        _serverURL = [serverURL copy];
+        NSString *label = [NSString stringWithFormat:@"com.alooma.engine.%@.%p", [[NSURL URLWithString:serverURL] host], self];
+        // its own queue: flushes wait on the network, which must not hold up other engines
+        _serialQueue = dispatch_queue_create([label UTF8String], DISPATCH_QUEUE_SERIAL);
+        _attached = [NSHashTable weakObjectsHashTable];
+        _unclaimedEvents = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    [[NSNotificationCenter defaultCenter] removeObserver:self];
+#if !defined(ALOOMA_NO_REACHABILITY)
+    if (_reachability != NULL) {
+        SCNetworkReachabilitySetCallback(_reachability, NULL, NULL);
+        SCNetworkReachabilitySetDispatchQueue(_reachability, NULL);
+        CFRelease(_reachability);
+        _reachability = NULL;
+    }
+#endif
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<AloomaEngine: %p %@>", self, self.serverURL];
+}
+
+#pragma mark - Instances
+
+- (void)attachInstance:(Alooma *)alooma
+{
+    @synchronized(self) {
+        [self.attached addObject:alooma];
+    }
+}
+
+- (NSArray *)instances
+{
+    @synchronized(self) {
+        return [self.attached allObjects];
+    }
+}
+
+#pragma mark - Network
+
+#if !defined(ALOOMA_NO_TELEPHONY)
+// created on first use: it talks to the telephony daemon, which is too slow
+// for the launch path
+- (CTTelephonyNetworkInfo *)telephonyInfo
+{
+    @synchronized(self) {
+        if (_telephonyInfo == nil) {
+            _telephonyInfo = [[CTTelephonyNetworkInfo alloc] init];
+        }
+        return _telephonyInfo;
+    }
+}
+#endif
+
+- (void)startMonitoringNetwork
+{
+    @synchronized(self) {
+        if (_monitoring) {
+            return;
+        }
+        _monitoring = YES;
+    }
+
+#if !defined(ALOOMA_NO_REACHABILITY)
+    BOOL reachabilityOk = NO;
+    NSString *host = [[NSURL URLWithString:self.serverURL] host];
+    if ((_reachability = SCNetworkReachabilityCreateWithName(NULL, host.UTF8String)) != NULL) {
+        SCNetworkReachabilityContext context = {0, (__bridge void*)self, NULL, NULL, NULL};
+        if (SCNetworkReachabilitySetCallback(_reachability, AloomaEngineReachabilityCallback, &context)) {
+            if (SCNetworkReachabilitySetDispatchQueue(_reachability, self.serialQueue)) {
+                reachabilityOk = YES;
+                AloomaDebug(@"%@ successfully set up reachability callback", self);
+            } else {
+                // cleanup callback if setting dispatch queue failed
+                SCNetworkReachabilitySetCallback(_reachability, NULL, NULL);
+            }
+        }
+    }
+    if (!reachabilityOk) {
+        AloomaError(@"%@ failed to set up reachability callback: %s", self, SCErrorString(SCError()));
+    }
+#endif
+
+#if !defined(ALOOMA_NO_TELEPHONY) && __IPHONE_OS_VERSION_MAX_ALLOWED >= 70000
+    if (floor(NSFoundationVersionNumber) > NSFoundationVersionNumber_iOS_6_1) {
+        [self setCurrentRadio];
+        [[NSNotificationCenter defaultCenter] addObserver:self
+                                                 selector:@selector(setCurrentRadio)
+                                                     name:CTRadioAccessTechnologyDidChangeNotification
+                                                   object:nil];
+    }
+#endif
+}
+
+#if !defined(ALOOMA_NO_REACHABILITY)
+static void AloomaEngineReachabilityCallback(SCNetworkReachabilityRef target, SCNetworkReachabilityFlags flags, void *info)
+{
+    if (info != NULL && [(__bridge NSObject*)info isKindOfClass:[AloomaEngine class]]) {
+        @autoreleasepool {
+            AloomaEngine *engine = (__bridge AloomaEngine *)info;
+            [engine reachabilityChanged:flags];
+        }
+    } else {
+        AloomaError(@"reachability callback received unexpected info object");
+    }
+}
+
+// runs on the serial queue, see SCNetworkReachabilitySetDispatchQueue above
+- (void)reachabilityChanged:(SCNetworkReachabilityFlags)flags
+{
+    BOOL wifi = (flags & kSCNetworkReachabilityFlagsReachable) && !(flags & kSCNetworkReachabilityFlagsIsWWAN);
+    [self setAutomaticProperty:@"$wifi" value:wifi ? @YES : @NO];
+    AloomaDebug(@"%@ reachability changed, wifi=%d", self, wifi);
+}
+#endif
+
+#if !defined(ALOOMA_NO_TELEPHONY)
+- (void)setCurrentRadio
+{
+    dispatch_async(self.serialQueue, ^{
+        [self setAutomaticProperty:@"$radio" value:[self currentRadio]];
+    });
+}
+
+- (NSString *)currentRadio
+{
+    NSString *radio = self.telephonyInfo.currentRadioAccessTechnology;
+    if (!radio) {
+        radio = @"None";
+    } else if ([radio hasPrefix:@"CTRadioAccessTechnology"]) {
+        radio = [radio substringFromIndex:23];
+    }
+    return radio;
+}
+#endif
+
+// must be called on the serial queue
+- (void)setAutomaticProperty:(NSString *)key value:(id)value
+{
+    NSMutableDictionary *properties = [NSMutableDictionary dictionaryWithDictionary:self.automaticProperties];
+    properties[key] = value;
+    self.automaticProperties = [properties copy];
+}
+
+#pragma mark - Persistence
+
+- (NSString *)eventsFilePath
+{
+    // one archive per server, named after a digest since URLs are not file names
+    NSData *url = [(self.serverURL ?: @"") dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA1_DIGEST_LENGTH];
+    CC_SHA1([url bytes], (CC_LONG)[url length], digest);
+    NSMutableString *name = [NSMutableString stringWithString:@"alooma-engine-"];
+    for (int i = 0; i < 8; i++) {
+        [name appendFormat:@"%02x", digest[i]];
+    }
+    [name appendString:@"-events.plist"];
+    return [[NSSearchPathForDirectoriesInDomains(NSLibraryDirectory, NSUserDomainMask, YES) lastObject]
+            stringByAppendingPathComponent:name];
+}
+
+// must be called while holding the lock on self
+- (void)loadArchiveIfNeeded
+{
+    if (_archiveLoaded) {
+        return;
+    }
+    _archiveLoaded = YES;
+#if !defined(ALOOMA_NO_PERSISTENCE)
+    NSString *filePath = [self eventsFilePath];
+    id archived = nil;
+    @try {
+        archived = [NSKeyedUnarchiver unarchiveObjectWithFile:filePath];
+    }
+    @catch (NSException *exception) {
+        AloomaError(@"%@ unable to unarchive data in %@, starting fresh", self, filePath);
+    }
+    if ([archived isKindOfClass:[NSDictionary class]]) {
+        [self.unclaimedEvents addEntriesFromDictionary:archived];
+    }
+    if ([[NSFileManager defaultManager] fileExistsAtPath:filePath]) {
+        NSError *error;
+        if (![[NSFileManager defaultManager] removeItemAtPath:filePath error:&error]) {
+            AloomaError(@"%@ unable to remove archived file at %@ - %@", self, filePath, error);
+        }
+    }
+#endif
+}
+
+- (NSArray *)claimArchivedEventsForToken:(NSString *)token
+{
+    @synchronized(self) {
+        [self loadArchiveIfNeeded];
+        NSArray *events = self.unclaimedEvents[token ?: @""];
+        [self.unclaimedEvents removeObjectForKey:token ?: @""];
+        return [events isKindOfClass:[NSArray class]] ? events : @[];
+    }
+}
+
+- (NSUInteger)archiveEventQueues:(NSDictionary *)queues
+{
+#if defined(ALOOMA_NO_PERSISTENCE)
+    return 0;
+#else
+    NSMutableDictionary *archive;
+    @synchronized(self) {
+        [self loadArchiveIfNeeded];
+        archive = [NSMutableDictionary dictionaryWithDictionary:self.unclaimedEvents];
+    }
+    [archive addEntriesFromDictionary:queues];
+    NSString *filePath = [self eventsFilePath];
+    AloomaDebug(@"%@ archiving events of %lu tokens to %@", self, (unsigned long)[archive count], filePath);
+    NSData *data = [NSKeyedArchiver archivedDataWithRootObject:archive];
+    if (![data writeToFile:filePath atomically:YES]) {
+        AloomaError(@"%@ unable to archive events data", self);
+        return 0;
+    }
+    return [data length];
+#endif
+}
+
+@end
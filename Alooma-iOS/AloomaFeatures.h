@@ -0,0 +1,61 @@
+//
+//  AloomaFeatures.h
+//  Alooma-iOS
+//
+//  Compile-time feature switches. Defining one of these in the build
+//  (GCC_PREPROCESSOR_DEFINITIONS, or -D) leaves the feature out of the
+//  binary, along with the framework or library it needs:
+//
+//    ALOOMA_NO_TELEPHONY       no $carrier or $radio; no CoreTelephony
+//    ALOOMA_NO_REACHABILITY    no $wifi; no SystemConfiguration
+//    ALOOMA_NO_IFA             no $ios_ifa, and the vendor identifier is the
+//                              default distinct id
+//    ALOOMA_NO_PERSISTENCE     queues, super properties and caches are only
+//                              kept in memory; nothing is read or written
+//    ALOOMA_MINIMAL_TRANSPORT  plain uploads only: no gzip bodies (no zlib)
+//                              and no remote configuration
+//
+//  ALOOMA_LITE turns on all of them. ALOOMA_APP_EXTENSION, which drops the
+//  UIApplication listeners that start network monitoring, implies
+//  ALOOMA_NO_REACHABILITY and ALOOMA_NO_TELEPHONY. MIXPANEL_NO_IFA is still
+//  accepted for ALOOMA_NO_IFA. The public API is the same in every
+//  configuration; settings for a feature that is compiled out are ignored.
+//  Benchmarks/feature_matrix.py builds each one and reports its size and
+//  load time.
+//
+
+#ifndef AloomaFeatures_h
+#define AloomaFeatures_h
+
+#if defined(ALOOMA_LITE)
+#ifndef ALOOMA_NO_TELEPHONY
+#define ALOOMA_NO_TELEPHONY 1
+#endif
+#ifndef ALOOMA_NO_REACHABILITY
+#define ALOOMA_NO_REACHABILITY 1
+#endif
+#ifndef ALOOMA_NO_IFA
+#define ALOOMA_NO_IFA 1
+#endif
+#ifndef ALOOMA_NO_PERSISTENCE
+#define ALOOMA_NO_PERSISTENCE 1
+#endif
+#ifndef ALOOMA_MINIMAL_TRANSPORT
+#define ALOOMA_MINIMAL_TRANSPORT 1
+#endif
+#endif
+
+#if defined(ALOOMA_APP_EXTENSION)
+#ifndef ALOOMA_NO_TELEPHONY
+#define ALOOMA_NO_TELEPHONY 1
+#endif
+#ifndef ALOOMA_NO_REACHABILITY
+#define ALOOMA_NO_REACHABILITY 1
+#endif
+#endif
+
+#if defined(MIXPANEL_NO_IFA) && !defined(ALOOMA_NO_IFA)
+#define ALOOMA_NO_IFA 1
+#endif
+
+#endif /* AloomaFeatures_h */
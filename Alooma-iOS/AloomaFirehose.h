@@ -0,0 +1,102 @@
+#import <Foundation/Foundation.h>
+
+/*!
+ @class
+ High-frequency record channel.
+
+ @abstract
+ Records fixed-layout numeric samples without building an event dictionary
+ per sample.
+
+ @discussion
+ Obtain a firehose from <code>-[Alooma firehoseWithName:fields:capacity:]</code>
+ and append one C array of doubles per sample, in the order of the registered
+ fields. Records are kept in a preallocated ring; when the ring is full the
+ oldest record is overwritten. On every flush the pending records are drained
+ and uploaded as columnar blocks through the regular <code>/track/</code>
+ pipeline, one <code>$firehose</code> event per block.
+
+ Appending is thread safe and does not allocate.
+
+ <pre>
+ AloomaFirehose *motion = [alooma firehoseWithName:@"motion"
+                                            fields:@[@"x", @"y", @"z"]
+                                          capacity:6000];
+ double sample[3] = {data.acceleration.x, data.acceleration.y, data.acceleration.z};
+ [motion appendValues:sample];
+ </pre>
+ */
+@interface AloomaFirehose : NSObject
+
+/*!
+ @property
+
+ @abstract
+ Name of the firehose, sent as the <code>firehose</code> property of each block.
+ */
+@property (nonatomic, readonly, copy) NSString *name;
+
+/*!
+ @property
+
+ @abstract
+ Field names, in the order values are appended.
+ */
+@property (nonatomic, readonly, copy) NSArray *fields;
+
+/*!
+ @property
+
+ @abstract
+ Number of records the ring holds before the oldest ones are overwritten.
+ */
+@property (nonatomic, readonly) NSUInteger capacity;
+
+/*!
+ @property
+
+ @abstract
+ Number of records waiting to be uploaded.
+ */
+@property (nonatomic, readonly) NSUInteger pendingCount;
+
+- (instancetype)initWithName:(NSString *)name fields:(NSArray *)fields capacity:(NSUInteger)capacity;
+
+/*!
+ @method
+
+ @abstract
+ Appends one record stamped with the current time.
+
+ @param values          C array holding one value per field
+ */
+- (void)appendValues:(const double *)values;
+
+/*!
+ @method
+
+ @abstract
+ Appends one record with an explicit timestamp.
+
+ @param values          C array holding one value per field
+ @param timestamp       seconds since 1970
+ */
+- (void)appendValues:(const double *)values timestamp:(NSTimeInterval)timestamp;
+
+/*!
+ @method
+
+ @abstract
+ Removes all pending records and returns them as block property dictionaries.
+
+ @discussion
+ Each block holds at most <code>maxRecords</code> records. Timestamps are
+ encoded as little-endian uint32 millisecond offsets from <code>t0</code>,
+ and each field as a little-endian float64 column, all base64 encoded. This is
+ called by <code>Alooma</code> when flushing; you do not need to call it.
+
+ @param maxRecords      maximum number of records per block
+ */
+- (NSArray *)drainBlocksWithMaxRecords:(NSUInteger)maxRecords;
+
+@end
@@ -0,0 +1,121 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import "AloomaClock.h"
+#import "AloomaFirehose.h"
+#import "AloomaFirehoseBuffer.h"
+#import "NSData+AloomaBase64.h"
+
+@interface AloomaFirehose ()
+{
+    AloomaFirehoseBuffer *_buffer;
+}
+
+@end
+
+@implementation AloomaFirehose
+
+- (instancetype)initWithName:(NSString *)name fields:(NSArray *)fields capacity:(NSUInteger)capacity
+{
+    if (self = [super init]) {
+        _name = [name copy];
+        _fields = [fields copy];
+        _capacity = capacity;
+        _buffer = AloomaFirehoseBufferCreate([fields count], capacity);
+        if (_buffer == NULL) {
+            return nil;
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    AloomaFirehoseBufferDestroy(_buffer);
+}
+
+- (NSUInteger)pendingCount
+{
+    return AloomaFirehoseBufferCount(_buffer);
+}
+
+- (void)appendValues:(const double *)values
+{
+    AloomaFirehoseBufferAppend(_buffer, AloomaClockNow(), values);
+}
+
+- (void)appendValues:(const double *)values timestamp:(NSTimeInterval)timestamp
+{
+    AloomaFirehoseBufferAppend(_buffer, timestamp, values);
+}
+
+- (NSArray *)drainBlocksWithMaxRecords:(NSUInteger)maxRecords
+{
+    NSMutableArray *blocks = [NSMutableArray array];
+    if (maxRecords == 0) {
+        return blocks;
+    }
+    NSUInteger fieldCount = [self.fields count];
+    double *timestamps = malloc(sizeof(double) * maxRecords);
+    double *columns = malloc(sizeof(double) * maxRecords * fieldCount);
+    uint32_t *offsets = malloc(sizeof(uint32_t) * maxRecords);
+    uint64_t *packed = malloc(sizeof(uint64_t) * maxRecords);
+    if (!timestamps || !columns || !offsets || !packed) {
+        free(timestamps);
+        free(columns);
+        free(offsets);
+        free(packed);
+        return blocks;
+    }
+
+    // only drain what is pending now, so a busy producer cannot keep us here
+    size_t remaining = AloomaFirehoseBufferCount(_buffer);
+    uint64_t dropped = 0;
+    while (remaining > 0) {
+        // columns are laid out with a stride of chunk records
+        size_t chunk = MIN(maxRecords, remaining);
+        size_t n = AloomaFirehoseBufferDrain(_buffer, timestamps, columns, chunk, blocks.count == 0 ? &dropped : NULL);
+        if (n == 0) {
+            break;
+        }
+        remaining -= n;
+        double t0 = timestamps[0];
+        for (size_t i = 0; i < n; i++) {
+            double ms = round((timestamps[i] - t0) * 1000.0);
+            offsets[i] = CFSwapInt32HostToLittle(ms <= 0 ? 0 : (ms >= UINT32_MAX ? UINT32_MAX : (uint32_t)ms));
+        }
+        NSMutableDictionary *encodedColumns = [NSMutableDictionary dictionaryWithCapacity:fieldCount];
+        for (NSUInteger f = 0; f < fieldCount; f++) {
+            const double *column = columns + f * chunk;
+            for (size_t i = 0; i < n; i++) {
+                uint64_t bits;
+                memcpy(&bits, &column[i], sizeof(bits));
+                packed[i] = CFSwapInt64HostToLittle(bits);
+            }
+            NSData *data = [NSData dataWithBytesNoCopy:packed length:sizeof(uint64_t) * n freeWhenDone:NO];
+            encodedColumns[[self.fields[f] description]] = [data mp_base64EncodedString];
+        }
+        NSData *offsetData = [NSData dataWithBytesNoCopy:offsets length:sizeof(uint32_t) * n freeWhenDone:NO];
+        NSMutableDictionary *block = [NSMutableDictionary dictionary];
+        block[@"firehose"] = self.name;
+        block[@"fields"] = self.fields;
+        block[@"record_count"] = @(n);
+        block[@"encoding"] = @"f64le";
+        block[@"t0"] = @(t0);
+        block[@"timestamps"] = [offsetData mp_base64EncodedString];
+        block[@"columns"] = encodedColumns;
+        if (blocks.count == 0 && dropped > 0) {
+            block[@"dropped_records"] = @(dropped);
+        }
+        [blocks addObject:block];
+    }
+
+    free(timestamps);
+    free(columns);
+    free(offsets);
+    free(packed);
+    return blocks;
+}
+
+@end
@@ -0,0 +1,120 @@
+//
+//  AloomaFirehoseBuffer.c
+//  Alooma-iOS
+//
+
+#include "AloomaFirehoseBuffer.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct AloomaFirehoseBuffer {
+    pthread_mutex_t lock;
+    size_t fieldCount;
+    size_t stride;      // doubles per record: timestamp followed by the fields
+    size_t capacity;
+    size_t head;        // index of the oldest record
+    size_t count;
+    uint64_t dropped;
+    double *records;
+};
+
+AloomaFirehoseBuffer *AloomaFirehoseBufferCreate(size_t fieldCount, size_t capacity)
+{
+    if (fieldCount == 0 || capacity == 0) {
+        return NULL;
+    }
+    AloomaFirehoseBuffer *buffer = calloc(1, sizeof(AloomaFirehoseBuffer));
+    if (buffer == NULL) {
+        return NULL;
+    }
+    buffer->fieldCount = fieldCount;
+    buffer->stride = fieldCount + 1;
+    buffer->capacity = capacity;
+    buffer->records = malloc(sizeof(double) * buffer->stride * capacity);
+    if (buffer->records == NULL) {
+        free(buffer);
+        return NULL;
+    }
+    pthread_mutex_init(&buffer->lock, NULL);
+    return buffer;
+}
+
+void AloomaFirehoseBufferDestroy(AloomaFirehoseBuffer *buffer)
+{
+    if (buffer == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&buffer->lock);
+    free(buffer->records);
+    free(buffer);
+}
+
+size_t AloomaFirehoseBufferFieldCount(const AloomaFirehoseBuffer *buffer)
+{
+    return buffer->fieldCount;
+}
+
+size_t AloomaFirehoseBufferCapacity(const AloomaFirehoseBuffer *buffer)
+{
+    return buffer->capacity;
+}
+
+size_t AloomaFirehoseBufferCount(AloomaFirehoseBuffer *buffer)
+{
+    pthread_mutex_lock(&buffer->lock);
+    size_t count = buffer->count;
+    pthread_mutex_unlock(&buffer->lock);
+    return count;
+}
+
+int AloomaFirehoseBufferAppend(AloomaFirehoseBuffer *buffer, double timestamp, const double *values)
+{
+    int overwrote = 0;
+    pthread_mutex_lock(&buffer->lock);
+    size_t slot = buffer->head + buffer->count;
+    if (slot >= buffer->capacity) {
+        slot -= buffer->capacity;
+    }
+    if (buffer->count == buffer->capacity) {
+        // full: the slot we are about to write is the oldest record
+        buffer->head = (buffer->head + 1 == buffer->capacity) ? 0 : buffer->head + 1;
+        buffer->dropped++;
+        overwrote = 1;
+    } else {
+        buffer->count++;
+    }
+    double *record = buffer->records + slot * buffer->stride;
+    record[0] = timestamp;
+    memcpy(record + 1, values, sizeof(double) * buffer->fieldCount);
+    pthread_mutex_unlock(&buffer->lock);
+    return overwrote;
+}
+
+size_t AloomaFirehoseBufferDrain(AloomaFirehoseBuffer *buffer,
+                                 double *timestamps,
+                                 double *columns,
+                                 size_t maxRecords,
+                                 uint64_t *dropped)
+{
+    pthread_mutex_lock(&buffer->lock);
+    size_t n = buffer->count < maxRecords ? buffer->count : maxRecords;
+    size_t slot = buffer->head;
+    for (size_t i = 0; i < n; i++) {
+        const double *record = buffer->records + slot * buffer->stride;
+        timestamps[i] = record[0];
+        for (size_t f = 0; f < buffer->fieldCount; f++) {
+            columns[f * maxRecords + i] = record[f + 1];
+        }
+        slot = (slot + 1 == buffer->capacity) ? 0 : slot + 1;
+    }
+    buffer->head = slot;
+    buffer->count -= n;
+    if (dropped != NULL) {
+        *dropped = buffer->dropped;
+        buffer->dropped = 0;
+    }
+    pthread_mutex_unlock(&buffer->lock);
+    return n;
+}
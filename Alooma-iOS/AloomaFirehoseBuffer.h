@@ -0,0 +1,48 @@
+//
+//  AloomaFirehoseBuffer.h
+//  Alooma-iOS
+//
+//  Preallocated ring of fixed-layout records backing AloomaFirehose. Plain C
+//  so it can be benchmarked outside of Foundation (see Benchmarks/).
+//
+
+#ifndef AloomaFirehoseBuffer_h
+#define AloomaFirehoseBuffer_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AloomaFirehoseBuffer AloomaFirehoseBuffer;
+
+// Returns NULL if fieldCount or capacity is 0, or if allocation fails.
+AloomaFirehoseBuffer *AloomaFirehoseBufferCreate(size_t fieldCount, size_t capacity);
+void AloomaFirehoseBufferDestroy(AloomaFirehoseBuffer *buffer);
+
+size_t AloomaFirehoseBufferFieldCount(const AloomaFirehoseBuffer *buffer);
+size_t AloomaFirehoseBufferCapacity(const AloomaFirehoseBuffer *buffer);
+size_t AloomaFirehoseBufferCount(AloomaFirehoseBuffer *buffer);
+
+// Copies one record (fieldCount values) into the ring. When the ring is full
+// the oldest record is overwritten, matching the drop-oldest behaviour of the
+// events queue. Returns 1 if a record was overwritten, 0 otherwise.
+int AloomaFirehoseBufferAppend(AloomaFirehoseBuffer *buffer, double timestamp, const double *values);
+
+// Moves up to maxRecords of the oldest records out of the ring, transposed
+// into columns: timestamps[i] and columns[field * maxRecords + i]. Returns
+// the number of records moved. If dropped is not NULL it receives the number
+// of records overwritten since the previous drain.
+size_t AloomaFirehoseBufferDrain(AloomaFirehoseBuffer *buffer,
+                                 double *timestamps,
+                                 double *columns,
+                                 size_t maxRecords,
+                                 uint64_t *dropped);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,403 @@
+//
+//  AloomaHamt.c
+//  Alooma-iOS
+//
+
+#include "AloomaHamt.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kBitsPerLevel 5
+#define kFanout 32
+// levels 0-12 consume the 64-bit hash; keys still together below that collide
+#define kMaxLevel 12
+
+typedef struct AloomaHamtNode AloomaHamtNode;
+
+struct AloomaHamtNode {
+    atomic_size_t refs;
+    uint32_t dataMap;
+    uint32_t nodeMap;
+    uint32_t collisions;    // entry count of a collision node, which has no bitmaps
+    const void *slots[];    // key/value pairs, then child nodes
+};
+
+struct AloomaHamt {
+    atomic_size_t refs;
+    size_t count;
+    const AloomaHamtCallbacks *callbacks;
+    AloomaHamtNode *root;
+};
+
+static inline unsigned AloomaPopCount(uint32_t x)
+{
+    return (unsigned)__builtin_popcount(x);
+}
+
+static inline unsigned AloomaFragment(uint64_t hash, unsigned level)
+{
+    return (unsigned)(hash >> (level * kBitsPerLevel)) & (kFanout - 1);
+}
+
+static inline unsigned AloomaSlotIndex(uint32_t bitmap, uint32_t bit)
+{
+    return AloomaPopCount(bitmap & (bit - 1));
+}
+
+static inline unsigned AloomaDataCount(const AloomaHamtNode *node)
+{
+    return node->collisions ? node->collisions : AloomaPopCount(node->dataMap);
+}
+
+static inline unsigned AloomaChildCount(const AloomaHamtNode *node)
+{
+    return node->collisions ? 0 : AloomaPopCount(node->nodeMap);
+}
+
+static inline AloomaHamtNode *AloomaChild(const AloomaHamtNode *node, unsigned index)
+{
+    return (AloomaHamtNode *)node->slots[2 * AloomaDataCount(node) + index];
+}
+
+static AloomaHamtNode *AloomaNodeRetain(AloomaHamtNode *node)
+{
+    atomic_fetch_add_explicit(&node->refs, 1, memory_order_relaxed);
+    return node;
+}
+
+static void AloomaNodeRelease(const AloomaHamtCallbacks *callbacks, AloomaHamtNode *node)
+{
+    if (atomic_fetch_sub_explicit(&node->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    unsigned dataCount = AloomaDataCount(node);
+    if (callbacks->release) {
+        for (unsigned i = 0; i < 2 * dataCount; i++) {
+            callbacks->release(node->slots[i]);
+        }
+    }
+    for (unsigned i = 0; i < AloomaChildCount(node); i++) {
+        AloomaNodeRelease(callbacks, AloomaChild(node, i));
+    }
+    free(node);
+}
+
+// Copies the entries and children into a new node and takes a reference on
+// each of them. Returns NULL if allocation fails.
+static AloomaHamtNode *AloomaNodeCreate(const AloomaHamtCallbacks *callbacks, uint32_t dataMap, uint32_t nodeMap,
+                                        uint32_t collisions, const void **entries, unsigned entryCount,
+                                        AloomaHamtNode **children, unsigned childCount)
+{
+    AloomaHamtNode *node = malloc(sizeof(AloomaHamtNode) + sizeof(void *) * (2 * entryCount + childCount));
+    if (node == NULL) {
+        return NULL;
+    }
+    atomic_init(&node->refs, 1);
+    node->dataMap = dataMap;
+    node->nodeMap = nodeMap;
+    node->collisions = collisions;
+    for (unsigned i = 0; i < 2 * entryCount; i++) {
+        node->slots[i] = entries[i];
+        if (callbacks->retain) {
+            callbacks->retain(entries[i]);
+        }
+    }
+    for (unsigned i = 0; i < childCount; i++) {
+        node->slots[2 * entryCount + i] = AloomaNodeRetain(children[i]);
+    }
+    return node;
+}
+
+static AloomaHamtNode *AloomaNodeMerge(const AloomaHamtCallbacks *callbacks, unsigned level,
+                                       const void *key1, const void *value1, uint64_t hash1,
+                                       const void *key2, const void *value2, uint64_t hash2)
+{
+    if (level > kMaxLevel) {
+        const void *entries[4] = {key1, value1, key2, value2};
+        return AloomaNodeCreate(callbacks, 0, 0, 2, entries, 2, NULL, 0);
+    }
+    unsigned fragment1 = AloomaFragment(hash1, level);
+    unsigned fragment2 = AloomaFragment(hash2, level);
+    if (fragment1 != fragment2) {
+        const void *entries[4];
+        int first = fragment1 < fragment2;
+        entries[first ? 0 : 2] = key1;
+        entries[first ? 1 : 3] = value1;
+        entries[first ? 2 : 0] = key2;
+        entries[first ? 3 : 1] = value2;
+        return AloomaNodeCreate(callbacks, (1u << fragment1) | (1u << fragment2), 0, 0, entries, 2, NULL, 0);
+    }
+    AloomaHamtNode *child = AloomaNodeMerge(callbacks, level + 1, key1, value1, hash1, key2, value2, hash2);
+    if (child == NULL) {
+        return NULL;
+    }
+    AloomaHamtNode *node = AloomaNodeCreate(callbacks, 0, 1u << fragment1, 0, NULL, 0, &child, 1);
+    AloomaNodeRelease(callbacks, child);
+    return node;
+}
+
+static AloomaHamtNode *AloomaCollisionSet(const AloomaHamtCallbacks *callbacks, AloomaHamtNode *node,
+                                          const void *key, const void *value, int *added)
+{
+    unsigned count = node->collisions;
+    const void **entries = malloc(sizeof(void *) * 2 * (count + 1));
+    if (entries == NULL) {
+        return NULL;
+    }
+    memcpy(entries, node->slots, sizeof(void *) * 2 * count);
+    unsigned i = 0;
+    while (i < count && !callbacks->equal(entries[2 * i], key)) {
+        i++;
+    }
+    if (i == count) {
+        count++;
+        *added = 1;
+    }
+    entries[2 * i] = key;
+    entries[2 * i + 1] = value;
+    AloomaHamtNode *result = AloomaNodeCreate(callbacks, 0, 0, count, entries, count, NULL, 0);
+    free(entries);
+    return result;
+}
+
+static AloomaHamtNode *AloomaNodeSet(const AloomaHamtCallbacks *callbacks, AloomaHamtNode *node, unsigned level,
+                                     uint64_t hash, const void *key, const void *value, int *added)
+{
+    if (node->collisions) {
+        return AloomaCollisionSet(callbacks, node, key, value, added);
+    }
+    uint32_t bit = 1u << AloomaFragment(hash, level);
+    unsigned dataCount = AloomaPopCount(node->dataMap);
+    unsigned childCount = AloomaPopCount(node->nodeMap);
+    const void *entries[2 * kFanout];
+    AloomaHamtNode *children[kFanout];
+    memcpy(entries, node->slots, sizeof(void *) * 2 * dataCount);
+    memcpy(children, &node->slots[2 * dataCount], sizeof(void *) * childCount);
+
+    if (node->dataMap & bit) {
+        unsigned i = AloomaSlotIndex(node->dataMap, bit);
+        if (callbacks->equal(entries[2 * i], key)) {
+            entries[2 * i + 1] = value;
+            return AloomaNodeCreate(callbacks, node->dataMap, node->nodeMap, 0, entries, dataCount, children, childCount);
+        }
+        // two keys share this slot: push both one level down
+        AloomaHamtNode *child = AloomaNodeMerge(callbacks, level + 1, entries[2 * i], entries[2 * i + 1],
+                                                callbacks->hash(entries[2 * i]), key, value, hash);
+        if (child == NULL) {
+            return NULL;
+        }
+        memmove(&entries[2 * i], &entries[2 * i + 2], sizeof(void *) * 2 * (dataCount - i - 1));
+        unsigned j = AloomaSlotIndex(node->nodeMap, bit);
+        memmove(&children[j + 1], &children[j], sizeof(void *) * (childCount - j));
+        children[j] = child;
+        *added = 1;
+        AloomaHamtNode *result = AloomaNodeCreate(callbacks, node->dataMap & ~bit, node->nodeMap | bit, 0,
+                                                  entries, dataCount - 1, children, childCount + 1);
+        AloomaNodeRelease(callbacks, child);
+        return result;
+    }
+
+    if (node->nodeMap & bit) {
+        unsigned j = AloomaSlotIndex(node->nodeMap, bit);
+        AloomaHamtNode *child = AloomaNodeSet(callbacks, children[j], level + 1, hash, key, value, added);
+        if (child == NULL) {
+            return NULL;
+        }
+        children[j] = child;
+        AloomaHamtNode *result = AloomaNodeCreate(callbacks, node->dataMap, node->nodeMap, 0,
+                                                  entries, dataCount, children, childCount);
+        AloomaNodeRelease(callbacks, child);
+        return result;
+    }
+
+    unsigned i = AloomaSlotIndex(node->dataMap, bit);
+    memmove(&entries[2 * i + 2], &entries[2 * i], sizeof(void *) * 2 * (dataCount - i));
+    entries[2 * i] = key;
+    entries[2 * i + 1] = value;
+    *added = 1;
+    return AloomaNodeCreate(callbacks, node->dataMap | bit, node->nodeMap, 0, entries, dataCount + 1, children, childCount);
+}
+
+static AloomaHamtNode *AloomaCollisionRemove(const AloomaHamtCallbacks *callbacks, AloomaHamtNode *node,
+                                             const void *key, int *removed)
+{
+    unsigned count = node->collisions;
+    unsigned i = 0;
+    while (i < count && !callbacks->equal(node->slots[2 * i], key)) {
+        i++;
+    }
+    if (i == count) {
+        return AloomaNodeRetain(node);
+    }
+    const void **entries = malloc(sizeof(void *) * 2 * count);
+    if (entries == NULL) {
+        return NULL;
+    }
+    memcpy(entries, node->slots, sizeof(void *) * 2 * i);
+    memcpy(&entries[2 * i], &node->slots[2 * i + 2], sizeof(void *) * 2 * (count - i - 1));
+    *removed = 1;
+    // a single remaining entry is pulled up into the parent by the caller
+    AloomaHamtNode *result = AloomaNodeCreate(callbacks, 0, 0, count - 1, entries, count - 1, NULL, 0);
+    free(entries);
+    return result;
+}
+
+static AloomaHamtNode *AloomaNodeRemove(const AloomaHamtCallbacks *callbacks, AloomaHamtNode *node, unsigned level,
+                                        uint64_t hash, const void *key, int *removed)
+{
+    if (node->collisions) {
+        return AloomaCollisionRemove(callbacks, node, key, removed);
+    }
+    uint32_t bit = 1u << AloomaFragment(hash, level);
+    unsigned dataCount = AloomaPopCount(node->dataMap);
+    unsigned childCount = AloomaPopCount(node->nodeMap);
+    const void *entries[2 * kFanout];
+    AloomaHamtNode *children[kFanout];
+    memcpy(entries, node->slots, sizeof(void *) * 2 * dataCount);
+    memcpy(children, &node->slots[2 * dataCount], sizeof(void *) * childCount);
+
+    if (node->dataMap & bit) {
+        unsigned i = AloomaSlotIndex(node->dataMap, bit);
+        if (!callbacks->equal(entries[2 * i], key)) {
+            return AloomaNodeRetain(node);
+        }
+        memmove(&entries[2 * i], &entries[2 * i + 2], sizeof(void *) * 2 * (dataCount - i - 1));
+        *removed = 1;
+        return AloomaNodeCreate(callbacks, node->dataMap & ~bit, node->nodeMap, 0, entries, dataCount - 1, children, childCount);
+    }
+
+    if (node->nodeMap & bit) {
+        unsigned j = AloomaSlotIndex(node->nodeMap, bit);
+        AloomaHamtNode *child = AloomaNodeRemove(callbacks, children[j], level + 1, hash, key, removed);
+        if (child == NULL) {
+            return NULL;
+        }
+        if (!*removed) {
+            AloomaNodeRelease(callbacks, child);
+            return AloomaNodeRetain(node);
+        }
+        AloomaHamtNode *result;
+        if (AloomaDataCount(child) == 1 && AloomaChildCount(child) == 0) {
+            // keep the trie canonical: a lone entry lives in its parent
+            memmove(&children[j], &children[j + 1], sizeof(void *) * (childCount - j - 1));
+            unsigned i = AloomaSlotIndex(node->dataMap | bit, bit);
+            memmove(&entries[2 * i + 2], &entries[2 * i], sizeof(void *) * 2 * (dataCount - i));
+            entries[2 * i] = child->slots[0];
+            entries[2 * i + 1] = child->slots[1];
+            result = AloomaNodeCreate(callbacks, node->dataMap | bit, node->nodeMap & ~bit, 0,
+                                      entries, dataCount + 1, children, childCount - 1);
+        } else {
+            children[j] = child;
+            result = AloomaNodeCreate(callbacks, node->dataMap, node->nodeMap, 0, entries, dataCount, children, childCount);
+        }
+        AloomaNodeRelease(callbacks, child);
+        return result;
+    }
+
+    return AloomaNodeRetain(node);
+}
+
+static AloomaHamt *AloomaHamtWrap(const AloomaHamtCallbacks *callbacks, AloomaHamtNode *root, size_t count)
+{
+    AloomaHamt *map = malloc(sizeof(AloomaHamt));
+    if (map == NULL) {
+        AloomaNodeRelease(callbacks, root);
+        return NULL;
+    }
+    atomic_init(&map->refs, 1);
+    map->count = count;
+    map->callbacks = callbacks;
+    map->root = root;
+    return map;
+}
+
+AloomaHamt *AloomaHamtCreate(const AloomaHamtCallbacks *callbacks)
+{
+    AloomaHamtNode *root = AloomaNodeCreate(callbacks, 0, 0, 0, NULL, 0, NULL, 0);
+    return root ? AloomaHamtWrap(callbacks, root, 0) : NULL;
+}
+
+AloomaHamt *AloomaHamtRetain(AloomaHamt *map)
+{
+    atomic_fetch_add_explicit(&map->refs, 1, memory_order_relaxed);
+    return map;
+}
+
+void AloomaHamtRelease(AloomaHamt *map)
+{
+    if (map == NULL || atomic_fetch_sub_explicit(&map->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+    AloomaNodeRelease(map->callbacks, map->root);
+    free(map);
+}
+
+size_t AloomaHamtCount(const AloomaHamt *map)
+{
+    return map->count;
+}
+
+const void *AloomaHamtGet(const AloomaHamt *map, const void *key)
+{
+    const AloomaHamtCallbacks *callbacks = map->callbacks;
+    uint64_t hash = callbacks->hash(key);
+    const AloomaHamtNode *node = map->root;
+    for (unsigned level = 0; ; level++) {
+        if (node->collisions) {
+            for (unsigned i = 0; i < node->collisions; i++) {
+                if (callbacks->equal(node->slots[2 * i], key)) {
+                    return node->slots[2 * i + 1];
+                }
+            }
+            return NULL;
+        }
+        uint32_t bit = 1u << AloomaFragment(hash, level);
+        if (node->dataMap & bit) {
+            unsigned i = AloomaSlotIndex(node->dataMap, bit);
+            return callbacks->equal(node->slots[2 * i], key) ? node->slots[2 * i + 1] : NULL;
+        }
+        if (!(node->nodeMap & bit)) {
+            return NULL;
+        }
+        node = AloomaChild(node, AloomaSlotIndex(node->nodeMap, bit));
+    }
+}
+
+AloomaHamt *AloomaHamtSet(AloomaHamt *map, const void *key, const void *value)
+{
+    int added = 0;
+    AloomaHamtNode *root = AloomaNodeSet(map->callbacks, map->root, 0, map->callbacks->hash(key), key, value, &added);
+    return root ? AloomaHamtWrap(map->callbacks, root, map->count + added) : NULL;
+}
+
+AloomaHamt *AloomaHamtRemove(AloomaHamt *map, const void *key)
+{
+    int removed = 0;
+    AloomaHamtNode *root = AloomaNodeRemove(map->callbacks, map->root, 0, map->callbacks->hash(key), key, &removed);
+    if (root == NULL) {
+        return NULL;
+    }
+    if (!removed) {
+        AloomaNodeRelease(map->callbacks, root);
+        return AloomaHamtRetain(map);
+    }
+    return AloomaHamtWrap(map->callbacks, root, map->count - 1);
+}
+
+static void AloomaNodeForEach(const AloomaHamtNode *node, AloomaHamtApplier applier, void *context)
+{
+    unsigned dataCount = AloomaDataCount(node);
+    for (unsigned i = 0; i < dataCount; i++) {
+        applier(node->slots[2 * i], node->slots[2 * i + 1], context);
+    }
+    for (unsigned i = 0; i < AloomaChildCount(node); i++) {
+        AloomaNodeForEach(AloomaChild(node, i), applier, context);
+    }
+}
+
+void AloomaHamtForEach(const AloomaHamt *map, AloomaHamtApplier applier, void *context)
+{
+    AloomaNodeForEach(map->root, applier, context);
+}
@@ -0,0 +1,54 @@
+//
+//  AloomaHamt.h
+//  Alooma-iOS
+//
+//  Persistent (immutable, structurally shared) hash array mapped trie. Every
+//  update returns a new map that shares all untouched nodes with the old one,
+//  so updates cost O(log32 n) and a map can be handed to other threads as a
+//  snapshot without copying. Nodes use the compressed CHAMP layout: inline
+//  entries and child nodes are kept in separate bitmaps.
+//
+
+#ifndef AloomaHamt_h
+#define AloomaHamt_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint64_t (*hash)(const void *key);
+    int (*equal)(const void *a, const void *b);
+    // may be NULL when keys and values are not reference counted
+    void (*retain)(const void *object);
+    void (*release)(const void *object);
+} AloomaHamtCallbacks;
+
+typedef struct AloomaHamt AloomaHamt;
+
+// Functions returning a map return it retained; release it with
+// AloomaHamtRelease. Maps are immutable and may be shared between threads.
+// callbacks must outlive every map derived from the empty one.
+AloomaHamt *AloomaHamtCreate(const AloomaHamtCallbacks *callbacks);
+AloomaHamt *AloomaHamtRetain(AloomaHamt *map);
+void AloomaHamtRelease(AloomaHamt *map);
+
+size_t AloomaHamtCount(const AloomaHamt *map);
+// Returns NULL if the key is absent.
+const void *AloomaHamtGet(const AloomaHamt *map, const void *key);
+
+AloomaHamt *AloomaHamtSet(AloomaHamt *map, const void *key, const void *value);
+// Returns map itself, retained, if the key is absent.
+AloomaHamt *AloomaHamtRemove(AloomaHamt *map, const void *key);
+
+typedef void (*AloomaHamtApplier)(const void *key, const void *value, void *context);
+void AloomaHamtForEach(const AloomaHamt *map, AloomaHamtApplier applier, void *context);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,127 @@
+//
+//  AloomaLogRing.c
+//  Alooma-iOS
+//
+//  Vyukov's bounded queue: every cell carries a sequence number telling
+//  producers and consumers whose turn it is, so a push or pop is one CAS on
+//  a shared index plus a copy.
+//
+
+#include "AloomaLogRing.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    atomic_size_t sequence;
+} AloomaLogCell;
+
+struct AloomaLogRing {
+    size_t mask;
+    size_t recordSize;
+    size_t stride;
+    unsigned char *cells;
+    // producers and the consumer hammer different lines
+    _Alignas(64) atomic_size_t enqueue;
+    _Alignas(64) atomic_size_t dequeue;
+    _Alignas(64) atomic_uint_fast64_t dropped;
+};
+
+static inline AloomaLogCell *AloomaLogRingCell(const AloomaLogRing *ring, size_t position)
+{
+    return (AloomaLogCell *)(ring->cells + (position & ring->mask) * ring->stride);
+}
+
+AloomaLogRing *AloomaLogRingCreate(size_t capacity, size_t recordSize)
+{
+    if (capacity < 2 || recordSize == 0) {
+        return NULL;
+    }
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    AloomaLogRing *ring = calloc(1, sizeof(AloomaLogRing));
+    if (ring == NULL) {
+        return NULL;
+    }
+    ring->mask = size - 1;
+    ring->recordSize = recordSize;
+    ring->stride = (sizeof(AloomaLogCell) + recordSize + 7) & ~(size_t)7;
+    ring->cells = calloc(size, ring->stride);
+    if (ring->cells == NULL) {
+        free(ring);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; i++) {
+        atomic_init(&AloomaLogRingCell(ring, i)->sequence, i);
+    }
+    atomic_init(&ring->enqueue, 0);
+    atomic_init(&ring->dequeue, 0);
+    atomic_init(&ring->dropped, 0);
+    return ring;
+}
+
+void AloomaLogRingDestroy(AloomaLogRing *ring)
+{
+    if (ring == NULL) {
+        return;
+    }
+    free(ring->cells);
+    free(ring);
+}
+
+int AloomaLogRingPush(AloomaLogRing *ring, const void *record)
+{
+    size_t position = atomic_load_explicit(&ring->enqueue, memory_order_relaxed);
+    AloomaLogCell *cell;
+    while (1) {
+        cell = AloomaLogRingCell(ring, position);
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->enqueue, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return 0;
+        } else {
+            position = atomic_load_explicit(&ring->enqueue, memory_order_relaxed);
+        }
+    }
+    memcpy(cell + 1, record, ring->recordSize);
+    atomic_store_explicit(&cell->sequence, position + 1, memory_order_release);
+    return 1;
+}
+
+int AloomaLogRingPop(AloomaLogRing *ring, void *record)
+{
+    size_t position = atomic_load_explicit(&ring->dequeue, memory_order_relaxed);
+    AloomaLogCell *cell;
+    while (1) {
+        cell = AloomaLogRingCell(ring, position);
+        size_t sequence = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+        if (difference == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->dequeue, &position, position + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            return 0;
+        } else {
+            position = atomic_load_explicit(&ring->dequeue, memory_order_relaxed);
+        }
+    }
+    memcpy(record, cell + 1, ring->recordSize);
+    atomic_store_explicit(&cell->sequence, position + ring->mask + 1, memory_order_release);
+    return 1;
+}
+
+uint64_t AloomaLogRingDropped(const AloomaLogRing *ring)
+{
+    return atomic_load_explicit(&ring->dropped, memory_order_relaxed);
+}
@@ -0,0 +1,38 @@
+//
+//  AloomaLogRing.h
+//  Alooma-iOS
+//
+//  Bounded lock-free queue of fixed-size records, used by the logger to hand
+//  captured log calls from any thread to the thread that formats them.
+//
+
+#ifndef AloomaLogRing_h
+#define AloomaLogRing_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AloomaLogRing AloomaLogRing;
+
+// capacity is rounded up to a power of two; records are copied in and out by
+// value, recordSize bytes each.
+AloomaLogRing *AloomaLogRingCreate(size_t capacity, size_t recordSize);
+void AloomaLogRingDestroy(AloomaLogRing *ring);
+
+// Both are safe to call from any number of threads. Push returns 0 and
+// counts a drop when the ring is full; Pop returns 0 when it is empty.
+int AloomaLogRingPush(AloomaLogRing *ring, const void *record);
+int AloomaLogRingPop(AloomaLogRing *ring, void *record);
+
+// records rejected by Push because the ring was full
+uint64_t AloomaLogRingDropped(const AloomaLogRing *ring);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,33 +8,42 @@
 
 #import <UIKit/UIKit.h>
 
+#import "Alooma.h"
+
 #ifndef AloomaLogger_h
 #define AloomaLogger_h
 
-static inline void AloomaLog(NSString *format, ...) {
-    __block va_list arg_list;
-    va_start (arg_list, format);
-    NSString *formattedString = [[NSString alloc] initWithFormat:format arguments:arg_list];
-    va_end(arg_list);
-    NSLog(@"[Alooma] %@", formattedString);
+// Log calls only capture their arguments (objects are copied or retained,
+// C strings duplicated) into a lock-free ring; formatting and NSLog happen on
+// a background queue, or in AloomaLogFlush. The level is checked before any
+// argument is evaluated. ALOOMA_ERROR, ALOOMA_DEBUG and
+// ALOOMA_MESSAGING_DEBUG pick the initial level, ALOOMA_NO_LOGGING compiles
+// every call out.
+
+extern NSInteger AloomaLogThreshold;
+
+static inline BOOL AloomaLogEnabled(AloomaLogLevel level) {
+    return level <= __atomic_load_n(&AloomaLogThreshold, __ATOMIC_RELAXED);
 }
 
-#ifdef ALOOMA_ERROR
-#define AloomaError(...) AloomaLog(__VA_ARGS__)
-#else
-#define AloomaError(...)
-#endif
+void AloomaLogCapture(AloomaLogLevel level, NSString *format, ...) NS_FORMAT_FUNCTION(2,3);
+void AloomaLogSetLevel(AloomaLogLevel level);
+void AloomaLogSetHandler(void (^handler)(AloomaLogLevel level, NSDate *time, NSString *message));
+// formats and writes out everything captured so far, on the calling thread
+void AloomaLogFlush(void);
 
-#ifdef ALOOMA_DEBUG
-#define AloomaDebug(...) AloomaLog(__VA_ARGS__)
+#ifdef ALOOMA_NO_LOGGING
+#define AloomaLogAt(level, ...)
 #else
-#define AloomaDebug(...)
+#define AloomaLogAt(level, ...) do { \
+    if (AloomaLogEnabled(level)) { \
+        AloomaLogCapture(level, __VA_ARGS__); \
+    } \
+} while (0)
 #endif
 
-#ifdef ALOOMA_MESSAGING_DEBUG
-#define AloomaMessagingDebug(...) AloomaLog(__VA_ARGS__)
-#else
-#define AloomaMessagingDebug(...)
-#endif
+#define AloomaError(...) AloomaLogAt(AloomaLogLevelError, __VA_ARGS__)
+#define AloomaDebug(...) AloomaLogAt(AloomaLogLevelDebug, __VA_ARGS__)
+#define AloomaMessagingDebug(...) AloomaLogAt(AloomaLogLevelVerbose, __VA_ARGS__)
 
 #endif
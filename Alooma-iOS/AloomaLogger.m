@@ -0,0 +1,369 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#import "AloomaLogger.h"
+#import "AloomaLogRing.h"
+
+#if defined(ALOOMA_MESSAGING_DEBUG)
+NSInteger AloomaLogThreshold = AloomaLogLevelVerbose;
+#elif defined(ALOOMA_DEBUG)
+NSInteger AloomaLogThreshold = AloomaLogLevelDebug;
+#elif defined(ALOOMA_ERROR)
+NSInteger AloomaLogThreshold = AloomaLogLevelError;
+#else
+NSInteger AloomaLogThreshold = AloomaLogLevelNone;
+#endif
+
+#define kLogCapacity 512
+#define kMaxLogArguments 8
+
+typedef enum {
+    AloomaLogLiteralPercent,
+    AloomaLogUnsupported,
+    AloomaLogObject,
+    AloomaLogInt,
+    AloomaLogLong,
+    AloomaLogLongLong,
+    AloomaLogDouble,
+    AloomaLogCString,
+    AloomaLogPointer
+} AloomaLogKind;
+
+typedef struct {
+    AloomaLogKind kind;
+    union {
+        const void *object;  // retained
+        int i;
+        long l;
+        long long ll;
+        double d;
+        char *s;             // malloced
+        void *p;
+    } value;
+} AloomaLogArgument;
+
+typedef struct {
+    AloomaLogLevel level;
+    CFAbsoluteTime time;
+    const void *format;      // retained
+    int count;
+    AloomaLogArgument arguments[kMaxLogArguments];
+} AloomaLogRecord;
+
+typedef struct {
+    size_t start;
+    size_t end;
+    AloomaLogKind kind;
+} AloomaLogSpec;
+
+static AloomaLogRing *logRing;
+static dispatch_queue_t logQueue;
+static atomic_bool drainScheduled;
+static uint64_t reportedDrops;
+static NSObject *handlerLock;
+static void (^logHandler)(AloomaLogLevel, NSDate *, NSString *);
+
+// Finds the next conversion in a format string, from *cursor on. Anything
+// the lazy path cannot replay argument by argument (* widths, long doubles,
+// unichar strings) comes back as AloomaLogUnsupported.
+static BOOL AloomaLogNextSpec(const char *format, size_t *cursor, AloomaLogSpec *spec)
+{
+    const char *start = strchr(format + *cursor, '%');
+    if (start == NULL) {
+        return NO;
+    }
+    const char *c = start + 1;
+    BOOL unsupported = NO;
+    while (*c && strchr("-+ #0'", *c)) {
+        c++;
+    }
+    while (*c == '*' || (*c >= '0' && *c <= '9') || *c == '.' || *c == '$') {
+        unsupported = unsupported || *c == '*' || *c == '$';
+        c++;
+    }
+    int length = 0;  // 1 long, 2 long long, -1 long double
+    if (*c == 'h') {
+        c += c[1] == 'h' ? 2 : 1;
+    } else if (*c == 'l') {
+        length = c[1] == 'l' ? 2 : 1;
+        c += length;
+    } else if (*c == 'q' || *c == 'j') {
+        length = 2;
+        c++;
+    } else if (*c == 'z' || *c == 't') {
+        length = 1;
+        c++;
+    } else if (*c == 'L') {
+        length = -1;
+        c++;
+    }
+    AloomaLogKind kind;
+    switch (*c) {
+        case '%':
+            kind = AloomaLogLiteralPercent;
+            break;
+        case '@':
+            kind = AloomaLogObject;
+            break;
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c': case 'C':
+            kind = length == 2 ? AloomaLogLongLong : length == 1 ? AloomaLogLong : AloomaLogInt;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            kind = length == -1 ? AloomaLogUnsupported : AloomaLogDouble;
+            break;
+        case 's':
+            kind = length == 1 ? AloomaLogUnsupported : AloomaLogCString;
+            break;
+        case 'p':
+            kind = AloomaLogPointer;
+            break;
+        default:
+            kind = AloomaLogUnsupported;
+            break;
+    }
+    spec->start = (size_t)(start - format);
+    spec->end = (size_t)(c - format) + (*c ? 1 : 0);
+    spec->kind = unsupported ? AloomaLogUnsupported : kind;
+    *cursor = spec->end;
+    return YES;
+}
+
+static void AloomaLogReleaseRecord(AloomaLogRecord *record)
+{
+    for (int i = 0; i < record->count; i++) {
+        AloomaLogArgument *argument = &record->arguments[i];
+        if (argument->kind == AloomaLogObject && argument->value.object) {
+            CFRelease(argument->value.object);
+        } else if (argument->kind == AloomaLogCString) {
+            free(argument->value.s);
+        }
+    }
+    CFRelease(record->format);
+}
+
+// Pulls the arguments off the list; NO if the format needs eager formatting.
+static BOOL AloomaLogCaptureArguments(AloomaLogRecord *record, const char *format, va_list arguments)
+{
+    size_t cursor = 0;
+    AloomaLogSpec spec;
+    while (AloomaLogNextSpec(format, &cursor, &spec)) {
+        if (spec.kind == AloomaLogLiteralPercent) {
+            continue;
+        }
+        if (spec.kind == AloomaLogUnsupported || record->count == kMaxLogArguments) {
+            return NO;
+        }
+        AloomaLogArgument *argument = &record->arguments[record->count];
+        argument->kind = spec.kind;
+        switch (spec.kind) {
+            case AloomaLogObject: {
+                id object = va_arg(arguments, id);
+                // a copy, so that a mutable argument may change before it is printed
+                if ([object respondsToSelector:@selector(copyWithZone:)]) {
+                    object = [object copy];
+                }
+                argument->value.object = object ? CFBridgingRetain(object) : NULL;
+                break;
+            }
+            case AloomaLogInt:
+                argument->value.i = va_arg(arguments, int);
+                break;
+            case AloomaLogLong:
+                argument->value.l = va_arg(arguments, long);
+                break;
+            case AloomaLogLongLong:
+                argument->value.ll = va_arg(arguments, long long);
+                break;
+            case AloomaLogDouble:
+                argument->value.d = va_arg(arguments, double);
+                break;
+            case AloomaLogCString: {
+                const char *s = va_arg(arguments, const char *);
+                argument->value.s = strdup(s ? s : "(null)");
+                break;
+            }
+            case AloomaLogPointer:
+                argument->value.p = va_arg(arguments, void *);
+                break;
+            default:
+                return NO;
+        }
+        record->count++;
+    }
+    return YES;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wformat-nonliteral"
+
+static NSString *AloomaLogFormatRecord(const AloomaLogRecord *record)
+{
+    NSString *format = (__bridge NSString *)record->format;
+    const char *utf8 = [format UTF8String];
+    NSMutableString *message = [NSMutableString stringWithCapacity:[format length] + 32];
+    size_t cursor = 0;
+    size_t literal = 0;
+    int index = 0;
+    AloomaLogSpec spec;
+    while (AloomaLogNextSpec(utf8, &cursor, &spec)) {
+        if (spec.start > literal) {
+            [message appendString:[[NSString alloc] initWithBytes:utf8 + literal length:spec.start - literal encoding:NSUTF8StringEncoding]];
+        }
+        literal = spec.end;
+        if (spec.kind == AloomaLogLiteralPercent) {
+            [message appendString:@"%"];
+            continue;
+        }
+        if (index >= record->count) {
+            break;
+        }
+        NSString *conversion = [[NSString alloc] initWithBytes:utf8 + spec.start length:spec.end - spec.start encoding:NSUTF8StringEncoding];
+        const AloomaLogArgument *argument = &record->arguments[index++];
+        switch (argument->kind) {
+            case AloomaLogObject:
+                [message appendFormat:conversion, (__bridge id)argument->value.object];
+                break;
+            case AloomaLogInt:
+                [message appendFormat:conversion, argument->value.i];
+                break;
+            case AloomaLogLong:
+                [message appendFormat:conversion, argument->value.l];
+                break;
+            case AloomaLogLongLong:
+                [message appendFormat:conversion, argument->value.ll];
+                break;
+            case AloomaLogDouble:
+                [message appendFormat:conversion, argument->value.d];
+                break;
+            case AloomaLogCString:
+                [message appendFormat:conversion, argument->value.s];
+                break;
+            case AloomaLogPointer:
+                [message appendFormat:conversion, argument->value.p];
+                break;
+            default:
+                break;
+        }
+    }
+    size_t total = strlen(utf8);
+    if (total > literal) {
+        [message appendString:[[NSString alloc] initWithBytes:utf8 + literal length:total - literal encoding:NSUTF8StringEncoding]];
+    }
+    return message;
+}
+
+#pragma clang diagnostic pop
+
+static void AloomaLogWrite(AloomaLogLevel level, CFAbsoluteTime time, NSString *message)
+{
+    void (^handler)(AloomaLogLevel, NSDate *, NSString *);
+    @synchronized(handlerLock) {
+        handler = logHandler;
+    }
+    if (handler) {
+        handler(level, [NSDate dateWithTimeIntervalSinceReferenceDate:time], message);
+    } else {
+        NSLog(@"[Alooma] %@", message);
+    }
+}
+
+// must be called on logQueue
+static void AloomaLogDrain(void)
+{
+    AloomaLogRecord record;
+    while (AloomaLogRingPop(logRing, &record)) {
+        @autoreleasepool {
+            AloomaLogWrite(record.level, record.time, AloomaLogFormatRecord(&record));
+            AloomaLogReleaseRecord(&record);
+        }
+    }
+    uint64_t dropped = AloomaLogRingDropped(logRing);
+    if (dropped > reportedDrops) {
+        AloomaLogWrite(AloomaLogLevelError, CFAbsoluteTimeGetCurrent(),
+                       [NSString stringWithFormat:@"%llu log messages dropped, the log ring was full", (unsigned long long)(dropped - reportedDrops)]);
+        reportedDrops = dropped;
+    }
+}
+
+static void AloomaLogSetUp(void)
+{
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        logRing = AloomaLogRingCreate(kLogCapacity, sizeof(AloomaLogRecord));
+        logQueue = dispatch_queue_create("com.alooma.log", DISPATCH_QUEUE_SERIAL);
+        handlerLock = [[NSObject alloc] init];
+        dispatch_set_target_queue(logQueue, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_BACKGROUND, 0));
+    });
+}
+
+void AloomaLogCapture(AloomaLogLevel level, NSString *format, ...)
+{
+    AloomaLogSetUp();
+    if (logRing == NULL || format == nil) {
+        return;
+    }
+    AloomaLogRecord record;
+    record.level = level;
+    record.time = CFAbsoluteTimeGetCurrent();
+    record.count = 0;
+
+    va_list arguments;
+    va_start(arguments, format);
+    va_list captured;
+    va_copy(captured, arguments);
+    // literals are immortal, so this is usually not a copy at all
+    format = [format copy];
+    BOOL lazy = AloomaLogCaptureArguments(&record, [format UTF8String], captured);
+    va_end(captured);
+    record.format = CFBridgingRetain(format);
+    if (!lazy) {
+        // drop what was captured before giving up and format right here
+        AloomaLogReleaseRecord(&record);
+        NSString *message = [[NSString alloc] initWithFormat:format arguments:arguments];
+        record.format = CFBridgingRetain(@"%@");
+        record.count = 1;
+        record.arguments[0].kind = AloomaLogObject;
+        record.arguments[0].value.object = CFBridgingRetain(message);
+    }
+    va_end(arguments);
+
+    if (!AloomaLogRingPush(logRing, &record)) {
+        AloomaLogReleaseRecord(&record);
+        return;
+    }
+    if (!atomic_exchange_explicit(&drainScheduled, true, memory_order_acq_rel)) {
+        dispatch_async(logQueue, ^{
+            atomic_store_explicit(&drainScheduled, false, memory_order_release);
+            AloomaLogDrain();
+        });
+    }
+}
+
+void AloomaLogSetLevel(AloomaLogLevel level)
+{
+    __atomic_store_n(&AloomaLogThreshold, (NSInteger)level, __ATOMIC_RELAXED);
+}
+
+void AloomaLogSetHandler(void (^handler)(AloomaLogLevel level, NSDate *time, NSString *message))
+{
+    AloomaLogSetUp();
+    @synchronized(handlerLock) {
+        logHandler = [handler copy];
+    }
+}
+
+void AloomaLogFlush(void)
+{
+    AloomaLogSetUp();
+    if (logRing == NULL) {
+        return;
+    }
+    dispatch_sync(logQueue, ^{
+        AloomaLogDrain();
+    });
+}
@@ -0,0 +1,267 @@
+//
+//  AloomaMatcher.c
+//  Alooma-iOS
+//
+
+#include "AloomaMatcher.h"
+#include "AloomaDedupe.h"
+
+#include <regex.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define kKeysPerBucket 4
+#define kMaxSeedAttempts 100000
+
+typedef struct {
+    const char *key;    // NULL marks an empty slot
+    size_t length;
+    long index;
+} AloomaKeySlot;
+
+struct AloomaKeyTable {
+    size_t bucketCount;
+    size_t mask;
+    uint32_t *seeds;
+    AloomaKeySlot *slots;
+    char *arena;
+};
+
+static inline size_t AloomaKeyBucket(uint64_t hash, size_t bucketCount)
+{
+    return (size_t)((hash >> 32) % bucketCount);
+}
+
+static inline size_t AloomaKeySlotIndex(uint64_t hash, uint32_t seed, size_t mask)
+{
+    return (size_t)(AloomaHashMix(hash, seed) & mask);
+}
+
+typedef struct {
+    size_t bucket;
+    size_t size;
+} AloomaBucketOrder;
+
+static int AloomaCompareBuckets(const void *a, const void *b)
+{
+    const AloomaBucketOrder *x = a, *y = b;
+    return x->size < y->size ? 1 : x->size > y->size ? -1 : 0;
+}
+
+AloomaKeyTable *AloomaKeyTableCreate(const char *const *keys, const size_t *lengths, size_t count)
+{
+    AloomaKeyTable *table = calloc(1, sizeof(AloomaKeyTable));
+    if (table == NULL) {
+        return NULL;
+    }
+    // a load factor of at most 0.5 keeps the seed search short
+    size_t size = 2;
+    while (size < count * 2) {
+        size <<= 1;
+    }
+    table->mask = size - 1;
+    table->bucketCount = count / kKeysPerBucket + 1;
+    size_t arenaSize = 1;
+    for (size_t i = 0; i < count; i++) {
+        arenaSize += lengths[i] + 1;
+    }
+    size_t n = count ? count : 1;
+    table->seeds = calloc(table->bucketCount, sizeof(uint32_t));
+    table->slots = calloc(size, sizeof(AloomaKeySlot));
+    table->arena = malloc(arenaSize);
+    const char **stored = malloc(sizeof(char *) * n);
+    uint64_t *hashes = malloc(sizeof(uint64_t) * n);
+    size_t *members = malloc(sizeof(size_t) * n);
+    size_t *candidate = malloc(sizeof(size_t) * n);
+    size_t *bucketStart = calloc(table->bucketCount + 1, sizeof(size_t));
+    size_t *fill = malloc(sizeof(size_t) * table->bucketCount);
+    AloomaBucketOrder *order = malloc(sizeof(AloomaBucketOrder) * table->bucketCount);
+    int ok = table->seeds && table->slots && table->arena && stored && hashes &&
+             members && candidate && bucketStart && fill && order;
+
+    if (ok) {
+        char *cursor = table->arena;
+        for (size_t i = 0; i < count; i++) {
+            memcpy(cursor, keys[i], lengths[i]);
+            cursor[lengths[i]] = '\0';
+            stored[i] = cursor;
+            cursor += lengths[i] + 1;
+            hashes[i] = AloomaHash64(keys[i], lengths[i], 0);
+            bucketStart[AloomaKeyBucket(hashes[i], table->bucketCount) + 1]++;
+        }
+        // group key indexes by bucket
+        for (size_t b = 0; b < table->bucketCount; b++) {
+            order[b].bucket = b;
+            order[b].size = bucketStart[b + 1];
+            bucketStart[b + 1] += bucketStart[b];
+            fill[b] = bucketStart[b];
+        }
+        for (size_t i = 0; i < count; i++) {
+            members[fill[AloomaKeyBucket(hashes[i], table->bucketCount)]++] = i;
+        }
+        // place the largest buckets first, while the table is still empty
+        qsort(order, table->bucketCount, sizeof(AloomaBucketOrder), AloomaCompareBuckets);
+    }
+
+    for (size_t o = 0; ok && o < table->bucketCount && order[o].size > 0; o++) {
+        size_t b = order[o].bucket;
+        const size_t *bucket = members + bucketStart[b];
+        size_t bucketSize = order[o].size;
+        uint32_t seed = 0;
+        for (; seed < kMaxSeedAttempts; seed++) {
+            size_t placed = 0;
+            for (; placed < bucketSize; placed++) {
+                size_t slot = AloomaKeySlotIndex(hashes[bucket[placed]], seed, table->mask);
+                if (table->slots[slot].key != NULL) {
+                    break;
+                }
+                size_t j = 0;
+                while (j < placed && candidate[j] != slot) {
+                    j++;
+                }
+                if (j < placed) {
+                    break;
+                }
+                candidate[placed] = slot;
+            }
+            if (placed == bucketSize) {
+                break;
+            }
+        }
+        if (seed == kMaxSeedAttempts) {
+            // only happens when two keys are equal
+            ok = 0;
+            break;
+        }
+        table->seeds[b] = seed;
+        for (size_t j = 0; j < bucketSize; j++) {
+            size_t i = bucket[j];
+            AloomaKeySlot *slot = &table->slots[candidate[j]];
+            slot->key = stored[i];
+            slot->length = lengths[i];
+            slot->index = (long)i;
+        }
+    }
+
+    free(stored);
+    free(hashes);
+    free(members);
+    free(candidate);
+    free(bucketStart);
+    free(fill);
+    free(order);
+    if (!ok) {
+        AloomaKeyTableDestroy(table);
+        return NULL;
+    }
+    return table;
+}
+
+void AloomaKeyTableDestroy(AloomaKeyTable *table)
+{
+    if (table == NULL) {
+        return;
+    }
+    free(table->seeds);
+    free(table->slots);
+    free(table->arena);
+    free(table);
+}
+
+long AloomaKeyTableFind(const AloomaKeyTable *table, const char *key, size_t length)
+{
+    uint64_t hash = AloomaHash64(key, length, 0);
+    uint32_t seed = table->seeds[AloomaKeyBucket(hash, table->bucketCount)];
+    const AloomaKeySlot *slot = &table->slots[AloomaKeySlotIndex(hash, seed, table->mask)];
+    if (slot->key != NULL && slot->length == length && memcmp(slot->key, key, length) == 0) {
+        return slot->index;
+    }
+    return -1;
+}
+
+struct AloomaPatternSet {
+    size_t count;
+    regex_t combined;
+    regex_t *patterns;
+};
+
+AloomaPatternSet *AloomaPatternSetCreate(const char *const *patterns, size_t count, size_t *badPattern)
+{
+    AloomaPatternSet *set = calloc(1, sizeof(AloomaPatternSet));
+    if (set == NULL) {
+        return NULL;
+    }
+    set->patterns = calloc(count ? count : 1, sizeof(regex_t));
+    if (set->patterns == NULL) {
+        free(set);
+        return NULL;
+    }
+    size_t combinedLength = 1;
+    for (size_t i = 0; i < count; i++) {
+        combinedLength += strlen(patterns[i]) + 3;
+    }
+    char *combined = malloc(combinedLength);
+    size_t compiled = 0;
+    int ok = combined != NULL;
+    if (ok) {
+        char *cursor = combined;
+        for (; compiled < count; compiled++) {
+            if (regcomp(&set->patterns[compiled], patterns[compiled], REG_EXTENDED | REG_NOSUB) != 0) {
+                if (badPattern) {
+                    *badPattern = compiled;
+                }
+                ok = 0;
+                break;
+            }
+            size_t length = strlen(patterns[compiled]);
+            if (compiled > 0) {
+                *cursor++ = '|';
+            }
+            *cursor++ = '(';
+            memcpy(cursor, patterns[compiled], length);
+            cursor += length;
+            *cursor++ = ')';
+        }
+        *cursor = '\0';
+    }
+    // one automaton for the common case of a value that matches nothing
+    ok = ok && count > 0 && regcomp(&set->combined, combined, REG_EXTENDED | REG_NOSUB) == 0;
+    free(combined);
+    set->count = compiled;
+    if (!ok) {
+        for (size_t i = 0; i < compiled; i++) {
+            regfree(&set->patterns[i]);
+        }
+        free(set->patterns);
+        free(set);
+        return NULL;
+    }
+    return set;
+}
+
+void AloomaPatternSetDestroy(AloomaPatternSet *set)
+{
+    if (set == NULL) {
+        return;
+    }
+    regfree(&set->combined);
+    for (size_t i = 0; i < set->count; i++) {
+        regfree(&set->patterns[i]);
+    }
+    free(set->patterns);
+    free(set);
+}
+
+long AloomaPatternSetMatch(const AloomaPatternSet *set, const char *string)
+{
+    if (regexec(&set->combined, string, 0, NULL, 0) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < set->count; i++) {
+        if (regexec(&set->patterns[i], string, 0, NULL, 0) == 0) {
+            return (long)i;
+        }
+    }
+    return -1;
+}
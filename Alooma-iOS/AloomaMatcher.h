@@ -0,0 +1,46 @@
+//
+//  AloomaMatcher.h
+//  Alooma-iOS
+//
+//  Matchers compiled once from the property filter rules and then used on
+//  every tracked property: a minimal perfect hash table of property keys and
+//  a set of value patterns behind a single combined regular expression.
+//
+
+#ifndef AloomaMatcher_h
+#define AloomaMatcher_h
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AloomaKeyTable AloomaKeyTable;
+
+// Builds a collision-free table over count distinct keys (hash and displace,
+// one 64-bit hash per lookup). Keys are copied. Returns NULL if a key is
+// repeated or allocation fails.
+AloomaKeyTable *AloomaKeyTableCreate(const char *const *keys, const size_t *lengths, size_t count);
+void AloomaKeyTableDestroy(AloomaKeyTable *table);
+
+// Returns the index the key had in the array passed to Create, or -1.
+long AloomaKeyTableFind(const AloomaKeyTable *table, const char *key, size_t length);
+
+typedef struct AloomaPatternSet AloomaPatternSet;
+
+// Compiles count > 0 POSIX extended regular expressions. Returns NULL if one
+// of them does not compile, with its index in *badPattern when that is not
+// NULL.
+AloomaPatternSet *AloomaPatternSetCreate(const char *const *patterns, size_t count, size_t *badPattern);
+void AloomaPatternSetDestroy(AloomaPatternSet *set);
+
+// Returns the index of the first pattern found anywhere in string, or -1.
+// Strings matching none of the patterns cost a single scan.
+long AloomaPatternSetMatch(const AloomaPatternSet *set, const char *string);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,265 @@
+//
+//  AloomaMetrics.c
+//  Alooma-iOS
+//
+
+#include "AloomaMetrics.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#define kLatencyHighest (86400ull * 1000000ull)
+#define kLatencySignificantFigures 2
+
+struct AloomaHdrHistogram {
+    uint64_t highestTrackable;
+    int subBucketHalfCountMagnitude;
+    uint32_t subBucketHalfCount;
+    uint64_t subBucketMask;
+    size_t countsLength;
+    atomic_uint_fast64_t totalCount;
+    atomic_uint_fast64_t totalSum;
+    atomic_uint_fast64_t min;
+    atomic_uint_fast64_t max;
+    atomic_uint_fast64_t counts[];
+};
+
+static inline int AloomaBitLength(uint64_t value)
+{
+    return value ? 64 - __builtin_clzll(value) : 0;
+}
+
+AloomaHdrHistogram *AloomaHdrHistogramCreate(uint64_t highestTrackable, int significantFigures)
+{
+    if (significantFigures < 1 || significantFigures > 5 || highestTrackable < 2) {
+        return NULL;
+    }
+    uint64_t largestSingleUnitResolution = 2;
+    for (int i = 0; i < significantFigures; i++) {
+        largestSingleUnitResolution *= 10;
+    }
+    int subBucketCountMagnitude = AloomaBitLength(largestSingleUnitResolution - 1);
+    uint64_t subBucketCount = 1ull << subBucketCountMagnitude;
+
+    // every bucket after the first doubles the covered range
+    size_t bucketCount = 1;
+    uint64_t smallestUntrackable = subBucketCount;
+    while (smallestUntrackable <= highestTrackable) {
+        if (smallestUntrackable > UINT64_MAX / 2) {
+            bucketCount++;
+            break;
+        }
+        smallestUntrackable <<= 1;
+        bucketCount++;
+    }
+    size_t countsLength = (bucketCount + 1) * (subBucketCount / 2);
+
+    AloomaHdrHistogram *histogram = calloc(1, sizeof(AloomaHdrHistogram) + sizeof(atomic_uint_fast64_t) * countsLength);
+    if (histogram == NULL) {
+        return NULL;
+    }
+    histogram->highestTrackable = highestTrackable;
+    histogram->subBucketHalfCountMagnitude = subBucketCountMagnitude - 1;
+    histogram->subBucketHalfCount = (uint32_t)(subBucketCount / 2);
+    histogram->subBucketMask = subBucketCount - 1;
+    histogram->countsLength = countsLength;
+    atomic_init(&histogram->min, UINT64_MAX);
+    return histogram;
+}
+
+void AloomaHdrHistogramDestroy(AloomaHdrHistogram *histogram)
+{
+    free(histogram);
+}
+
+static inline size_t AloomaHdrIndex(const AloomaHdrHistogram *histogram, uint64_t value)
+{
+    int bucket = AloomaBitLength(value | histogram->subBucketMask) - (histogram->subBucketHalfCountMagnitude + 1);
+    uint64_t subBucket = value >> bucket;
+    return ((size_t)(bucket + 1) << histogram->subBucketHalfCountMagnitude) + (subBucket - histogram->subBucketHalfCount);
+}
+
+static inline uint64_t AloomaHdrValueAtIndex(const AloomaHdrHistogram *histogram, size_t index)
+{
+    int bucket = (int)(index >> histogram->subBucketHalfCountMagnitude) - 1;
+    uint64_t subBucket = (index & (histogram->subBucketHalfCount - 1)) + histogram->subBucketHalfCount;
+    if (bucket < 0) {
+        subBucket -= histogram->subBucketHalfCount;
+        bucket = 0;
+    }
+    return subBucket << bucket;
+}
+
+static inline uint64_t AloomaHdrHighestEquivalent(const AloomaHdrHistogram *histogram, size_t index)
+{
+    int bucket = (int)(index >> histogram->subBucketHalfCountMagnitude) - 1;
+    uint64_t range = 1ull << (bucket < 0 ? 0 : bucket);
+    return AloomaHdrValueAtIndex(histogram, index) + range - 1;
+}
+
+void AloomaHdrHistogramRecord(AloomaHdrHistogram *histogram, uint64_t value)
+{
+    if (value > histogram->highestTrackable) {
+        value = histogram->highestTrackable;
+    }
+    atomic_fetch_add_explicit(&histogram->counts[AloomaHdrIndex(histogram, value)], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->totalCount, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->totalSum, value, memory_order_relaxed);
+    uint_fast64_t seen = atomic_load_explicit(&histogram->min, memory_order_relaxed);
+    while (value < seen && !atomic_compare_exchange_weak_explicit(&histogram->min, &seen, value,
+                                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    seen = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while (value > seen && !atomic_compare_exchange_weak_explicit(&histogram->max, &seen, value,
+                                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+uint64_t AloomaHdrHistogramCount(const AloomaHdrHistogram *histogram)
+{
+    return atomic_load_explicit(&histogram->totalCount, memory_order_relaxed);
+}
+
+uint64_t AloomaHdrHistogramMin(const AloomaHdrHistogram *histogram)
+{
+    uint64_t min = atomic_load_explicit(&histogram->min, memory_order_relaxed);
+    return min == UINT64_MAX ? 0 : min;
+}
+
+uint64_t AloomaHdrHistogramMax(const AloomaHdrHistogram *histogram)
+{
+    return atomic_load_explicit(&histogram->max, memory_order_relaxed);
+}
+
+double AloomaHdrHistogramMean(const AloomaHdrHistogram *histogram)
+{
+    uint64_t count = AloomaHdrHistogramCount(histogram);
+    return count ? (double)atomic_load_explicit(&histogram->totalSum, memory_order_relaxed) / count : 0;
+}
+
+uint64_t AloomaHdrHistogramValueAtPercentile(const AloomaHdrHistogram *histogram, double percentile)
+{
+    // counts may move while we read them; the answer is approximate then
+    uint64_t total = 0;
+    for (size_t i = 0; i < histogram->countsLength; i++) {
+        total += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+    percentile = percentile < 0 ? 0 : percentile > 100 ? 100 : percentile;
+    uint64_t target = (uint64_t)ceil(percentile / 100.0 * total);
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t seen = 0;
+    for (size_t i = 0; i < histogram->countsLength; i++) {
+        seen += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+        if (seen >= target) {
+            uint64_t value = AloomaHdrHighestEquivalent(histogram, i);
+            uint64_t max = AloomaHdrHistogramMax(histogram);
+            return value < max ? value : max;
+        }
+    }
+    return AloomaHdrHistogramMax(histogram);
+}
+
+const char *const AloomaCounterNames[AloomaCounterCount] = {
+    "events_tracked",
+    "events_dropped_queue_full",
+    "events_sent",
+    "bytes_sent",
+    "requests",
+    "request_failures",
+    "requests_rejected",
+    "flushes",
+};
+
+const char *const AloomaGaugeNames[AloomaGaugeCount] = {
+    "queue_depth",
+    "queue_bytes",
+};
+
+const char *const AloomaLatencyNames[AloomaLatencyCount] = {
+    "enqueue_to_ack_us",
+    "encode_us",
+    "request_us",
+    "flush_us",
+};
+
+struct AloomaMetrics {
+    // one cache line each so hot counters do not contend
+    struct {
+        atomic_uint_fast64_t value;
+        char padding[64 - sizeof(atomic_uint_fast64_t)];
+    } counters[AloomaCounterCount];
+    atomic_int_fast64_t gauges[AloomaGaugeCount];
+    AloomaHdrHistogram *latencies[AloomaLatencyCount];
+};
+
+AloomaMetrics *AloomaMetricsCreate(void)
+{
+    AloomaMetrics *metrics = calloc(1, sizeof(AloomaMetrics));
+    if (metrics == NULL) {
+        return NULL;
+    }
+    for (int i = 0; i < AloomaLatencyCount; i++) {
+        metrics->latencies[i] = AloomaHdrHistogramCreate(kLatencyHighest, kLatencySignificantFigures);
+        if (metrics->latencies[i] == NULL) {
+            AloomaMetricsDestroy(metrics);
+            return NULL;
+        }
+    }
+    return metrics;
+}
+
+void AloomaMetricsDestroy(AloomaMetrics *metrics)
+{
+    if (metrics == NULL) {
+        return;
+    }
+    for (int i = 0; i < AloomaLatencyCount; i++) {
+        AloomaHdrHistogramDestroy(metrics->latencies[i]);
+    }
+    free(metrics);
+}
+
+void AloomaMetricsAdd(AloomaMetrics *metrics, AloomaCounter counter, uint64_t amount)
+{
+    if (metrics == NULL) {
+        return;
+    }
+    atomic_fetch_add_explicit(&metrics->counters[counter].value, amount, memory_order_relaxed);
+}
+
+void AloomaMetricsSetGauge(AloomaMetrics *metrics, AloomaGauge gauge, int64_t value)
+{
+    if (metrics == NULL) {
+        return;
+    }
+    atomic_store_explicit(&metrics->gauges[gauge], value, memory_order_relaxed);
+}
+
+void AloomaMetricsRecordLatency(AloomaMetrics *metrics, AloomaLatency latency, uint64_t microseconds)
+{
+    if (metrics == NULL) {
+        return;
+    }
+    AloomaHdrHistogramRecord(metrics->latencies[latency], microseconds);
+}
+
+uint64_t AloomaMetricsCounterValue(const AloomaMetrics *metrics, AloomaCounter counter)
+{
+    return atomic_load_explicit(&metrics->counters[counter].value, memory_order_relaxed);
+}
+
+int64_t AloomaMetricsGaugeValue(const AloomaMetrics *metrics, AloomaGauge gauge)
+{
+    return atomic_load_explicit(&metrics->gauges[gauge], memory_order_relaxed);
+}
+
+const AloomaHdrHistogram *AloomaMetricsLatency(const AloomaMetrics *metrics, AloomaLatency latency)
+{
+    return metrics->latencies[latency];
+}
@@ -0,0 +1,87 @@
+//
+//  AloomaMetrics.h
+//  Alooma-iOS
+//
+//  The library's own health metrics: a fixed set of atomic counters and
+//  gauges plus HDR histograms of latencies. Recording never locks or
+//  allocates, so it can sit on the track: path.
+//
+
+#ifndef AloomaMetrics_h
+#define AloomaMetrics_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AloomaHdrHistogram AloomaHdrHistogram;
+
+// Tracks values from 1 to highestTrackable (larger values are clamped) with
+// significantFigures (1-5) decimal digits of precision, e.g. 2 keeps every
+// recorded value within 1% of its bucket.
+AloomaHdrHistogram *AloomaHdrHistogramCreate(uint64_t highestTrackable, int significantFigures);
+void AloomaHdrHistogramDestroy(AloomaHdrHistogram *histogram);
+
+void AloomaHdrHistogramRecord(AloomaHdrHistogram *histogram, uint64_t value);
+uint64_t AloomaHdrHistogramCount(const AloomaHdrHistogram *histogram);
+uint64_t AloomaHdrHistogramMin(const AloomaHdrHistogram *histogram);
+uint64_t AloomaHdrHistogramMax(const AloomaHdrHistogram *histogram);
+double AloomaHdrHistogramMean(const AloomaHdrHistogram *histogram);
+// Highest value equivalent to the one at percentile (0-100); 0 when empty.
+uint64_t AloomaHdrHistogramValueAtPercentile(const AloomaHdrHistogram *histogram, double percentile);
+
+typedef enum {
+    AloomaCounterEventsTracked,
+    AloomaCounterEventsDroppedQueueFull,
+    AloomaCounterEventsSent,
+    AloomaCounterBytesSent,
+    AloomaCounterRequests,
+    AloomaCounterRequestFailures,
+    AloomaCounterRequestsRejected,
+    AloomaCounterFlushes,
+    AloomaCounterCount
+} AloomaCounter;
+
+typedef enum {
+    AloomaGaugeQueueDepth,
+    AloomaGaugeQueueBytes,
+    AloomaGaugeCount
+} AloomaGauge;
+
+// all in microseconds
+typedef enum {
+    AloomaLatencyEnqueueToAck,
+    AloomaLatencyEncode,
+    AloomaLatencyRequest,
+    AloomaLatencyFlush,
+    AloomaLatencyCount
+} AloomaLatency;
+
+// snake_case names used in snapshots
+extern const char *const AloomaCounterNames[AloomaCounterCount];
+extern const char *const AloomaGaugeNames[AloomaGaugeCount];
+extern const char *const AloomaLatencyNames[AloomaLatencyCount];
+
+typedef struct AloomaMetrics AloomaMetrics;
+
+// Latencies are tracked up to one day at two significant figures. Recording
+// into a NULL registry does nothing.
+AloomaMetrics *AloomaMetricsCreate(void);
+void AloomaMetricsDestroy(AloomaMetrics *metrics);
+
+void AloomaMetricsAdd(AloomaMetrics *metrics, AloomaCounter counter, uint64_t amount);
+void AloomaMetricsSetGauge(AloomaMetrics *metrics, AloomaGauge gauge, int64_t value);
+void AloomaMetricsRecordLatency(AloomaMetrics *metrics, AloomaLatency latency, uint64_t microseconds);
+
+uint64_t AloomaMetricsCounterValue(const AloomaMetrics *metrics, AloomaCounter counter);
+int64_t AloomaMetricsGaugeValue(const AloomaMetrics *metrics, AloomaGauge gauge);
+const AloomaHdrHistogram *AloomaMetricsLatency(const AloomaMetrics *metrics, AloomaLatency latency);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+#import <Foundation/Foundation.h>
+
+/*!
+ @class
+ Event being enriched by a middleware stage.
+
+ @abstract
+ A mutable view of an event on its way into the queue.
+
+ @discussion
+ All stages of an event share one view, backed by the dictionary the library
+ merges the event's properties into, so adding, removing or rewriting fields
+ does not copy the event. The view is only valid for the duration of the
+ stage; do not keep a reference to it.
+ */
+@interface AloomaEventView : NSObject
+
+// used internally by Alooma; properties is not copied
+- (instancetype)initWithEvent:(NSString *)event properties:(NSMutableDictionary *)properties;
+
+/*!
+ @property
+
+ @abstract
+ Event name; may be rewritten.
+ */
+@property (nonatomic, copy) NSString *event;
+
+/*!
+ @property
+
+ @abstract
+ Merged properties of the event: automatic properties, super properties and
+ the properties passed to <code>track:</code>.
+ */
+@property (nonatomic, readonly, strong) NSMutableDictionary *properties;
+
+- (id)objectForKeyedSubscript:(NSString *)key;
+
+/*!
+ @method
+
+ @abstract
+ Sets a property, or removes it when obj is nil.
+ */
+- (void)setObject:(id)obj forKeyedSubscript:(NSString *)key;
+
+@end
+
+/*!
+ @typedef
+
+ @abstract
+ A middleware stage. Returning NO drops the event.
+ */
+typedef BOOL (^AloomaMiddlewareBlock)(AloomaEventView *event);
+
+/*!
+ @class
+ A registered middleware stage and its timings; used internally by Alooma.
+ */
+@interface AloomaMiddlewareStage : NSObject
+
+@property (nonatomic, readonly, copy) NSString *name;
+
+- (instancetype)initWithName:(NSString *)name block:(AloomaMiddlewareBlock)block;
+
+/*!
+ @method
+
+ @abstract
+ Runs the stage on view, timing it. Returns NO if the event was dropped.
+ */
+- (BOOL)runWithView:(AloomaEventView *)view;
+
+/*!
+ @method
+
+ @abstract
+ Returns calls, dropped, total_ms, mean_us and max_us for this stage.
+ */
+- (NSDictionary *)timings;
+
+@end
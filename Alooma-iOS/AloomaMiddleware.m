@@ -0,0 +1,91 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import "AloomaClock.h"
+#import "AloomaLogger.h"
+#import "AloomaMiddleware.h"
+
+@implementation AloomaEventView
+
+- (instancetype)initWithEvent:(NSString *)event properties:(NSMutableDictionary *)properties
+{
+    if (self = [super init]) {
+        _event = [event copy];
+        _properties = properties;
+    }
+    return self;
+}
+
+- (id)objectForKeyedSubscript:(NSString *)key
+{
+    return _properties[key];
+}
+
+- (void)setObject:(id)obj forKeyedSubscript:(NSString *)key
+{
+    if (obj) {
+        _properties[key] = obj;
+    } else {
+        [_properties removeObjectForKey:key];
+    }
+}
+
+@end
+
+@interface AloomaMiddlewareStage ()
+{
+    uint64_t _calls;
+    uint64_t _dropped;
+    double _totalSeconds;
+    double _maxSeconds;
+}
+
+@property (nonatomic, copy) AloomaMiddlewareBlock block;
+
+@end
+
+@implementation AloomaMiddlewareStage
+
+- (instancetype)initWithName:(NSString *)name block:(AloomaMiddlewareBlock)block
+{
+    if (self = [super init]) {
+        _name = [name copy];
+        _block = [block copy];
+    }
+    return self;
+}
+
+- (BOOL)runWithView:(AloomaEventView *)view
+{
+    double start = AloomaClockMonotonicNow();
+    BOOL keep = self.block(view);
+    double elapsed = AloomaClockMonotonicNow() - start;
+    @synchronized(self) {
+        _calls++;
+        _totalSeconds += elapsed;
+        _maxSeconds = MAX(_maxSeconds, elapsed);
+        if (!keep) {
+            _dropped++;
+        }
+    }
+    return keep;
+}
+
+- (NSDictionary *)timings
+{
+    @synchronized(self) {
+        return @{@"calls": @(_calls),
+                 @"dropped": @(_dropped),
+                 @"total_ms": @(_totalSeconds * 1e3),
+                 @"mean_us": @(_calls ? _totalSeconds * 1e6 / _calls : 0),
+                 @"max_us": @(_maxSeconds * 1e6)};
+    }
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<AloomaMiddlewareStage: %p %@>", self, self.name];
+}
+
+@end
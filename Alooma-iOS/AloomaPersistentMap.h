@@ -0,0 +1,27 @@
+#import <Foundation/Foundation.h>
+
+/*!
+ @class
+ Immutable dictionary with cheap updates.
+
+ @abstract
+ An <code>NSDictionary</code> backed by a persistent hash trie, used for
+ super properties and timed events.
+
+ @discussion
+ The <code>mapBy...</code> methods return a new map that shares all
+ untouched structure with the receiver, so an update costs O(log n) instead
+ of a full copy, and <code>copy</code> returns the receiver. A map never
+ changes once created and can be read from any thread. Maps are archived as
+ plain dictionaries.
+ */
+@interface AloomaPersistentMap : NSDictionary
+
++ (instancetype)map;
++ (instancetype)mapWithDictionary:(NSDictionary *)dictionary;
+
+- (instancetype)mapBySettingObject:(id)object forKey:(id<NSCopying>)key;
+- (instancetype)mapByAddingEntriesFromDictionary:(NSDictionary *)dictionary;
+- (instancetype)mapByRemovingObjectForKey:(id)key;
+
+@end
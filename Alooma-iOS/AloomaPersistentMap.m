@@ -0,0 +1,193 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import "AloomaDedupe.h"
+#import "AloomaHamt.h"
+#import "AloomaPersistentMap.h"
+
+static uint64_t AloomaMapHash(const void *key)
+{
+    // -hash of short strings leaves high bits empty, spread it over all 64
+    return AloomaHashMix((uint64_t)[(__bridge id)key hash], 0);
+}
+
+static int AloomaMapEqual(const void *a, const void *b)
+{
+    return a == b || [(__bridge id)a isEqual:(__bridge id)b];
+}
+
+static void AloomaMapRetain(const void *object)
+{
+    CFRetain(object);
+}
+
+static void AloomaMapRelease(const void *object)
+{
+    CFRelease(object);
+}
+
+static const AloomaHamtCallbacks kAloomaMapCallbacks = {
+    AloomaMapHash, AloomaMapEqual, AloomaMapRetain, AloomaMapRelease
+};
+
+@interface AloomaPersistentMap ()
+{
+    AloomaHamt *_map;
+}
+
+@end
+
+@implementation AloomaPersistentMap
+
++ (instancetype)map
+{
+    return [[self alloc] init];
+}
+
++ (instancetype)mapWithDictionary:(NSDictionary *)dictionary
+{
+    if ([dictionary isKindOfClass:[AloomaPersistentMap class]]) {
+        return (AloomaPersistentMap *)dictionary;
+    }
+    return [[self map] mapByAddingEntriesFromDictionary:dictionary];
+}
+
+// takes ownership of map
+- (instancetype)initWithHamt:(AloomaHamt *)map
+{
+    if (map == NULL) {
+        return nil;
+    }
+    if (self = [super init]) {
+        _map = map;
+    }
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithHamt:AloomaHamtCreate(&kAloomaMapCallbacks)];
+}
+
+- (instancetype)initWithObjects:(const id [])objects forKeys:(const id<NSCopying> [])keys count:(NSUInteger)count
+{
+    AloomaHamt *map = AloomaHamtCreate(&kAloomaMapCallbacks);
+    for (NSUInteger i = 0; map && i < count; i++) {
+        AloomaHamt *next = AloomaHamtSet(map, (__bridge const void *)[(id)keys[i] copyWithZone:nil], (__bridge const void *)objects[i]);
+        AloomaHamtRelease(map);
+        map = next;
+    }
+    return [self initWithHamt:map];
+}
+
+- (void)dealloc
+{
+    AloomaHamtRelease(_map);
+}
+
+- (instancetype)mapWithHamt:(AloomaHamt *)map
+{
+    if (map == _map) {
+        AloomaHamtRelease(map);
+        return self;
+    }
+    return [[[self class] alloc] initWithHamt:map] ?: self;
+}
+
+- (instancetype)mapBySettingObject:(id)object forKey:(id<NSCopying>)key
+{
+    if (object == nil || key == nil) {
+        return self;
+    }
+    id copiedKey = [(id)key copyWithZone:nil];
+    return [self mapWithHamt:AloomaHamtSet(_map, (__bridge const void *)copiedKey, (__bridge const void *)object)];
+}
+
+- (instancetype)mapByAddingEntriesFromDictionary:(NSDictionary *)dictionary
+{
+    AloomaHamt *map = AloomaHamtRetain(_map);
+    for (id key in dictionary) {
+        id copiedKey = [key copyWithZone:nil];
+        AloomaHamt *next = AloomaHamtSet(map, (__bridge const void *)copiedKey, (__bridge const void *)dictionary[key]);
+        if (next == NULL) {
+            break;
+        }
+        AloomaHamtRelease(map);
+        map = next;
+    }
+    return [self mapWithHamt:map];
+}
+
+- (instancetype)mapByRemovingObjectForKey:(id)key
+{
+    if (key == nil) {
+        return self;
+    }
+    return [self mapWithHamt:AloomaHamtRemove(_map, (__bridge const void *)key)];
+}
+
+#pragma mark - NSDictionary primitives
+
+- (NSUInteger)count
+{
+    return AloomaHamtCount(_map);
+}
+
+- (id)objectForKey:(id)key
+{
+    if (key == nil) {
+        return nil;
+    }
+    return (__bridge id)AloomaHamtGet(_map, (__bridge const void *)key);
+}
+
+static void AloomaCollectKey(const void *key, const void *value, void *context)
+{
+    [(__bridge NSMutableArray *)context addObject:(__bridge id)key];
+}
+
+- (NSEnumerator *)keyEnumerator
+{
+    NSMutableArray *keys = [NSMutableArray arrayWithCapacity:[self count]];
+    AloomaHamtForEach(_map, AloomaCollectKey, (__bridge void *)keys);
+    return [keys objectEnumerator];
+}
+
+typedef struct {
+    __unsafe_unretained void (^block)(id key, id obj, BOOL *stop);
+    BOOL stop;
+} AloomaEnumeration;
+
+static void AloomaEnumerateEntry(const void *key, const void *value, void *context)
+{
+    AloomaEnumeration *enumeration = context;
+    if (!enumeration->stop) {
+        enumeration->block((__bridge id)key, (__bridge id)value, &enumeration->stop);
+    }
+}
+
+- (void)enumerateKeysAndObjectsUsingBlock:(void (^)(id key, id obj, BOOL *stop))block
+{
+    AloomaEnumeration enumeration = {block, NO};
+    AloomaHamtForEach(_map, AloomaEnumerateEntry, &enumeration);
+}
+
+- (id)copyWithZone:(NSZone *)zone
+{
+    return self;
+}
+
+#pragma mark - Archiving
+
+- (Class)classForCoder
+{
+    return [NSDictionary class];
+}
+
+- (id)replacementObjectForKeyedArchiver:(NSKeyedArchiver *)archiver
+{
+    return [NSDictionary dictionaryWithDictionary:self];
+}
+
+@end
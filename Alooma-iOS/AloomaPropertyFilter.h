@@ -0,0 +1,65 @@
+#import <Foundation/Foundation.h>
+
+/*!
+ @class
+ Compiled property filter rules.
+
+ @abstract
+ Drops, hashes or truncates event properties before they are queued.
+
+ @discussion
+ Rules are dictionaries. A rule names either a property <code>key</code> or a
+ value <code>pattern</code> (a POSIX extended regular expression searched for
+ in string values), and an <code>action</code>:
+
+ <pre>
+ @{@"key": @"email", @"action": @"drop"}
+ @{@"key": @"user_id", @"action": @"hash"}
+ @{@"key": @"comment", @"action": @"truncate", @"length": @64}
+ @{@"pattern": @"[0-9]{3}-[0-9]{2}-[0-9]{4}", @"action": @"drop"}
+ @{@"allow": @[@"plan", @"screen"]}
+ </pre>
+
+ <code>hash</code> replaces a value with the hex SHA-256 of the salt followed
+ by the value. An <code>allow</code> rule turns on allow-listing: properties
+ whose keys are not listed are dropped, except for the ones the library sets
+ itself. Key rules win over value patterns; among patterns the first one that
+ matches applies.
+
+ The fields the library puts on every event (<code>token</code>,
+ <code>distinct_id</code>, <code>time</code>, <code>session_id</code>,
+ <code>message_index</code> and the like) are never dropped, hashed or
+ truncated, whatever the rules say; the collector needs them as sent.
+ Automatic <code>$</code> properties survive an allow-list but can still be
+ matched by key rules and patterns.
+
+ Key rules and patterns also apply inside nested dictionaries and arrays, at
+ any depth; the allow-list only looks at top-level keys. The top-level fields
+ of custom events (<code>trackCustomEvent:</code>) are filtered like
+ properties.
+
+ All rules are compiled when the filter is created, into one perfect hash
+ table for the keys and one combined regular expression for the patterns, so
+ filtering an event costs one table lookup per key and one scan per string
+ value. Filters are immutable and safe to use from any thread.
+ */
+@interface AloomaPropertyFilter : NSObject
+
+/*!
+ @method
+
+ @abstract
+ Compiles the rules. Returns nil and logs the offending rule if one of them
+ is malformed.
+ */
+- (instancetype)initWithRules:(NSArray *)rules salt:(NSString *)salt;
+
+/*!
+ @method
+
+ @abstract
+ Applies the rules to the properties in place.
+ */
+- (void)filterProperties:(NSMutableDictionary *)properties;
+
+@end
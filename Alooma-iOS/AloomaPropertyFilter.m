@@ -0,0 +1,318 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import <CommonCrypto/CommonDigest.h>
+
+#import "AloomaLogger.h"
+#import "AloomaMatcher.h"
+#import "AloomaPropertyFilter.h"
+
+typedef NS_ENUM(uint8_t, AloomaFilterAction) {
+    AloomaFilterActionNone = 0,
+    AloomaFilterActionDrop,
+    AloomaFilterActionHash,
+    AloomaFilterActionTruncate
+};
+
+typedef struct {
+    AloomaFilterAction action;
+    BOOL allowed;
+    NSUInteger length;
+} AloomaFilterRule;
+
+@interface AloomaPropertyFilter ()
+{
+    AloomaKeyTable *_keys;
+    AloomaPatternSet *_patterns;
+    AloomaFilterRule *_keyRules;
+    AloomaFilterRule *_patternRules;
+    BOOL _allowList;
+    // any drop, hash or truncate rule, so nested containers need a look
+    BOOL _hasRules;
+}
+
+@property (nonatomic, copy) NSData *salt;
+
+@end
+
+@implementation AloomaPropertyFilter
+
+// properties the library sets on every event, never filtered
+static BOOL AloomaIsEventField(NSString *key)
+{
+    static NSSet *libraryKeys;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        libraryKeys = [NSSet setWithArray:@[@"token", @"time", @"distinct_id", @"session_id", @"message_index",
+                                            @"sending_time", @"sample_weight", @"mp_name_tag", @"mp_lib",
+                                            @"mp_device_model"]];
+    });
+    return [libraryKeys containsObject:key];
+}
+
+// properties the library sets itself survive an allow-list
+static BOOL AloomaIsLibraryProperty(NSString *key)
+{
+    return [key hasPrefix:@"$"] || AloomaIsEventField(key);
+}
+
+// UTF-8 bytes of s without allocating for short or ASCII strings
+static const char *AloomaUTF8(NSString *s, char *buffer, size_t size)
+{
+    const char *bytes = CFStringGetCStringPtr((__bridge CFStringRef)s, kCFStringEncodingUTF8);
+    if (bytes == NULL && [s getCString:buffer maxLength:size encoding:NSUTF8StringEncoding]) {
+        bytes = buffer;
+    }
+    return bytes ?: [s UTF8String];
+}
+
+static BOOL AloomaParseAction(NSDictionary *rule, AloomaFilterRule *parsed)
+{
+    id action = rule[@"action"];
+    if ([action isEqual:@"drop"]) {
+        parsed->action = AloomaFilterActionDrop;
+    } else if ([action isEqual:@"hash"]) {
+        parsed->action = AloomaFilterActionHash;
+    } else if ([action isEqual:@"truncate"] && [rule[@"length"] isKindOfClass:[NSNumber class]] &&
+               [rule[@"length"] integerValue] > 0) {
+        parsed->action = AloomaFilterActionTruncate;
+        parsed->length = [rule[@"length"] unsignedIntegerValue];
+    } else {
+        return NO;
+    }
+    return YES;
+}
+
+- (instancetype)initWithRules:(NSArray *)rules salt:(NSString *)salt
+{
+    if (self = [super init]) {
+        _salt = [salt ?: @"" dataUsingEncoding:NSUTF8StringEncoding];
+        NSMutableArray *keys = [NSMutableArray array];
+        NSMutableDictionary *keyIndexes = [NSMutableDictionary dictionary];
+        NSMutableData *keyRules = [NSMutableData data];
+        NSMutableArray *patterns = [NSMutableArray array];
+        NSMutableData *patternRules = [NSMutableData data];
+
+        for (NSDictionary *rule in rules) {
+            if (![rule isKindOfClass:[NSDictionary class]]) {
+                AloomaError(@"%@ filter rule is not a dictionary: %@", self, rule);
+                return nil;
+            }
+            NSArray *allowed = rule[@"allow"];
+            NSMutableArray *ruleKeys = [NSMutableArray array];
+            AloomaFilterRule parsed = {0};
+            if (allowed) {
+                if (![allowed isKindOfClass:[NSArray class]]) {
+                    AloomaError(@"%@ allow rule must list keys: %@", self, rule);
+                    return nil;
+                }
+                [ruleKeys addObjectsFromArray:allowed];
+                _allowList = YES;
+            } else if (!AloomaParseAction(rule, &parsed)) {
+                AloomaError(@"%@ filter rule has no valid action: %@", self, rule);
+                return nil;
+            } else if ([rule[@"key"] isKindOfClass:[NSString class]]) {
+                [ruleKeys addObject:rule[@"key"]];
+                _hasRules = YES;
+            } else if ([rule[@"pattern"] isKindOfClass:[NSString class]]) {
+                _hasRules = YES;
+                [patterns addObject:rule[@"pattern"]];
+                [patternRules appendBytes:&parsed length:sizeof(parsed)];
+                continue;
+            } else {
+                AloomaError(@"%@ filter rule needs a key or a pattern: %@", self, rule);
+                return nil;
+            }
+
+            for (NSString *key in ruleKeys) {
+                if (![key isKindOfClass:[NSString class]]) {
+                    AloomaError(@"%@ filter rule key is not a string: %@", self, rule);
+                    return nil;
+                }
+                NSNumber *index = keyIndexes[key];
+                if (index == nil) {
+                    index = @([keys count]);
+                    keyIndexes[key] = index;
+                    [keys addObject:key];
+                    AloomaFilterRule empty = {0};
+                    [keyRules appendBytes:&empty length:sizeof(empty)];
+                }
+                AloomaFilterRule *existing = (AloomaFilterRule *)[keyRules mutableBytes] + [index unsignedIntegerValue];
+                if (allowed) {
+                    existing->allowed = YES;
+                } else {
+                    // a later rule for the same key replaces the action
+                    existing->action = parsed.action;
+                    existing->length = parsed.length;
+                }
+            }
+        }
+
+        _keyRules = malloc(MAX([keyRules length], 1));
+        memcpy(_keyRules, [keyRules bytes], [keyRules length]);
+        _patternRules = malloc(MAX([patternRules length], 1));
+        memcpy(_patternRules, [patternRules bytes], [patternRules length]);
+
+        const char **keyBytes = malloc(sizeof(char *) * MAX([keys count], 1));
+        size_t *keyLengths = malloc(sizeof(size_t) * MAX([keys count], 1));
+        for (NSUInteger i = 0; i < [keys count]; i++) {
+            keyBytes[i] = [keys[i] UTF8String];
+            keyLengths[i] = strlen(keyBytes[i]);
+        }
+        _keys = AloomaKeyTableCreate(keyBytes, keyLengths, [keys count]);
+        free(keyBytes);
+        free(keyLengths);
+        if (_keys == NULL) {
+            return nil;
+        }
+
+        if ([patterns count] > 0) {
+            const char **patternBytes = malloc(sizeof(char *) * [patterns count]);
+            for (NSUInteger i = 0; i < [patterns count]; i++) {
+                patternBytes[i] = [patterns[i] UTF8String];
+            }
+            size_t bad = 0;
+            _patterns = AloomaPatternSetCreate(patternBytes, [patterns count], &bad);
+            free(patternBytes);
+            if (_patterns == NULL) {
+                AloomaError(@"%@ invalid filter pattern: %@", self, patterns[bad]);
+                return nil;
+            }
+        }
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    AloomaKeyTableDestroy(_keys);
+    AloomaPatternSetDestroy(_patterns);
+    free(_keyRules);
+    free(_patternRules);
+}
+
+- (NSString *)hashValue:(id)value
+{
+    NSData *data = [[value description] dataUsingEncoding:NSUTF8StringEncoding];
+    unsigned char digest[CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_CTX context;
+    CC_SHA256_Init(&context);
+    CC_SHA256_Update(&context, [self.salt bytes], (CC_LONG)[self.salt length]);
+    CC_SHA256_Update(&context, [data bytes], (CC_LONG)[data length]);
+    CC_SHA256_Final(digest, &context);
+    NSMutableString *hex = [NSMutableString stringWithCapacity:CC_SHA256_DIGEST_LENGTH * 2];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; i++) {
+        [hex appendFormat:@"%02x", digest[i]];
+    }
+    return hex;
+}
+
+// the value the rule leaves, or nil to drop it
+- (id)applyRule:(const AloomaFilterRule *)rule toValue:(id)value
+{
+    switch (rule->action) {
+        case AloomaFilterActionDrop:
+            return nil;
+        case AloomaFilterActionHash:
+            if ([value isKindOfClass:[NSString class]] || [value isKindOfClass:[NSNumber class]]) {
+                return [self hashValue:value];
+            }
+            // collections could carry the very data the rule protects
+            return value == [NSNull null] ? value : nil;
+        case AloomaFilterActionTruncate:
+            if ([value isKindOfClass:[NSString class]] && [value length] > rule->length) {
+                NSUInteger end = [value rangeOfComposedCharacterSequenceAtIndex:rule->length].location;
+                return [value substringToIndex:end];
+            }
+            return value;
+        case AloomaFilterActionNone:
+            return value;
+    }
+    return value;
+}
+
+// key rules and patterns for a value found anywhere in the event; containers
+// are copied only when something inside them changes
+- (id)filterValue:(id)value rule:(const AloomaFilterRule *)rule
+{
+    if (rule && rule->action != AloomaFilterActionNone) {
+        return [self applyRule:rule toValue:value];
+    }
+    if ([value isKindOfClass:[NSString class]]) {
+        if (_patterns) {
+            char buffer[512];
+            long match = AloomaPatternSetMatch(_patterns, AloomaUTF8(value, buffer, sizeof(buffer)));
+            if (match >= 0) {
+                return [self applyRule:&_patternRules[match] toValue:value];
+            }
+        }
+        return value;
+    }
+    if (!_hasRules) {
+        return value;
+    }
+    if ([value isKindOfClass:[NSDictionary class]]) {
+        NSMutableDictionary *copy = nil;
+        for (id key in value) {
+            id item = value[key];
+            id filtered = [self filterValue:item rule:[key isKindOfClass:[NSString class]] ? [self ruleForKey:key] : NULL];
+            if (filtered != item) {
+                copy = copy ?: [value mutableCopy];
+                if (filtered) {
+                    copy[key] = filtered;
+                } else {
+                    [copy removeObjectForKey:key];
+                }
+            }
+        }
+        return copy ?: value;
+    }
+    if ([value isKindOfClass:[NSArray class]]) {
+        NSMutableArray *copy = nil;
+        NSUInteger index = 0;
+        for (id item in value) {
+            id filtered = [self filterValue:item rule:NULL];
+            if (filtered != item && copy == nil) {
+                copy = [[value subarrayWithRange:NSMakeRange(0, index)] mutableCopy];
+            }
+            if (copy && filtered) {
+                [copy addObject:filtered];
+            }
+            index++;
+        }
+        return copy ?: value;
+    }
+    return value;
+}
+
+- (const AloomaFilterRule *)ruleForKey:(NSString *)key
+{
+    char buffer[128];
+    const char *bytes = AloomaUTF8(key, buffer, sizeof(buffer));
+    long index = AloomaKeyTableFind(_keys, bytes, strlen(bytes));
+    return index >= 0 ? &_keyRules[index] : NULL;
+}
+
+- (void)filterProperties:(NSMutableDictionary *)properties
+{
+    for (NSString *key in [properties allKeys]) {
+        if (AloomaIsEventField(key)) {
+            continue;
+        }
+        const AloomaFilterRule *rule = [self ruleForKey:key];
+        if (_allowList && !(rule && rule->allowed) && !AloomaIsLibraryProperty(key)) {
+            [properties removeObjectForKey:key];
+            continue;
+        }
+        id value = properties[key];
+        id filtered = [self filterValue:value rule:rule];
+        if (filtered == nil) {
+            [properties removeObjectForKey:key];
+        } else if (filtered != value) {
+            properties[key] = filtered;
+        }
+    }
+}
+
+@end
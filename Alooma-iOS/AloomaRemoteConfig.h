@@ -0,0 +1,67 @@
+#import <Foundation/Foundation.h>
+
+/*!
+ @class
+ Server-driven configuration document.
+
+ @abstract
+ Verifies and decodes the signed configuration served by the collector at
+ <code>/config/&lt;token&gt;</code>.
+
+ @discussion
+ The document is a JSON object with two strings:
+ <pre>
+ {"payload": "&lt;base64 encoded JSON object&gt;",
+  "signature": "&lt;base64 DER ECDSA P-256 SHA-256 signature of the payload string&gt;"}
+ </pre>
+ The signature is computed over the base64 payload string exactly as sent, so
+ no JSON canonicalisation is needed. The collector signs with its private key;
+ the app only holds the public key, set as <code>-[Alooma remoteConfigKey]</code>.
+ Documents that fail verification are ignored. Verification needs iOS 10.
+
+ The payload must set <code>version</code>, a positive integer the collector
+ increases with every change; the library ignores documents older than the
+ one it has. <code>expires</code>, in seconds since 1970, optionally limits
+ how long a document is applied.
+
+ Other recognised payload keys, all optional: <code>enabled</code> (kill switch),
+ <code>flush_interval</code>, <code>batch_size</code>,
+ <code>batch_bytes</code>, <code>max_queue_size</code>,
+ <code>compression</code> (<code>none</code> or <code>gzip</code>),
+ <code>sampling</code> (event name or <code>*</code> to rate),
+ <code>rate_limits</code> (event name or <code>*</code> to
+ <code>{"per_second": n, "burst": n}</code>; 0 per second drops the event,
+ no <code>per_second</code> means no limit) and
+ <code>refresh_interval</code>.
+ */
+@interface AloomaRemoteConfig : NSObject
+
+/*!
+ @method
+
+ @abstract
+ Returns a config for a signed document, or nil if it is malformed, has no
+ version, or the signature does not verify with the public key, given as
+ base64 of the uncompressed X9.63 point or of its DER SubjectPublicKeyInfo.
+ Expired documents are returned so that their version still counts.
+ */
++ (instancetype)configWithDocument:(NSData *)document publicKey:(NSString *)publicKey;
+
+@property (nonatomic, readonly, copy) NSData *document;
+@property (nonatomic, readonly, copy) NSDictionary *payload;
+@property (nonatomic, readonly) NSNumber *version;
+@property (nonatomic, readonly) NSNumber *expires;
+@property (nonatomic, readonly, getter=isExpired) BOOL expired;
+
+// nil when the payload does not set the value, or sets it to something invalid
+@property (nonatomic, readonly) NSNumber *enabled;
+@property (nonatomic, readonly) NSNumber *flushInterval;
+@property (nonatomic, readonly) NSNumber *batchSize;
+@property (nonatomic, readonly) NSNumber *batchBytes;
+@property (nonatomic, readonly) NSNumber *maxQueueSize;
+@property (nonatomic, readonly) NSNumber *refreshInterval;
+@property (nonatomic, readonly) NSString *compression;
+@property (nonatomic, readonly) NSDictionary *sampling;
+@property (nonatomic, readonly) NSDictionary *rateLimits;
+
+@end
@@ -0,0 +1,209 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import "AloomaFeatures.h"
+
+#if !defined(ALOOMA_MINIMAL_TRANSPORT)
+#import <Security/Security.h>
+#endif
+
+#import "AloomaLogger.h"
+#import "AloomaRemoteConfig.h"
+
+// an uncompressed X9.63 point: 0x04, then 32 bytes each of x and y
+static const NSUInteger kPublicKeyLength = 65;
+// the DER SubjectPublicKeyInfo prefix openssl puts in front of a P-256 point
+static const unsigned char kSubjectPublicKeyInfoPrefix[] = {
+    0x30, 0x59, 0x30, 0x13, 0x06, 0x07, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x02, 0x01,
+    0x06, 0x08, 0x2a, 0x86, 0x48, 0xce, 0x3d, 0x03, 0x01, 0x07, 0x03, 0x42, 0x00
+};
+
+@implementation AloomaRemoteConfig
+
+// nil unless the string is base64. Only called once iOS 10 is known to be
+// there, so the iOS 7 NSData method is safe on an iOS 6 deployment target.
+static NSData *AloomaBase64Decode(NSString *string)
+{
+    return [[NSData alloc] initWithBase64EncodedString:string options:NSDataBase64DecodingIgnoreUnknownCharacters];
+}
+
+static NSData *AloomaPublicKeyData(NSString *publicKey)
+{
+    NSData *data = AloomaBase64Decode(publicKey);
+    if ([data length] == sizeof(kSubjectPublicKeyInfoPrefix) + kPublicKeyLength &&
+        memcmp([data bytes], kSubjectPublicKeyInfoPrefix, sizeof(kSubjectPublicKeyInfoPrefix)) == 0) {
+        data = [data subdataWithRange:NSMakeRange(sizeof(kSubjectPublicKeyInfoPrefix), kPublicKeyLength)];
+    }
+    if ([data length] != kPublicKeyLength || ((const unsigned char *)[data bytes])[0] != 0x04) {
+        return nil;
+    }
+    return data;
+}
+
+static BOOL AloomaVerifySignature(NSData *message, NSString *signatureString, NSString *publicKey)
+{
+#if defined(ALOOMA_MINIMAL_TRANSPORT)
+    return NO;
+#else
+    if (@available(iOS 10.0, *)) {
+        NSData *keyData = AloomaPublicKeyData(publicKey);
+        if (keyData == nil) {
+            AloomaError(@"remote config key is not a base64 P-256 public key");
+            return NO;
+        }
+        NSData *signature = AloomaBase64Decode(signatureString);
+        if ([signature length] == 0) {
+            return NO;
+        }
+        NSDictionary *attributes = @{(__bridge id)kSecAttrKeyType: (__bridge id)kSecAttrKeyTypeECSECPrimeRandom,
+                                     (__bridge id)kSecAttrKeyClass: (__bridge id)kSecAttrKeyClassPublic,
+                                     (__bridge id)kSecAttrKeySizeInBits: @256};
+        SecKeyRef key = SecKeyCreateWithData((__bridge CFDataRef)keyData, (__bridge CFDictionaryRef)attributes, NULL);
+        if (key == NULL) {
+            AloomaError(@"remote config key is not a valid P-256 public key");
+            return NO;
+        }
+        BOOL valid = SecKeyVerifySignature(key, kSecKeyAlgorithmECDSASignatureMessageX962SHA256,
+                                           (__bridge CFDataRef)message, (__bridge CFDataRef)signature, NULL);
+        CFRelease(key);
+        return valid;
+    }
+    AloomaError(@"remote config needs iOS 10 or later to verify signatures");
+    return NO;
+#endif
+}
+
++ (instancetype)configWithDocument:(NSData *)document publicKey:(NSString *)publicKey
+{
+    if ([document length] == 0 || [publicKey length] == 0) {
+        return nil;
+    }
+    NSDictionary *envelope = nil;
+    @try {
+        envelope = [NSJSONSerialization JSONObjectWithData:document options:0 error:NULL];
+    }
+    @catch (NSException *exception) {
+        envelope = nil;
+    }
+    if (![envelope isKindOfClass:[NSDictionary class]] ||
+        ![envelope[@"payload"] isKindOfClass:[NSString class]] ||
+        ![envelope[@"signature"] isKindOfClass:[NSString class]]) {
+        AloomaError(@"malformed remote config document");
+        return nil;
+    }
+
+    NSData *payloadString = [envelope[@"payload"] dataUsingEncoding:NSUTF8StringEncoding];
+    if (!AloomaVerifySignature(payloadString, envelope[@"signature"], publicKey)) {
+        AloomaError(@"remote config signature does not verify, ignoring document");
+        return nil;
+    }
+
+    NSData *payloadData = AloomaBase64Decode(envelope[@"payload"]);
+    NSDictionary *payload = nil;
+    @try {
+        payload = payloadData ? [NSJSONSerialization JSONObjectWithData:payloadData options:0 error:NULL] : nil;
+    }
+    @catch (NSException *exception) {
+        payload = nil;
+    }
+    if (![payload isKindOfClass:[NSDictionary class]]) {
+        AloomaError(@"remote config payload is not a JSON object");
+        return nil;
+    }
+
+    AloomaRemoteConfig *config = [[self alloc] init];
+    config->_document = [document copy];
+    config->_payload = [payload copy];
+    if (config.version == nil) {
+        AloomaError(@"remote config payload has no version, ignoring document");
+        return nil;
+    }
+    return config;
+}
+
+- (NSNumber *)numberForKey:(NSString *)key minimum:(double)minimum
+{
+    id value = self.payload[key];
+    if (![value isKindOfClass:[NSNumber class]] || [value doubleValue] < minimum) {
+        return nil;
+    }
+    return value;
+}
+
+- (NSNumber *)version
+{
+    id value = self.payload[@"version"];
+    if (![value isKindOfClass:[NSNumber class]] || [value longLongValue] < 1 || [value doubleValue] != [value longLongValue]) {
+        return nil;
+    }
+    return value;
+}
+
+- (NSNumber *)expires
+{
+    return [self numberForKey:@"expires" minimum:0];
+}
+
+- (BOOL)isExpired
+{
+    return self.expires != nil && [self.expires doubleValue] <= [[NSDate date] timeIntervalSince1970];
+}
+
+- (NSNumber *)enabled
+{
+    return [self numberForKey:@"enabled" minimum:0];
+}
+
+- (NSNumber *)flushInterval
+{
+    return [self numberForKey:@"flush_interval" minimum:0];
+}
+
+- (NSNumber *)batchSize
+{
+    return [self numberForKey:@"batch_size" minimum:1];
+}
+
+- (NSNumber *)batchBytes
+{
+    return [self numberForKey:@"batch_bytes" minimum:0];
+}
+
+- (NSNumber *)maxQueueSize
+{
+    return [self numberForKey:@"max_queue_size" minimum:1];
+}
+
+- (NSNumber *)refreshInterval
+{
+    return [self numberForKey:@"refresh_interval" minimum:60];
+}
+
+- (NSString *)compression
+{
+    id value = self.payload[@"compression"];
+    if ([value isEqual:@"none"] || [value isEqual:@"gzip"]) {
+        return value;
+    }
+    return nil;
+}
+
+- (NSDictionary *)sampling
+{
+    id value = self.payload[@"sampling"];
+    return [value isKindOfClass:[NSDictionary class]] ? value : nil;
+}
+
+- (NSDictionary *)rateLimits
+{
+    id value = self.payload[@"rate_limits"];
+    return [value isKindOfClass:[NSDictionary class]] ? value : nil;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat:@"<AloomaRemoteConfig: %p %@>", self, self.payload];
+}
+
+@end
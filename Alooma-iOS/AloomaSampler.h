@@ -0,0 +1,59 @@
+#import <Foundation/Foundation.h>
+
+/*!
+ @class
+ Ingest sampling and rate limiting.
+
+ @abstract
+ Decides per event name whether a <code>track:</code> call is kept, before
+ any property work is done.
+
+ @discussion
+ A rule combines an optional sample rate with an optional token bucket. Events
+ are sampled first, then the survivors are rate limited. Rules set for a nil
+ event name apply to every event without a rule of its own. With no rules
+ installed <code>admitEvent:</code> returns without taking a lock.
+ */
+@interface AloomaSampler : NSObject
+
+- (void)setSampleRate:(double)rate forEvent:(NSString *)event;
+- (void)setRateLimit:(double)eventsPerSecond burst:(NSUInteger)burst forEvent:(NSString *)event;
+- (void)removeRulesForEvent:(NSString *)event;
+- (void)removeAllRules;
+
+/*!
+ @method
+
+ @abstract
+ Returns 0 if the event should be dropped, otherwise its sample weight.
+
+ @discussion
+ The weight is the inverse of the sample rate that applied, so 1 for events
+ that are not sampled, plus the weight of the events the rate limit dropped
+ since the last one it let through.
+ */
+- (double)admitEvent:(NSString *)event;
+
+/*!
+ @method
+
+ @abstract
+ Counts an event dropped elsewhere in the pipeline, e.g. as a duplicate.
+ */
+- (void)recordSuppressedEvent:(NSString *)event reason:(NSString *)reason;
+
+/*!
+ @method
+
+ @abstract
+ Returns the number of events dropped so far.
+
+ @discussion
+ The dictionary maps a reason, <code>sampled_out</code>,
+ <code>rate_limited</code> or one passed to
+ <code>recordSuppressedEvent:reason:</code>, to a dictionary of event names to
+ counts. Events without a name are counted under <code>$custom_event</code>.
+ */
+- (NSDictionary *)suppressedCounts;
+
+@end
@@ -0,0 +1,196 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import <math.h>
+
+#import "AloomaSampler.h"
+#import "AloomaClock.h"
+#import "AloomaLogger.h"
+
+const double AloomaRateUnlimited = INFINITY;
+
+static NSString * const kUnnamedEvent = @"$custom_event";
+static NSString * const kSampledOut = @"sampled_out";
+static NSString * const kRateLimited = @"rate_limited";
+
+@interface AloomaSamplingRule : NSObject
+{
+@public
+    double _sampleRate;
+    double _ratePerSecond;  // AloomaRateUnlimited disables the token bucket, 0 drops all
+    double _burst;
+    double _tokens;
+    double _lastRefill;
+    double _carriedWeight;  // of rate limited events, added to the next one kept
+}
+
+@end
+
+@implementation AloomaSamplingRule
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _sampleRate = 1.0;
+        _ratePerSecond = AloomaRateUnlimited;
+    }
+    return self;
+}
+
+@end
+
+@interface AloomaSampler ()
+{
+    // read without the lock on the fast path; a stale value only means one
+    // more or one less locked lookup
+    volatile BOOL _hasRules;
+}
+
+@property (nonatomic, strong) NSMutableDictionary *rules;
+@property (nonatomic, strong) AloomaSamplingRule *defaultRule;
+@property (nonatomic, strong) NSMutableDictionary *suppressed;
+
+@end
+
+@implementation AloomaSampler
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _rules = [NSMutableDictionary dictionary];
+        _suppressed = [NSMutableDictionary dictionary];
+    }
+    return self;
+}
+
+// must be called while holding the lock on self
+- (AloomaSamplingRule *)ruleForSettingEvent:(NSString *)event
+{
+    AloomaSamplingRule *rule = event ? self.rules[event] : self.defaultRule;
+    if (rule == nil) {
+        rule = [[AloomaSamplingRule alloc] init];
+        if (event) {
+            self.rules[event] = rule;
+        } else {
+            self.defaultRule = rule;
+        }
+        _hasRules = YES;
+    }
+    return rule;
+}
+
+- (void)setSampleRate:(double)rate forEvent:(NSString *)event
+{
+    if (!(rate > 0 && rate <= 1)) {
+        AloomaError(@"%@ sample rate must be in (0, 1], got %f", self, rate);
+        return;
+    }
+    @synchronized(self) {
+        [self ruleForSettingEvent:event]->_sampleRate = rate;
+    }
+}
+
+- (void)setRateLimit:(double)eventsPerSecond burst:(NSUInteger)burst forEvent:(NSString *)event
+{
+    if (!(eventsPerSecond >= 0)) {
+        AloomaError(@"%@ rate limit must not be negative, got %f", self, eventsPerSecond);
+        return;
+    }
+    @synchronized(self) {
+        AloomaSamplingRule *rule = [self ruleForSettingEvent:event];
+        rule->_ratePerSecond = eventsPerSecond;
+        rule->_burst = MAX((double)burst, 1.0);
+        rule->_tokens = rule->_burst;
+        rule->_lastRefill = AloomaClockNow();
+    }
+}
+
+- (void)removeRulesForEvent:(NSString *)event
+{
+    @synchronized(self) {
+        if (event) {
+            [self.rules removeObjectForKey:event];
+        } else {
+            self.defaultRule = nil;
+        }
+        _hasRules = self.defaultRule != nil || [self.rules count] > 0;
+    }
+}
+
+- (void)removeAllRules
+{
+    @synchronized(self) {
+        [self.rules removeAllObjects];
+        self.defaultRule = nil;
+        _hasRules = NO;
+    }
+}
+
+// must be called while holding the lock on self
+- (void)countSuppressedEvent:(NSString *)event reason:(NSString *)reason
+{
+    NSMutableDictionary *counts = self.suppressed[reason];
+    if (counts == nil) {
+        counts = [NSMutableDictionary dictionary];
+        self.suppressed[reason] = counts;
+    }
+    NSString *key = event ?: kUnnamedEvent;
+    counts[key] = @([counts[key] unsignedLongLongValue] + 1);
+}
+
+- (void)recordSuppressedEvent:(NSString *)event reason:(NSString *)reason
+{
+    @synchronized(self) {
+        [self countSuppressedEvent:event reason:reason];
+    }
+}
+
+- (double)admitEvent:(NSString *)event
+{
+    if (!_hasRules) {
+        return 1.0;
+    }
+    @synchronized(self) {
+        AloomaSamplingRule *rule = event ? self.rules[event] : nil;
+        if (rule == nil) {
+            rule = self.defaultRule;
+        }
+        if (rule == nil) {
+            return 1.0;
+        }
+        if (rule->_sampleRate < 1.0 && arc4random() >= rule->_sampleRate * 4294967296.0) {
+            [self countSuppressedEvent:event reason:kSampledOut];
+            return 0;
+        }
+        double weight = 1.0 / rule->_sampleRate;
+        if (rule->_ratePerSecond != AloomaRateUnlimited) {
+            double now = AloomaClockNow();
+            double elapsed = MAX(now - rule->_lastRefill, 0.0);
+            rule->_tokens = MIN(rule->_burst, rule->_tokens + elapsed * rule->_ratePerSecond);
+            rule->_lastRefill = now;
+            if (rule->_ratePerSecond == 0 || rule->_tokens < 1.0) {
+                rule->_carriedWeight += weight;
+                [self countSuppressedEvent:event reason:kRateLimited];
+                return 0;
+            }
+            rule->_tokens -= 1.0;
+            weight += rule->_carriedWeight;
+            rule->_carriedWeight = 0;
+        }
+        return weight;
+    }
+}
+
+- (NSDictionary *)suppressedCounts
+{
+    @synchronized(self) {
+        NSMutableDictionary *counts = [NSMutableDictionary dictionaryWithDictionary:@{kSampledOut: @{}, kRateLimited: @{}}];
+        for (NSString *reason in self.suppressed) {
+            counts[reason] = [self.suppressed[reason] copy];
+        }
+        return counts;
+    }
+}
+
+@end
@@ -0,0 +1,65 @@
+#import <Foundation/Foundation.h>
+
+/*!
+ @class
+ Process-wide timer shared by every Alooma instance.
+
+ @abstract
+ One timer that drives every periodic task.
+
+ @discussion
+ Timers are kept in a hashed timing wheel with a one second tick and driven
+ by a single dispatch timer that is only armed for the earliest deadline;
+ timers due within the same tick fire from one wakeup.
+ Repeating timers are aligned to multiples of their interval, so that timers
+ with the same interval, such as the flush timers of several instances, fire
+ together. The dispatch timer runs on a queue of its own and only hands
+ each due block to the queue it was scheduled on, so a busy queue delays its
+ own timers and no others.
+ */
+@interface AloomaScheduler : NSObject
+
+/*!
+ @method
+
+ @abstract
+ Returns the scheduler of the process.
+ */
++ (instancetype)sharedScheduler;
+
+/*!
+ @property
+
+ @abstract
+ How many times the timer has woken up so far.
+ */
+@property (atomic, readonly) NSUInteger wakeups;
+
+/*!
+ @method
+
+ @abstract
+ Runs a block on a queue after a delay, and then every interval if repeats
+ is set.
+
+ @discussion
+ Deadlines are rounded up to the next tick, so a timer fires up to a second
+ late. A repeating timer that misses several periods, for example while the
+ app is suspended, fires once. Returns an identifier for
+ <code>cancelTimer:</code>, 0 if the timer could not be created.
+ */
+- (uint64_t)scheduleTimerWithInterval:(NSTimeInterval)interval
+                              repeats:(BOOL)repeats
+                                queue:(dispatch_queue_t)queue
+                                block:(void (^)(void))block;
+
+/*!
+ @method
+
+ @abstract
+ Stops a timer. Its block does not run again once this returns, unless it
+ has already started. Unknown identifiers are ignored.
+ */
+- (void)cancelTimer:(uint64_t)timer;
+
+@end
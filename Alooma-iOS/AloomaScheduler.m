@@ -0,0 +1,199 @@
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import "AloomaScheduler.h"
+#import "AloomaTimerWheel.h"
+
+static const NSTimeInterval kSchedulerTick = 1.0;
+static const NSTimeInterval kSchedulerLeeway = 0.1;
+// one turn covers a little over eight minutes; later deadlines take more turns
+static const size_t kSchedulerSlots = 512;
+
+@interface AloomaScheduledTimer : NSObject
+
+@property (nonatomic, assign) uint64_t identifier;
+@property (nonatomic, strong) dispatch_queue_t queue;
+@property (nonatomic, copy) void (^block)(void);
+@property (nonatomic, assign) BOOL repeats;
+@property (atomic, assign) BOOL cancelled;
+
+@end
+
+@implementation AloomaScheduledTimer
+
+@end
+
+@interface AloomaScheduler ()
+{
+    AloomaTimerWheel *_wheel;
+    dispatch_source_t _source;
+    NSMutableDictionary *_timers;
+    NSMutableArray *_fired;
+    double _armedDeadline;
+}
+
+@property (atomic, readwrite) NSUInteger wakeups;
+
+- (void)timerFired:(uint64_t)timer;
+
+@end
+
+static void AloomaSchedulerFire(uint64_t timer, void *context, void *info)
+{
+    [(__bridge AloomaScheduler *)info timerFired:timer];
+}
+
+@implementation AloomaScheduler
+
++ (instancetype)sharedScheduler
+{
+    static AloomaScheduler *sharedScheduler;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedScheduler = [[self alloc] init];
+    });
+    return sharedScheduler;
+}
+
+- (instancetype)init
+{
+    if (self = [super init]) {
+        _timers = [NSMutableDictionary dictionary];
+        _fired = [NSMutableArray array];
+        _wheel = AloomaTimerWheelCreate(kSchedulerTick, kSchedulerSlots, [self now]);
+        _armedDeadline = -1;
+
+        // a queue of its own, so timers fire while the queues they run blocks on are busy
+        dispatch_queue_t queue = dispatch_queue_create("com.alooma.scheduler", DISPATCH_QUEUE_SERIAL);
+        _source = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, queue);
+        dispatch_source_set_timer(_source, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        dispatch_source_set_event_handler(_source, ^{
+            [self advance];
+        });
+        dispatch_resume(_source);
+    }
+    return self;
+}
+
+- (void)dealloc
+{
+    dispatch_source_cancel(_source);
+    AloomaTimerWheelDestroy(_wheel);
+}
+
+- (NSString *)description
+{
+    @synchronized(self) {
+        return [NSString stringWithFormat:@"<AloomaScheduler: %p %lu timers>", self, (unsigned long)[_timers count]];
+    }
+}
+
+// the same clock as dispatch_time, which also stops while the device sleeps
+- (double)now
+{
+    return [[NSProcessInfo processInfo] systemUptime];
+}
+
+#pragma mark - Timers
+
+- (uint64_t)scheduleTimerWithInterval:(NSTimeInterval)interval
+                              repeats:(BOOL)repeats
+                                queue:(dispatch_queue_t)queue
+                                block:(void (^)(void))block
+{
+    if (block == nil || queue == nil || _wheel == NULL) {
+        return 0;
+    }
+    AloomaScheduledTimer *entry = [[AloomaScheduledTimer alloc] init];
+    entry.queue = queue;
+    entry.block = block;
+    entry.repeats = repeats && interval > 0;
+
+    double now = [self now];
+    double delay = interval;
+    if (entry.repeats) {
+        // the next multiple of the interval, shared by every timer with the same interval
+        delay = interval - fmod(now, interval);
+    }
+    @synchronized(self) {
+        entry.identifier = AloomaTimerWheelSchedule(_wheel, now, delay, entry.repeats ? interval : 0, NULL);
+        if (entry.identifier == 0) {
+            return 0;
+        }
+        _timers[@(entry.identifier)] = entry;
+        [self rearm];
+        return entry.identifier;
+    }
+}
+
+- (void)cancelTimer:(uint64_t)timer
+{
+    @synchronized(self) {
+        AloomaScheduledTimer *entry = _timers[@(timer)];
+        if (entry == nil) {
+            return;
+        }
+        entry.cancelled = YES;
+        [_timers removeObjectForKey:@(timer)];
+        if (AloomaTimerWheelCancel(_wheel, timer)) {
+            [self rearm];
+        }
+    }
+}
+
+// called with the lock held
+- (void)rearm
+{
+    double deadline = AloomaTimerWheelNextDeadline(_wheel);
+    if (deadline == _armedDeadline) {
+        return;
+    }
+    _armedDeadline = deadline;
+    if (deadline < 0) {
+        dispatch_source_set_timer(_source, DISPATCH_TIME_FOREVER, DISPATCH_TIME_FOREVER, 0);
+        return;
+    }
+    double delay = MAX(0, deadline - [self now]);
+    dispatch_source_set_timer(_source,
+                              dispatch_time(DISPATCH_TIME_NOW, (int64_t)(delay * NSEC_PER_SEC)),
+                              DISPATCH_TIME_FOREVER,
+                              (uint64_t)(kSchedulerLeeway * NSEC_PER_SEC));
+}
+
+- (void)advance
+{
+    NSArray *fired;
+    @synchronized(self) {
+        self.wakeups++;
+        AloomaTimerWheelAdvance(_wheel, [self now], AloomaSchedulerFire, (__bridge void *)self);
+        fired = [_fired copy];
+        [_fired removeAllObjects];
+        // the source fires once per arming, so it always needs arming again
+        _armedDeadline = -2;
+        [self rearm];
+    }
+    for (AloomaScheduledTimer *entry in fired) {
+        dispatch_async(entry.queue, ^{
+            if (!entry.repeats) {
+                @synchronized(self) {
+                    [self->_timers removeObjectForKey:@(entry.identifier)];
+                }
+            }
+            if (!entry.cancelled) {
+                entry.block();
+            }
+        });
+    }
+}
+
+// called by the wheel from advance, with the lock held
+- (void)timerFired:(uint64_t)timer
+{
+    AloomaScheduledTimer *entry = _timers[@(timer)];
+    if (entry != nil) {
+        [_fired addObject:entry];
+    }
+}
+
+@end
@@ -0,0 +1,264 @@
+//
+//  AloomaSketch.c
+//  Alooma-iOS
+//
+
+#include "AloomaSketch.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// growth headroom, so a slowly drifting range does not reallocate per value
+#define kStoreHeadroom 16
+// magnitudes below this are counted as zero
+#define kMinIndexableValue 1e-9
+
+typedef struct {
+    int32_t offset;     // bin index of counts[0]
+    size_t length;
+    uint64_t *counts;
+} AloomaSketchStore;
+
+struct AloomaSketch {
+    double gamma;
+    double logGamma;
+    size_t maxBins;
+    AloomaSketchStore positive;
+    AloomaSketchStore negative;
+    uint64_t zeroCount;
+    uint64_t count;
+    double sum;
+    double min;
+    double max;
+};
+
+static int AloomaSketchStoreResize(AloomaSketchStore *store, int32_t index, size_t maxBins)
+{
+    int64_t lo, hi;
+    if (store->length == 0) {
+        lo = (int64_t)index - kStoreHeadroom;
+        hi = (int64_t)index + kStoreHeadroom;
+    } else {
+        lo = store->offset;
+        hi = (int64_t)store->offset + (int64_t)store->length - 1;
+        if (index < lo) {
+            lo = (int64_t)index - kStoreHeadroom;
+        }
+        if (index > hi) {
+            hi = (int64_t)index + kStoreHeadroom;
+        }
+    }
+    if (hi - lo + 1 > (int64_t)maxBins) {
+        lo = hi - (int64_t)maxBins + 1;
+    }
+    size_t length = (size_t)(hi - lo + 1);
+    uint64_t *counts = calloc(length, sizeof(uint64_t));
+    if (counts == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < store->length; i++) {
+        int64_t binIndex = (int64_t)store->offset + (int64_t)i;
+        // bins below the new range collapse into the lowest kept bin
+        counts[binIndex < lo ? 0 : (size_t)(binIndex - lo)] += store->counts[i];
+    }
+    free(store->counts);
+    store->counts = counts;
+    store->offset = (int32_t)lo;
+    store->length = length;
+    return 1;
+}
+
+static void AloomaSketchStoreAdd(AloomaSketchStore *store, int32_t index, uint64_t n, size_t maxBins)
+{
+    if (store->length == 0 || index < store->offset || (int64_t)index >= (int64_t)store->offset + (int64_t)store->length) {
+        if (!AloomaSketchStoreResize(store, index, maxBins)) {
+            return;
+        }
+    }
+    if (index < store->offset) {
+        index = store->offset;
+    }
+    store->counts[index - store->offset] += n;
+}
+
+static inline int32_t AloomaSketchIndex(const AloomaSketch *sketch, double magnitude)
+{
+    return (int32_t)ceil(log(magnitude) / sketch->logGamma);
+}
+
+static inline double AloomaSketchValue(const AloomaSketch *sketch, int32_t index)
+{
+    // midpoint of (gamma^(i-1), gamma^i] with bounded relative error
+    return 2.0 * pow(sketch->gamma, index) / (sketch->gamma + 1.0);
+}
+
+AloomaSketch *AloomaSketchCreate(double relativeAccuracy, size_t maxBins)
+{
+    if (!(relativeAccuracy > 0 && relativeAccuracy < 1) || maxBins == 0) {
+        return NULL;
+    }
+    AloomaSketch *sketch = calloc(1, sizeof(AloomaSketch));
+    if (sketch == NULL) {
+        return NULL;
+    }
+    sketch->gamma = (1.0 + relativeAccuracy) / (1.0 - relativeAccuracy);
+    sketch->logGamma = log(sketch->gamma);
+    sketch->maxBins = maxBins;
+    sketch->min = INFINITY;
+    sketch->max = -INFINITY;
+    return sketch;
+}
+
+void AloomaSketchDestroy(AloomaSketch *sketch)
+{
+    if (sketch == NULL) {
+        return;
+    }
+    free(sketch->positive.counts);
+    free(sketch->negative.counts);
+    free(sketch);
+}
+
+void AloomaSketchAdd(AloomaSketch *sketch, double value)
+{
+    // infinities have no bin, and would poison sum, min and max
+    if (!isfinite(value)) {
+        return;
+    }
+    if (value > kMinIndexableValue) {
+        AloomaSketchStoreAdd(&sketch->positive, AloomaSketchIndex(sketch, value), 1, sketch->maxBins);
+    } else if (value < -kMinIndexableValue) {
+        AloomaSketchStoreAdd(&sketch->negative, AloomaSketchIndex(sketch, -value), 1, sketch->maxBins);
+    } else {
+        sketch->zeroCount++;
+    }
+    sketch->count++;
+    sketch->sum += value;
+    if (value < sketch->min) {
+        sketch->min = value;
+    }
+    if (value > sketch->max) {
+        sketch->max = value;
+    }
+}
+
+int AloomaSketchMerge(AloomaSketch *into, const AloomaSketch *from)
+{
+    if (into->gamma != from->gamma) {
+        return 0;
+    }
+    for (size_t i = 0; i < from->positive.length; i++) {
+        if (from->positive.counts[i]) {
+            AloomaSketchStoreAdd(&into->positive, from->positive.offset + (int32_t)i, from->positive.counts[i], into->maxBins);
+        }
+    }
+    for (size_t i = 0; i < from->negative.length; i++) {
+        if (from->negative.counts[i]) {
+            AloomaSketchStoreAdd(&into->negative, from->negative.offset + (int32_t)i, from->negative.counts[i], into->maxBins);
+        }
+    }
+    into->zeroCount += from->zeroCount;
+    into->count += from->count;
+    into->sum += from->sum;
+    if (from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    return 1;
+}
+
+void AloomaSketchClear(AloomaSketch *sketch)
+{
+    if (sketch->positive.counts) {
+        memset(sketch->positive.counts, 0, sketch->positive.length * sizeof(uint64_t));
+    }
+    if (sketch->negative.counts) {
+        memset(sketch->negative.counts, 0, sketch->negative.length * sizeof(uint64_t));
+    }
+    sketch->zeroCount = 0;
+    sketch->count = 0;
+    sketch->sum = 0;
+    sketch->min = INFINITY;
+    sketch->max = -INFINITY;
+}
+
+uint64_t AloomaSketchCount(const AloomaSketch *sketch)
+{
+    return sketch->count;
+}
+
+double AloomaSketchSum(const AloomaSketch *sketch)
+{
+    return sketch->sum;
+}
+
+double AloomaSketchMin(const AloomaSketch *sketch)
+{
+    return sketch->count ? sketch->min : NAN;
+}
+
+double AloomaSketchMax(const AloomaSketch *sketch)
+{
+    return sketch->count ? sketch->max : NAN;
+}
+
+double AloomaSketchGamma(const AloomaSketch *sketch)
+{
+    return sketch->gamma;
+}
+
+uint64_t AloomaSketchZeroCount(const AloomaSketch *sketch)
+{
+    return sketch->zeroCount;
+}
+
+double AloomaSketchQuantile(const AloomaSketch *sketch, double q)
+{
+    if (sketch->count == 0 || q < 0 || q > 1) {
+        return NAN;
+    }
+    double rank = q * (double)(sketch->count - 1);
+    double seen = 0;
+    double value = sketch->max;
+    int found = 0;
+    // most negative values first: highest negative index down
+    for (size_t i = sketch->negative.length; i > 0 && !found; i--) {
+        seen += (double)sketch->negative.counts[i - 1];
+        if (seen > rank) {
+            value = -AloomaSketchValue(sketch, sketch->negative.offset + (int32_t)(i - 1));
+            found = 1;
+        }
+    }
+    if (!found) {
+        seen += (double)sketch->zeroCount;
+        if (seen > rank) {
+            value = 0;
+            found = 1;
+        }
+    }
+    for (size_t i = 0; i < sketch->positive.length && !found; i++) {
+        seen += (double)sketch->positive.counts[i];
+        if (seen > rank) {
+            value = AloomaSketchValue(sketch, sketch->positive.offset + (int32_t)i);
+            found = 1;
+        }
+    }
+    if (value < sketch->min) {
+        value = sketch->min;
+    }
+    if (value > sketch->max) {
+        value = sketch->max;
+    }
+    return value;
+}
+
+size_t AloomaSketchBins(const AloomaSketch *sketch, int negative, int32_t *offset, const uint64_t **counts)
+{
+    const AloomaSketchStore *store = negative ? &sketch->negative : &sketch->positive;
+    *offset = store->offset;
+    *counts = store->counts;
+    return store->length;
+}
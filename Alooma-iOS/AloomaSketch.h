@@ -0,0 +1,53 @@
+//
+//  AloomaSketch.h
+//  Alooma-iOS
+//
+//  DDSketch quantile sketch backing histogram aggregates. Values are counted
+//  in logarithmic bins so every quantile is reported within a fixed relative
+//  error, and two sketches with the same accuracy merge by adding bins.
+//
+
+#ifndef AloomaSketch_h
+#define AloomaSketch_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AloomaSketch AloomaSketch;
+
+// relativeAccuracy is in (0, 1), e.g. 0.01 for 1%. When a store needs more
+// than maxBins bins its lowest bins are collapsed together, trading accuracy
+// on the smallest magnitudes for bounded memory.
+AloomaSketch *AloomaSketchCreate(double relativeAccuracy, size_t maxBins);
+void AloomaSketchDestroy(AloomaSketch *sketch);
+
+// NaN and infinite values are ignored.
+void AloomaSketchAdd(AloomaSketch *sketch, double value);
+// Returns 0 if the sketches were created with different accuracies.
+int AloomaSketchMerge(AloomaSketch *into, const AloomaSketch *from);
+void AloomaSketchClear(AloomaSketch *sketch);
+
+uint64_t AloomaSketchCount(const AloomaSketch *sketch);
+double AloomaSketchSum(const AloomaSketch *sketch);
+double AloomaSketchMin(const AloomaSketch *sketch);
+double AloomaSketchMax(const AloomaSketch *sketch);
+double AloomaSketchGamma(const AloomaSketch *sketch);
+uint64_t AloomaSketchZeroCount(const AloomaSketch *sketch);
+
+// q in [0, 1]. Returns NAN for an empty sketch.
+double AloomaSketchQuantile(const AloomaSketch *sketch, double q);
+
+// Exposes the bins of the positive (negative == 0) or negative store, for
+// serialisation. Bin i holds values whose magnitude is in
+// (gamma^(offset+i-1), gamma^(offset+i)]. Returns the number of bins.
+size_t AloomaSketchBins(const AloomaSketch *sketch, int negative, int32_t *offset, const uint64_t **counts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,364 @@
+//
+//  AloomaStaging.c
+//  Alooma-iOS
+//
+//  Buffers are found through a pthread key per staging. Each has a spin
+//  lock that only its own thread takes on append, and the consumer on a
+//  flush, so it stays uncontended. A full chunk is pushed onto the sealed
+//  stack while that lock is held, and a flush locks every buffer before it
+//  takes the stack, so a merge never sees a thread's later records without
+//  its earlier ones.
+//
+
+#include "AloomaStaging.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+typedef struct {
+    double timestamp;
+    uint64_t sequence;
+    void *item;
+} AloomaStagedRecord;
+
+typedef struct AloomaStagingChunk {
+    struct AloomaStagingChunk *next;
+    uint32_t thread;
+    size_t count;
+    AloomaStagedRecord records[];
+} AloomaStagingChunk;
+
+typedef struct AloomaStagingBuffer {
+    _Alignas(64) atomic_flag lock;
+    AloomaStagingChunk *chunk;  // NULL until the next append
+    uint64_t sequence;
+    uint32_t thread;
+    AloomaStaging *staging;
+    struct AloomaStagingBuffer *previous;
+    struct AloomaStagingBuffer *next;
+} AloomaStagingBuffer;
+
+struct AloomaStaging {
+    pthread_key_t key;
+    size_t capacity;
+    AloomaStagingSealFunction sealed;
+    void *info;
+    pthread_mutex_t registryLock;
+    AloomaStagingBuffer *buffers;
+    uint32_t threads;
+    _Alignas(64) _Atomic(AloomaStagingChunk *) sealedChunks;
+};
+
+static inline void AloomaStagingLock(AloomaStagingBuffer *buffer)
+{
+    while (atomic_flag_test_and_set_explicit(&buffer->lock, memory_order_acquire)) {
+        sched_yield();
+    }
+}
+
+static inline void AloomaStagingUnlock(AloomaStagingBuffer *buffer)
+{
+    atomic_flag_clear_explicit(&buffer->lock, memory_order_release);
+}
+
+static void AloomaStagingPush(AloomaStaging *staging, AloomaStagingChunk *chunk)
+{
+    // only the consumer removes, and always the whole stack, so there is no ABA
+    AloomaStagingChunk *head = atomic_load_explicit(&staging->sealedChunks, memory_order_relaxed);
+    do {
+        chunk->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&staging->sealedChunks, &head, chunk,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+static void AloomaStagingThreadExit(void *value)
+{
+    AloomaStagingBuffer *buffer = value;
+    AloomaStaging *staging = buffer->staging;
+    pthread_mutex_lock(&staging->registryLock);
+    if (buffer->previous != NULL) {
+        buffer->previous->next = buffer->next;
+    } else {
+        staging->buffers = buffer->next;
+    }
+    if (buffer->next != NULL) {
+        buffer->next->previous = buffer->previous;
+    }
+    pthread_mutex_unlock(&staging->registryLock);
+
+    // a flush may still hold the lock it took before the buffer was unlinked
+    AloomaStagingLock(buffer);
+    AloomaStagingChunk *chunk = buffer->chunk;
+    int sealed = chunk != NULL && chunk->count > 0;
+    if (sealed) {
+        AloomaStagingPush(staging, chunk);
+    } else {
+        free(chunk);
+    }
+    AloomaStagingUnlock(buffer);
+    free(buffer);
+    if (sealed && staging->sealed != NULL) {
+        staging->sealed(staging, staging->info);
+    }
+}
+
+AloomaStaging *AloomaStagingCreate(size_t capacity, AloomaStagingSealFunction sealed, void *info)
+{
+    if (capacity == 0) {
+        return NULL;
+    }
+    AloomaStaging *staging = calloc(1, sizeof(AloomaStaging));
+    if (staging == NULL) {
+        return NULL;
+    }
+    if (pthread_key_create(&staging->key, AloomaStagingThreadExit) != 0) {
+        free(staging);
+        return NULL;
+    }
+    pthread_mutex_init(&staging->registryLock, NULL);
+    staging->capacity = capacity;
+    staging->sealed = sealed;
+    staging->info = info;
+    atomic_init(&staging->sealedChunks, NULL);
+    return staging;
+}
+
+void AloomaStagingDestroy(AloomaStaging *staging)
+{
+    if (staging == NULL) {
+        return;
+    }
+    // from here on exiting threads no longer call AloomaStagingThreadExit
+    pthread_key_delete(staging->key);
+    AloomaStagingBuffer *buffer = staging->buffers;
+    while (buffer != NULL) {
+        AloomaStagingBuffer *next = buffer->next;
+        free(buffer->chunk);
+        free(buffer);
+        buffer = next;
+    }
+    AloomaStagingChunk *chunk = atomic_exchange(&staging->sealedChunks, NULL);
+    while (chunk != NULL) {
+        AloomaStagingChunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    pthread_mutex_destroy(&staging->registryLock);
+    free(staging);
+}
+
+static AloomaStagingBuffer *AloomaStagingRegister(AloomaStaging *staging)
+{
+    void *memory = NULL;
+    if (posix_memalign(&memory, 64, sizeof(AloomaStagingBuffer)) != 0) {
+        return NULL;
+    }
+    AloomaStagingBuffer *buffer = memory;
+    atomic_flag_clear(&buffer->lock);
+    buffer->chunk = NULL;
+    buffer->sequence = 0;
+    buffer->staging = staging;
+    buffer->previous = NULL;
+    pthread_mutex_lock(&staging->registryLock);
+    buffer->thread = staging->threads++;
+    buffer->next = staging->buffers;
+    if (buffer->next != NULL) {
+        buffer->next->previous = buffer;
+    }
+    staging->buffers = buffer;
+    pthread_mutex_unlock(&staging->registryLock);
+    if (pthread_setspecific(staging->key, buffer) != 0) {
+        AloomaStagingThreadExit(buffer);
+        return NULL;
+    }
+    return buffer;
+}
+
+int AloomaStagingAppend(AloomaStaging *staging, double timestamp, void *item)
+{
+    AloomaStagingBuffer *buffer = pthread_getspecific(staging->key);
+    if (buffer == NULL && (buffer = AloomaStagingRegister(staging)) == NULL) {
+        return 0;
+    }
+    AloomaStagingLock(buffer);
+    AloomaStagingChunk *chunk = buffer->chunk;
+    if (chunk == NULL) {
+        chunk = malloc(sizeof(AloomaStagingChunk) + staging->capacity * sizeof(AloomaStagedRecord));
+        if (chunk == NULL) {
+            AloomaStagingUnlock(buffer);
+            return 0;
+        }
+        chunk->thread = buffer->thread;
+        chunk->count = 0;
+        buffer->chunk = chunk;
+    }
+    AloomaStagedRecord *record = &chunk->records[chunk->count++];
+    record->timestamp = timestamp;
+    record->sequence = buffer->sequence++;
+    record->item = item;
+    int sealed = chunk->count == staging->capacity;
+    if (sealed) {
+        buffer->chunk = NULL;
+        AloomaStagingPush(staging, chunk);
+    }
+    AloomaStagingUnlock(buffer);
+    if (sealed && staging->sealed != NULL) {
+        staging->sealed(staging, staging->info);
+    }
+    return 1;
+}
+
+// by thread, then by the order the thread filled them
+static int AloomaStagingCompareChunks(const void *a, const void *b)
+{
+    const AloomaStagingChunk *x = *(AloomaStagingChunk * const *)a;
+    const AloomaStagingChunk *y = *(AloomaStagingChunk * const *)b;
+    if (x->thread != y->thread) {
+        return x->thread < y->thread ? -1 : 1;
+    }
+    uint64_t first = x->records[0].sequence;
+    uint64_t second = y->records[0].sequence;
+    return first < second ? -1 : first > second;
+}
+
+typedef struct {
+    AloomaStagingChunk **chunks;  // this thread's, in order
+    size_t count;
+    size_t chunk;
+    size_t record;
+    double timestamp;             // of the next record
+    uint32_t thread;
+} AloomaStagingRun;
+
+static inline int AloomaStagingRunBefore(const AloomaStagingRun *a, const AloomaStagingRun *b)
+{
+    return a->timestamp < b->timestamp || (a->timestamp == b->timestamp && a->thread < b->thread);
+}
+
+static void AloomaStagingSiftDown(AloomaStagingRun **heap, size_t count, size_t i)
+{
+    while (1) {
+        size_t smallest = i;
+        size_t left = 2 * i + 1;
+        size_t right = left + 1;
+        if (left < count && AloomaStagingRunBefore(heap[left], heap[smallest])) {
+            smallest = left;
+        }
+        if (right < count && AloomaStagingRunBefore(heap[right], heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == i) {
+            return;
+        }
+        AloomaStagingRun *swap = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = swap;
+        i = smallest;
+    }
+}
+
+size_t AloomaStagingMerge(AloomaStaging *staging, int unsealed, AloomaStagingConsumeFunction consume, void *info)
+{
+    AloomaStagingChunk *open = NULL;
+    if (unsealed) {
+        pthread_mutex_lock(&staging->registryLock);
+        for (AloomaStagingBuffer *buffer = staging->buffers; buffer != NULL; buffer = buffer->next) {
+            AloomaStagingLock(buffer);
+            AloomaStagingChunk *chunk = buffer->chunk;
+            if (chunk != NULL && chunk->count > 0) {
+                buffer->chunk = NULL;
+                chunk->next = open;
+                open = chunk;
+            }
+            AloomaStagingUnlock(buffer);
+        }
+        pthread_mutex_unlock(&staging->registryLock);
+    }
+    // taken after the open chunks, so it holds everything sealed before them
+    AloomaStagingChunk *taken = atomic_exchange_explicit(&staging->sealedChunks, NULL, memory_order_acquire);
+
+    size_t chunkCount = 0;
+    for (AloomaStagingChunk *c = taken; c != NULL; c = c->next) {
+        chunkCount++;
+    }
+    for (AloomaStagingChunk *c = open; c != NULL; c = c->next) {
+        chunkCount++;
+    }
+    if (chunkCount == 0) {
+        return 0;
+    }
+    AloomaStagingChunk **chunks = malloc(chunkCount * sizeof(AloomaStagingChunk *));
+    AloomaStagingRun *runs = malloc(chunkCount * sizeof(AloomaStagingRun));
+    AloomaStagingRun **heap = malloc(chunkCount * sizeof(AloomaStagingRun *));
+    if (chunks == NULL || runs == NULL || heap == NULL) {
+        // out of memory: consume in whatever order, rather than lose records
+        free(chunks);
+        free(runs);
+        free(heap);
+        size_t consumed = 0;
+        AloomaStagingChunk *lists[2] = {taken, open};
+        for (int l = 0; l < 2; l++) {
+            for (AloomaStagingChunk *c = lists[l]; c != NULL;) {
+                AloomaStagingChunk *next = c->next;
+                for (size_t r = 0; r < c->count; r++) {
+                    consume(c->records[r].item, c->records[r].timestamp, info);
+                }
+                consumed += c->count;
+                free(c);
+                c = next;
+            }
+        }
+        return consumed;
+    }
+    size_t n = 0;
+    for (AloomaStagingChunk *c = taken; c != NULL; c = c->next) {
+        chunks[n++] = c;
+    }
+    for (AloomaStagingChunk *c = open; c != NULL; c = c->next) {
+        chunks[n++] = c;
+    }
+    qsort(chunks, chunkCount, sizeof(AloomaStagingChunk *), AloomaStagingCompareChunks);
+
+    size_t runCount = 0;
+    for (size_t i = 0; i < chunkCount; i++) {
+        if (runCount == 0 || chunks[i]->thread != runs[runCount - 1].chunks[0]->thread) {
+            runs[runCount++] = (AloomaStagingRun){ &chunks[i], 0, 0, 0, chunks[i]->records[0].timestamp, chunks[i]->thread };
+        }
+        runs[runCount - 1].count++;
+    }
+
+    // k-way merge on timestamps, with a heap of each thread's next record
+    size_t heapCount = runCount;
+    for (size_t i = 0; i < runCount; i++) {
+        heap[i] = &runs[i];
+    }
+    for (size_t i = heapCount / 2; i > 0; i--) {
+        AloomaStagingSiftDown(heap, heapCount, i - 1);
+    }
+    size_t consumed = 0;
+    while (heapCount > 0) {
+        AloomaStagingRun *next = heap[0];
+        AloomaStagingChunk *chunk = next->chunks[next->chunk];
+        consume(chunk->records[next->record].item, next->timestamp, info);
+        consumed++;
+        if (++next->record == chunk->count) {
+            next->record = 0;
+            next->chunk++;
+        }
+        if (next->chunk == next->count) {
+            heap[0] = heap[--heapCount];
+        } else {
+            next->timestamp = next->chunks[next->chunk]->records[next->record].timestamp;
+        }
+        AloomaStagingSiftDown(heap, heapCount, 0);
+    }
+    for (size_t i = 0; i < chunkCount; i++) {
+        free(chunks[i]);
+    }
+    free(chunks);
+    free(runs);
+    free(heap);
+    return consumed;
+}
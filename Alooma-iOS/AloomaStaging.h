@@ -0,0 +1,51 @@
+//
+//  AloomaStaging.h
+//  Alooma-iOS
+//
+//  Per-thread staging buffers for events tracked from many threads. Each
+//  producer thread appends to a buffer of its own, so producers never touch
+//  a shared cache line. A full buffer is sealed and handed over through a
+//  lock-free stack; the consumer merges sealed buffers, and on flush the
+//  open ones too. Within one merge records come out in timestamp order,
+//  ties broken by thread, and the records of one thread always in the order
+//  they were appended.
+//
+
+#ifndef AloomaStaging_h
+#define AloomaStaging_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AloomaStaging AloomaStaging;
+
+// Called on a producer thread right after it sealed a full buffer, so the
+// consumer can schedule a merge.
+typedef void (*AloomaStagingSealFunction)(AloomaStaging *staging, void *info);
+// Called by merge for each record, in merged order.
+typedef void (*AloomaStagingConsumeFunction)(void *item, double timestamp, void *info);
+
+// capacity is the number of records per buffer; sealed may be NULL.
+AloomaStaging *AloomaStagingCreate(size_t capacity, AloomaStagingSealFunction sealed, void *info);
+// Records still staged are freed without being consumed, so merge them
+// first. No thread may append while, or after, the staging is destroyed.
+void AloomaStagingDestroy(AloomaStaging *staging);
+
+// Safe to call from any number of threads. Returns 0, without taking the
+// item, if out of memory.
+int AloomaStagingAppend(AloomaStaging *staging, double timestamp, void *item);
+
+// Consumes the sealed buffers, and the open ones as well if unsealed is
+// non-zero, and returns how many records were consumed. Only one thread
+// may merge at a time, and consume must not merge the same staging.
+size_t AloomaStagingMerge(AloomaStaging *staging, int unsealed, AloomaStagingConsumeFunction consume, void *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
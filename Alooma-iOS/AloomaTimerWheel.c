@@ -0,0 +1,293 @@
+//
+//  AloomaTimerWheel.c
+//  Alooma-iOS
+//
+
+#include "AloomaTimerWheel.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+typedef struct {
+    uint64_t expires;   // tick
+    uint64_t interval;  // ticks, 0 for one-shot
+    void *context;
+    uint32_t generation;
+    int32_t previous;
+    int32_t next;
+    int32_t slot;       // or one of the states below
+} AloomaTimerEntry;
+
+enum {
+    kSlotFree = -1,
+    kSlotFiring = -2,     // a one-shot that fired, until its callback has run
+    kSlotCancelled = -3,  // the same, cancelled by an earlier callback
+};
+
+typedef struct {
+    uint64_t timer;
+    void *context;
+} AloomaFiredTimer;
+
+struct AloomaTimerWheel {
+    double tick;
+    uint64_t current;   // every tick up to and including this one is done
+    size_t mask;
+    int32_t *heads;
+    AloomaTimerEntry *entries;
+    size_t capacity;
+    int32_t freeList;
+    size_t count;
+    AloomaFiredTimer *fired;
+    size_t firedCapacity;
+};
+
+static inline uint64_t AloomaTimerIdentifier(int32_t index, uint32_t generation)
+{
+    // generation starts at 1, so identifiers are never 0
+    return ((uint64_t)generation << 32) | (uint32_t)index;
+}
+
+static void AloomaTimerLink(AloomaTimerWheel *wheel, int32_t index)
+{
+    AloomaTimerEntry *entry = &wheel->entries[index];
+    int32_t slot = (int32_t)(entry->expires & wheel->mask);
+    entry->slot = slot;
+    entry->previous = -1;
+    entry->next = wheel->heads[slot];
+    if (entry->next >= 0) {
+        wheel->entries[entry->next].previous = index;
+    }
+    wheel->heads[slot] = index;
+}
+
+static void AloomaTimerUnlink(AloomaTimerWheel *wheel, int32_t index)
+{
+    AloomaTimerEntry *entry = &wheel->entries[index];
+    if (entry->previous >= 0) {
+        wheel->entries[entry->previous].next = entry->next;
+    } else {
+        wheel->heads[entry->slot] = entry->next;
+    }
+    if (entry->next >= 0) {
+        wheel->entries[entry->next].previous = entry->previous;
+    }
+}
+
+static void AloomaTimerRelease(AloomaTimerWheel *wheel, int32_t index)
+{
+    AloomaTimerEntry *entry = &wheel->entries[index];
+    entry->slot = kSlotFree;
+    entry->context = NULL;
+    entry->generation++;
+    if (entry->generation == 0) {
+        entry->generation = 1;
+    }
+    entry->next = wheel->freeList;
+    wheel->freeList = index;
+    wheel->count--;
+}
+
+static int AloomaTimerGrow(AloomaTimerWheel *wheel)
+{
+    size_t capacity = wheel->capacity ? wheel->capacity * 2 : 16;
+    if (capacity > INT32_MAX) {
+        return 0;
+    }
+    AloomaTimerEntry *entries = realloc(wheel->entries, capacity * sizeof(AloomaTimerEntry));
+    if (entries == NULL) {
+        return 0;
+    }
+    for (size_t i = capacity; i > wheel->capacity; i--) {
+        AloomaTimerEntry *entry = &entries[i - 1];
+        entry->generation = 1;
+        entry->slot = kSlotFree;
+        entry->context = NULL;
+        entry->next = (i == capacity) ? wheel->freeList : (int32_t)i;
+    }
+    wheel->freeList = (int32_t)wheel->capacity;
+    wheel->entries = entries;
+    wheel->capacity = capacity;
+    return 1;
+}
+
+AloomaTimerWheel *AloomaTimerWheelCreate(double tick, size_t slots, double now)
+{
+    if (!(tick > 0)) {
+        return NULL;
+    }
+    size_t size = 2;
+    while (size < slots) {
+        size <<= 1;
+    }
+    AloomaTimerWheel *wheel = calloc(1, sizeof(AloomaTimerWheel));
+    if (wheel == NULL) {
+        return NULL;
+    }
+    wheel->heads = malloc(size * sizeof(int32_t));
+    if (wheel->heads == NULL) {
+        free(wheel);
+        return NULL;
+    }
+    for (size_t i = 0; i < size; i++) {
+        wheel->heads[i] = -1;
+    }
+    wheel->tick = tick;
+    wheel->mask = size - 1;
+    wheel->current = now > 0 ? (uint64_t)floor(now / tick) : 0;
+    wheel->freeList = -1;
+    return wheel;
+}
+
+void AloomaTimerWheelDestroy(AloomaTimerWheel *wheel)
+{
+    if (wheel == NULL) {
+        return;
+    }
+    free(wheel->heads);
+    free(wheel->entries);
+    free(wheel->fired);
+    free(wheel);
+}
+
+uint64_t AloomaTimerWheelSchedule(AloomaTimerWheel *wheel, double now, double delay, double interval, void *context)
+{
+    if (wheel->freeList < 0 && !AloomaTimerGrow(wheel)) {
+        return 0;
+    }
+    int32_t index = wheel->freeList;
+    AloomaTimerEntry *entry = &wheel->entries[index];
+    wheel->freeList = entry->next;
+    wheel->count++;
+
+    double deadline = now + (delay > 0 ? delay : 0);
+    uint64_t expires = deadline > 0 ? (uint64_t)ceil(deadline / wheel->tick) : 0;
+    // a timer due now, or in the past, goes out with the next advance
+    entry->expires = expires > wheel->current ? expires : wheel->current + 1;
+    entry->interval = interval > 0 ? (uint64_t)ceil(interval / wheel->tick) : 0;
+    if (interval > 0 && entry->interval == 0) {
+        entry->interval = 1;
+    }
+    entry->context = context;
+    AloomaTimerLink(wheel, index);
+    return AloomaTimerIdentifier(index, entry->generation);
+}
+
+int AloomaTimerWheelCancel(AloomaTimerWheel *wheel, uint64_t timer)
+{
+    uint32_t index = (uint32_t)timer;
+    uint32_t generation = (uint32_t)(timer >> 32);
+    if (index >= wheel->capacity) {
+        return 0;
+    }
+    AloomaTimerEntry *entry = &wheel->entries[index];
+    if (entry->generation != generation) {
+        return 0;
+    }
+    if (entry->slot == kSlotFiring) {
+        entry->slot = kSlotCancelled;
+        return 1;
+    }
+    if (entry->slot < 0) {
+        return 0;
+    }
+    AloomaTimerUnlink(wheel, (int32_t)index);
+    AloomaTimerRelease(wheel, (int32_t)index);
+    return 1;
+}
+
+static int AloomaTimerRecordFired(AloomaTimerWheel *wheel, size_t count, uint64_t timer, void *context)
+{
+    if (count == wheel->firedCapacity) {
+        size_t capacity = wheel->firedCapacity ? wheel->firedCapacity * 2 : 16;
+        AloomaFiredTimer *fired = realloc(wheel->fired, capacity * sizeof(AloomaFiredTimer));
+        if (fired == NULL) {
+            return 0;
+        }
+        wheel->fired = fired;
+        wheel->firedCapacity = capacity;
+    }
+    wheel->fired[count].timer = timer;
+    wheel->fired[count].context = context;
+    return 1;
+}
+
+size_t AloomaTimerWheelAdvance(AloomaTimerWheel *wheel, double now, AloomaTimerFunction fire, void *info)
+{
+    uint64_t target = now > 0 ? (uint64_t)floor(now / wheel->tick) : 0;
+    if (target <= wheel->current) {
+        return 0;
+    }
+    // past one turn every slot is visited once, checking each entry's tick
+    uint64_t steps = target - wheel->current;
+    if (steps > wheel->mask + 1) {
+        steps = wheel->mask + 1;
+    }
+    size_t fired = 0;
+    for (uint64_t step = 1; step <= steps; step++) {
+        int32_t slot = (int32_t)((wheel->current + step) & wheel->mask);
+        int32_t index = wheel->heads[slot];
+        while (index >= 0) {
+            AloomaTimerEntry *entry = &wheel->entries[index];
+            int32_t next = entry->next;
+            if (entry->expires <= target) {
+                if (!AloomaTimerRecordFired(wheel, fired, AloomaTimerIdentifier(index, entry->generation), entry->context)) {
+                    // out of memory: leave it for the next advance
+                    index = next;
+                    continue;
+                }
+                fired++;
+                AloomaTimerUnlink(wheel, index);
+                if (entry->interval > 0) {
+                    uint64_t missed = (target - entry->expires) / entry->interval + 1;
+                    entry->expires += missed * entry->interval;
+                    // relinked at the head of its slot, so this walk does not see it again
+                    AloomaTimerLink(wheel, index);
+                } else {
+                    entry->slot = kSlotFiring;
+                }
+            }
+            index = next;
+        }
+    }
+    wheel->current = target;
+    // the wheel is consistent again, callbacks may change it; one that
+    // cancels a timer fired in the same advance still keeps it from running
+    size_t ran = 0;
+    for (size_t i = 0; i < fired; i++) {
+        uint64_t timer = wheel->fired[i].timer;
+        AloomaTimerEntry *entry = &wheel->entries[(uint32_t)timer];
+        if (entry->generation == (uint32_t)(timer >> 32) && entry->slot != kSlotCancelled) {
+            fire(timer, wheel->fired[i].context, info);
+            ran++;
+        }
+    }
+    for (size_t i = 0; i < fired; i++) {
+        uint64_t timer = wheel->fired[i].timer;
+        int32_t index = (int32_t)(uint32_t)timer;
+        AloomaTimerEntry *entry = &wheel->entries[index];
+        if (entry->generation == (uint32_t)(timer >> 32) && (entry->slot == kSlotFiring || entry->slot == kSlotCancelled)) {
+            AloomaTimerRelease(wheel, index);
+        }
+    }
+    return ran;
+}
+
+double AloomaTimerWheelNextDeadline(const AloomaTimerWheel *wheel)
+{
+    if (wheel->count == 0) {
+        return -1;
+    }
+    uint64_t earliest = UINT64_MAX;
+    for (size_t i = 0; i < wheel->capacity; i++) {
+        if (wheel->entries[i].slot >= 0 && wheel->entries[i].expires < earliest) {
+            earliest = wheel->entries[i].expires;
+        }
+    }
+    return (double)earliest * wheel->tick;
+}
+
+size_t AloomaTimerWheelCount(const AloomaTimerWheel *wheel)
+{
+    return wheel->count;
+}
@@ -0,0 +1,55 @@
+//
+//  AloomaTimerWheel.h
+//  Alooma-iOS
+//
+//  Hashed timing wheel behind the shared scheduler's timers. Deadlines are
+//  rounded up to whole ticks, so timers due within the same tick fire
+//  together from a single wakeup. Scheduling and cancelling are O(1),
+//  advancing costs one slot per elapsed tick (at most one turn of the wheel)
+//  plus the timers that fire. Not thread safe; the scheduler serializes
+//  access.
+//
+
+#ifndef AloomaTimerWheel_h
+#define AloomaTimerWheel_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct AloomaTimerWheel AloomaTimerWheel;
+
+typedef void (*AloomaTimerFunction)(uint64_t timer, void *context, void *info);
+
+// tick is the resolution in seconds; slots is rounded up to a power of two.
+// now is the time on whatever monotonic clock the caller uses throughout.
+AloomaTimerWheel *AloomaTimerWheelCreate(double tick, size_t slots, double now);
+void AloomaTimerWheelDestroy(AloomaTimerWheel *wheel);
+
+// Fires first delay seconds after now, then every interval seconds if
+// interval > 0. Returns a non-zero identifier, or 0 if out of memory.
+uint64_t AloomaTimerWheelSchedule(AloomaTimerWheel *wheel, double now, double delay, double interval, void *context);
+// Returns 1 if the timer was pending, 0 if it had fired (one-shot) or was
+// already cancelled. Identifiers are not reused.
+int AloomaTimerWheelCancel(AloomaTimerWheel *wheel, uint64_t timer);
+
+// Calls fire for every timer due by now, in no particular order, and
+// returns how many fired. Repeating timers that missed several periods fire
+// once and are re-armed for their next period after now. fire is called
+// after the wheel has been updated, so it may schedule and cancel timers,
+// including ones due in the same advance that have not run yet.
+size_t AloomaTimerWheelAdvance(AloomaTimerWheel *wheel, double now, AloomaTimerFunction fire, void *info);
+
+// When the earliest pending timer is due, on the caller's clock, or a
+// negative value when none is pending.
+double AloomaTimerWheelNextDeadline(const AloomaTimerWheel *wheel);
+size_t AloomaTimerWheelCount(const AloomaTimerWheel *wheel);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,54 @@
+#import <Foundation/Foundation.h>
+
+@class Alooma;
+
+/*!
+ @enum
+ Stages of an event's way from <code>track:</code> to the server.
+
+ @constant AloomaTraceStageTrack     the <code>track:</code> call on the caller's thread
+ @constant AloomaTraceStageMerge     merging properties and queueing, on the serial queue
+ @constant AloomaTraceStageEncode    encoding a batch in <code>encodeAPIData:</code>
+ @constant AloomaTraceStageRequest   the HTTP request of a batch
+ @constant AloomaTraceStageResponse  handling the response and dequeueing the batch
+ @constant AloomaTraceStagePersist   archiving queued events or properties to disk
+ */
+typedef NS_ENUM(NSInteger, AloomaTraceStage) {
+    AloomaTraceStageTrack,
+    AloomaTraceStageMerge,
+    AloomaTraceStageEncode,
+    AloomaTraceStageRequest,
+    AloomaTraceStageResponse,
+    AloomaTraceStagePersist
+};
+
+/*!
+ @protocol
+
+ @abstract
+ Receives begin and end callbacks for every pipeline stage.
+
+ @discussion
+ Install a tracer with the <code>tracer</code> property of
+ <code>Alooma</code> to turn the library's work into spans in your own
+ tracing system. Callbacks are made synchronously on the thread doing the
+ work, which is the serial queue for every stage but
+ <code>AloomaTraceStageTrack</code>, so they should be quick.
+
+ The identifier ties the callbacks of one unit of work together. The track
+ and merge stages of an event share one identifier. Encode, request and
+ response share the identifier of their batch. Each archive gets its own.
+ Identifiers increase per <code>Alooma</code> instance, and the three
+ sequences are separate.
+
+ <code>count</code> is the number of events involved. <code>bytes</code> is
+ the size of the encoded batch, the request body, the response or the
+ archive, where known, and 0 otherwise.
+ */
+@protocol AloomaTracer <NSObject>
+@optional
+
+- (void)alooma:(Alooma *)alooma beganStage:(AloomaTraceStage)stage identifier:(uint64_t)identifier count:(NSUInteger)count bytes:(NSUInteger)bytes;
+- (void)alooma:(Alooma *)alooma endedStage:(AloomaTraceStage)stage identifier:(uint64_t)identifier count:(NSUInteger)count bytes:(NSUInteger)bytes;
+
+@end
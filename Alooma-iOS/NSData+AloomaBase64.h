@@ -14,16 +14,7 @@
 
 #import <Foundation/Foundation.h>
 
-void *Alooma_NewBase64Decode(
-	const char *inputBuffer,
-	size_t length,
-	size_t *outputLength);
-
-char *Alooma_NewBase64Encode(
-	const void *inputBuffer,
-	size_t length,
-	bool separateLines,
-	size_t *outputLength);
+#import "AloomaBase64.h"
 
 @interface NSData (Alooma_Base64)
 
@@ -0,0 +1,184 @@
+//
+//  AloomaBench.h
+//  Alooma-iOS Benchmarks
+//
+//  Minimal single-header benchmark harness modelled on Google Benchmark. Each
+//  case runs its body state->iterations times; the harness grows the
+//  iteration count until a run lasts at least --min-time seconds, then prints
+//  a table to stderr and Google Benchmark compatible JSON to stdout.
+//
+//  Options: --filter=<substring> --min-time=<seconds> --repetitions=<n>
+//
+
+#ifndef AloomaBench_h
+#define AloomaBench_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ALOOMA_BENCH_MAX_COUNTERS 8
+
+typedef struct {
+    uint64_t iterations;
+    int64_t arg;                // case argument, e.g. a size or a thread count
+    double items;               // items processed over all iterations
+    double bytes;               // bytes processed over all iterations
+    int counterCount;
+    const char *counterNames[ALOOMA_BENCH_MAX_COUNTERS];
+    double counterValues[ALOOMA_BENCH_MAX_COUNTERS];
+    double startReal;
+    double startCPU;
+} AloomaBenchState;
+
+typedef void (*AloomaBenchFunction)(AloomaBenchState *state);
+
+typedef struct {
+    const char *name;
+    AloomaBenchFunction function;
+    int64_t arg;
+    int hasArg;
+} AloomaBenchCase;
+
+#define ALOOMA_BENCH(fn) { #fn, fn, 0, 0 }
+#define ALOOMA_BENCH_ARG(fn, a) { #fn, fn, (a), 1 }
+
+static inline double AloomaBenchRealTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline double AloomaBenchCPUTime(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Call after per-case setup so it is excluded from the measurement.
+static inline void AloomaBenchResetTimer(AloomaBenchState *state)
+{
+    state->startReal = AloomaBenchRealTime();
+    state->startCPU = AloomaBenchCPUTime();
+}
+
+// Reports a custom value, e.g. payload bytes; the last value set wins.
+static inline void AloomaBenchSetCounter(AloomaBenchState *state, const char *name, double value)
+{
+    for (int i = 0; i < state->counterCount; i++) {
+        if (strcmp(state->counterNames[i], name) == 0) {
+            state->counterValues[i] = value;
+            return;
+        }
+    }
+    if (state->counterCount < ALOOMA_BENCH_MAX_COUNTERS) {
+        state->counterNames[state->counterCount] = name;
+        state->counterValues[state->counterCount] = value;
+        state->counterCount++;
+    }
+}
+
+// Keeps the compiler from optimising away a computed value.
+static inline void AloomaBenchDoNotOptimize(const void *p)
+{
+    __asm__ __volatile__("" : : "r"(p) : "memory");
+}
+
+static inline void AloomaBenchRunOnce(const AloomaBenchCase *c, uint64_t iterations,
+                                      AloomaBenchState *state, double *real, double *cpu)
+{
+    memset(state, 0, sizeof(*state));
+    state->iterations = iterations;
+    state->arg = c->arg;
+    AloomaBenchResetTimer(state);
+    c->function(state);
+    *real = AloomaBenchRealTime() - state->startReal;
+    *cpu = AloomaBenchCPUTime() - state->startCPU;
+}
+
+static inline int AloomaBenchMain(const AloomaBenchCase *cases, size_t count, int argc, char **argv)
+{
+    const char *filter = NULL;
+    double minTime = 0.5;
+    int repetitions = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--filter=", 9) == 0) {
+            filter = argv[i] + 9;
+        } else if (strncmp(argv[i], "--min-time=", 11) == 0) {
+            minTime = atof(argv[i] + 11);
+        } else if (strncmp(argv[i], "--repetitions=", 14) == 0) {
+            repetitions = atoi(argv[i] + 14);
+        } else {
+            fprintf(stderr, "usage: %s [--filter=<substring>] [--min-time=<seconds>] [--repetitions=<n>]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (repetitions < 1) {
+        repetitions = 1;
+    }
+
+    char date[64];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", localtime(&now));
+    printf("{\n  \"context\": {\n    \"date\": \"%s\",\n    \"executable\": \"%s\",\n    \"num_cpus\": %ld,\n    \"library_build_type\": \"release\"\n  },\n  \"benchmarks\": [",
+           date, argv[0], sysconf(_SC_NPROCESSORS_ONLN));
+    fprintf(stderr, "%-48s %14s %14s %12s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations");
+
+    int first = 1;
+    for (size_t i = 0; i < count; i++) {
+        const AloomaBenchCase *c = &cases[i];
+        char name[128];
+        if (c->hasArg) {
+            snprintf(name, sizeof(name), "%s/%lld", c->name, (long long)c->arg);
+        } else {
+            snprintf(name, sizeof(name), "%s", c->name);
+        }
+        if (filter && strstr(name, filter) == NULL) {
+            continue;
+        }
+        for (int rep = 0; rep < repetitions; rep++) {
+            AloomaBenchState state;
+            double real = 0, cpu = 0;
+            uint64_t iterations = 1;
+            for (;;) {
+                AloomaBenchRunOnce(c, iterations, &state, &real, &cpu);
+                if (real >= minTime || iterations >= (1ull << 40)) {
+                    break;
+                }
+                double scale = real > 0 ? (minTime * 1.4) / real : 10.0;
+                if (scale > 10.0 || real < minTime / 10.0) {
+                    scale = 10.0;
+                }
+                uint64_t next = (uint64_t)(iterations * scale);
+                iterations = next > iterations ? next : iterations + 1;
+            }
+            double realNs = real * 1e9 / iterations;
+            double cpuNs = cpu * 1e9 / iterations;
+            fprintf(stderr, "%-48s %14.1f %14.1f %12llu\n", name, realNs, cpuNs, (unsigned long long)iterations);
+            printf("%s\n    {\n      \"name\": \"%s\",\n      \"run_name\": \"%s\",\n      \"run_type\": \"iteration\",\n"
+                   "      \"repetitions\": %d,\n      \"repetition_index\": %d,\n      \"iterations\": %llu,\n"
+                   "      \"real_time\": %.3f,\n      \"cpu_time\": %.3f,\n      \"time_unit\": \"ns\"",
+                   first ? "" : ",", name, name, repetitions, rep, (unsigned long long)iterations, realNs, cpuNs);
+            if (state.items > 0) {
+                printf(",\n      \"items_per_second\": %.3f", state.items / real);
+            }
+            if (state.bytes > 0) {
+                printf(",\n      \"bytes_per_second\": %.3f", state.bytes / real);
+            }
+            for (int k = 0; k < state.counterCount; k++) {
+                printf(",\n      \"%s\": %.3f", state.counterNames[k], state.counterValues[k]);
+            }
+            printf("\n    }");
+            first = 0;
+        }
+    }
+    printf("\n  ]\n}\n");
+    return 0;
+}
+
+#endif
@@ -0,0 +1,55 @@
+//
+//  StubCollector.h
+//  Alooma-iOS Benchmarks
+//
+//  An NSURLProtocol that answers every request to kStubServerURL with "1",
+//  so the Objective-C benchmarks can flush without a network. It counts the
+//  requests and body bytes it was sent. Register it with
+//  [NSURLProtocol registerClass:[StubCollectorProtocol class]] in main().
+//
+
+#ifndef StubCollector_h
+#define StubCollector_h
+
+#include <stdatomic.h>
+
+#import <Foundation/Foundation.h>
+
+static NSString * const kStubServerURL = @"http://127.0.0.1:9";
+
+static atomic_uint_fast64_t stubRequests;
+static atomic_uint_fast64_t stubBodyBytes;
+
+@interface StubCollectorProtocol : NSURLProtocol
+
+@end
+
+@implementation StubCollectorProtocol
+
++ (BOOL)canInitWithRequest:(NSURLRequest *)request
+{
+    return [[[request URL] absoluteString] hasPrefix:kStubServerURL];
+}
+
++ (NSURLRequest *)canonicalRequestForRequest:(NSURLRequest *)request
+{
+    return request;
+}
+
+- (void)startLoading
+{
+    atomic_fetch_add(&stubRequests, 1);
+    atomic_fetch_add(&stubBodyBytes, [[[self request] HTTPBody] length]);
+    NSHTTPURLResponse *response = [[NSHTTPURLResponse alloc] initWithURL:[[self request] URL] statusCode:200 HTTPVersion:@"HTTP/1.1" headerFields:@{@"Content-Length": @"1"}];
+    [[self client] URLProtocol:self didReceiveResponse:response cacheStoragePolicy:NSURLCacheStorageNotAllowed];
+    [[self client] URLProtocol:self didLoadData:[@"1" dataUsingEncoding:NSUTF8StringEncoding]];
+    [[self client] URLProtocolDidFinishLoading:self];
+}
+
+- (void)stopLoading
+{
+}
+
+@end
+
+#endif
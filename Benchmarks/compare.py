@@ -0,0 +1,285 @@
+#!/usr/bin/env python3
+"""Benchmark regression gate.
+
+Collects repeated benchmark runs into a samples file and compares a
+candidate against a stored baseline, case by case and metric by metric:
+
+    ./compare.py run -n 10 -o baseline.json -- --min-time=0.2     # on the base commit
+    ./compare.py run -n 10 -o candidate.json -- --min-time=0.2    # on the change
+    ./compare.py compare baseline.json candidate.json
+
+`run` calls run.sh (or run_sdk.sh with --sdk) n times, each into its own
+results directory, and merges every JSON file written. Extra arguments after
+-- go to the benchmark binaries. `collect` merges results directories that
+already exist, e.g. from CI artifacts.
+
+A metric regresses when it moved the wrong way by more than --threshold
+(relative change of the medians, 5% by default) and a two-sided
+Mann-Whitney U test rejects equal distributions at --alpha. The effect size
+is Cliff's delta. Metrics with no spread on either side, like payload
+bytes, are compared by their change alone. Times and sizes are better
+lower, rates (*_per_second) better higher.
+
+Exits 1 when anything regressed, 0 otherwise.
+"""
+
+import argparse
+import glob
+import itertools
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+IGNORED = {'name', 'run_name', 'run_type', 'repetitions', 'repetition_index', 'iterations',
+           'time_unit', 'threads', 'family_index', 'per_family_instance_index', 'aggregate_name'}
+# counters that describe the workload rather than its cost
+NEUTRAL = {'requests', 'items'}
+
+
+def higher_is_better(metric):
+    return metric.endswith('_per_second')
+
+
+# -- samples --
+
+def read_document(document, samples):
+    for entry in document.get('benchmarks', []):
+        if entry.get('run_type', 'iteration') != 'iteration':
+            continue
+        case = samples.setdefault(entry['name'], {})
+        for metric, value in entry.items():
+            if metric in IGNORED or metric in NEUTRAL or not isinstance(value, (int, float)):
+                continue
+            case.setdefault(metric, []).append(float(value))
+    return samples
+
+
+def read_results(paths, samples):
+    for path in paths:
+        with open(path) as f:
+            read_document(json.load(f), samples)
+    return samples
+
+
+def collect(directories):
+    samples = {}
+    for directory in directories:
+        read_results(sorted(glob.glob(os.path.join(directory, '*.json'))), samples)
+    return samples
+
+
+def run(count, sdk, extra):
+    script = os.path.join(BENCH_DIR, 'run_sdk.sh' if sdk else 'run.sh')
+    samples = {}
+    with tempfile.TemporaryDirectory() as scratch:
+        for i in range(count):
+            out = os.path.join(scratch, str(i))
+            print('== run %d of %d' % (i + 1, count), file=sys.stderr)
+            environment = dict(os.environ, OUT_DIR=out)
+            subprocess.run([script] + extra, env=environment, check=True)
+            read_results(sorted(glob.glob(os.path.join(out, '*.json'))), samples)
+    return samples
+
+
+def save(samples, path, source):
+    with open(path, 'w') as f:
+        json.dump({'source': source, 'samples': samples}, f, indent=1, sort_keys=True)
+
+
+def load(path):
+    with open(path) as f:
+        document = json.load(f)
+    # a plain benchmark output file works too
+    return document['samples'] if 'samples' in document else read_document(document, {})
+
+
+# -- statistics --
+
+def median(values):
+    ordered = sorted(values)
+    middle = len(ordered) // 2
+    return ordered[middle] if len(ordered) % 2 else (ordered[middle - 1] + ordered[middle]) / 2.0
+
+
+def ranks(values):
+    """Average ranks, 1-based, ties sharing the mean of their positions."""
+    order = sorted(range(len(values)), key=lambda i: values[i])
+    result = [0.0] * len(values)
+    i = 0
+    while i < len(order):
+        j = i
+        while j + 1 < len(order) and values[order[j + 1]] == values[order[i]]:
+            j += 1
+        for k in range(i, j + 1):
+            result[order[k]] = (i + j) / 2.0 + 1
+        i = j + 1
+    return result
+
+
+def exact_u_distribution(n1, n2):
+    """Number of arrangements giving each U, for samples without ties."""
+    # counts[n][m][u], built up one observation at a time
+    table = {(0, m): [1] for m in range(n2 + 1)}
+    for n in range(1, n1 + 1):
+        table[(n, 0)] = [1]
+        for m in range(1, n2 + 1):
+            a = table[(n - 1, m)]
+            b = table[(n, m - 1)]
+            size = n * m + 1
+            counts = [0] * size
+            # the largest value belongs to the first sample (adds m to U) or the second
+            for u, c in enumerate(a):
+                counts[u + m] += c
+            for u, c in enumerate(b):
+                counts[u] += c
+            table[(n, m)] = counts
+    return table[(n1, n2)]
+
+
+def mann_whitney(a, b):
+    """Two-sided Mann-Whitney U test; returns (U of a, p value)."""
+    n1, n2 = len(a), len(b)
+    r = ranks(a + b)
+    u1 = sum(r[:n1]) - n1 * (n1 + 1) / 2.0
+    tied = len(set(a + b)) < n1 + n2
+    if not tied and n1 * n2 <= 400:
+        counts = exact_u_distribution(n1, n2)
+        total = float(sum(counts))
+        low = min(u1, n1 * n2 - u1)
+        p = 2 * sum(counts[:int(low) + 1]) / total
+        return u1, min(1.0, p)
+    # normal approximation with tie correction and continuity correction
+    n = n1 + n2
+    ties = {}
+    for value in a + b:
+        ties[value] = ties.get(value, 0) + 1
+    correction = sum(t ** 3 - t for t in ties.values()) / float(n * (n - 1))
+    variance = n1 * n2 / 12.0 * ((n + 1) - correction)
+    if variance <= 0:
+        return u1, 1.0
+    z = (abs(u1 - n1 * n2 / 2.0) - 0.5) / math.sqrt(variance)
+    return u1, min(1.0, math.erfc(max(z, 0) / math.sqrt(2)))
+
+
+def cliffs_delta(a, b):
+    """P(b > a) - P(b < a): positive when the candidate is larger."""
+    greater = sum(1 for x, y in itertools.product(a, b) if y > x)
+    less = sum(1 for x, y in itertools.product(a, b) if y < x)
+    return (greater - less) / float(len(a) * len(b))
+
+
+def magnitude(delta):
+    delta = abs(delta)
+    if delta < 0.147:
+        return 'negligible'
+    if delta < 0.33:
+        return 'small'
+    if delta < 0.474:
+        return 'medium'
+    return 'large'
+
+
+# -- comparison --
+
+def compare(baseline, candidate, alpha, threshold, filter_text):
+    rows = []
+    for case in sorted(set(baseline) & set(candidate)):
+        if filter_text and filter_text not in case:
+            continue
+        for metric in sorted(set(baseline[case]) & set(candidate[case])):
+            a, b = baseline[case][metric], candidate[case][metric]
+            if not a or not b:
+                continue
+            base, cand = median(a), median(b)
+            change = (cand - base) / abs(base) if base else (0.0 if cand == base else math.inf)
+            worse = -change if higher_is_better(metric) else change
+            if len(set(a)) == 1 and len(set(b)) == 1:
+                # deterministic metrics: any change past the threshold counts
+                p, delta = (0.0 if base != cand else 1.0), (0.0 if base == cand else math.copysign(1, cand - base))
+            else:
+                _, p = mann_whitney(a, b)
+                delta = cliffs_delta(a, b)
+            significant = p < alpha and abs(change) >= threshold
+            verdict = 'REGRESSION' if significant and worse > 0 else 'improved' if significant else ''
+            rows.append({'case': case, 'metric': metric, 'baseline': base, 'candidate': cand,
+                         'change': change, 'p': p, 'delta': delta, 'effect': magnitude(delta),
+                         'runs': (len(a), len(b)), 'verdict': verdict})
+    missing = sorted(set(baseline) - set(candidate))
+    return rows, missing
+
+
+def format_value(value):
+    if value == 0 or 0.01 <= abs(value) < 1e7:
+        return '%.3f' % value if abs(value) < 1000 else '%.0f' % value
+    return '%.3e' % value
+
+
+def print_rows(rows, show_all):
+    print('%-40s %-24s %12s %12s %8s %8s %7s %-11s %s'
+          % ('case', 'metric', 'baseline', 'candidate', 'change', 'p', 'delta', 'effect', ''))
+    for row in rows:
+        if not show_all and not row['verdict']:
+            continue
+        print('%-40s %-24s %12s %12s %+7.1f%% %8.4f %+7.3f %-11s %s'
+              % (row['case'], row['metric'], format_value(row['baseline']), format_value(row['candidate']),
+                 row['change'] * 100 if math.isfinite(row['change']) else float('inf'),
+                 row['p'], row['delta'], row['effect'], row['verdict']))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='benchmark regression gate')
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    run_parser = commands.add_parser('run', help='run the benchmarks n times and save the samples')
+    run_parser.add_argument('-n', '--runs', type=int, default=10)
+    run_parser.add_argument('-o', '--output', required=True)
+    run_parser.add_argument('--sdk', action='store_true', help='run the Objective-C benchmarks (run_sdk.sh)')
+    run_parser.add_argument('extra', nargs=argparse.REMAINDER, help='-- followed by benchmark arguments')
+
+    collect_parser = commands.add_parser('collect', help='merge existing results directories')
+    collect_parser.add_argument('directories', nargs='+')
+    collect_parser.add_argument('-o', '--output', required=True)
+
+    compare_parser = commands.add_parser('compare', help='compare a candidate against a baseline')
+    compare_parser.add_argument('baseline')
+    compare_parser.add_argument('candidate')
+    compare_parser.add_argument('--alpha', type=float, default=0.01)
+    compare_parser.add_argument('--threshold', type=float, default=0.05,
+                                help='smallest relative change of the medians that counts')
+    compare_parser.add_argument('--filter', help='only cases whose name contains this')
+    compare_parser.add_argument('--all', action='store_true', help='list unchanged metrics too')
+    compare_parser.add_argument('--json', action='store_true')
+
+    args = parser.parse_args(argv)
+    if args.command == 'run':
+        extra = args.extra[1:] if args.extra[:1] == ['--'] else args.extra
+        save(run(args.runs, args.sdk, extra), args.output, {'runs': args.runs, 'arguments': extra})
+        return 0
+    if args.command == 'collect':
+        save(collect(args.directories), args.output, {'directories': args.directories})
+        return 0
+
+    rows, missing = compare(load(args.baseline), load(args.candidate), args.alpha, args.threshold, args.filter)
+    if args.json:
+        print(json.dumps({'rows': rows, 'missing': missing}, indent=1,
+                         default=lambda v: None))
+    else:
+        print_rows(rows, args.all)
+        for case in missing:
+            print('missing from the candidate: %s' % case)
+        regressions = [r for r in rows if r['verdict'] == 'REGRESSION']
+        print('\n%d metrics compared, %d regressed, %d improved'
+              % (len(rows), len(regressions), sum(1 for r in rows if r['verdict'] == 'improved')))
+        runs = min((r['runs'] for r in rows), default=None, key=lambda r: math.comb(r[0] + r[1], r[0]))
+        if runs and 2.0 / math.comb(runs[0] + runs[1], runs[0]) >= args.alpha:
+            print('note: %d and %d runs cannot reach p < %g, use more runs' % (runs[0], runs[1], args.alpha))
+    return 1 if any(r['verdict'] == 'REGRESSION' for r in rows) else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
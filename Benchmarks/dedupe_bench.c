@@ -0,0 +1,84 @@
+//
+//  dedupe_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  Per-event overhead of the duplicate suppression window: hashing an event
+//  name plus 20 property key/value pairs the way Alooma.m does (one hash per
+//  key and value, combined order-independently) and checking the window, at
+//  0%, 10% and 50% duplicate rates (the argument).
+//
+
+#include <stdio.h>
+
+#include "AloomaBench.h"
+#include "AloomaDedupe.h"
+
+#define kProperties 20
+#define kDistinctEvents 4096
+
+static char keys[kProperties][24];
+static char values[kDistinctEvents][kProperties][24];
+
+static void SetUpProperties(void)
+{
+    for (int k = 0; k < kProperties; k++) {
+        snprintf(keys[k], sizeof(keys[k]), "property_%d", k);
+        for (int e = 0; e < kDistinctEvents; e++) {
+            snprintf(values[e][k], sizeof(values[e][k]), "value-%d-%d", e, k);
+        }
+    }
+}
+
+static uint64_t HashEvent(int e)
+{
+    uint64_t hash = AloomaHash64("Button Clicked", 14, 0);
+    uint64_t properties = 0;
+    for (int k = 0; k < kProperties; k++) {
+        uint64_t key = AloomaHash64(keys[k], strlen(keys[k]), 1);
+        uint64_t value = AloomaHash64(values[e][k], strlen(values[e][k]), 2);
+        properties += AloomaHashMix(key, value);
+    }
+    return AloomaHashMix(hash, properties);
+}
+
+static void BM_DedupeHash(AloomaBenchState *state)
+{
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        total ^= HashEvent((int)(i % kDistinctEvents));
+    }
+    AloomaBenchDoNotOptimize(&total);
+    state->items = (double)state->iterations;
+}
+
+static void BM_DedupeTrack(AloomaBenchState *state)
+{
+    int duplicatePercent = (int)state->arg;
+    AloomaDedupeWindow *window = AloomaDedupeWindowCreate(1024);
+    uint64_t fresh = 0, suppressed = 0;
+    uint64_t last = 0;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        // deterministic mix: duplicatePercent of calls repeat the previous event
+        uint64_t e = (i * 37 % 100) < (uint64_t)duplicatePercent ? last : fresh++;
+        last = e;
+        double now = (double)i * 1e-4;   // 10k events/s
+        suppressed += AloomaDedupeWindowCheck(window, HashEvent((int)(e % kDistinctEvents)) ^ e, now, 0.5);
+    }
+    state->items = (double)state->iterations;
+    AloomaBenchSetCounter(state, "suppressed_ratio", state->iterations ? (double)suppressed / state->iterations : 0);
+    AloomaDedupeWindowDestroy(window);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH(BM_DedupeHash),
+    ALOOMA_BENCH_ARG(BM_DedupeTrack, 0),
+    ALOOMA_BENCH_ARG(BM_DedupeTrack, 10),
+    ALOOMA_BENCH_ARG(BM_DedupeTrack, 50),
+};
+
+int main(int argc, char **argv)
+{
+    SetUpProperties();
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
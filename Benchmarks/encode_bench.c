@@ -0,0 +1,164 @@
+//
+//  encode_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  Cost of turning a serialized batch into a request body, for payloads of
+//  the argument's size in bytes: base64 encoding and decoding, percent
+//  escaping of the base64 text, and both encoding steps together as
+//  encodeAPIData: runs them. A batch of 50 typical events is around 32 KB.
+//  Base64DecodeMalformed decodes empty, truncated and padded input, such as
+//  a broken signature from a server, each in an exactly sized buffer; it
+//  exits with an error on a wrong length and is meant to run under ASan.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AloomaBase64.h"
+#include "AloomaBench.h"
+
+static unsigned char *Payload(size_t length)
+{
+    // JSON-ish bytes, so the text looks like a real batch
+    static const char sample[] = "{\"event\":\"Button Clicked\",\"properties\":{\"$os\":\"iPhone OS\",\"time\":1500000000}},";
+    unsigned char *payload = malloc(length);
+    for (size_t i = 0; i < length; i++) {
+        payload[i] = (unsigned char)sample[i % (sizeof(sample) - 1)];
+    }
+    return payload;
+}
+
+static void BM_Base64Encode(AloomaBenchState *state)
+{
+    size_t length = (size_t)state->arg;
+    unsigned char *payload = Payload(length);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        char *encoded = Alooma_NewBase64Encode(payload, length, false, NULL);
+        AloomaBenchDoNotOptimize(encoded);
+        free(encoded);
+    }
+    state->bytes = (double)state->iterations * length;
+    free(payload);
+}
+
+static void BM_Base64Decode(AloomaBenchState *state)
+{
+    size_t length = (size_t)state->arg;
+    unsigned char *payload = Payload(length);
+    size_t encodedLength = 0;
+    char *encoded = Alooma_NewBase64Encode(payload, length, false, &encodedLength);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        void *decoded = Alooma_NewBase64Decode(encoded, encodedLength, NULL);
+        AloomaBenchDoNotOptimize(decoded);
+        free(decoded);
+    }
+    state->bytes = (double)state->iterations * length;
+    free(encoded);
+    free(payload);
+}
+
+// decodes from a heap copy of exactly length bytes, so reads past it show up
+static size_t DecodedLength(const char *input, size_t length)
+{
+    char *copy = malloc(length ? length : 1);
+    memcpy(copy, input, length);
+    size_t decodedLength = 0;
+    void *decoded = Alooma_NewBase64Decode(copy, length, &decodedLength);
+    AloomaBenchDoNotOptimize(decoded);
+    free(decoded);
+    free(copy);
+    return decodedLength;
+}
+
+static void BM_Base64DecodeMalformed(AloomaBenchState *state)
+{
+    static const struct {
+        const char *input;
+        size_t length;
+    } cases[] = {
+        {"", 0}, {"A", 0}, {"AB", 1}, {"ABC", 2}, {"ABCD", 3}, {"AB==", 1}, {"ABC=\n", 2},
+        {"QUJD\n", 3}, {"QUJDRA", 4}, {"====", 0}, {"\n\r\t", 0}, {"QUJD!", 3},
+    };
+    size_t count = sizeof(cases) / sizeof(cases[0]);
+    // and every truncation of a real encoded payload
+    unsigned char *payload = Payload(96);
+    size_t encodedLength = 0;
+    char *encoded = Alooma_NewBase64Encode(payload, 96, false, &encodedLength);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        for (size_t c = 0; c < count; c++) {
+            size_t length = DecodedLength(cases[c].input, strlen(cases[c].input));
+            if (length != cases[c].length) {
+                fprintf(stderr, "Base64DecodeMalformed: \"%s\" decoded to %zu bytes, not %zu\n",
+                        cases[c].input, length, cases[c].length);
+                exit(1);
+            }
+        }
+        for (size_t cut = 0; cut <= encodedLength; cut++) {
+            size_t expected = cut / 4 * 3 + (cut % 4 ? cut % 4 - 1 : 0);
+            if (DecodedLength(encoded, cut) != expected) {
+                fprintf(stderr, "Base64DecodeMalformed: %zu characters decoded wrong\n", cut);
+                exit(1);
+            }
+        }
+    }
+    state->items = (double)state->iterations * (count + encodedLength + 1);
+    free(encoded);
+    free(payload);
+}
+
+static void BM_PercentEncode(AloomaBenchState *state)
+{
+    size_t length = (size_t)state->arg;
+    unsigned char *payload = Payload(length);
+    size_t encodedLength = 0;
+    char *encoded = Alooma_NewBase64Encode(payload, length, false, &encodedLength);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        char *escaped = AloomaPercentEncode(encoded, encodedLength, NULL);
+        AloomaBenchDoNotOptimize(escaped);
+        free(escaped);
+    }
+    state->bytes = (double)state->iterations * encodedLength;
+    free(encoded);
+    free(payload);
+}
+
+static void BM_RequestBody(AloomaBenchState *state)
+{
+    size_t length = (size_t)state->arg;
+    unsigned char *payload = Payload(length);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        size_t encodedLength = 0;
+        char *encoded = Alooma_NewBase64Encode(payload, length, false, &encodedLength);
+        char *escaped = AloomaPercentEncode(encoded, encodedLength, NULL);
+        AloomaBenchDoNotOptimize(escaped);
+        free(escaped);
+        free(encoded);
+    }
+    state->bytes = (double)state->iterations * length;
+    free(payload);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_Base64Encode, 64),
+    ALOOMA_BENCH_ARG(BM_Base64Encode, 1024),
+    ALOOMA_BENCH_ARG(BM_Base64Encode, 32768),
+    ALOOMA_BENCH_ARG(BM_Base64Encode, 262144),
+    ALOOMA_BENCH_ARG(BM_Base64Decode, 64),
+    ALOOMA_BENCH_ARG(BM_Base64Decode, 1024),
+    ALOOMA_BENCH_ARG(BM_Base64Decode, 32768),
+    ALOOMA_BENCH_ARG(BM_Base64Decode, 262144),
+    ALOOMA_BENCH(BM_Base64DecodeMalformed),
+    ALOOMA_BENCH_ARG(BM_PercentEncode, 1024),
+    ALOOMA_BENCH_ARG(BM_PercentEncode, 32768),
+    ALOOMA_BENCH_ARG(BM_RequestBody, 32768),
+};
+
+int main(int argc, char **argv)
+{
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
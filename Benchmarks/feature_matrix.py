@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+"""Builds every configuration of Alooma-iOS/AloomaFeatures.h and measures it.
+
+For each configuration the SDK is built for the iOS simulator as a dynamic
+library, linked against only the frameworks and libraries that
+configuration should need, so a feature that was not compiled out fails the
+link. Each build is then measured:
+
+- file_bytes, text_bytes, data_bytes: size of the library and of its
+  __TEXT and __DATA segments;
+- load_us: median time dlopen takes to load it, with the frameworks it
+  links, in a fresh simulator process (--loads processes, 10 by default);
+- init_us, ready_us: launch_bench.m's Launch/0 built in the same
+  configuration, the time init blocks the caller and the time until the
+  first event is merged.
+
+    ./feature_matrix.py                        # every configuration
+    ./feature_matrix.py lite full --loads=30   # only these two
+
+Needs macOS with Xcode and a booted simulator (xcrun simctl boot <device>).
+Prints a table and writes $OUT_DIR/feature_matrix.json in the benchmark
+JSON schema, one FeatureMatrix/<configuration> entry each, so that two
+commits can be compared with compare.py. Exits 1 if a configuration does
+not build.
+"""
+
+import argparse
+import glob
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+SDK_DIR = os.path.join(BENCH_DIR, '..', 'Alooma-iOS')
+
+# name, preprocessor flags, and what the configuration leaves out
+CONFIGURATIONS = [
+    ('full', [], set()),
+    ('app_extension', ['ALOOMA_APP_EXTENSION'], {'telephony', 'reachability'}),
+    ('no_telephony', ['ALOOMA_NO_TELEPHONY'], {'telephony'}),
+    ('no_reachability', ['ALOOMA_NO_REACHABILITY'], {'reachability'}),
+    ('no_ifa', ['ALOOMA_NO_IFA'], set()),
+    ('no_persistence', ['ALOOMA_NO_PERSISTENCE'], set()),
+    ('minimal_transport', ['ALOOMA_MINIMAL_TRANSPORT'], {'zlib', 'security'}),
+    ('lite', ['ALOOMA_LITE'], {'telephony', 'reachability', 'zlib', 'security'}),
+]
+
+LOADER = r'''
+#include <dlfcn.h>
+#include <stdio.h>
+#include <time.h>
+
+int main(int argc, char **argv)
+{
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    void *handle = dlopen(argv[1], RTLD_NOW);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (handle == NULL) {
+        fprintf(stderr, "%s\n", dlerror());
+        return 1;
+    }
+    printf("%.1f\n", (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3);
+    return 0;
+}
+'''
+
+
+def link_flags(omitted):
+    flags = ['-framework', 'Foundation', '-framework', 'UIKit', '-licucore']
+    if 'telephony' not in omitted:
+        flags += ['-framework', 'CoreTelephony']
+    if 'reachability' not in omitted:
+        flags += ['-framework', 'SystemConfiguration']
+    if 'zlib' not in omitted:
+        flags += ['-lz']
+    if 'security' not in omitted:
+        flags += ['-framework', 'Security']
+    return flags
+
+
+def clang(target, arguments):
+    command = ['xcrun', '-sdk', 'iphonesimulator', 'clang', '-O2', '-target', target] + arguments
+    return subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+
+
+def spawn(arguments):
+    result = subprocess.run(['xcrun', 'simctl', 'spawn', 'booted'] + arguments,
+                            stdout=subprocess.PIPE, stderr=subprocess.PIPE, universal_newlines=True)
+    if result.returncode != 0:
+        raise RuntimeError(result.stderr.strip())
+    return result.stdout
+
+
+def segment_sizes(library):
+    # `size -m` lists segments as "Segment __TEXT: 123"
+    output = subprocess.run(['xcrun', 'size', '-m', library], stdout=subprocess.PIPE,
+                            universal_newlines=True, check=True).stdout
+    sizes = {}
+    for line in output.splitlines():
+        if line.startswith('Segment '):
+            name, _, value = line[len('Segment '):].partition(':')
+            sizes[name.strip()] = int(value.split()[0])
+    return sizes
+
+
+def linked_libraries(library):
+    output = subprocess.run(['xcrun', 'otool', '-L', library], stdout=subprocess.PIPE,
+                            universal_newlines=True, check=True).stdout
+    names = []
+    for line in output.splitlines()[2:]:
+        path = line.strip().split(' ')[0]
+        names.append(os.path.basename(path))
+    return names
+
+
+def median(values):
+    ordered = sorted(values)
+    middle = len(ordered) // 2
+    return ordered[middle] if len(ordered) % 2 else (ordered[middle - 1] + ordered[middle]) / 2.0
+
+
+def measure(name, defines, omitted, target, build_dir, loader, loads):
+    directory = os.path.join(build_dir, name)
+    os.makedirs(directory, exist_ok=True)
+    sources = sorted(glob.glob(os.path.join(SDK_DIR, '*.m')) + glob.glob(os.path.join(SDK_DIR, '*.c')))
+    common = ['-fobjc-arc', '-I' + SDK_DIR, '-I' + BENCH_DIR] + ['-D' + d for d in defines]
+
+    library = os.path.join(directory, 'libAlooma.dylib')
+    result = clang(target, common + ['-dynamiclib', '-install_name', '@rpath/libAlooma.dylib', '-Wl,-dead_strip',
+                                     '-o', library] + sources + link_flags(omitted))
+    if result.returncode != 0:
+        return None, result.stderr
+
+    bench = os.path.join(directory, 'launch_bench')
+    result = clang(target, common + ['-o', bench, os.path.join(BENCH_DIR, 'launch_bench.m')] + sources
+                   + link_flags(omitted))
+    if result.returncode != 0:
+        return None, result.stderr
+
+    segments = segment_sizes(library)
+    times = [float(spawn([loader, library])) for _ in range(loads)]
+    launch = {}
+    for entry in json.loads(spawn([bench, '--filter=Launch/0'])).get('benchmarks', []):
+        launch = entry
+    row = {
+        'name': 'FeatureMatrix/' + name,
+        'run_name': 'FeatureMatrix/' + name,
+        'run_type': 'iteration',
+        'defines': defines,
+        'links': linked_libraries(library),
+        'file_bytes': os.path.getsize(library),
+        'text_bytes': segments.get('__TEXT', 0),
+        'data_bytes': segments.get('__DATA', 0) + segments.get('__DATA_CONST', 0),
+        'load_us': median(times),
+        'init_us': launch.get('init_us', 0),
+        'ready_us': launch.get('ready_us', 0),
+    }
+    return row, None
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='build and measure every feature configuration')
+    parser.add_argument('configurations', nargs='*', help='only these, by name (default: all)')
+    parser.add_argument('--loads', type=int, default=10, help='processes to time dlopen in')
+    args = parser.parse_args(argv)
+
+    known = [c[0] for c in CONFIGURATIONS]
+    for name in args.configurations:
+        if name not in known:
+            parser.error('unknown configuration %s, expected one of %s' % (name, ', '.join(known)))
+    selected = [c for c in CONFIGURATIONS if not args.configurations or c[0] in args.configurations]
+
+    out_dir = os.environ.get('OUT_DIR', os.path.join(BENCH_DIR, 'results'))
+    build_dir = os.environ.get('BUILD_DIR', os.path.join(BENCH_DIR, 'build'))
+    arch = os.environ.get('ARCH') or os.uname().machine
+    target = '%s-apple-ios%s-simulator' % (arch, os.environ.get('MIN_IOS', '12.0'))
+    os.makedirs(out_dir, exist_ok=True)
+    os.makedirs(build_dir, exist_ok=True)
+
+    loader = os.path.join(build_dir, 'dlopen_loader')
+    with tempfile.NamedTemporaryFile('w', suffix='.c') as source:
+        source.write(LOADER)
+        source.flush()
+        result = clang(target, ['-o', loader, source.name])
+        if result.returncode != 0:
+            sys.stderr.write(result.stderr)
+            return 1
+
+    rows, failed = [], []
+    for name, defines, omitted in selected:
+        print('== %s' % name, file=sys.stderr)
+        row, error = measure(name, defines, omitted, target, build_dir, loader, args.loads)
+        if row is None:
+            failed.append(name)
+            sys.stderr.write(error)
+            continue
+        rows.append(row)
+
+    full = next((r for r in rows if r['name'] == 'FeatureMatrix/full'), None)
+    print('%-20s %10s %10s %9s %9s %9s %9s  %s' % ('configuration', 'file', 'text', 'vs full', 'load us',
+                                                  'init us', 'ready us', 'links'))
+    for row in rows:
+        saved = '%+.1f%%' % ((row['file_bytes'] - full['file_bytes']) * 100.0 / full['file_bytes']) if full else ''
+        print('%-20s %10d %10d %9s %9.0f %9.0f %9.0f  %s'
+              % (row['name'].split('/', 1)[1], row['file_bytes'], row['text_bytes'], saved, row['load_us'],
+                 row['init_us'], row['ready_us'], ' '.join(row['links'])))
+    for name in failed:
+        print('%-20s does not build' % name)
+
+    with open(os.path.join(out_dir, 'feature_matrix.json'), 'w') as f:
+        json.dump({'context': {'target': target, 'loads': args.loads}, 'benchmarks': rows}, f, indent=1)
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
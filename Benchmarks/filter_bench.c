@@ -0,0 +1,157 @@
+//
+//  filter_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  Per-event cost of the compiled property filter with 50 rules (40 key
+//  rules, 10 value patterns) on an event of 20 string properties, split into
+//  key lookup and value scanning. The Linear and EachPattern cases are the
+//  naive equivalents the compiled matchers replace.
+//
+
+#include <regex.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "AloomaBench.h"
+#include "AloomaMatcher.h"
+
+#define kKeyRules 40
+#define kPatternRules 10
+#define kProperties 20
+#define kDistinctEvents 256
+
+static char ruleKeys[kKeyRules][32];
+static const char *ruleKeyPointers[kKeyRules];
+static size_t ruleKeyLengths[kKeyRules];
+
+static const char *patterns[kPatternRules] = {
+    "[0-9]{3}-[0-9]{2}-[0-9]{4}",
+    "[A-Za-z0-9._%+-]+@[A-Za-z0-9.-]+\\.[A-Za-z]{2,}",
+    "[0-9]{4}[ -]?[0-9]{4}[ -]?[0-9]{4}[ -]?[0-9]{4}",
+    "\\+?[0-9]{1,3}[ .-]?\\(?[0-9]{3}\\)?[ .-]?[0-9]{3}[ .-]?[0-9]{4}",
+    "([0-9]{1,3}\\.){3}[0-9]{1,3}",
+    "[Bb]earer [A-Za-z0-9._-]{20,}",
+    "AKIA[0-9A-Z]{16}",
+    "-----BEGIN [A-Z ]+-----",
+    "password=[^&]+",
+    "[A-Z]{2}[0-9]{2}[A-Z0-9]{11,30}",
+};
+
+static char propertyKeys[kProperties][32];
+static size_t propertyKeyLengths[kProperties];
+static char values[kDistinctEvents][kProperties][48];
+
+static void SetUp(void)
+{
+    for (int i = 0; i < kKeyRules; i++) {
+        snprintf(ruleKeys[i], sizeof(ruleKeys[i]), "sensitive_field_%d", i);
+        ruleKeyPointers[i] = ruleKeys[i];
+        ruleKeyLengths[i] = strlen(ruleKeys[i]);
+    }
+    for (int k = 0; k < kProperties; k++) {
+        // a quarter of the properties hit a key rule
+        if (k % 4 == 0) {
+            snprintf(propertyKeys[k], sizeof(propertyKeys[k]), "sensitive_field_%d", k);
+        } else {
+            snprintf(propertyKeys[k], sizeof(propertyKeys[k]), "property_%d", k);
+        }
+        propertyKeyLengths[k] = strlen(propertyKeys[k]);
+        for (int e = 0; e < kDistinctEvents; e++) {
+            // one value in twenty looks like an email address
+            if ((e + k) % 20 == 0) {
+                snprintf(values[e][k], sizeof(values[e][k]), "user%d@example.com", e);
+            } else {
+                snprintf(values[e][k], sizeof(values[e][k]), "Screen %d / button %d", e, k);
+            }
+        }
+    }
+}
+
+static void BM_FilterKeysPerfectHash(AloomaBenchState *state)
+{
+    AloomaKeyTable *table = AloomaKeyTableCreate(ruleKeyPointers, ruleKeyLengths, kKeyRules);
+    long hits = 0;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        for (int k = 0; k < kProperties; k++) {
+            hits += AloomaKeyTableFind(table, propertyKeys[k], propertyKeyLengths[k]) >= 0;
+        }
+    }
+    AloomaBenchDoNotOptimize(&hits);
+    state->items = (double)state->iterations;
+    AloomaKeyTableDestroy(table);
+}
+
+static void BM_FilterKeysLinear(AloomaBenchState *state)
+{
+    long hits = 0;
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        for (int k = 0; k < kProperties; k++) {
+            for (int r = 0; r < kKeyRules; r++) {
+                if (ruleKeyLengths[r] == propertyKeyLengths[k] &&
+                    memcmp(ruleKeys[r], propertyKeys[k], propertyKeyLengths[k]) == 0) {
+                    hits++;
+                    break;
+                }
+            }
+        }
+    }
+    AloomaBenchDoNotOptimize(&hits);
+    state->items = (double)state->iterations;
+}
+
+static void BM_FilterPatternsCombined(AloomaBenchState *state)
+{
+    AloomaPatternSet *set = AloomaPatternSetCreate(patterns, kPatternRules, NULL);
+    long hits = 0;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        int e = (int)(i % kDistinctEvents);
+        for (int k = 0; k < kProperties; k++) {
+            hits += AloomaPatternSetMatch(set, values[e][k]) >= 0;
+        }
+    }
+    AloomaBenchDoNotOptimize(&hits);
+    state->items = (double)state->iterations;
+    AloomaBenchSetCounter(state, "matched_ratio", state->iterations ? (double)hits / (state->iterations * kProperties) : 0);
+    AloomaPatternSetDestroy(set);
+}
+
+static void BM_FilterPatternsEach(AloomaBenchState *state)
+{
+    regex_t compiled[kPatternRules];
+    for (int p = 0; p < kPatternRules; p++) {
+        regcomp(&compiled[p], patterns[p], REG_EXTENDED | REG_NOSUB);
+    }
+    long hits = 0;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        int e = (int)(i % kDistinctEvents);
+        for (int k = 0; k < kProperties; k++) {
+            for (int p = 0; p < kPatternRules; p++) {
+                if (regexec(&compiled[p], values[e][k], 0, NULL, 0) == 0) {
+                    hits++;
+                    break;
+                }
+            }
+        }
+    }
+    AloomaBenchDoNotOptimize(&hits);
+    state->items = (double)state->iterations;
+    for (int p = 0; p < kPatternRules; p++) {
+        regfree(&compiled[p]);
+    }
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH(BM_FilterKeysPerfectHash),
+    ALOOMA_BENCH(BM_FilterKeysLinear),
+    ALOOMA_BENCH(BM_FilterPatternsCombined),
+    ALOOMA_BENCH(BM_FilterPatternsEach),
+};
+
+int main(int argc, char **argv)
+{
+    SetUp();
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
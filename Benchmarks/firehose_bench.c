@@ -0,0 +1,63 @@
+//
+//  firehose_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  Append throughput of the firehose ring. The target is a sustained
+//  100k records/s on one core; items_per_second is records appended.
+//
+
+#include "AloomaBench.h"
+#include "AloomaFirehoseBuffer.h"
+
+#define kCapacity 6000
+#define kBlockRecords 1000
+
+static void BM_FirehoseAppend(AloomaBenchState *state)
+{
+    size_t fields = (size_t)state->arg;
+    AloomaFirehoseBuffer *buffer = AloomaFirehoseBufferCreate(fields, kCapacity);
+    double values[64] = {0};
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        values[0] = (double)i;
+        AloomaFirehoseBufferAppend(buffer, 1.5e9 + i * 1e-3, values);
+    }
+    state->items = (double)state->iterations;
+    AloomaFirehoseBufferDestroy(buffer);
+}
+
+// Appends and drains a block whenever one is full, i.e. steady state with
+// flushes keeping up.
+static void BM_FirehoseAppendDrain(AloomaBenchState *state)
+{
+    size_t fields = (size_t)state->arg;
+    AloomaFirehoseBuffer *buffer = AloomaFirehoseBufferCreate(fields, kCapacity);
+    double values[64] = {0};
+    double *timestamps = malloc(sizeof(double) * kBlockRecords);
+    double *columns = malloc(sizeof(double) * kBlockRecords * fields);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        values[0] = (double)i;
+        AloomaFirehoseBufferAppend(buffer, 1.5e9 + i * 1e-3, values);
+        if ((i + 1) % kBlockRecords == 0) {
+            AloomaFirehoseBufferDrain(buffer, timestamps, columns, kBlockRecords, NULL);
+        }
+    }
+    AloomaBenchDoNotOptimize(columns);
+    state->items = (double)state->iterations;
+    free(timestamps);
+    free(columns);
+    AloomaFirehoseBufferDestroy(buffer);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_FirehoseAppend, 3),
+    ALOOMA_BENCH_ARG(BM_FirehoseAppend, 12),
+    ALOOMA_BENCH_ARG(BM_FirehoseAppendDrain, 3),
+    ALOOMA_BENCH_ARG(BM_FirehoseAppendDrain, 12),
+};
+
+int main(int argc, char **argv)
+{
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,142 @@
+//
+//  hamt_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  Cost of updating the super properties map with n entries (the argument):
+//  one set on the persistent trie versus rebuilding a hash table of n
+//  entries, which is what copying into a new dictionary on every
+//  registerSuperProperties: amounts to. Lookups are measured as well.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "AloomaBench.h"
+#include "AloomaDedupe.h"
+#include "AloomaHamt.h"
+
+#define kMaxEntries 1024
+
+static char keys[kMaxEntries][24];
+
+static uint64_t StringHash(const void *key)
+{
+    return AloomaHash64(key, strlen(key), 0);
+}
+
+static int StringEqual(const void *a, const void *b)
+{
+    return a == b || strcmp(a, b) == 0;
+}
+
+static const AloomaHamtCallbacks callbacks = {StringHash, StringEqual, NULL, NULL};
+
+static AloomaHamt *MapWithEntries(size_t n)
+{
+    AloomaHamt *map = AloomaHamtCreate(&callbacks);
+    for (size_t i = 0; i < n; i++) {
+        AloomaHamt *next = AloomaHamtSet(map, keys[i], keys[i]);
+        AloomaHamtRelease(map);
+        map = next;
+    }
+    return map;
+}
+
+static void BM_HamtSet(AloomaBenchState *state)
+{
+    size_t n = (size_t)state->arg;
+    AloomaHamt *map = MapWithEntries(n);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        AloomaHamt *next = AloomaHamtSet(map, keys[i % n], keys[(i + 1) % n]);
+        AloomaHamtRelease(map);
+        map = next;
+    }
+    state->items = (double)state->iterations;
+    AloomaHamtRelease(map);
+}
+
+static void BM_HamtGet(AloomaBenchState *state)
+{
+    size_t n = (size_t)state->arg;
+    AloomaHamt *map = MapWithEntries(n);
+    const void *found = NULL;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        found = AloomaHamtGet(map, keys[i % n]);
+        AloomaBenchDoNotOptimize(&found);
+    }
+    state->items = (double)state->iterations;
+    AloomaHamtRelease(map);
+}
+
+typedef struct {
+    const char *key;
+    const char *value;
+} Entry;
+
+// open addressing table rebuilt from scratch, like a dictionary copy
+static Entry *CopyTable(const Entry *table, size_t size)
+{
+    Entry *copy = calloc(size, sizeof(Entry));
+    for (size_t i = 0; i < size; i++) {
+        if (table[i].key == NULL) {
+            continue;
+        }
+        size_t slot = StringHash(table[i].key) & (size - 1);
+        while (copy[slot].key != NULL) {
+            slot = (slot + 1) & (size - 1);
+        }
+        copy[slot] = table[i];
+    }
+    return copy;
+}
+
+static void BM_CopyOnWrite(AloomaBenchState *state)
+{
+    size_t n = (size_t)state->arg;
+    size_t size = 2;
+    while (size < n * 2) {
+        size <<= 1;
+    }
+    Entry *table = calloc(size, sizeof(Entry));
+    for (size_t i = 0; i < n; i++) {
+        table[i].key = keys[i];
+        table[i].value = keys[i];
+    }
+    Entry *seed = CopyTable(table, size);
+    free(table);
+    table = seed;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        Entry *copy = CopyTable(table, size);
+        size_t slot = StringHash(keys[i % n]) & (size - 1);
+        while (strcmp(copy[slot].key, keys[i % n]) != 0) {
+            slot = (slot + 1) & (size - 1);
+        }
+        copy[slot].value = keys[(i + 1) % n];
+        free(table);
+        table = copy;
+    }
+    state->items = (double)state->iterations;
+    free(table);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_HamtSet, 16),
+    ALOOMA_BENCH_ARG(BM_HamtSet, 128),
+    ALOOMA_BENCH_ARG(BM_HamtSet, 1024),
+    ALOOMA_BENCH_ARG(BM_CopyOnWrite, 16),
+    ALOOMA_BENCH_ARG(BM_CopyOnWrite, 128),
+    ALOOMA_BENCH_ARG(BM_CopyOnWrite, 1024),
+    ALOOMA_BENCH_ARG(BM_HamtGet, 128),
+};
+
+int main(int argc, char **argv)
+{
+    for (int i = 0; i < kMaxEntries; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "super_property_%d", i);
+    }
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,89 @@
+//
+//  launch_bench.m
+//  Alooma-iOS Benchmarks
+//
+//  What creating an instance costs an app at launch; built and run in the
+//  simulator by run_sdk.sh. Each iteration creates an instance, tracks one
+//  event and waits until it is merged on the SDK queue.
+//
+//  - Launch/0: a cold engine and nothing cached on disk, so device and
+//    automatic properties are collected as on the first launch.
+//  - Launch/1: an engine that already has them, as for a second token.
+//  - Launch/2: a cold engine with the properties cached by an earlier
+//    launch of the same app and OS version (by the first iterations when
+//    run on its own).
+//
+//  All report init_us, the time the caller is blocked in init, and
+//  ready_us, until the first event is merged. The file only uses what
+//  already existed before init went asynchronous, so it can be copied into
+//  an older checkout to compare the two with compare.py.
+//
+
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import <Foundation/Foundation.h>
+
+#import "Alooma.h"
+#import "AloomaBench.h"
+#import "AloomaEngine.h"
+#import "StubCollector.h"
+
+@interface Alooma (Benchmarks)
+
+@property (nonatomic, strong) dispatch_queue_t serialQueue;
+
+@end
+
+// the SDK's cache file; removing it is harmless on versions without one
+static NSString *AutomaticPropertiesCachePath(void)
+{
+    return [[NSSearchPathForDirectoriesInDomains(NSCachesDirectory, NSUserDomainMask, YES) lastObject]
+            stringByAppendingPathComponent:@"alooma-automatic-properties.json"];
+}
+
+static void BM_Launch(AloomaBenchState *state)
+{
+    AloomaEngine *engine = [AloomaEngine engineForServerURL:kStubServerURL];
+    double init = 0, ready = 0;
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            if (state->arg != 1) {
+                engine.automaticProperties = nil;
+            }
+            if (state->arg == 0) {
+                [[NSFileManager defaultManager] removeItemAtPath:AutomaticPropertiesCachePath() error:NULL];
+            }
+            NSString *token = [NSString stringWithFormat:@"launch-%llu", (unsigned long long)i];
+            double start = AloomaBenchRealTime();
+            Alooma *alooma = [[Alooma alloc] initWithToken:token serverURL:kStubServerURL andFlushInterval:0];
+            double returned = AloomaBenchRealTime();
+            [alooma track:@"App Launched" properties:@{@"cold": @(state->arg == 0)}];
+            dispatch_sync(alooma.serialQueue, ^{});
+            double merged = AloomaBenchRealTime();
+            init += returned - start;
+            ready += merged - start;
+            [alooma reset];
+            dispatch_sync(alooma.serialQueue, ^{});
+        }
+    }
+    double n = (double)state->iterations;
+    AloomaBenchSetCounter(state, "init_us", init / n * 1e6);
+    AloomaBenchSetCounter(state, "ready_us", ready / n * 1e6);
+    state->items = n;
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_Launch, 0),
+    ALOOMA_BENCH_ARG(BM_Launch, 1),
+    ALOOMA_BENCH_ARG(BM_Launch, 2),
+};
+
+int main(int argc, char **argv)
+{
+    @autoreleasepool {
+        [NSURLProtocol registerClass:[StubCollectorProtocol class]];
+        return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+    }
+}
@@ -0,0 +1,65 @@
+//
+//  logring_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  What a log call costs the thread making it once its arguments are
+//  captured: one push of a log-record-sized entry into the ring. The drain
+//  side pops in the same loop so the ring never fills.
+//
+
+#include <string.h>
+
+#include "AloomaBench.h"
+#include "AloomaLogRing.h"
+
+// level, time, format, count and eight 16-byte arguments, as in AloomaLogger.m
+typedef struct {
+    unsigned char bytes[160];
+} Record;
+
+static void BM_LogRingPushPop(AloomaBenchState *state)
+{
+    AloomaLogRing *ring = AloomaLogRingCreate(512, sizeof(Record));
+    Record in, out;
+    memset(&in, 1, sizeof(in));
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        AloomaLogRingPush(ring, &in);
+        AloomaLogRingPop(ring, &out);
+        AloomaBenchDoNotOptimize(&out);
+    }
+    state->items = (double)state->iterations;
+    state->bytes = (double)state->iterations * sizeof(Record);
+    AloomaLogRingDestroy(ring);
+}
+
+// a burst of records pushed before the consumer gets to run
+static void BM_LogRingBurst(AloomaBenchState *state)
+{
+    size_t burst = (size_t)state->arg;
+    AloomaLogRing *ring = AloomaLogRingCreate(burst, sizeof(Record));
+    Record in, out;
+    memset(&in, 1, sizeof(in));
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        for (size_t j = 0; j < burst; j++) {
+            AloomaLogRingPush(ring, &in);
+        }
+        while (AloomaLogRingPop(ring, &out)) {
+            AloomaBenchDoNotOptimize(&out);
+        }
+    }
+    state->items = (double)state->iterations * burst;
+    AloomaLogRingDestroy(ring);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH(BM_LogRingPushPop),
+    ALOOMA_BENCH_ARG(BM_LogRingBurst, 64),
+    ALOOMA_BENCH_ARG(BM_LogRingBurst, 512),
+};
+
+int main(int argc, char **argv)
+{
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,177 @@
+//
+//  memory_bench.m
+//  Alooma-iOS Benchmarks
+//
+//  Memory cost of an instance and of its queue, on the same harness as the
+//  other benchmarks; built and run in the simulator by run_sdk.sh. Heap
+//  numbers come from malloc_zone_statistics, the footprint from the task's
+//  phys_footprint (what jetsam counts). The timings are those of building
+//  the queue and are only there because the harness needs them.
+//
+//  - Queued/n: an instance with 20 super properties and n queued events.
+//    Reports heap bytes and live blocks per instance and per event, next to
+//    the queue_bytes estimate of metricsSnapshot. Queued/0 is the cost of an
+//    idle instance.
+//  - FlushPeak/n: the highest heap use while n queued events are flushed to a
+//    stub collector, above the level before the flush.
+//
+
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#include <pthread.h>
+
+#import <Foundation/Foundation.h>
+
+#import "Alooma.h"
+#import "AloomaBench.h"
+#import "StubCollector.h"
+
+@interface Alooma (Benchmarks)
+
+@property (nonatomic, strong) dispatch_queue_t serialQueue;
+@property (atomic) NSUInteger maxQueueSize;
+
+@end
+
+typedef struct {
+    int64_t heapBytes;
+    int64_t heapBlocks;
+    int64_t footprint;
+} MemoryUsage;
+
+static MemoryUsage CurrentMemoryUsage(void)
+{
+    MemoryUsage usage = {0, 0, 0};
+    malloc_statistics_t stats;
+    malloc_zone_statistics(NULL, &stats);
+    usage.heapBytes = (int64_t)stats.size_in_use;
+    usage.heapBlocks = (int64_t)stats.blocks_in_use;
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, (task_info_t)&info, &count) == KERN_SUCCESS) {
+        usage.footprint = (int64_t)info.phys_footprint;
+    }
+    return usage;
+}
+
+static Alooma *NewAlooma(void)
+{
+    Alooma *alooma = [[Alooma alloc] initWithToken:[[NSUUID UUID] UUIDString] serverURL:kStubServerURL andFlushInterval:0];
+    NSMutableDictionary *properties = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < 20; i++) {
+        properties[[NSString stringWithFormat:@"super_property_%lu", (unsigned long)i]] = @(i);
+    }
+    [alooma registerSuperProperties:properties];
+    dispatch_sync(alooma.serialQueue, ^{});
+    return alooma;
+}
+
+static void QueueEvents(Alooma *alooma, NSUInteger count)
+{
+    alooma.maxQueueSize = MAX(count, alooma.maxQueueSize);
+    for (NSUInteger i = 0; i < count; i++) {
+        @autoreleasepool {
+            [alooma track:@"Button Clicked" properties:@{@"screen": @"home", @"button": @"buy", @"index": @(i), @"price": @9.99, @"premium": @YES}];
+        }
+    }
+    dispatch_sync(alooma.serialQueue, ^{});
+}
+
+static void BM_Queued(AloomaBenchState *state)
+{
+    NSUInteger events = (NSUInteger)state->arg;
+    double heapBytes = 0, heapBlocks = 0, footprint = 0, estimate = 0;
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            MemoryUsage before = CurrentMemoryUsage();
+            Alooma *alooma = NewAlooma();
+            QueueEvents(alooma, events);
+            MemoryUsage after = CurrentMemoryUsage();
+            heapBytes += after.heapBytes - before.heapBytes;
+            heapBlocks += after.heapBlocks - before.heapBlocks;
+            footprint += after.footprint - before.footprint;
+            estimate += [[alooma metricsSnapshot][@"gauges"][@"queue_bytes"] doubleValue];
+            [alooma reset];
+            dispatch_sync(alooma.serialQueue, ^{});
+        }
+    }
+    double n = (double)state->iterations;
+    AloomaBenchSetCounter(state, "heap_bytes", heapBytes / n);
+    AloomaBenchSetCounter(state, "heap_blocks", heapBlocks / n);
+    AloomaBenchSetCounter(state, "footprint_bytes", footprint / n);
+    AloomaBenchSetCounter(state, "estimated_queue_bytes", estimate / n);
+    if (events > 0) {
+        // includes the instance itself, which Queued/0 gives
+        AloomaBenchSetCounter(state, "bytes_per_event", heapBytes / n / events);
+        AloomaBenchSetCounter(state, "blocks_per_event", heapBlocks / n / events);
+        AloomaBenchSetCounter(state, "estimated_bytes_per_event", estimate / n / events);
+    }
+    state->items = n * events;
+}
+
+static atomic_bool sampling;
+static atomic_llong peakHeapBytes;
+static atomic_llong peakFootprint;
+
+static void *SampleMemory(void *unused)
+{
+    (void)unused;
+    while (atomic_load(&sampling)) {
+        MemoryUsage usage = CurrentMemoryUsage();
+        if (usage.heapBytes > atomic_load(&peakHeapBytes)) {
+            atomic_store(&peakHeapBytes, usage.heapBytes);
+        }
+        if (usage.footprint > atomic_load(&peakFootprint)) {
+            atomic_store(&peakFootprint, usage.footprint);
+        }
+        usleep(200);
+    }
+    return NULL;
+}
+
+static void BM_FlushPeak(AloomaBenchState *state)
+{
+    NSUInteger events = (NSUInteger)state->arg;
+    double peakHeap = 0, peakPrint = 0;
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            Alooma *alooma = NewAlooma();
+            QueueEvents(alooma, events);
+            MemoryUsage before = CurrentMemoryUsage();
+            atomic_store(&peakHeapBytes, before.heapBytes);
+            atomic_store(&peakFootprint, before.footprint);
+            atomic_store(&sampling, true);
+            pthread_t sampler;
+            pthread_create(&sampler, NULL, SampleMemory, NULL);
+            [alooma flush];
+            dispatch_sync(alooma.serialQueue, ^{});
+            atomic_store(&sampling, false);
+            pthread_join(sampler, NULL);
+            peakHeap += atomic_load(&peakHeapBytes) - before.heapBytes;
+            peakPrint += atomic_load(&peakFootprint) - before.footprint;
+        }
+    }
+    AloomaBenchSetCounter(state, "peak_heap_bytes", peakHeap / state->iterations);
+    AloomaBenchSetCounter(state, "peak_footprint_bytes", peakPrint / state->iterations);
+    state->items = (double)state->iterations * events;
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_Queued, 0),
+    ALOOMA_BENCH_ARG(BM_Queued, 500),
+    ALOOMA_BENCH_ARG(BM_Queued, 5000),
+    ALOOMA_BENCH_ARG(BM_FlushPeak, 500),
+    ALOOMA_BENCH_ARG(BM_FlushPeak, 5000),
+};
+
+int main(int argc, char **argv)
+{
+    @autoreleasepool {
+        [NSURLProtocol registerClass:[StubCollectorProtocol class]];
+        return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+    }
+}
@@ -0,0 +1,87 @@
+//
+//  metrics_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  Cost of the SDK's self-instrumentation. PerEvent is everything one event
+//  pays over its life: the tracked counter and queue depth gauge when it is
+//  queued, its share of the sent counter and one ack latency record when it
+//  is uploaded. Compare it with the few microseconds track: itself takes to
+//  merge and queue the event's properties; the target is under 1% of that.
+//  That target has not been checked against the whole SDK yet: the enqueue
+//  time table in Alooma.m is not covered here, and TrackNoMetrics/20 in
+//  sdk_bench.m, which is, has not been run on a device.
+//
+
+#include "AloomaBench.h"
+#include "AloomaMetrics.h"
+
+static void BM_CounterAdd(AloomaBenchState *state)
+{
+    AloomaMetrics *metrics = AloomaMetricsCreate();
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        AloomaMetricsAdd(metrics, AloomaCounterEventsTracked, 1);
+    }
+    state->items = (double)state->iterations;
+    AloomaMetricsDestroy(metrics);
+}
+
+static void BM_HdrRecord(AloomaBenchState *state)
+{
+    AloomaMetrics *metrics = AloomaMetricsCreate();
+    uint64_t value = 1;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        // spread over the whole range so every bucket gets touched
+        value = value * 6364136223846793005ull + 1442695040888963407ull;
+        AloomaMetricsRecordLatency(metrics, AloomaLatencyEnqueueToAck, value >> 28);
+    }
+    state->items = (double)state->iterations;
+    AloomaMetricsDestroy(metrics);
+}
+
+static void BM_PerEvent(AloomaBenchState *state)
+{
+    AloomaMetrics *metrics = AloomaMetricsCreate();
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        AloomaMetricsAdd(metrics, AloomaCounterEventsTracked, 1);
+        AloomaMetricsSetGauge(metrics, AloomaGaugeQueueDepth, (int64_t)(i & 511));
+        AloomaMetricsAdd(metrics, AloomaCounterEventsSent, 1);
+        AloomaMetricsRecordLatency(metrics, AloomaLatencyEnqueueToAck, 20000 + (i & 65535));
+    }
+    state->items = (double)state->iterations;
+    AloomaMetricsDestroy(metrics);
+}
+
+// reading p50, p90 and p99 of a histogram, as metricsSnapshot does
+static void BM_Percentiles(AloomaBenchState *state)
+{
+    AloomaMetrics *metrics = AloomaMetricsCreate();
+    for (uint64_t v = 1; v < 1000000; v += 7) {
+        AloomaMetricsRecordLatency(metrics, AloomaLatencyRequest, v);
+    }
+    const AloomaHdrHistogram *histogram = AloomaMetricsLatency(metrics, AloomaLatencyRequest);
+    uint64_t result = 0;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        result += AloomaHdrHistogramValueAtPercentile(histogram, 50);
+        result += AloomaHdrHistogramValueAtPercentile(histogram, 90);
+        result += AloomaHdrHistogramValueAtPercentile(histogram, 99);
+        AloomaBenchDoNotOptimize(&result);
+    }
+    state->items = (double)state->iterations;
+    AloomaMetricsDestroy(metrics);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH(BM_CounterAdd),
+    ALOOMA_BENCH(BM_HdrRecord),
+    ALOOMA_BENCH(BM_PerEvent),
+    ALOOMA_BENCH(BM_Percentiles),
+};
+
+int main(int argc, char **argv)
+{
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,181 @@
+//
+//  replay_bench.m
+//  Alooma-iOS Benchmarks
+//
+//  Replays a trace captured with Example/TestServer/trace_capture.py into
+//  the SDK, for throughput and payload numbers on real property shapes.
+//  Built and run in the simulator by run_sdk.sh.
+//
+//  The SDK runs on a virtual clock (AloomaClockSet) that jumps to each
+//  event's recorded offset, and flushes are driven from that clock rather
+//  than the SDK's timer, so event times, batching and payloads are the same
+//  on every run whatever the replay speed. Requests go to a stub collector.
+//
+//  - Replay/0: the whole trace, uncompressed.
+//  - Replay/1: the same with gzip bodies.
+//
+//  Each reports events per second, requests, body bytes per event and per
+//  request. Environment:
+//
+//    ALOOMA_TRACE                  trace file; without it nothing is run
+//    ALOOMA_REPLAY_SPEED           0 (default) as fast as possible, n for n
+//                                  times the recorded speed, 1 for real time
+//    ALOOMA_REPLAY_FLUSH_INTERVAL  virtual seconds between flushes, 60 by default
+//
+
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import <Foundation/Foundation.h>
+
+#import "Alooma.h"
+#import "AloomaBench.h"
+#import "AloomaClock.h"
+#import "StubCollector.h"
+
+// an arbitrary fixed epoch, so that timestamps do not depend on the day
+static const double kReplayEpoch = 1500000000;
+
+@interface Alooma (Benchmarks)
+
+@property (nonatomic, strong) dispatch_queue_t serialQueue;
+@property (atomic) NSUInteger maxQueueSize;
+@property (atomic, copy) NSString *compression;
+
+@end
+
+@interface ReplayEvent : NSObject
+
+@property (nonatomic) double offset;
+@property (nonatomic) NSUInteger token;
+@property (nonatomic, copy) NSString *name;
+@property (nonatomic, copy) NSDictionary *properties;
+
+@end
+
+@implementation ReplayEvent
+
+@end
+
+static NSArray *trace;
+static NSUInteger traceTokens;
+static double replaySpeed;
+static double flushInterval = 60;
+static _Atomic double virtualNow;
+
+static double VirtualClock(void)
+{
+    return virtualNow;
+}
+
+static NSArray *LoadTrace(NSString *path)
+{
+    NSString *contents = [NSString stringWithContentsOfFile:path encoding:NSUTF8StringEncoding error:NULL];
+    if (contents == nil) {
+        fprintf(stderr, "cannot read trace %s\n", [path UTF8String]);
+        return nil;
+    }
+    NSMutableArray *events = [NSMutableArray array];
+    __block BOOL header = YES;
+    [contents enumerateLinesUsingBlock:^(NSString *line, BOOL *stop) {
+        NSDictionary *object = [NSJSONSerialization JSONObjectWithData:[line dataUsingEncoding:NSUTF8StringEncoding] options:0 error:NULL];
+        if (![object isKindOfClass:[NSDictionary class]]) {
+            return;
+        }
+        if (header) {
+            header = NO;
+            if (![object[@"format"] isEqual:@"alooma-trace"]) {
+                fprintf(stderr, "%s is not an alooma trace\n", [path UTF8String]);
+                *stop = YES;
+            }
+            return;
+        }
+        ReplayEvent *event = [[ReplayEvent alloc] init];
+        event.offset = [object[@"t"] doubleValue];
+        event.token = [object[@"token"] unsignedIntegerValue];
+        event.name = [object[@"event"] isKindOfClass:[NSString class]] ? object[@"event"] : nil;
+        event.properties = [object[@"properties"] isKindOfClass:[NSDictionary class]] ? object[@"properties"] : nil;
+        traceTokens = MAX(traceTokens, event.token + 1);
+        [events addObject:event];
+    }];
+    return header ? nil : events;
+}
+
+static void BM_Replay(AloomaBenchState *state)
+{
+    uint64_t requestsBefore = atomic_load(&stubRequests);
+    uint64_t bytesBefore = atomic_load(&stubBodyBytes);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            virtualNow = kReplayEpoch;
+            NSMutableArray *instances = [NSMutableArray arrayWithCapacity:traceTokens];
+            for (NSUInteger t = 0; t < traceTokens; t++) {
+                Alooma *alooma = [[Alooma alloc] initWithToken:[NSString stringWithFormat:@"replay-%lu-%llu", (unsigned long)t, (unsigned long long)i] serverURL:kStubServerURL andFlushInterval:0];
+                alooma.maxQueueSize = NSUIntegerMax;
+                alooma.compression = state->arg ? @"gzip" : @"none";
+                [instances addObject:alooma];
+            }
+            Alooma *first = instances[0];
+            double nextFlush = flushInterval;
+            double wallStart = AloomaClockMonotonicNow();
+            for (ReplayEvent *event in trace) {
+                while (event.offset >= nextFlush) {
+                    virtualNow = kReplayEpoch + nextFlush;
+                    // instances share one engine, so one flush sends every queue
+                    [first flush];
+                    dispatch_sync(first.serialQueue, ^{});
+                    nextFlush += flushInterval;
+                }
+                if (replaySpeed > 0) {
+                    double wait = wallStart + event.offset / replaySpeed - AloomaClockMonotonicNow();
+                    if (wait > 0) {
+                        usleep((useconds_t)(wait * 1e6));
+                    }
+                }
+                virtualNow = kReplayEpoch + event.offset;
+                [instances[event.token] track:event.name properties:event.properties];
+            }
+            [first flush];
+            dispatch_sync(first.serialQueue, ^{});
+            for (Alooma *alooma in instances) {
+                [alooma reset];
+            }
+            dispatch_sync(first.serialQueue, ^{});
+        }
+    }
+    double n = (double)state->iterations;
+    double requests = (double)(atomic_load(&stubRequests) - requestsBefore);
+    double bytes = (double)(atomic_load(&stubBodyBytes) - bytesBefore);
+    AloomaBenchSetCounter(state, "requests", requests / n);
+    AloomaBenchSetCounter(state, "body_bytes", bytes / n);
+    AloomaBenchSetCounter(state, "bytes_per_event", [trace count] ? bytes / n / [trace count] : 0);
+    AloomaBenchSetCounter(state, "bytes_per_request", requests ? bytes / requests : 0);
+    state->items = n * [trace count];
+    state->bytes = bytes;
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_Replay, 0),
+    ALOOMA_BENCH_ARG(BM_Replay, 1),
+};
+
+int main(int argc, char **argv)
+{
+    @autoreleasepool {
+        NSDictionary *environment = [[NSProcessInfo processInfo] environment];
+        NSString *path = environment[@"ALOOMA_TRACE"];
+        replaySpeed = [environment[@"ALOOMA_REPLAY_SPEED"] doubleValue];
+        if ([environment[@"ALOOMA_REPLAY_FLUSH_INTERVAL"] doubleValue] > 0) {
+            flushInterval = [environment[@"ALOOMA_REPLAY_FLUSH_INTERVAL"] doubleValue];
+        }
+        trace = path ? LoadTrace(path) : nil;
+        if ([trace count] == 0) {
+            fprintf(stderr, "replay_bench: set ALOOMA_TRACE to a trace from trace_capture.py, skipping\n");
+            return AloomaBenchMain(cases, 0, argc, argv);
+        }
+        [NSURLProtocol registerClass:[StubCollectorProtocol class]];
+        AloomaClockSet(VirtualClock);
+        return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+    }
+}
@@ -0,0 +1,24 @@
+#!/bin/sh
+#
+# Builds and runs the portable C benchmarks. Each *_bench.c is compiled
+# against the plain C sources of the SDK and writes Google Benchmark style
+# JSON to $OUT_DIR/<name>.json. Extra arguments are passed to every binary,
+# e.g. ./run.sh --min-time=0.1 --filter=Append
+#
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+SDK_DIR="$BENCH_DIR/../Alooma-iOS"
+OUT_DIR=${OUT_DIR:-"$BENCH_DIR/results"}
+BUILD_DIR=${BUILD_DIR:-"$BENCH_DIR/build"}
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-O2 -std=c11 -D_GNU_SOURCE"}
+
+mkdir -p "$OUT_DIR" "$BUILD_DIR"
+
+for src in "$BENCH_DIR"/*_bench.c; do
+    name=$(basename "$src" .c)
+    $CC $CFLAGS -I"$SDK_DIR" -I"$BENCH_DIR" -o "$BUILD_DIR/$name" "$src" "$SDK_DIR"/*.c -lpthread -lm
+    echo "== $name" >&2
+    "$BUILD_DIR/$name" "$@" > "$OUT_DIR/$name.json"
+done
@@ -0,0 +1,36 @@
+#!/bin/sh
+#
+# Builds every *_bench.m with the whole SDK for the iOS simulator and runs it
+# in the booted simulator (xcrun simctl boot <device> first). Needs macOS with
+# Xcode. Writes Google Benchmark style JSON to $OUT_DIR/<name>.json; extra
+# arguments are passed to every binary, e.g. ./run_sdk.sh --filter=Track
+#
+set -e
+
+BENCH_DIR=$(cd "$(dirname "$0")" && pwd)
+SDK_DIR="$BENCH_DIR/../Alooma-iOS"
+OUT_DIR=${OUT_DIR:-"$BENCH_DIR/results"}
+BUILD_DIR=${BUILD_DIR:-"$BENCH_DIR/build"}
+ARCH=${ARCH:-$(uname -m)}
+MIN_IOS=${MIN_IOS:-12.0}
+
+mkdir -p "$OUT_DIR" "$BUILD_DIR"
+
+# simctl only hands SIMCTL_CHILD_ prefixed variables to the process
+for var in ALOOMA_TRACE ALOOMA_REPLAY_SPEED ALOOMA_REPLAY_FLUSH_INTERVAL; do
+    eval "value=\${$var:-}"
+    if [ -n "$value" ]; then
+        export "SIMCTL_CHILD_$var=$value"
+    fi
+done
+
+for src in "$BENCH_DIR"/*_bench.m; do
+    name=$(basename "$src" .m)
+    xcrun -sdk iphonesimulator clang -O2 -fobjc-arc -target "$ARCH-apple-ios$MIN_IOS-simulator" \
+        -I"$SDK_DIR" -I"$BENCH_DIR" -o "$BUILD_DIR/$name" \
+        "$src" "$SDK_DIR"/*.m "$SDK_DIR"/*.c \
+        -framework Foundation -framework UIKit -framework CoreTelephony \
+        -framework SystemConfiguration -framework Security -licucore -lz
+    echo "== $name" >&2
+    xcrun simctl spawn booted "$BUILD_DIR/$name" "$@" > "$OUT_DIR/$name.json"
+done
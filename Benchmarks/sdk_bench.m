@@ -0,0 +1,293 @@
+//
+//  sdk_bench.m
+//  Alooma-iOS Benchmarks
+//
+//  Benchmarks of the Objective-C hot paths, on the same harness as the C
+//  ones. They need Foundation and UIKit, so run_sdk.sh builds this file for
+//  the iOS simulator and runs it there; see README.md.
+//
+//  - Track/n: track:properties: with 5 properties and n super properties,
+//    including the merge on the serial queue.
+//  - TrackNoMetrics/20: Track/20 with the SDK metrics switched off; the
+//    difference from Track/20 is what metrics cost per event.
+//  - StagedOrdering/n: track: from n threads with stagedIngest on, each
+//    thread changing a super property of its own every 64 events and the
+//    first one also calling identify:. A middleware checks that every event
+//    carries the values set before it was tracked, and each thread that
+//    distinctId and currentSuperProperties return what it just set; the
+//    run exits with an error if one does not.
+//  - SerializeBatch/50: JSON serialization of a 50 event batch.
+//  - EncodeBatch/50: serialization, base64 and percent escaping, as sent.
+//  - ArchiveRoundTrip/n: archiving and unarchiving a queue of n events.
+//  - RemoteConfigMalformed: verifies a signed remote config document, then
+//    every truncation of its payload, signature and key and a few malformed
+//    base64 strings. The run exits with an error if the signed document is
+//    refused or any of the others is accepted.
+//
+
+#if ! __has_feature(objc_arc)
+#error This file must be compiled with ARC. Either turn on ARC for the project or use -fobjc-arc flag on this file.
+#endif
+
+#import <Foundation/Foundation.h>
+
+#import "Alooma.h"
+#import "AloomaBench.h"
+#import "AloomaRemoteConfig.h"
+
+@interface Alooma (Benchmarks)
+
+@property (nonatomic, strong) dispatch_queue_t serialQueue;
+@property (nonatomic, strong) NSMutableArray *eventsQueue;
+@property (atomic) NSUInteger maxQueueSize;
+
+- (NSData *)JSONSerializeObject:(id)obj;
+- (NSString *)encodeAPIData:(NSArray *)array;
+- (void)archiveEvents;
+- (void)unarchiveEvents;
+- (void)disableMetrics;
+
+@end
+
+static Alooma *NewAlooma(NSUInteger superProperties)
+{
+    // nothing listens there, and with no flush interval nothing is sent
+    Alooma *alooma = [[Alooma alloc] initWithToken:[[NSUUID UUID] UUIDString] serverURL:@"http://127.0.0.1:9" andFlushInterval:0];
+    NSMutableDictionary *properties = [NSMutableDictionary dictionary];
+    for (NSUInteger i = 0; i < superProperties; i++) {
+        properties[[NSString stringWithFormat:@"super_property_%lu", (unsigned long)i]] = @(i);
+    }
+    [alooma registerSuperProperties:properties];
+    dispatch_sync(alooma.serialQueue, ^{});
+    return alooma;
+}
+
+static NSDictionary *EventProperties(uint64_t i)
+{
+    return @{@"screen": @"home", @"button": @"buy", @"index": @(i), @"price": @9.99, @"premium": @YES};
+}
+
+static NSMutableArray *QueuedEvents(Alooma *alooma, NSUInteger count)
+{
+    alooma.maxQueueSize = MAX(count, alooma.maxQueueSize);
+    for (NSUInteger i = 0; i < count; i++) {
+        [alooma track:@"Button Clicked" properties:EventProperties(i)];
+    }
+    __block NSMutableArray *events;
+    dispatch_sync(alooma.serialQueue, ^{
+        events = [alooma.eventsQueue mutableCopy];
+    });
+    return events;
+}
+
+static void RunTrack(AloomaBenchState *state, Alooma *alooma)
+{
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            [alooma track:@"Button Clicked" properties:EventProperties(i)];
+        }
+        if ((i & 255) == 255) {
+            dispatch_sync(alooma.serialQueue, ^{});
+        }
+    }
+    dispatch_sync(alooma.serialQueue, ^{});
+    state->items = (double)state->iterations;
+}
+
+static void BM_Track(AloomaBenchState *state)
+{
+    RunTrack(state, NewAlooma((NSUInteger)state->arg));
+}
+
+static void BM_TrackNoMetrics(AloomaBenchState *state)
+{
+    Alooma *alooma = NewAlooma((NSUInteger)state->arg);
+    [alooma disableMetrics];
+    RunTrack(state, alooma);
+}
+
+static const uint64_t kOrderingPeriod = 64;
+
+static void BM_StagedOrdering(AloomaBenchState *state)
+{
+    Alooma *alooma = NewAlooma(0);
+    alooma.stagedIngest = YES;
+    size_t threads = (size_t)state->arg;
+    uint64_t records = state->iterations / threads + 1;
+    __block uint64_t checked = 0, errors = 0;
+    // one slot per thread, checked on that thread
+    uint64_t *staleReads = calloc(threads, sizeof(uint64_t));
+    // runs on the serial queue; drops every event so the queue stays empty
+    [alooma addMiddlewareNamed:@"check" block:^BOOL(AloomaEventView *event) {
+        uint64_t thread = [event[@"thread"] unsignedLongLongValue];
+        uint64_t i = [event[@"index"] unsignedLongLongValue];
+        uint64_t epoch = i - i % kOrderingPeriod;
+        NSString *key = [NSString stringWithFormat:@"epoch_%llu", (unsigned long long)thread];
+        BOOL ok = [event[key] unsignedLongLongValue] == epoch;
+        if (thread == 0) {
+            ok = ok && [event[@"distinct_id"] isEqual:[NSString stringWithFormat:@"user-%llu", (unsigned long long)epoch]];
+        }
+        checked++;
+        errors += ok ? 0 : 1;
+        return NO;
+    }];
+    AloomaBenchResetTimer(state);
+    dispatch_apply(threads, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t thread) {
+        NSString *key = [NSString stringWithFormat:@"epoch_%zu", thread];
+        for (uint64_t i = 0; i < records; i++) {
+            @autoreleasepool {
+                if (i % kOrderingPeriod == 0) {
+                    NSString *distinctId = [NSString stringWithFormat:@"user-%llu", (unsigned long long)i];
+                    if (thread == 0) {
+                        [alooma identify:distinctId];
+                        staleReads[thread] += [alooma.distinctId isEqual:distinctId] ? 0 : 1;
+                    }
+                    [alooma registerSuperProperties:@{key: @(i)}];
+                    staleReads[thread] += [[alooma currentSuperProperties][key] isEqual:@(i)] ? 0 : 1;
+                }
+                [alooma track:@"Button Clicked" properties:@{@"thread": @(thread), @"index": @(i)}];
+            }
+        }
+    });
+    alooma.stagedIngest = NO;
+    dispatch_sync(alooma.serialQueue, ^{});
+    state->items = (double)(records * threads);
+    uint64_t stale = 0;
+    for (size_t thread = 0; thread < threads; thread++) {
+        stale += staleReads[thread];
+    }
+    free(staleReads);
+    if (checked != records * threads || errors > 0 || stale > 0) {
+        fprintf(stderr, "StagedOrdering/%zu: %llu of %llu events checked, %llu out of order, %llu stale reads\n", threads,
+                (unsigned long long)checked, (unsigned long long)(records * threads), (unsigned long long)errors,
+                (unsigned long long)stale);
+        exit(1);
+    }
+}
+
+static void BM_SerializeBatch(AloomaBenchState *state)
+{
+    Alooma *alooma = NewAlooma(20);
+    NSArray *batch = QueuedEvents(alooma, (NSUInteger)state->arg);
+    NSUInteger bytes = [[alooma JSONSerializeObject:batch] length];
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            NSData *data = [alooma JSONSerializeObject:batch];
+            AloomaBenchDoNotOptimize((__bridge const void *)data);
+        }
+    }
+    state->items = (double)state->iterations * [batch count];
+    state->bytes = (double)state->iterations * bytes;
+}
+
+static void BM_EncodeBatch(AloomaBenchState *state)
+{
+    Alooma *alooma = NewAlooma(20);
+    NSArray *batch = QueuedEvents(alooma, (NSUInteger)state->arg);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            NSString *body = [alooma encodeAPIData:batch];
+            AloomaBenchDoNotOptimize((__bridge const void *)body);
+        }
+    }
+    state->items = (double)state->iterations * [batch count];
+}
+
+static void BM_ArchiveRoundTrip(AloomaBenchState *state)
+{
+    Alooma *alooma = NewAlooma(20);
+    NSArray *events = QueuedEvents(alooma, (NSUInteger)state->arg);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            dispatch_sync(alooma.serialQueue, ^{
+                [alooma archiveEvents];
+                [alooma.eventsQueue removeAllObjects];
+                [alooma unarchiveEvents];
+            });
+        }
+    }
+    state->items = (double)state->iterations * [events count];
+}
+
+// signed with a throwaway P-256 key: openssl dgst -sha256 -sign over the payload string
+static NSString *const kConfigPublicKey = @"MFkwEwYHKoZIzj0CAQYIKoZIzj0DAQcDQgAEGr1HcuWU5DaoWBj9SaBII1KqdQTK+iozvfICIO86lQtNsLvBKlM9WPvLFwVWZ7gJvuTs1hk2lxUWnW5yUNbI0A==";
+static NSString *const kConfigPayload = @"eyJ2ZXJzaW9uIjoxLCJmbHVzaF9pbnRlcnZhbCI6MzB9";
+static NSString *const kConfigSignature = @"MEUCIB2Fd59ZDEd5DZ0LmPN3/zE3EqLI5Zi9FJVnK3fxrgC+AiEA2DoLxuVCVWETnjemdHlcHacnNegwt4/PsCPwbPHdoAg=";
+
+static NSData *ConfigDocument(NSString *payload, NSString *signature)
+{
+    return [NSJSONSerialization dataWithJSONObject:@{@"payload": payload, @"signature": signature} options:0 error:NULL];
+}
+
+static void BM_RemoteConfigMalformed(AloomaBenchState *state)
+{
+    NSArray *garbage = @[@"", @"A", @"AB", @"ABC", @"====", @"\n", @"A\n", @"!!!!"];
+    NSMutableArray *documents = [NSMutableArray array];
+    NSMutableArray *keys = [NSMutableArray array];
+    for (NSUInteger cut = 0; cut < [kConfigPayload length]; cut++) {
+        [documents addObject:ConfigDocument([kConfigPayload substringToIndex:cut], kConfigSignature)];
+        [keys addObject:kConfigPublicKey];
+    }
+    for (NSUInteger cut = 0; cut < [kConfigSignature length]; cut++) {
+        [documents addObject:ConfigDocument(kConfigPayload, [kConfigSignature substringToIndex:cut])];
+        [keys addObject:kConfigPublicKey];
+    }
+    for (NSUInteger cut = 1; cut < [kConfigPublicKey length]; cut++) {
+        [documents addObject:ConfigDocument(kConfigPayload, kConfigSignature)];
+        [keys addObject:[kConfigPublicKey substringToIndex:cut]];
+    }
+    for (NSString *string in garbage) {
+        [documents addObject:ConfigDocument(string, kConfigSignature)];
+        [keys addObject:kConfigPublicKey];
+        [documents addObject:ConfigDocument(kConfigPayload, string)];
+        [keys addObject:kConfigPublicKey];
+        if ([string length] > 0) {
+            [documents addObject:ConfigDocument(kConfigPayload, kConfigSignature)];
+            [keys addObject:string];
+        }
+    }
+    NSData *signedDocument = ConfigDocument(kConfigPayload, kConfigSignature);
+    uint64_t accepted = 0;
+    BOOL verified = YES;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        @autoreleasepool {
+            verified = verified && [AloomaRemoteConfig configWithDocument:signedDocument publicKey:kConfigPublicKey] != nil;
+            for (NSUInteger j = 0; j < [documents count]; j++) {
+                accepted += [AloomaRemoteConfig configWithDocument:documents[j] publicKey:keys[j]] != nil;
+            }
+        }
+    }
+    state->items = (double)state->iterations * ([documents count] + 1);
+    if (!verified || accepted > 0) {
+        fprintf(stderr, "RemoteConfigMalformed: signed document %s, %llu malformed documents accepted\n",
+                verified ? "verified" : "refused", (unsigned long long)accepted);
+        exit(1);
+    }
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_Track, 0),
+    ALOOMA_BENCH_ARG(BM_Track, 20),
+    ALOOMA_BENCH_ARG(BM_Track, 100),
+    ALOOMA_BENCH_ARG(BM_TrackNoMetrics, 20),
+    ALOOMA_BENCH_ARG(BM_StagedOrdering, 1),
+    ALOOMA_BENCH_ARG(BM_StagedOrdering, 4),
+    ALOOMA_BENCH_ARG(BM_SerializeBatch, 50),
+    ALOOMA_BENCH_ARG(BM_EncodeBatch, 50),
+    ALOOMA_BENCH_ARG(BM_ArchiveRoundTrip, 50),
+    ALOOMA_BENCH_ARG(BM_ArchiveRoundTrip, 500),
+    ALOOMA_BENCH_ARG(BM_ArchiveRoundTrip, 5000),
+    ALOOMA_BENCH(BM_RemoteConfigMalformed),
+};
+
+int main(int argc, char **argv)
+{
+    @autoreleasepool {
+        return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+    }
+}
@@ -0,0 +1,73 @@
+//
+//  sketch_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  Cost of recording into and summarising the DDSketch used by histogram
+//  aggregates.
+//
+
+#include <math.h>
+
+#include "AloomaBench.h"
+#include "AloomaSketch.h"
+
+// frame-time like values spread over three orders of magnitude
+static double SampleValue(uint64_t i)
+{
+    return 1.0 + fmod((double)i * 7.31, 1000.0);
+}
+
+static void BM_SketchAdd(AloomaBenchState *state)
+{
+    AloomaSketch *sketch = AloomaSketchCreate(0.01, 2048);
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        AloomaSketchAdd(sketch, SampleValue(i));
+    }
+    state->items = (double)state->iterations;
+    AloomaSketchDestroy(sketch);
+}
+
+static void BM_SketchQuantiles(AloomaBenchState *state)
+{
+    AloomaSketch *sketch = AloomaSketchCreate(0.01, 2048);
+    for (int64_t i = 0; i < state->arg; i++) {
+        AloomaSketchAdd(sketch, SampleValue((uint64_t)i));
+    }
+    AloomaBenchResetTimer(state);
+    double total = 0;
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        total += AloomaSketchQuantile(sketch, 0.5);
+        total += AloomaSketchQuantile(sketch, 0.9);
+        total += AloomaSketchQuantile(sketch, 0.99);
+    }
+    AloomaBenchDoNotOptimize(&total);
+    AloomaSketchDestroy(sketch);
+}
+
+static void BM_SketchMerge(AloomaBenchState *state)
+{
+    AloomaSketch *from = AloomaSketchCreate(0.01, 2048);
+    AloomaSketch *into = AloomaSketchCreate(0.01, 2048);
+    for (int64_t i = 0; i < state->arg; i++) {
+        AloomaSketchAdd(from, SampleValue((uint64_t)i));
+    }
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        AloomaSketchMerge(into, from);
+    }
+    AloomaSketchDestroy(from);
+    AloomaSketchDestroy(into);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH(BM_SketchAdd),
+    ALOOMA_BENCH_ARG(BM_SketchQuantiles, 1000),
+    ALOOMA_BENCH_ARG(BM_SketchQuantiles, 1000000),
+    ALOOMA_BENCH_ARG(BM_SketchMerge, 1000000),
+};
+
+int main(int argc, char **argv)
+{
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,194 @@
+//
+//  staging_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  Ingest throughput with 1 to 32 producer threads and one consumer, as
+//  with stagedIngest on and many threads calling track:. Staged appends to
+//  per-thread buffers and merges sealed ones; Ring is the lock-free shared
+//  ring the logger uses, where every producer contends on its head index;
+//  Mutex is a locked shared queue. items_per_second counts records over all
+//  threads, wall clock.
+//
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "AloomaBench.h"
+#include "AloomaLogRing.h"
+#include "AloomaStaging.h"
+
+#define kStagingCapacity 256
+#define kRingCapacity 4096
+
+// what staging holds per record: a timestamp and an object pointer
+typedef struct {
+    double timestamp;
+    void *item;
+} Record;
+
+typedef struct {
+    uint64_t records;       // per producer
+    atomic_int running;     // producers not yet done
+    AloomaStaging *staging;
+    AloomaLogRing *ring;
+    pthread_mutex_t lock;
+    Record *queue;
+    size_t queued;
+    size_t queueCapacity;
+    uint64_t consumed;
+} Ingest;
+
+typedef void *(*Producer)(void *);
+
+static void Consume(void *item, double timestamp, void *info)
+{
+    (void)timestamp;
+    AloomaBenchDoNotOptimize(item);
+    ((Ingest *)info)->consumed++;
+}
+
+static void *StagedProducer(void *arg)
+{
+    Ingest *ingest = arg;
+    for (uint64_t i = 0; i < ingest->records; i++) {
+        AloomaStagingAppend(ingest->staging, (double)i, (void *)(uintptr_t)(i + 1));
+    }
+    atomic_fetch_sub(&ingest->running, 1);
+    return NULL;
+}
+
+static void *RingProducer(void *arg)
+{
+    Ingest *ingest = arg;
+    for (uint64_t i = 0; i < ingest->records; i++) {
+        Record record = { (double)i, (void *)(uintptr_t)(i + 1) };
+        while (!AloomaLogRingPush(ingest->ring, &record)) {
+            sched_yield();
+        }
+    }
+    atomic_fetch_sub(&ingest->running, 1);
+    return NULL;
+}
+
+static void *MutexProducer(void *arg)
+{
+    Ingest *ingest = arg;
+    for (uint64_t i = 0; i < ingest->records; i++) {
+        Record record = { (double)i, (void *)(uintptr_t)(i + 1) };
+        pthread_mutex_lock(&ingest->lock);
+        while (ingest->queued == ingest->queueCapacity) {
+            pthread_mutex_unlock(&ingest->lock);
+            sched_yield();
+            pthread_mutex_lock(&ingest->lock);
+        }
+        ingest->queue[ingest->queued++] = record;
+        pthread_mutex_unlock(&ingest->lock);
+    }
+    atomic_fetch_sub(&ingest->running, 1);
+    return NULL;
+}
+
+// the calling thread is the consumer
+static void RunIngest(AloomaBenchState *state, Ingest *ingest, Producer producer)
+{
+    int threads = (int)state->arg;
+    ingest->records = state->iterations / (uint64_t)threads + 1;
+    atomic_init(&ingest->running, threads);
+    pthread_t *workers = malloc(sizeof(pthread_t) * (size_t)threads);
+    Record *drained = malloc(sizeof(Record) * kRingCapacity);
+    AloomaBenchResetTimer(state);
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&workers[t], NULL, producer, ingest);
+    }
+    while (1) {
+        int done = atomic_load(&ingest->running) == 0;
+        uint64_t before = ingest->consumed;
+        if (ingest->staging != NULL) {
+            AloomaStagingMerge(ingest->staging, done, Consume, ingest);
+        } else if (ingest->ring != NULL) {
+            Record record;
+            while (AloomaLogRingPop(ingest->ring, &record)) {
+                Consume(record.item, record.timestamp, ingest);
+            }
+        } else {
+            pthread_mutex_lock(&ingest->lock);
+            size_t count = ingest->queued;
+            memcpy(drained, ingest->queue, count * sizeof(Record));
+            ingest->queued = 0;
+            pthread_mutex_unlock(&ingest->lock);
+            for (size_t i = 0; i < count; i++) {
+                Consume(drained[i].item, drained[i].timestamp, ingest);
+            }
+        }
+        if (done) {
+            break;
+        }
+        if (ingest->consumed == before) {
+            sched_yield();
+        }
+    }
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    if (ingest->staging != NULL) {
+        // producers that exited after the last merge sealed their buffers
+        AloomaStagingMerge(ingest->staging, 1, Consume, ingest);
+    }
+    state->items = (double)ingest->consumed;
+    free(workers);
+    free(drained);
+}
+
+static void BM_IngestStaged(AloomaBenchState *state)
+{
+    Ingest ingest = {0};
+    ingest.staging = AloomaStagingCreate(kStagingCapacity, NULL, NULL);
+    RunIngest(state, &ingest, StagedProducer);
+    AloomaStagingDestroy(ingest.staging);
+}
+
+static void BM_IngestRing(AloomaBenchState *state)
+{
+    Ingest ingest = {0};
+    ingest.ring = AloomaLogRingCreate(kRingCapacity, sizeof(Record));
+    RunIngest(state, &ingest, RingProducer);
+    AloomaLogRingDestroy(ingest.ring);
+}
+
+static void BM_IngestMutex(AloomaBenchState *state)
+{
+    Ingest ingest = {0};
+    pthread_mutex_init(&ingest.lock, NULL);
+    ingest.queueCapacity = kRingCapacity;
+    ingest.queue = malloc(sizeof(Record) * kRingCapacity);
+    RunIngest(state, &ingest, MutexProducer);
+    free(ingest.queue);
+    pthread_mutex_destroy(&ingest.lock);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_IngestStaged, 1),
+    ALOOMA_BENCH_ARG(BM_IngestStaged, 2),
+    ALOOMA_BENCH_ARG(BM_IngestStaged, 4),
+    ALOOMA_BENCH_ARG(BM_IngestStaged, 8),
+    ALOOMA_BENCH_ARG(BM_IngestStaged, 16),
+    ALOOMA_BENCH_ARG(BM_IngestStaged, 32),
+    ALOOMA_BENCH_ARG(BM_IngestRing, 1),
+    ALOOMA_BENCH_ARG(BM_IngestRing, 2),
+    ALOOMA_BENCH_ARG(BM_IngestRing, 4),
+    ALOOMA_BENCH_ARG(BM_IngestRing, 8),
+    ALOOMA_BENCH_ARG(BM_IngestRing, 16),
+    ALOOMA_BENCH_ARG(BM_IngestRing, 32),
+    ALOOMA_BENCH_ARG(BM_IngestMutex, 1),
+    ALOOMA_BENCH_ARG(BM_IngestMutex, 2),
+    ALOOMA_BENCH_ARG(BM_IngestMutex, 4),
+    ALOOMA_BENCH_ARG(BM_IngestMutex, 8),
+    ALOOMA_BENCH_ARG(BM_IngestMutex, 16),
+    ALOOMA_BENCH_ARG(BM_IngestMutex, 32),
+};
+
+int main(int argc, char **argv)
+{
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,101 @@
+//
+//  timerwheel_bench.c
+//  Alooma-iOS Benchmarks
+//
+//  The timing wheel behind the shared scheduler. Schedule and cancel should
+//  stay flat as the number of pending timers grows; Coalesce counts the
+//  wakeups that flush timers of many instances cost over a simulated hour,
+//  against one wakeup per timer per period when each has its own timer.
+//
+
+#include <math.h>
+
+#include "AloomaBench.h"
+#include "AloomaTimerWheel.h"
+
+static void Count(uint64_t timer, void *context, void *info)
+{
+    (void)timer;
+    (void)context;
+    (*(size_t *)info)++;
+}
+
+// schedule and cancel one timer with arg timers already pending
+static void BM_TimerScheduleCancel(AloomaBenchState *state)
+{
+    size_t pending = (size_t)state->arg;
+    AloomaTimerWheel *wheel = AloomaTimerWheelCreate(1, 512, 0);
+    for (size_t i = 0; i < pending; i++) {
+        AloomaTimerWheelSchedule(wheel, 0, (double)(i % 3600), 60, NULL);
+    }
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        uint64_t timer = AloomaTimerWheelSchedule(wheel, 0, (double)(i % 600), 0, NULL);
+        AloomaTimerWheelCancel(wheel, timer);
+    }
+    state->items = (double)state->iterations;
+    AloomaTimerWheelDestroy(wheel);
+}
+
+// one tick per iteration with arg repeating timers spread over a minute
+static void BM_TimerAdvance(AloomaBenchState *state)
+{
+    size_t timers = (size_t)state->arg;
+    AloomaTimerWheel *wheel = AloomaTimerWheelCreate(1, 512, 0);
+    for (size_t i = 0; i < timers; i++) {
+        AloomaTimerWheelSchedule(wheel, 0, (double)(i % 60), 60, NULL);
+    }
+    size_t fired = 0;
+    AloomaBenchResetTimer(state);
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        AloomaTimerWheelAdvance(wheel, (double)(i + 1), Count, &fired);
+    }
+    AloomaBenchDoNotOptimize(&fired);
+    state->items = (double)state->iterations;
+    AloomaBenchSetCounter(state, "fired_per_tick", (double)fired / (double)state->iterations);
+    AloomaTimerWheelDestroy(wheel);
+}
+
+// arg flush timers with a 60 s interval, started at unrelated times and
+// aligned like the scheduler does; one wakeup per distinct deadline
+static void BM_TimerCoalesce(AloomaBenchState *state)
+{
+    size_t timers = (size_t)state->arg;
+    double wakeups = 0, separate = 0;
+    for (uint64_t i = 0; i < state->iterations; i++) {
+        AloomaTimerWheel *wheel = AloomaTimerWheelCreate(1, 512, 0);
+        for (size_t t = 0; t < timers; t++) {
+            double now = (double)((t * 7919 + i) % 60) + 0.25;
+            AloomaTimerWheelSchedule(wheel, now, 60 - fmod(now, 60), 60, NULL);
+        }
+        double now = 60;
+        size_t fired = 0;
+        while (now <= 3600) {
+            double deadline = AloomaTimerWheelNextDeadline(wheel);
+            now = deadline > now ? deadline : now;
+            AloomaTimerWheelAdvance(wheel, now, Count, &fired);
+            wakeups++;
+        }
+        separate += (double)fired;
+        AloomaTimerWheelDestroy(wheel);
+    }
+    state->items = (double)state->iterations * timers;
+    AloomaBenchSetCounter(state, "wakeups_per_hour", wakeups / (double)state->iterations);
+    AloomaBenchSetCounter(state, "timer_fires_per_hour", separate / (double)state->iterations);
+}
+
+static const AloomaBenchCase cases[] = {
+    ALOOMA_BENCH_ARG(BM_TimerScheduleCancel, 16),
+    ALOOMA_BENCH_ARG(BM_TimerScheduleCancel, 1024),
+    ALOOMA_BENCH_ARG(BM_TimerScheduleCancel, 65536),
+    ALOOMA_BENCH_ARG(BM_TimerAdvance, 16),
+    ALOOMA_BENCH_ARG(BM_TimerAdvance, 1024),
+    ALOOMA_BENCH_ARG(BM_TimerAdvance, 65536),
+    ALOOMA_BENCH_ARG(BM_TimerCoalesce, 4),
+    ALOOMA_BENCH_ARG(BM_TimerCoalesce, 64),
+};
+
+int main(int argc, char **argv)
+{
+    return AloomaBenchMain(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
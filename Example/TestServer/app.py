@@ -2,8 +2,12 @@ import flask
 import json
 import argparse
 import base64
+import gzip
 import sqlite3
+import subprocess
 import sys
+import time
+import urllib.parse
 
 
 TEST_DB = 'example_app_test_db.db'
@@ -29,6 +33,14 @@ DELETE_EVENTS_BY_TOKEN_QUERY_TPL = 'delete from events where token=\'{token}\''
 
 app = flask.Flask('alooma-iossdk-test-server')
 
+# remote config payloads by token ('*' serves every token), signed with the
+# EC private key in the REMOTE_CONFIG_KEY PEM file when requested
+REMOTE_CONFIGS = {}
+REMOTE_CONFIG_KEY = None
+# served as the payload version unless it sets one; bumped on every change so
+# the sdk never sees a newer document go backwards
+REMOTE_CONFIG_VERSION = int(time.time())
+
 
 @app.route('/kill', methods=['POST'])
 def kill_app():
@@ -39,9 +51,16 @@ def kill_app():
     return 'Shutting down...\n'
 
 
+def request_form():
+    if flask.request.headers.get('Content-Encoding') == 'gzip':
+        body = gzip.decompress(flask.request.get_data()).decode()
+        return {k: v[0] for k, v in urllib.parse.parse_qs(body).items()}
+    return flask.request.form
+
+
 @app.route('/track/', methods=['POST'])
 def track_event():
-    decoded_data = base64.decodebytes(flask.request.form['data'].encode())
+    decoded_data = base64.decodebytes(request_form()['data'].encode())
     received_events = json.loads(decoded_data)
     if len(received_events) > 0:
         cursor = get_db().cursor()
@@ -57,6 +76,37 @@ def track_event():
     return "0", 200
 
 
+def sign_config(payload, key_file):
+    payload = dict(payload)
+    payload.setdefault('version', REMOTE_CONFIG_VERSION)
+    encoded_payload = base64.b64encode(json.dumps(payload).encode()).decode()
+    # DER encoded ECDSA signature over the SHA-256 of the payload string
+    signature = subprocess.run(['openssl', 'dgst', '-sha256', '-sign', key_file],
+                               input=encoded_payload.encode(),
+                               stdout=subprocess.PIPE, check=True).stdout
+    return {
+        'payload': encoded_payload,
+        'signature': base64.b64encode(signature).decode()
+    }
+
+
+@app.route('/config/<token>', methods=['GET', 'PUT', 'DELETE'])
+def remote_config(token):
+    global REMOTE_CONFIG_VERSION
+    if flask.request.method == 'PUT':
+        REMOTE_CONFIGS[token] = flask.request.get_json(force=True)
+        REMOTE_CONFIG_VERSION += 1
+        return flask.jsonify({'success': True, 'token': token})
+    if flask.request.method == 'DELETE':
+        REMOTE_CONFIGS.pop(token, None)
+        REMOTE_CONFIG_VERSION += 1
+        return flask.jsonify({'success': True, 'token': token})
+    payload = REMOTE_CONFIGS.get(token, REMOTE_CONFIGS.get('*'))
+    if payload is None or not REMOTE_CONFIG_KEY:
+        return 'no remote config\n', 404
+    return flask.jsonify(sign_config(payload, REMOTE_CONFIG_KEY))
+
+
 @app.route('/events/', methods=['GET', 'DELETE'])
 def events():
     if flask.request.method == 'GET':
@@ -126,6 +176,14 @@ def close_connection(exception):
         db.close()
 
 
+def public_key(key_file):
+    der = subprocess.run(['openssl', 'ec', '-in', key_file, '-pubout',
+                          '-outform', 'DER'],
+                         stdout=subprocess.PIPE, stderr=subprocess.DEVNULL,
+                         check=True).stdout
+    return base64.b64encode(der).decode()
+
+
 def init_db():
     with app.app_context():
         db = get_db()
@@ -138,6 +196,17 @@ if __name__ == '__main__':
     parser.add_argument('--host', '-d', default='0.0.0.0')
     parser.add_argument('--port', '-p', default='8000')
     parser.add_argument('--debug', action='store_true')
+    parser.add_argument('--config-key',
+                        help='EC P-256 private key PEM file used to sign '
+                             'remote config documents')
+    parser.add_argument('--config-file',
+                        help='JSON remote config payload served to every token')
     args = parser.parse_args()
+    REMOTE_CONFIG_KEY = args.config_key
+    if REMOTE_CONFIG_KEY:
+        print('remote config public key: %s' % public_key(REMOTE_CONFIG_KEY))
+    if args.config_file:
+        with open(args.config_file) as f:
+            REMOTE_CONFIGS['*'] = json.load(f)
     init_db()
     app.run(host=args.host, port=args.port, debug=args.debug)
@@ -0,0 +1,349 @@
+"""High-throughput stand-in for the Alooma collector, for load tests.
+
+Speaks the same /track/ protocol as app.py (form encoded, base64 JSON
+batches, optionally gzip compressed) but runs on asyncio with keep-alive
+connections and no per-event database work. Accepted batches are appended,
+one JSON line per request, to a log file by a background writer that batches
+its writes.
+
+Faults can be injected from the command line or changed at runtime with
+PUT /faults (a JSON object with any of the option names below):
+
+    latency_ms      fixed delay before every /track/ response
+    jitter_ms       extra uniformly random delay, 0..jitter_ms
+    error_rate      fraction of requests answered 503
+    reject_rate     fraction of requests answered 200 "0" (batch rejected)
+    partial_rate    fraction of requests whose response is cut off halfway
+    slow_bps        response bytes per second, 0 for full speed
+
+GET /stats returns the counters and per-request latency percentiles; a
+summary line is also printed every --report-interval seconds.
+"""
+
+import argparse
+import asyncio
+import base64
+import binascii
+import gzip
+import json
+import random
+import signal
+import sys
+import time
+import urllib.parse
+
+
+FAULT_OPTIONS = ('latency_ms', 'jitter_ms', 'error_rate', 'reject_rate',
+                 'partial_rate', 'slow_bps')
+REASONS = {200: 'OK', 400: 'Bad Request', 404: 'Not Found',
+           411: 'Length Required', 413: 'Payload Too Large',
+           503: 'Service Unavailable'}
+MAX_BODY = 64 * 1024 * 1024
+LATENCY_SAMPLES = 100000
+
+
+class Stats(object):
+    def __init__(self):
+        self.started = time.time()
+        self.requests = 0
+        self.events = 0
+        self.bytes = 0
+        self.errors = 0
+        self.rejected = 0
+        self.partial = 0
+        self.bad_requests = 0
+        self.latencies = []
+        self.seen = 0
+        self.last_report = (self.started, 0, 0, 0)
+
+    def record_latency(self, seconds):
+        # reservoir, so memory stays bounded on long runs
+        self.seen += 1
+        if len(self.latencies) < LATENCY_SAMPLES:
+            self.latencies.append(seconds)
+        else:
+            slot = random.randrange(self.seen)
+            if slot < LATENCY_SAMPLES:
+                self.latencies[slot] = seconds
+
+    def percentiles(self):
+        ordered = sorted(self.latencies)
+        if not ordered:
+            return {}
+
+        def at(p):
+            return round(ordered[min(len(ordered) - 1, int(p / 100.0 * len(ordered)))] * 1000, 3)
+        return {'p50_ms': at(50), 'p90_ms': at(90), 'p99_ms': at(99),
+                'max_ms': round(ordered[-1] * 1000, 3)}
+
+    def snapshot(self):
+        elapsed = max(time.time() - self.started, 1e-9)
+        return {
+            'uptime_s': round(elapsed, 3),
+            'requests': self.requests,
+            'events': self.events,
+            'bytes': self.bytes,
+            'errors_injected': self.errors,
+            'rejects_injected': self.rejected,
+            'partials_injected': self.partial,
+            'bad_requests': self.bad_requests,
+            'events_per_s': round(self.events / elapsed, 1),
+            'requests_per_s': round(self.requests / elapsed, 1),
+            'latency': self.percentiles(),
+        }
+
+    def report(self):
+        now = time.time()
+        then, requests, events, size = self.last_report
+        elapsed = max(now - then, 1e-9)
+        self.last_report = (now, self.requests, self.events, self.bytes)
+        latency = self.percentiles()
+        print('%8.1f req/s %10.1f events/s %8.2f MB/s  p50 %s ms  p99 %s ms  total %d events'
+              % ((self.requests - requests) / elapsed,
+                 (self.events - events) / elapsed,
+                 (self.bytes - size) / elapsed / 1e6,
+                 latency.get('p50_ms', '-'), latency.get('p99_ms', '-'),
+                 self.events), flush=True)
+
+
+class EventLog(object):
+    """Append-only JSON lines log written off the event loop in batches."""
+
+    def __init__(self, path, flush_interval):
+        self.path = path
+        self.flush_interval = flush_interval
+        self.pending = []
+        self.file = open(path, 'a', encoding='utf-8') if path else None
+
+    def append(self, received_at, events_json):
+        if self.file:
+            # events_json is the compact array the sdk sent, no need to re-encode it
+            self.pending.append('{"received_at": %.6f, "events": %s}\n' % (received_at, events_json))
+
+    async def run(self):
+        loop = asyncio.get_running_loop()
+        while True:
+            await asyncio.sleep(self.flush_interval)
+            await self.flush(loop)
+
+    async def flush(self, loop):
+        if not self.file or not self.pending:
+            return
+        lines, self.pending = self.pending, []
+        await loop.run_in_executor(None, self.write, ''.join(lines))
+
+    def write(self, text):
+        self.file.write(text)
+        self.file.flush()
+
+
+class Collector(object):
+    def __init__(self, args):
+        self.faults = {name: getattr(args, name) for name in FAULT_OPTIONS}
+        self.stats = Stats()
+        self.log = EventLog(args.log, args.log_flush_interval)
+        self.keep_events = args.keep_events
+        self.events_by_token = {}
+        self.stopping = None
+
+    # -- http plumbing --
+
+    async def handle_connection(self, reader, writer):
+        try:
+            while True:
+                try:
+                    head = await reader.readuntil(b'\r\n\r\n')
+                except (asyncio.IncompleteReadError, ConnectionError):
+                    return
+                started = time.perf_counter()
+                lines = head.decode('latin-1').split('\r\n')
+                try:
+                    method, target, version = lines[0].split(' ', 2)
+                except ValueError:
+                    await self.respond(writer, 400, b'bad request line\n', close=True)
+                    return
+                headers = {}
+                for line in lines[1:]:
+                    if ':' in line:
+                        name, value = line.split(':', 1)
+                        headers[name.strip().lower()] = value.strip()
+                if headers.get('transfer-encoding', '').lower() == 'chunked':
+                    await self.respond(writer, 411, b'chunked bodies are not supported\n', close=True)
+                    return
+                length = int(headers.get('content-length', '0') or 0)
+                if length > MAX_BODY:
+                    await self.respond(writer, 413, b'body too large\n', close=True)
+                    return
+                body = await reader.readexactly(length) if length else b''
+                keep_alive = (version == 'HTTP/1.1' and headers.get('connection', '').lower() != 'close') \
+                    or headers.get('connection', '').lower() == 'keep-alive'
+                keep_alive = await self.dispatch(writer, method, target, headers, body, keep_alive, started)
+                if not keep_alive:
+                    return
+        except (asyncio.IncompleteReadError, ConnectionError):
+            return
+        finally:
+            writer.close()
+
+    async def respond(self, writer, status, body, content_type='text/plain', close=False, slow_bps=0, cut=False):
+        head = ('HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %d\r\nConnection: %s\r\n\r\n'
+                % (status, REASONS.get(status, 'Unknown'), content_type, len(body),
+                   'close' if close else 'keep-alive')).encode()
+        payload = head + body
+        if cut:
+            payload = payload[:len(head) + len(body) // 2]
+        if slow_bps > 0:
+            chunk = max(1, int(slow_bps / 20))
+            for i in range(0, len(payload), chunk):
+                writer.write(payload[i:i + chunk])
+                await writer.drain()
+                await asyncio.sleep(len(payload[i:i + chunk]) / slow_bps)
+        else:
+            writer.write(payload)
+            await writer.drain()
+
+    async def respond_json(self, writer, obj, keep_alive):
+        await self.respond(writer, 200, (json.dumps(obj) + '\n').encode(), 'application/json', not keep_alive)
+        return keep_alive
+
+    # -- endpoints --
+
+    async def dispatch(self, writer, method, target, headers, body, keep_alive, started):
+        path = urllib.parse.urlsplit(target).path
+        if path == '/track/' and method == 'POST':
+            return await self.track(writer, headers, body, keep_alive, started)
+        if path == '/stats' and method == 'GET':
+            return await self.respond_json(writer, self.stats.snapshot(), keep_alive)
+        if path == '/stats' and method == 'DELETE':
+            self.stats = Stats()
+            return await self.respond_json(writer, {'success': True}, keep_alive)
+        if path == '/faults':
+            if method == 'PUT':
+                try:
+                    changes = json.loads(body or b'{}')
+                    for name, value in changes.items():
+                        if name not in FAULT_OPTIONS:
+                            raise ValueError('unknown fault %s' % name)
+                        self.faults[name] = float(value)
+                except ValueError as e:
+                    await self.respond(writer, 400, ('%s\n' % e).encode(), close=not keep_alive)
+                    return keep_alive
+            return await self.respond_json(writer, self.faults, keep_alive)
+        if path.startswith('/events/') and method in ('GET', 'DELETE'):
+            token = path[len('/events/'):].strip('/') or None
+            return await self.events(writer, method, token, keep_alive)
+        if path == '/kill' and method == 'POST':
+            await self.respond(writer, 200, b'Shutting down...\n', close=True)
+            self.stopping.set()
+            return False
+        await self.respond(writer, 404, b'not found\n', close=not keep_alive)
+        return keep_alive
+
+    async def track(self, writer, headers, body, keep_alive, started):
+        faults = self.faults
+        try:
+            if headers.get('content-encoding', '').lower() == 'gzip':
+                body = gzip.decompress(body)
+            form = urllib.parse.parse_qs(body.decode('ascii'))
+            events_json = base64.b64decode(form['data'][0]).decode('utf-8')
+            events = json.loads(events_json)
+            if not isinstance(events, list):
+                raise ValueError('batch is not a list')
+        except (KeyError, IndexError, ValueError, UnicodeDecodeError, binascii.Error, OSError) as e:
+            self.stats.bad_requests += 1
+            await self.respond(writer, 400, ('malformed batch: %s\n' % e).encode(), close=not keep_alive)
+            return keep_alive
+
+        delay = faults['latency_ms'] + random.uniform(0, faults['jitter_ms'])
+        if delay > 0:
+            await asyncio.sleep(delay / 1000.0)
+
+        self.stats.requests += 1
+        self.stats.bytes += len(body)
+        if random.random() < faults['error_rate']:
+            self.stats.errors += 1
+            await self.respond(writer, 503, b'injected error\n', close=not keep_alive,
+                               slow_bps=faults['slow_bps'])
+            self.stats.record_latency(time.perf_counter() - started)
+            return keep_alive
+        if random.random() < faults['reject_rate']:
+            # the sdk drops rejected batches, so they are not logged either
+            self.stats.rejected += 1
+            await self.respond(writer, 200, b'0', close=not keep_alive, slow_bps=faults['slow_bps'])
+            self.stats.record_latency(time.perf_counter() - started)
+            return keep_alive
+
+        received_at = time.time()
+        self.stats.events += len(events)
+        self.log.append(received_at, events_json)
+        if self.keep_events:
+            for e in events:
+                token = (e.get('properties') or {}).get('token')
+                self.events_by_token.setdefault(token, []).append(e)
+
+        cut = random.random() < faults['partial_rate']
+        if cut:
+            self.stats.partial += 1
+        await self.respond(writer, 200, b'1', close=cut or not keep_alive,
+                           slow_bps=faults['slow_bps'], cut=cut)
+        self.stats.record_latency(time.perf_counter() - started)
+        return keep_alive and not cut
+
+    async def events(self, writer, method, token, keep_alive):
+        tokens = [token] if token else list(self.events_by_token)
+        if method == 'GET':
+            events = [e for t in tokens for e in self.events_by_token.get(t, [])]
+            return await self.respond_json(writer, {'events': [{'token': (e.get('properties') or {}).get('token'),
+                                                                'data': e} for e in events]}, keep_alive)
+        deleted = sum(len(self.events_by_token.pop(t, [])) for t in tokens)
+        return await self.respond_json(writer, {'success': True, 'token': token,
+                                                'num_deleted_events': deleted}, keep_alive)
+
+    # -- lifecycle --
+
+    async def report(self, interval):
+        while True:
+            await asyncio.sleep(interval)
+            self.stats.report()
+
+    async def serve(self, host, port, report_interval):
+        self.stopping = asyncio.Event()
+        loop = asyncio.get_running_loop()
+        for sig in (signal.SIGINT, signal.SIGTERM):
+            loop.add_signal_handler(sig, self.stopping.set)
+        server = await asyncio.start_server(self.handle_connection, host, port, backlog=1024)
+        print('collector listening on %s:%d' % (host, port), flush=True)
+        tasks = [asyncio.create_task(self.log.run())]
+        if report_interval > 0:
+            tasks.append(asyncio.create_task(self.report(report_interval)))
+        async with server:
+            await self.stopping.wait()
+        for task in tasks:
+            task.cancel()
+        await self.log.flush(loop)
+        print(json.dumps(self.stats.snapshot()), flush=True)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser('load-testing stand-in for the alooma collector')
+    parser.add_argument('--host', '-d', default='0.0.0.0')
+    parser.add_argument('--port', '-p', type=int, default=8000)
+    parser.add_argument('--log', default='collector_events.jsonl',
+                        help='append accepted batches here, one JSON line per request; empty to disable')
+    parser.add_argument('--log-flush-interval', type=float, default=0.05)
+    parser.add_argument('--keep-events', action='store_true',
+                        help='also keep events in memory for GET /events/ (as app.py does)')
+    parser.add_argument('--report-interval', type=float, default=5,
+                        help='seconds between summary lines, 0 to disable')
+    parser.add_argument('--latency-ms', type=float, default=0)
+    parser.add_argument('--jitter-ms', type=float, default=0)
+    parser.add_argument('--error-rate', type=float, default=0)
+    parser.add_argument('--reject-rate', type=float, default=0)
+    parser.add_argument('--partial-rate', type=float, default=0)
+    parser.add_argument('--slow-bps', type=float, default=0)
+    args = parser.parse_args(argv)
+    asyncio.run(Collector(args).serve(args.host, args.port, args.report_interval))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,216 @@
+"""Loss, duplication, reordering and latency report for a collector log.
+
+Reads the JSON lines written by collector.py (one {"received_at", "events"}
+line per accepted request) and checks every session against the numbering
+the sdk gives its events: message_index starts at 1 for each session_id and
+goes up by one for every event that got past sampling and middleware, so
+
+    loss         indices missing between 1 (or the first one seen, with
+                 --mid-session) and the highest one received
+    duplicates   indices received more than once
+    reordering   events that arrived after an event with a higher index
+
+Latencies come from the event's `time` (track call), `sending_time` (batch
+built) and the request's `received_at`:
+
+    track_to_send    sending_time - time
+    send_to_ingest   received_at - sending_time
+    track_to_ingest  received_at - time
+
+The sdk rounds `time` and `sending_time` to whole seconds, so the latency
+distributions are only good to about a second.
+
+Exits 1 when a --max-* threshold is exceeded, so the report can gate an
+uploader change:
+
+    python3 delivery_report.py collector_events.jsonl --max-loss 0 --max-duplicate-rate 0.01
+"""
+
+import argparse
+import json
+import sys
+
+
+PERCENTILES = (50, 90, 99)
+
+
+def percentile(ordered, p):
+    if not ordered:
+        return None
+    return ordered[min(len(ordered) - 1, int(p / 100.0 * len(ordered)))]
+
+
+def distribution(values):
+    ordered = sorted(values)
+    if not ordered:
+        return {'count': 0}
+    summary = {'count': len(ordered), 'min': ordered[0], 'max': ordered[-1],
+               'mean': round(sum(ordered) / len(ordered), 3)}
+    for p in PERCENTILES:
+        summary['p%d' % p] = percentile(ordered, p)
+    return summary
+
+
+class Session(object):
+    def __init__(self, token, session_id):
+        self.token = token
+        self.session_id = session_id
+        self.seen = {}
+        self.arrivals = 0
+        self.reordered = 0
+        self.highest = 0
+
+    def add(self, index):
+        self.arrivals += 1
+        self.seen[index] = self.seen.get(index, 0) + 1
+        if index < self.highest:
+            self.reordered += 1
+        self.highest = max(self.highest, index)
+
+    def summary(self, mid_session):
+        first = min(self.seen) if mid_session else 1
+        expected = self.highest - first + 1
+        received = sum(1 for i in self.seen if i >= first)
+        return {
+            'token': self.token,
+            'session_id': self.session_id,
+            'first_index': min(self.seen),
+            'last_index': self.highest,
+            'received': self.arrivals,
+            'unique': len(self.seen),
+            'missing': max(0, expected - received),
+            'duplicates': sum(count - 1 for count in self.seen.values()),
+            'reordered': self.reordered,
+            'gaps': self.gaps(first),
+        }
+
+    def gaps(self, first, limit=10):
+        """The first few missing ranges, as [from, to] pairs."""
+        gaps = []
+        start = None
+        for index in range(first, self.highest + 1):
+            if index not in self.seen:
+                start = index if start is None else start
+            elif start is not None:
+                gaps.append([start, index - 1])
+                start = None
+                if len(gaps) == limit:
+                    break
+        return gaps
+
+
+def analyze(paths, mid_session=False):
+    sessions = {}
+    latencies = {'track_to_send': [], 'send_to_ingest': [], 'track_to_ingest': []}
+    unnumbered = 0
+    requests = 0
+    malformed = 0
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                try:
+                    request = json.loads(line)
+                except ValueError:
+                    # the collector may have been killed halfway through a line
+                    malformed += 1
+                    continue
+                requests += 1
+                received_at = request.get('received_at')
+                for event in request.get('events') or []:
+                    properties = event.get('properties') or {}
+                    session_id = properties.get('session_id')
+                    index = properties.get('message_index')
+                    if session_id is None or not isinstance(index, int):
+                        unnumbered += 1
+                        continue
+                    key = (properties.get('token'), session_id)
+                    if key not in sessions:
+                        sessions[key] = Session(*key)
+                    sessions[key].add(index)
+
+                    tracked = properties.get('time')
+                    sent = properties.get('sending_time')
+                    if isinstance(tracked, (int, float)) and isinstance(sent, (int, float)):
+                        latencies['track_to_send'].append(sent - tracked)
+                    if isinstance(sent, (int, float)) and received_at is not None:
+                        latencies['send_to_ingest'].append(round(received_at - sent, 3))
+                    if isinstance(tracked, (int, float)) and received_at is not None:
+                        latencies['track_to_ingest'].append(round(received_at - tracked, 3))
+
+    summaries = [s.summary(mid_session) for s in sessions.values()]
+    totals = {
+        'requests': requests,
+        'malformed_lines': malformed,
+        'sessions': len(summaries),
+        'events': sum(s['received'] for s in summaries),
+        'unnumbered_events': unnumbered,
+        'missing': sum(s['missing'] for s in summaries),
+        'duplicates': sum(s['duplicates'] for s in summaries),
+        'reordered': sum(s['reordered'] for s in summaries),
+    }
+    expected = sum(s['unique'] + s['missing'] for s in summaries)
+    totals['loss_rate'] = round(totals['missing'] / float(expected), 6) if expected else 0.0
+    totals['duplicate_rate'] = round(totals['duplicates'] / float(totals['events']), 6) if totals['events'] else 0.0
+    return {'totals': totals,
+            'latency_s': {name: distribution(values) for name, values in latencies.items()},
+            'sessions': sorted(summaries, key=lambda s: (s['token'] or '', s['session_id']))}
+
+
+def print_report(report, show_sessions):
+    totals = report['totals']
+    print('%(requests)d requests, %(sessions)d sessions, %(events)d numbered events '
+          '(%(unnumbered_events)d without session_id/message_index)' % totals)
+    print('missing    %8d  (%.4f%%)' % (totals['missing'], totals['loss_rate'] * 100))
+    print('duplicates %8d  (%.4f%%)' % (totals['duplicates'], totals['duplicate_rate'] * 100))
+    print('reordered  %8d' % totals['reordered'])
+    print('')
+    print('%-16s %8s %8s %8s %8s %8s %8s' % ('latency (s)', 'count', 'p50', 'p90', 'p99', 'max', 'mean'))
+    for name, d in report['latency_s'].items():
+        if d['count']:
+            print('%-16s %8d %8s %8s %8s %8s %8s' % (name, d['count'], d['p50'], d['p90'], d['p99'], d['max'], d['mean']))
+    if show_sessions:
+        print('')
+        for s in report['sessions']:
+            print('%s %s: %d..%d received %d missing %d duplicates %d reordered %d%s'
+                  % (s['token'], s['session_id'], s['first_index'], s['last_index'], s['received'],
+                     s['missing'], s['duplicates'], s['reordered'],
+                     ('  gaps %s' % s['gaps']) if s['gaps'] else ''))
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='delivery report for collector.py event logs')
+    parser.add_argument('logs', nargs='+', help='collector JSON lines logs')
+    parser.add_argument('--mid-session', action='store_true',
+                        help='count gaps from the first index seen instead of 1, for logs started mid-session')
+    parser.add_argument('--json', action='store_true', help='print the report as JSON')
+    parser.add_argument('--sessions', action='store_true', help='list every session')
+    parser.add_argument('--max-loss', type=int, help='fail when more events than this are missing')
+    parser.add_argument('--max-duplicate-rate', type=float, help='fail above this fraction of duplicates')
+    parser.add_argument('--max-reordered', type=int, help='fail when more events than this arrived out of order')
+    parser.add_argument('--max-p99-track-to-ingest', type=float, help='fail when the p99 is above this many seconds')
+    args = parser.parse_args(argv)
+
+    report = analyze(args.logs, args.mid_session)
+    if args.json:
+        print(json.dumps(report, indent=2))
+    else:
+        print_report(report, args.sessions)
+
+    totals = report['totals']
+    p99 = report['latency_s']['track_to_ingest'].get('p99')
+    failures = []
+    if args.max_loss is not None and totals['missing'] > args.max_loss:
+        failures.append('%d events missing, at most %d allowed' % (totals['missing'], args.max_loss))
+    if args.max_duplicate_rate is not None and totals['duplicate_rate'] > args.max_duplicate_rate:
+        failures.append('duplicate rate %.6f above %.6f' % (totals['duplicate_rate'], args.max_duplicate_rate))
+    if args.max_reordered is not None and totals['reordered'] > args.max_reordered:
+        failures.append('%d events reordered, at most %d allowed' % (totals['reordered'], args.max_reordered))
+    if args.max_p99_track_to_ingest is not None and p99 is not None and p99 > args.max_p99_track_to_ingest:
+        failures.append('p99 track to ingest %.3fs above %.3fs' % (p99, args.max_p99_track_to_ingest))
+    for failure in failures:
+        print('FAIL: %s' % failure, file=sys.stderr)
+    return 1 if failures else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
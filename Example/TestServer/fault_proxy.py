@@ -0,0 +1,369 @@
+"""Programmable fault-injection proxy between the sdk and a collector.
+
+Forwards HTTP/1.1 requests to --upstream (collector.py or app.py) and, per
+request, may delay them, throttle bandwidth both ways, drop the connection
+without answering, reset it halfway through the request body, answer 5xx or
+429 itself, or stall halfway through the response.
+
+Faults come from a scenario: a JSON file with a list of phases, each lasting
+a number of seconds or requests and setting any of the options below. The
+decisions are drawn from a generator seeded with the scenario's seed, in
+request order, so a scenario replays the same faults against the same
+request sequence.
+
+    {"seed": 7, "loop": false, "phases": [
+        {"name": "healthy", "requests": 50},
+        {"name": "outage", "seconds": 30, "status_rate": 1, "status": 503},
+        {"name": "flaky", "requests": 200, "reset_rate": 0.2, "latency_ms": 300,
+         "jitter_ms": 500, "bandwidth_bps": 20000}
+    ]}
+
+Options:
+
+    latency_ms, jitter_ms   delay before forwarding: latency + uniform(0, jitter)
+    bandwidth_bps           throttle request and response bodies, 0 for no limit
+    drop_rate               read the request, then close without a response
+    reset_rate              read half the request body, then reset the connection
+    status_rate             answer with `status` (503 by default) instead of forwarding
+    status                  status code for status_rate, e.g. 429 or 500
+    retry_after             Retry-After seconds sent with injected statuses
+    stall_rate, stall_ms    send half the upstream response, then hold it for stall_ms
+
+Requests to /__proxy/ are answered by the proxy: GET /__proxy/stats,
+GET or PUT /__proxy/faults (overrides on top of the current phase, JSON),
+POST /__proxy/next (skip to the next phase). With --log, every request is
+appended to a JSON lines file with its phase, injected fault and timings.
+"""
+
+import argparse
+import asyncio
+import json
+import random
+import signal
+import socket
+import struct
+import sys
+import time
+import urllib.parse
+
+
+DEFAULTS = {'latency_ms': 0, 'jitter_ms': 0, 'bandwidth_bps': 0, 'drop_rate': 0,
+            'reset_rate': 0, 'status_rate': 0, 'status': 503, 'retry_after': 0,
+            'stall_rate': 0, 'stall_ms': 0}
+REASONS = {200: 'OK', 400: 'Bad Request', 404: 'Not Found', 429: 'Too Many Requests',
+           500: 'Internal Server Error', 502: 'Bad Gateway', 503: 'Service Unavailable',
+           504: 'Gateway Timeout'}
+CHUNK = 4096
+
+
+class Scenario(object):
+    def __init__(self, document):
+        self.seed = document.get('seed', 0)
+        self.loop = document.get('loop', False)
+        self.phases = document.get('phases') or [{'name': 'passthrough'}]
+        for phase in self.phases:
+            for name in phase:
+                if name not in DEFAULTS and name not in ('name', 'seconds', 'requests'):
+                    raise ValueError('unknown option %s in phase %s' % (name, phase.get('name')))
+        self.random = random.Random(self.seed)
+        self.overrides = {}
+        self.index = 0
+        self.enter_phase()
+
+    @classmethod
+    def load(cls, path):
+        with open(path) as f:
+            return cls(json.load(f))
+
+    def enter_phase(self):
+        self.phase_started = time.monotonic()
+        self.phase_requests = 0
+
+    def advance(self):
+        if self.index + 1 < len(self.phases):
+            self.index += 1
+        elif self.loop:
+            self.index = 0
+        self.enter_phase()
+
+    def current(self):
+        phase = self.phases[self.index]
+        # time based phases end by the clock, request based ones by their count
+        seconds = phase.get('seconds')
+        requests = phase.get('requests')
+        if (seconds is not None and time.monotonic() - self.phase_started >= seconds) or \
+                (requests is not None and self.phase_requests >= requests):
+            if self.index + 1 < len(self.phases) or self.loop:
+                self.advance()
+                phase = self.phases[self.index]
+        return phase
+
+    def decide(self):
+        """Draws the faults for the next request, always consuming the same
+        number of random values so that one decision never shifts the next."""
+        phase = self.current()
+        self.phase_requests += 1
+        options = dict(DEFAULTS)
+        options.update({k: v for k, v in phase.items() if k in DEFAULTS})
+        options.update(self.overrides)
+        draws = [self.random.random() for _ in range(5)]
+        fault = None
+        if draws[0] < options['drop_rate']:
+            fault = 'drop'
+        elif draws[1] < options['reset_rate']:
+            fault = 'reset'
+        elif draws[2] < options['status_rate']:
+            fault = 'status'
+        elif draws[3] < options['stall_rate']:
+            fault = 'stall'
+        delay = options['latency_ms'] + draws[4] * options['jitter_ms']
+        return phase.get('name', str(self.index)), fault, delay, options
+
+
+class Stats(object):
+    def __init__(self):
+        self.requests = 0
+        self.forwarded = 0
+        self.faults = {}
+        self.bytes_in = 0
+        self.bytes_out = 0
+        self.upstream_errors = 0
+
+    def snapshot(self, scenario):
+        return {'requests': self.requests, 'forwarded': self.forwarded, 'faults': self.faults,
+                'bytes_in': self.bytes_in, 'bytes_out': self.bytes_out,
+                'upstream_errors': self.upstream_errors,
+                'phase': scenario.phases[scenario.index].get('name', str(scenario.index)),
+                'overrides': scenario.overrides}
+
+
+async def read_message(reader):
+    """Reads one HTTP/1.1 message head; returns (start line, headers list, length)."""
+    head = await reader.readuntil(b'\r\n\r\n')
+    lines = head.decode('latin-1').split('\r\n')[:-2]
+    headers = []
+    for line in lines[1:]:
+        if ':' in line:
+            name, value = line.split(':', 1)
+            headers.append((name.strip(), value.strip()))
+    length = None
+    for name, value in headers:
+        if name.lower() == 'content-length':
+            length = int(value)
+        elif name.lower() == 'transfer-encoding' and value.lower() == 'chunked':
+            raise ValueError('chunked bodies are not supported')
+    return lines[0], headers, length
+
+
+def encode_head(start, headers):
+    return ('%s\r\n%s\r\n' % (start, ''.join('%s: %s\r\n' % h for h in headers))).encode('latin-1')
+
+
+async def paced_write(writer, data, bps):
+    if bps <= 0:
+        writer.write(data)
+        await writer.drain()
+        return
+    for i in range(0, len(data), CHUNK):
+        chunk = data[i:i + CHUNK]
+        writer.write(chunk)
+        await writer.drain()
+        await asyncio.sleep(len(chunk) / float(bps))
+
+
+async def paced_read(reader, length, bps, limit=None):
+    """Reads length bytes (or only limit of them) at no more than bps."""
+    want = length if limit is None else min(length, limit)
+    if bps <= 0:
+        return await reader.readexactly(want)
+    parts = []
+    while want > 0:
+        chunk = await reader.readexactly(min(CHUNK, want))
+        parts.append(chunk)
+        want -= len(chunk)
+        await asyncio.sleep(len(chunk) / float(bps))
+    return b''.join(parts)
+
+
+def reset(writer):
+    # linger 0 turns the close into a RST, like a dropped mobile connection
+    sock = writer.get_extra_info('socket')
+    if sock is not None:
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_LINGER, struct.pack('ii', 1, 0))
+    writer.transport.abort()
+
+
+class Proxy(object):
+    def __init__(self, args, scenario):
+        self.upstream = args.upstream.rsplit(':', 1)
+        self.scenario = scenario
+        self.stats = Stats()
+        self.log = open(args.log, 'a') if args.log else None
+        self.stopping = None
+
+    def record(self, entry):
+        if self.log:
+            self.log.write(json.dumps(entry) + '\n')
+            self.log.flush()
+
+    async def handle_connection(self, reader, writer):
+        upstream = None
+        try:
+            while True:
+                try:
+                    start, headers, length = await read_message(reader)
+                except (asyncio.IncompleteReadError, ConnectionError):
+                    return
+                except ValueError as e:
+                    await self.respond(writer, 400, str(e).encode())
+                    return
+                method, target = start.split(' ')[:2]
+                path = urllib.parse.urlsplit(target).path
+                if path.startswith('/__proxy/'):
+                    body = await reader.readexactly(length or 0)
+                    await self.control(writer, method, path, body)
+                    continue
+                upstream = await self.forward(reader, writer, upstream, start, headers, length or 0, path)
+                if upstream is False:
+                    return
+        except (asyncio.IncompleteReadError, ConnectionError):
+            return
+        finally:
+            if upstream:
+                upstream[1].close()
+            if not writer.transport.is_closing():
+                writer.close()
+
+    async def forward(self, reader, writer, upstream, start, headers, length, path):
+        """Handles one proxied request; returns the upstream connection to
+        reuse, None if it was closed, or False if the client connection is gone."""
+        began = time.monotonic()
+        phase, fault, delay, options = self.scenario.decide()
+        self.stats.requests += 1
+        entry = {'t': time.time(), 'phase': phase, 'path': path, 'bytes': length, 'fault': fault}
+        if fault:
+            self.stats.faults[fault] = self.stats.faults.get(fault, 0) + 1
+
+        if fault == 'reset':
+            await paced_read(reader, length, options['bandwidth_bps'], limit=length // 2)
+            entry['total_ms'] = round((time.monotonic() - began) * 1000, 3)
+            self.record(entry)
+            reset(writer)
+            return False
+        body = await paced_read(reader, length, options['bandwidth_bps'])
+        self.stats.bytes_in += len(body)
+        if delay > 0:
+            await asyncio.sleep(delay / 1000.0)
+        if fault == 'drop':
+            entry['total_ms'] = round((time.monotonic() - began) * 1000, 3)
+            self.record(entry)
+            writer.close()
+            return False
+        if fault == 'status':
+            status = int(options['status'])
+            extra = [('Retry-After', '%d' % options['retry_after'])] if options['retry_after'] else []
+            await self.respond(writer, status, b'injected\n', extra)
+            entry.update(status=status, total_ms=round((time.monotonic() - began) * 1000, 3))
+            self.record(entry)
+            return upstream
+
+        upstream_began = time.monotonic()
+        try:
+            if upstream is None:
+                upstream = await asyncio.open_connection(self.upstream[0], int(self.upstream[1]))
+            up_reader, up_writer = upstream
+            up_writer.write(encode_head(start, headers) + body)
+            await up_writer.drain()
+            status_line, response_headers, response_length = await read_message(up_reader)
+            if response_length is None:
+                response_body = await up_reader.read()
+            else:
+                response_body = await up_reader.readexactly(response_length)
+        except (OSError, asyncio.IncompleteReadError, ValueError) as e:
+            self.stats.upstream_errors += 1
+            if upstream:
+                upstream[1].close()
+            await self.respond(writer, 502, ('upstream: %s\n' % e).encode())
+            entry.update(status=502, total_ms=round((time.monotonic() - began) * 1000, 3))
+            self.record(entry)
+            return None
+        self.stats.forwarded += 1
+        entry['upstream_ms'] = round((time.monotonic() - upstream_began) * 1000, 3)
+        entry['status'] = int(status_line.split(' ')[1])
+        if response_length is None or any(n.lower() == 'connection' and v.lower() == 'close'
+                                          for n, v in response_headers):
+            up_writer.close()
+            upstream = None
+
+        payload = encode_head(status_line, response_headers) + response_body
+        if fault == 'stall':
+            half = len(payload) // 2
+            await paced_write(writer, payload[:half], options['bandwidth_bps'])
+            await asyncio.sleep(options['stall_ms'] / 1000.0)
+            payload = payload[half:]
+        await paced_write(writer, payload, options['bandwidth_bps'])
+        self.stats.bytes_out += len(payload)
+        entry['total_ms'] = round((time.monotonic() - began) * 1000, 3)
+        self.record(entry)
+        return upstream
+
+    async def respond(self, writer, status, body, extra=()):
+        headers = [('Content-Type', 'text/plain'), ('Content-Length', str(len(body)))] + list(extra)
+        writer.write(encode_head('HTTP/1.1 %d %s' % (status, REASONS.get(status, 'Unknown')), headers) + body)
+        await writer.drain()
+
+    async def control(self, writer, method, path, body):
+        scenario = self.scenario
+        if path == '/__proxy/stats' and method == 'GET':
+            payload = self.stats.snapshot(scenario)
+        elif path == '/__proxy/faults' and method in ('GET', 'PUT'):
+            if method == 'PUT':
+                try:
+                    changes = json.loads(body or b'{}')
+                    unknown = [name for name in changes if name not in DEFAULTS]
+                    if unknown:
+                        raise ValueError('unknown options %s' % ', '.join(unknown))
+                except ValueError as e:
+                    await self.respond(writer, 400, ('%s\n' % e).encode())
+                    return
+                scenario.overrides = {k: v for k, v in changes.items() if v is not None}
+            payload = scenario.overrides
+        elif path == '/__proxy/next' and method == 'POST':
+            scenario.advance()
+            payload = {'phase': scenario.phases[scenario.index].get('name', str(scenario.index))}
+        else:
+            await self.respond(writer, 404, b'not found\n')
+            return
+        body = (json.dumps(payload) + '\n').encode()
+        await self.respond(writer, 200, body, [])
+
+    async def serve(self, host, port):
+        self.stopping = asyncio.Event()
+        loop = asyncio.get_running_loop()
+        for sig in (signal.SIGINT, signal.SIGTERM):
+            loop.add_signal_handler(sig, self.stopping.set)
+        server = await asyncio.start_server(self.handle_connection, host, port, backlog=1024)
+        print('fault proxy listening on %s:%d, forwarding to %s' % (host, port, ':'.join(self.upstream)), flush=True)
+        async with server:
+            await self.stopping.wait()
+        print(json.dumps(self.stats.snapshot(self.scenario)), flush=True)
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser('fault-injection proxy for the alooma sdk uploader')
+    parser.add_argument('--host', '-d', default='0.0.0.0')
+    parser.add_argument('--port', '-p', type=int, default=8001)
+    parser.add_argument('--upstream', default='127.0.0.1:8000', help='host:port of the collector')
+    parser.add_argument('--scenario', help='JSON scenario file; without one every request is passed through')
+    parser.add_argument('--seed', type=int, help='overrides the scenario seed')
+    parser.add_argument('--log', help='append one JSON line per proxied request')
+    args = parser.parse_args(argv)
+    scenario = Scenario.load(args.scenario) if args.scenario else Scenario({})
+    if args.seed is not None:
+        scenario.seed = args.seed
+        scenario.random = random.Random(args.seed)
+    asyncio.run(Proxy(args, scenario).serve(args.host, args.port))
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,155 @@
+"""Turns a collector log into an anonymized event trace for replay.
+
+Reads the JSON lines written by collector.py and writes a trace that keeps
+what matters for throughput and payload size, and nothing that identifies a
+user or an app:
+
+- event names, property keys and string values are replaced by salted
+  hashes of the same length (names and keys get a few characters at least),
+  so equal values stay equal (dedupe, gzip and cardinality behave the same)
+  but cannot be read back;
+- numbers keep their type, sign and number of digits, booleans and nulls are
+  kept, lists and nested objects keep their shape;
+- properties the sdk adds itself (token, time, session and message numbering,
+  automatic device properties, ...) and the sdk's own events are left out,
+  since the replaying sdk adds its own;
+- timing is kept as seconds since the first event, from each event's `time`;
+- events received twice (a batch retried after a lost response) are kept once.
+
+The trace is JSON lines: a header line, then one line per event
+
+    {"format": "alooma-trace", "version": 1, "events": 1200, "tokens": 2, "sessions": 40, "duration": 3600}
+    {"t": 12, "token": 0, "session": 3, "event": "e_3f9c21a", "properties": {"k_8be1": "4c1d0a", "k_02": 17}}
+
+and is replayed into the sdk by Benchmarks/replay_bench.m. Without --salt a
+random one is used, so two captures of the same log do not share hashes.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import sys
+
+
+SDK_PROPERTIES = {
+    'token', 'time', 'sending_time', 'session_id', 'message_index', 'distinct_id', 'mp_name_tag',
+    'sample_weight', '$duration', 'mp_lib', 'mp_device_model', '$lib_version', '$manufacturer',
+    '$os', '$os_version', '$model', '$screen_height', '$screen_width', '$app_version',
+    '$app_release', '$ios_ifa', '$carrier', '$watch_model', '$wifi', '$radio',
+}
+SDK_EVENTS = {'$sdk_metrics', '$aggregate', '$firehose', '$app_open', '$create_alias', '$campaign_received'}
+
+
+class Anonymizer(object):
+    def __init__(self, salt):
+        self.salt = salt
+
+    def digest(self, kind, value):
+        return hashlib.sha256(self.salt + kind + str(value).encode('utf-8')).hexdigest()
+
+    def text(self, kind, value, prefix=''):
+        # same length as the original, at least long enough to stay distinct
+        length = max(len(value), len(prefix) + 4)
+        digest = self.digest(kind, value)
+        while len(digest) < length:
+            digest += hashlib.sha256(digest.encode()).hexdigest()
+        return prefix + digest[:length - len(prefix)]
+
+    def number(self, value):
+        if isinstance(value, bool) or value == 0:
+            return value
+        seed = int(self.digest(b'n', value)[:15], 16)
+        if isinstance(value, int):
+            digits = len(str(abs(value)))
+            low = 10 ** (digits - 1) if digits > 1 else 1
+            result = low + seed % (10 ** digits - low)
+            return result if value > 0 else -result
+        text = repr(abs(value))
+        if 'e' in text or 'inf' in text or 'nan' in text:
+            return value
+        whole, _, fraction = text.partition('.')
+        scale = 10 ** len(fraction)
+        limit = 10 ** len(whole.lstrip('0')) * scale if whole.lstrip('0') else scale
+        result = (seed % limit) / float(scale)
+        return result if value > 0 else -result
+
+    def value(self, value):
+        if value is None or isinstance(value, bool):
+            return value
+        if isinstance(value, (int, float)):
+            return self.number(value)
+        if isinstance(value, str):
+            return self.text(b'v', value)
+        if isinstance(value, list):
+            return [self.value(v) for v in value]
+        if isinstance(value, dict):
+            return self.properties(value)
+        return self.text(b'v', str(value))
+
+    def properties(self, properties):
+        return {self.text(b'k', key, 'k_'): self.value(value) for key, value in properties.items()}
+
+
+def capture(paths, anonymizer):
+    events = []
+    seen = set()
+    skipped = 0
+    for path in paths:
+        with open(path) as f:
+            for line in f:
+                try:
+                    request = json.loads(line)
+                except ValueError:
+                    continue
+                for event in request.get('events') or []:
+                    properties = event.get('properties') or {}
+                    name = event.get('event')
+                    if name in SDK_EVENTS or not isinstance(properties.get('time'), (int, float)):
+                        skipped += 1
+                        continue
+                    # batches retried after a lost response arrive twice
+                    key = (properties.get('token'), properties.get('session_id'), properties.get('message_index'))
+                    if key[2] is not None and key in seen:
+                        continue
+                    seen.add(key)
+                    events.append((properties['time'], properties.get('token'), properties.get('session_id'),
+                                   properties.get('message_index') or 0, name,
+                                   {k: v for k, v in properties.items() if k not in SDK_PROPERTIES}))
+    events.sort(key=lambda e: (e[0], str(e[2]), e[3]))
+    tokens = {}
+    sessions = {}
+    start = events[0][0] if events else 0
+    trace = []
+    for time, token, session_id, _, name, properties in events:
+        trace.append({
+            't': round(time - start, 3),
+            'token': tokens.setdefault(token, len(tokens)),
+            'session': sessions.setdefault((token, session_id), len(sessions)),
+            'event': anonymizer.text(b'e', name, 'e_') if name is not None else None,
+            'properties': anonymizer.properties(properties),
+        })
+    header = {'format': 'alooma-trace', 'version': 1, 'events': len(trace), 'tokens': len(tokens),
+              'sessions': len(sessions), 'duration': trace[-1]['t'] if trace else 0}
+    return header, trace, skipped
+
+
+def main(argv=None):
+    parser = argparse.ArgumentParser(description='capture an anonymized event trace from collector.py logs')
+    parser.add_argument('logs', nargs='+', help='collector JSON lines logs')
+    parser.add_argument('--output', '-o', default='trace.jsonl')
+    parser.add_argument('--salt', help='hash salt; random when not given')
+    args = parser.parse_args(argv)
+
+    salt = args.salt.encode('utf-8') if args.salt is not None else os.urandom(16)
+    header, trace, skipped = capture(args.logs, Anonymizer(salt))
+    with open(args.output, 'w') as f:
+        f.write(json.dumps(header) + '\n')
+        for event in trace:
+            f.write(json.dumps(event, separators=(',', ':')) + '\n')
+    print('%d events from %d sessions over %ss written to %s (%d sdk events skipped)'
+          % (header['events'], header['sessions'], header['duration'], args.output, skipped), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    sys.exit(main())